@@ -0,0 +1,818 @@
+/******************************************************************************
+telemac-archive - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "telemac-archive.h"
+#include "telemac-writer.h"
+#include "telemac-stats.h"
+#include "telemac-thread.h"
+
+/*!
+ * @file
+ * @brief Error-bounded compressed archives of TELEMAC results
+ *
+ * Archive layout, following the SELAFIN header and mesh records:
+ *
+ * | Field                      | Size                        |
+ * |----------------------------|-----------------------------|
+ * | Magic (TMQARCH1)           | 8 bytes                     |
+ * | Version                    | uint32_t                    |
+ * | keyint, nt, nvar, npoin    | 4 x uint32_t                |
+ * | Error bounds               | nvar x float                |
+ * | Compressed blocks          | variable                    |
+ * | Timestamps                 | nt x float                  |
+ * | Block offsets              | nt x nvar x uint64_t        |
+ * | Block lengths              | nt x nvar x uint32_t        |
+ * | Index offset               | uint64_t                    |
+ * | Magic (TMQARCH1)           | 8 bytes                     |
+ *
+ * Values after the mesh are stored in host byte order. The version field is
+ * used to detect archives written on a host with different byte order.
+ *
+ * Each block starts with a mode byte: BLOCK_RICE for Rice coded residuals or
+ * BLOCK_RAW for uncompressed floats (used where a value is not finite, the
+ * residual is too large to quantise, or the error bound is zero).
+ */
+
+#define BLOCK_RICE 0 //!< Block holds Rice coded quantised residuals
+#define BLOCK_RAW 1 //!< Block holds raw float values
+#define RICE_GROUP 64 //!< Values sharing a Rice parameter
+#define RICE_ZERO 31 //!< Rice parameter marking a group of zero residuals
+#define RICE_ESCAPE 24 //!< Unary prefix length marking a raw 32-bit value
+#define QUANT_LIMIT 1073741823.0 //!< Largest quantised residual magnitude
+
+//! Growable byte buffer with a bit-level writer
+typedef struct {
+	unsigned char *data; //!< Buffer contents
+	size_t len; //!< Bytes used
+	size_t cap; //!< Bytes allocated
+	uint64_t acc; //!< Pending bits, least significant first
+	int nacc; //!< Number of pending bits
+} bitbuf_t;
+
+//! Bit-level reader
+typedef struct {
+	const unsigned char *data; //!< Input
+	size_t len; //!< Input length
+	size_t pos; //!< Next byte to load
+	uint64_t acc; //!< Loaded bits, least significant first
+	int nacc; //!< Number of loaded bits
+	bool overrun; //!< Set when a read went past the end of input
+} bitreader_t;
+
+//! Per-thread decoding state (see get_scratch())
+typedef struct {
+	uint64_t id; //!< Archive the state belongs to, or 0
+	uint32_t nvar; //!< Number of entries in recon and recon_t
+	float **recon; //!< Most recently decoded values of each variable
+	int *recon_t; //!< Timestep held in recon for each variable, or -1
+	int32_t *q; //!< Quantised residuals for one block
+	unsigned char *buf; //!< Buffer for compressed blocks
+	size_t bufsize; //!< Size of buf
+} archive_scratch_t;
+
+static uint64_t archive_serial; //!< Last identifier assigned to an archive
+static pthread_key_t scratch_key; //!< Key for each thread's archive_scratch_t
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT; //!< Creates scratch_key
+
+static int buf_reserve(bitbuf_t *b, size_t extra) {
+//! Ensure at least extra bytes can be appended
+	if (b->len + extra <= b->cap) {
+		return 0;
+	}
+	size_t ncap = (b->cap ? b->cap : 4096);
+	while (ncap < b->len + extra) {
+		ncap *= 2;
+	}
+	unsigned char *nd = realloc(b->data, ncap);
+	if (nd == NULL) {
+		return -1;
+	}
+	b->data = nd;
+	b->cap = ncap;
+	return 0;
+}
+
+static int buf_append(bitbuf_t *b, const void *src, size_t n) {
+//! Append bytes to the buffer (no pending bits)
+	if (buf_reserve(b, n) != 0) {
+		return -1;
+	}
+	memcpy(b->data + b->len, src, n);
+	b->len += n;
+	return 0;
+}
+
+static void put_bits(bitbuf_t *b, uint32_t value, int n) {
+//! Append the n low bits of value. Space must have been reserved.
+	b->acc |= (uint64_t)value << b->nacc;
+	b->nacc += n;
+	while (b->nacc >= 8) {
+		b->data[b->len++] = b->acc & 0xff;
+		b->acc >>= 8;
+		b->nacc -= 8;
+	}
+}
+
+static void flush_bits(bitbuf_t *b) {
+//! Write any pending bits, padding to a whole byte
+	if (b->nacc > 0) {
+		b->data[b->len++] = b->acc & 0xff;
+	}
+	b->acc = 0;
+	b->nacc = 0;
+}
+
+static uint32_t get_bits(bitreader_t *r, int n) {
+//! Read n (<= 32) bits. Reads past the end of input return zeros and set overrun.
+	while (r->nacc < n) {
+		uint64_t byte = 0;
+		if (r->pos < r->len) {
+			byte = r->data[r->pos];
+		} else {
+			r->overrun = true;
+		}
+		r->pos++;
+		r->acc |= byte << r->nacc;
+		r->nacc += 8;
+	}
+	uint32_t v = (n == 32 ? (uint32_t)r->acc : (uint32_t)(r->acc & ((1ULL << n) - 1)));
+	r->acc >>= n;
+	r->nacc -= n;
+	return v;
+}
+
+static inline uint32_t zigzag(int32_t v) {
+//! Map signed residuals to unsigned values, small magnitudes first
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u) {
+//! Inverse of zigzag()
+	return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+static int rice_encode(const uint32_t *u, size_t n, bitbuf_t *b) {
+/*!
+ * @brief Rice code an array of unsigned values
+ *
+ * Each group of RICE_GROUP values shares a parameter k, written in 5 bits and
+ * chosen from the group mean. A group of zeros is written as k = RICE_ZERO
+ * alone.
+ * @returns 0 on success, -1 on allocation failure
+ */
+	for (size_t g = 0; g < n; g += RICE_GROUP) {
+		size_t end = (g + RICE_GROUP < n ? g + RICE_GROUP : n);
+		uint64_t sum = 0;
+		for (size_t i = g; i < end; i++) {
+			sum += u[i];
+		}
+		// Worst case: escape and raw value for every entry
+		if (buf_reserve(b, 1 + (end - g) * 8) != 0) {
+			return -1;
+		}
+		if (sum == 0) {
+			put_bits(b, RICE_ZERO, 5);
+			continue;
+		}
+		int k = 0;
+		uint64_t mean = sum / (end - g);
+		while (k < 30 && (1ULL << (k + 1)) <= mean) {
+			k++;
+		}
+		put_bits(b, k, 5);
+		for (size_t i = g; i < end; i++) {
+			uint32_t q = u[i] >> k;
+			if (q >= RICE_ESCAPE) {
+				put_bits(b, (1U << RICE_ESCAPE) - 1, RICE_ESCAPE);
+				put_bits(b, u[i], 32);
+				continue;
+			}
+			put_bits(b, (1U << q) - 1, q + 1); // q ones, then a zero
+			if (k) {
+				put_bits(b, u[i] & ((1U << k) - 1), k);
+			}
+		}
+	}
+	flush_bits(b);
+	return 0;
+}
+
+static int rice_decode(bitreader_t *r, int32_t *q, size_t n) {
+/*!
+ * @brief Decode n values written by rice_encode(), undoing the zigzag mapping
+ * @returns 0 on success, -1 if the input is too short or holds an impossible value
+ */
+	for (size_t g = 0; g < n; g += RICE_GROUP) {
+		size_t end = (g + RICE_GROUP < n ? g + RICE_GROUP : n);
+		int k = get_bits(r, 5);
+		if (k == RICE_ZERO) {
+			memset(&q[g], 0, (end - g) * sizeof(int32_t));
+			continue;
+		}
+		for (size_t i = g; i < end; i++) {
+			uint32_t ones = 0;
+			while (ones < RICE_ESCAPE && get_bits(r, 1)) {
+				ones++;
+			}
+			uint32_t u = 0;
+			if (ones == RICE_ESCAPE) {
+				u = get_bits(r, 32);
+			} else {
+				if (ones > (UINT32_MAX >> k)) {
+					return -1;
+				}
+				u = (ones << k) | (k ? get_bits(r, k) : 0);
+			}
+			q[i] = unzigzag(u);
+		}
+		if (r->overrun) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int encode_block(const float *x, float *recon, int32_t *q, uint32_t *u, uint32_t n, float eb, bitbuf_t *b) {
+/*!
+ * @brief Encode one variable at one timestep
+ *
+ * @param x	Values to encode
+ * @param recon	On entry, the prediction (previous reconstruction or zeros).
+ *		On exit, the values a decoder will reconstruct.
+ * @param q	Scratch space for n quantised residuals
+ * @param u	Scratch space for n zigzag coded residuals
+ * @param n	Number of values
+ * @param eb	Absolute error bound
+ * @param b	Buffer to append the block to
+ * @returns	0 on success, -1 on allocation failure
+ */
+	double step = 2.0 * eb;
+	bool raw = !(eb > 0);
+	for (uint32_t i = 0; i < n && !raw; i++) {
+		double r = ((double)x[i] - recon[i]) / step;
+		if (!isfinite(x[i]) || !(fabs(r) < QUANT_LIMIT)) {
+			raw = true;
+			break;
+		}
+		q[i] = (int32_t)lrint(r);
+	}
+
+	if (raw) {
+		unsigned char mode = BLOCK_RAW;
+		if (buf_append(b, &mode, 1) != 0 || buf_append(b, x, sizeof(float) * n) != 0) {
+			return -1;
+		}
+		memcpy(recon, x, sizeof(float) * n);
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < n; i++) {
+		recon[i] = (float)(recon[i] + q[i] * step);
+		u[i] = zigzag(q[i]);
+	}
+	unsigned char mode = BLOCK_RICE;
+	if (buf_append(b, &mode, 1) != 0) {
+		return -1;
+	}
+	return rice_encode(u, n, b);
+}
+
+static int decode_block(const unsigned char *in, size_t len, float *recon, int32_t *q, uint32_t n, float eb) {
+/*!
+ * @brief Decode one block, updating recon from the previous reconstruction
+ * @returns 0 on success, -1 if the block is malformed
+ */
+	if (len < 1) {
+		return -1;
+	}
+	if (in[0] == BLOCK_RAW) {
+		if (len != 1 + sizeof(float) * n) {
+			return -1;
+		}
+		memcpy(recon, in + 1, sizeof(float) * n);
+		return 0;
+	}
+	if (in[0] != BLOCK_RICE) {
+		return -1;
+	}
+	bitreader_t r = {in + 1, len - 1, 0, 0, 0, false};
+	// The encoder pads the final byte, so a valid block is consumed exactly
+	if (rice_decode(&r, q, n) != 0 || r.pos != r.len) {
+		return -1;
+	}
+	double step = 2.0 * eb;
+	for (uint32_t i = 0; i < n; i++) {
+		recon[i] = (float)(recon[i] + q[i] * step);
+	}
+	return 0;
+}
+
+static void scratch_reset(archive_scratch_t *s) {
+//! Release the decoded values held in per-thread state, keeping the read buffer
+	for (uint32_t v = 0; s->recon != NULL && v < s->nvar; v++) {
+		free(s->recon[v]);
+	}
+	free(s->recon);
+	free(s->recon_t);
+	free(s->q);
+	s->recon = NULL;
+	s->recon_t = NULL;
+	s->q = NULL;
+	s->nvar = 0;
+	s->id = 0;
+}
+
+static void scratch_free(void *p) {
+//! Release per-thread state. Called on thread exit.
+	archive_scratch_t *s = (archive_scratch_t *)p;
+	scratch_reset(s);
+	free(s->buf);
+	free(s);
+}
+
+static void scratch_key_create(void) {
+//! pthread_once() callback: create scratch_key
+	pthread_key_create(&scratch_key, scratch_free);
+}
+
+static archive_scratch_t *get_scratch(const telemac_archive_t *a) {
+/*!
+ * @brief Get the calling thread's decoding state for an archive
+ *
+ * Each thread keeps the most recently decoded values of each variable for one
+ * archive. State for a different archive is discarded.
+ *
+ * @returns Decoding state, or NULL on allocation failure
+ */
+	pthread_once(&scratch_once, scratch_key_create);
+	archive_scratch_t *s = pthread_getspecific(scratch_key);
+	if (s == NULL) {
+		s = calloc(sizeof(archive_scratch_t), 1);
+		if (s == NULL) {
+			return NULL;
+		}
+		if (pthread_setspecific(scratch_key, s) != 0) {
+			free(s);
+			return NULL;
+		}
+	}
+	if (s->id == a->id) {
+		return s;
+	}
+
+	scratch_reset(s);
+	s->recon = calloc(sizeof(float *), (a->nvar ? a->nvar : 1));
+	s->recon_t = calloc(sizeof(int), (a->nvar ? a->nvar : 1));
+	s->q = malloc(sizeof(int32_t) * (a->npoin ? a->npoin : 1));
+	if (s->recon == NULL || s->recon_t == NULL || s->q == NULL) {
+		scratch_reset(s);
+		return NULL;
+	}
+	s->nvar = a->nvar;
+	for (uint32_t v = 0; v < a->nvar; v++) {
+		s->recon_t[v] = -1;
+	}
+	s->id = a->id;
+	return s;
+}
+
+int telemac_archive_detect(resfile_t *rfile) {
+/*!
+ * @brief Check for an archive data section following the mesh
+ * @param rfile	Results file with mesh loaded (datastart set)
+ * @returns	Non-zero if the file is an archive
+ */
+	char magic[8];
+	if (pread(fileno(rfile->file), magic, sizeof(magic), rfile->datastart) != sizeof(magic)) {
+		return 0;
+	}
+	return (memcmp(magic, TELEMAC_ARCHIVE_MAGIC, 8) == 0);
+}
+
+int telemac_archive_open(resfile_t *rfile, int verbose) {
+/*!
+ * @brief Read archive header and index, attaching the archive to rfile
+ *
+ * Called from open_telemac() when telemac_archive_detect() finds an archive.
+ * Sets the number of timesteps and all timestamps in rfile->tmdat.
+ *
+ * @param rfile	Results file with mesh loaded
+ * @param verbose	Non-zero for verbose output
+ * @retval 0	Success
+ * @retval -1	Malformed or unsupported archive
+ * @retval -2	Memory allocation failure
+ */
+	int fd = fileno(rfile->file);
+	telemac_data_t *results = &rfile->tmdat;
+	off_t pos = rfile->datastart + 8;
+
+	uint32_t hdr[5];
+	if (pread(fd, hdr, sizeof(hdr), pos) != sizeof(hdr)) {
+		fprintf(stderr, "Unable to read archive header\n");
+		return -1;
+	}
+	pos += sizeof(hdr);
+	if (hdr[0] != TELEMAC_ARCHIVE_VERSION) {
+		fprintf(stderr, "Unsupported archive version or byte order (%u)\n", hdr[0]);
+		return -1;
+	}
+
+	telemac_archive_t *a = calloc(sizeof(telemac_archive_t), 1);
+	if (a == NULL) {
+		perror("telemac_archive_open");
+		return -2;
+	}
+	a->keyint = hdr[1];
+	a->nt = hdr[2];
+	a->nvar = hdr[3];
+	a->npoin = hdr[4];
+	a->id = __atomic_add_fetch(&archive_serial, 1, __ATOMIC_RELAXED);
+	rfile->archive = a;
+
+	if (a->nvar != results->nbv_1 + results->nbv_2 || a->npoin != results->npoin || a->keyint == 0) {
+		fprintf(stderr, "Archive dimensions do not match mesh\n");
+		return -1;
+	}
+
+	size_t nblk = (size_t)a->nt * a->nvar;
+	a->errbound = calloc(sizeof(float), a->nvar);
+	a->times = calloc(sizeof(float), (a->nt ? a->nt : 1));
+	a->offset = calloc(sizeof(uint64_t), (nblk ? nblk : 1));
+	a->length = calloc(sizeof(uint32_t), (nblk ? nblk : 1));
+	if (a->errbound == NULL || a->times == NULL || a->offset == NULL || a->length == NULL) {
+		perror("telemac_archive_open");
+		return -2;
+	}
+
+	if (pread(fd, a->errbound, sizeof(float) * a->nvar, pos) != (ssize_t)(sizeof(float) * a->nvar)) {
+		fprintf(stderr, "Unable to read archive error bounds\n");
+		return -1;
+	}
+
+	struct stat buf;
+	if (fstat(fd, &buf) != 0) {
+		perror("telemac_archive_open: fstat");
+		return -1;
+	}
+	uint64_t indexstart = 0;
+	char magic[8];
+	if (pread(fd, &indexstart, sizeof(indexstart), buf.st_size - 16) != sizeof(indexstart)
+			|| pread(fd, magic, sizeof(magic), buf.st_size - 8) != sizeof(magic)
+			|| memcmp(magic, TELEMAC_ARCHIVE_MAGIC, 8) != 0) {
+		fprintf(stderr, "Archive trailer missing - incomplete archive?\n");
+		return -1;
+	}
+	if (pread(fd, a->times, sizeof(float) * a->nt, indexstart) != (ssize_t)(sizeof(float) * a->nt)
+			|| pread(fd, a->offset, sizeof(uint64_t) * nblk, indexstart + sizeof(float) * a->nt) != (ssize_t)(sizeof(uint64_t) * nblk)
+			|| pread(fd, a->length, sizeof(uint32_t) * nblk, indexstart + (sizeof(float) + sizeof(uint64_t) * a->nvar) * a->nt) != (ssize_t)(sizeof(uint32_t) * nblk)) {
+		fprintf(stderr, "Unable to read archive index\n");
+		return -1;
+	}
+	TM_STATS_ADD(TM_COUNT_BYTES_READ, (sizeof(float) + (sizeof(uint64_t) + sizeof(uint32_t)) * a->nvar) * a->nt);
+
+	float *ts = realloc(results->timestamp, sizeof(float) * (a->nt ? a->nt : 1));
+	if (ts == NULL) {
+		perror("telemac_archive_open");
+		return -2;
+	}
+	results->timestamp = ts;
+	memcpy(results->timestamp, a->times, sizeof(float) * a->nt);
+	results->nt = a->nt;
+
+	if (verbose) {
+		fprintf(stdout, "Compressed archive: %d timesteps, keyframe every %d timesteps\n", a->nt, a->keyint);
+		for (uint32_t v = 0; v < a->nvar; v++) {
+			fprintf(stdout, "\tVariable %d error bound: %g\n", v, a->errbound[v]);
+		}
+	}
+	return 0;
+}
+
+int telemac_archive_read_var(const resfile_t *rfile, int timestep, int var, float *out) {
+/*!
+ * @brief Decode one variable at one timestep from an archive
+ *
+ * Decoding starts from the timestep of the variable most recently decoded by
+ * the calling thread where possible (e.g. when reading timesteps in order),
+ * otherwise from the preceding keyframe. The blocks needed are contiguous and
+ * are fetched with a single positioned read. Threads decode independently.
+ *
+ * @param rfile	Results file with archive attached
+ * @param timestep	Timestep to decode
+ * @param var	Variable to decode
+ * @param out	Buffer for npoin values
+ * @retval 0	Success
+ * @retval -1	Timestep or variable out of range
+ * @retval -2	Read error or memory allocation failure
+ * @retval -3	Malformed block or index
+ */
+	const telemac_archive_t *a = rfile->archive;
+	if (timestep < 0 || timestep >= (int)a->nt || var < 0 || var >= (int)a->nvar) {
+		fprintf(stderr, "telemac_archive_read_var: timestep %d or variable %d out of range\n", timestep, var);
+		return -1;
+	}
+
+	archive_scratch_t *s = get_scratch(a);
+	if (s == NULL || (s->recon[var] == NULL && (s->recon[var] = malloc(sizeof(float) * (a->npoin ? a->npoin : 1))) == NULL)) {
+		perror("telemac_archive_read_var");
+		return -2;
+	}
+	float *recon = s->recon[var];
+	int key = timestep - timestep % a->keyint;
+	int have = s->recon_t[var];
+	int from = key;
+	if (have >= key && have <= timestep) {
+		from = have + 1;
+	} else {
+		memset(recon, 0, sizeof(float) * a->npoin);
+	}
+	s->recon_t[var] = -1;
+
+	if (from <= timestep) {
+		size_t first = (size_t)from * a->nvar + var;
+		size_t last = (size_t)timestep * a->nvar + var;
+		uint64_t start = a->offset[first];
+		uint64_t stop = a->offset[last] + a->length[last];
+		for (int t = from; t <= timestep; t++) {
+			size_t b = (size_t)t * a->nvar + var;
+			if (a->offset[b] < start || a->offset[b] + a->length[b] > stop) {
+				fprintf(stderr, "Malformed archive index (timestep %d, variable %d)\n", t, var);
+				return -3;
+			}
+		}
+		size_t span = stop - start;
+		if (span > s->bufsize) {
+			unsigned char *nb = realloc(s->buf, span);
+			if (nb == NULL) {
+				perror("telemac_archive_read_var");
+				return -2;
+			}
+			s->buf = nb;
+			s->bufsize = span;
+		}
+
+		TM_STATS_BEGIN(TM_PHASE_READ);
+		ssize_t got = pread(fileno(rfile->file), s->buf, span, start);
+		TM_STATS_END(TM_PHASE_READ);
+		TM_STATS_ADD(TM_COUNT_READ_CALLS, 1);
+		if (got != (ssize_t)span) {
+			fprintf(stderr, "telemac_archive_read_var: short read\n");
+			return -2;
+		}
+		TM_STATS_ADD(TM_COUNT_BYTES_READ, got);
+
+		int rv = 0;
+		TM_STATS_BEGIN(TM_PHASE_SWAP);
+		for (int t = from; t <= timestep && rv == 0; t++) {
+			size_t b = (size_t)t * a->nvar + var;
+			if (decode_block(s->buf + (a->offset[b] - start), a->length[b], recon, s->q, a->npoin, a->errbound[var]) != 0) {
+				fprintf(stderr, "Malformed archive block (timestep %d, variable %d)\n", t, var);
+				rv = -3;
+			}
+		}
+		TM_STATS_END(TM_PHASE_SWAP);
+		if (rv != 0) {
+			return rv;
+		}
+	}
+
+	s->recon_t[var] = timestep;
+	memcpy(out, recon, sizeof(float) * a->npoin);
+	return 0;
+}
+
+void telemac_archive_close(resfile_t *rfile) {
+/*!
+ * @brief Release archive state attached to a results file
+ *
+ * Decoding state held by the calling thread is released. Other threads
+ * release theirs on exit, or when they next read from a different archive.
+ *
+ * @param rfile	Results file
+ */
+	telemac_archive_t *a = rfile->archive;
+	if (a == NULL) {
+		return;
+	}
+	pthread_once(&scratch_once, scratch_key_create);
+	archive_scratch_t *s = pthread_getspecific(scratch_key);
+	if (s != NULL) {
+		scratch_free(s);
+		pthread_setspecific(scratch_key, NULL);
+	}
+	free(a->errbound);
+	free(a->times);
+	free(a->offset);
+	free(a->length);
+	free(a);
+	rfile->archive = NULL;
+}
+
+//! Work for one keyframe interval, shared between threads
+typedef struct {
+	const resfile_t *src; //!< Source results
+	const float *errbound; //!< Error bound for each variable
+	int t0; //!< First timestep in interval
+	int t1; //!< One past the last timestep in interval
+	bitbuf_t *out; //!< Output buffer for each variable
+	uint32_t **len; //!< Block lengths for each variable and timestep in interval
+	float **scratch; //!< Per-thread scratch space (4 x npoin values)
+	int failed; //!< Set on error
+} pack_work_t;
+
+static int pack_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: encode a range of variables over one interval
+	pack_work_t *w = (pack_work_t *)ctx;
+	uint32_t npoin = w->src->tmdat.npoin;
+	float *x = w->scratch[thread];
+	float *recon = x + npoin;
+	int32_t *q = (int32_t *)(recon + npoin);
+	uint32_t *u = (uint32_t *)(q + npoin);
+
+	for (size_t v = start; v < end; v++) {
+		memset(recon, 0, sizeof(float) * npoin);
+		w->out[v].len = 0;
+		for (int t = w->t0; t < w->t1; t++) {
+			if (read_telemac_var(w->src, t, v, x) != 0) {
+				return -1;
+			}
+			size_t before = w->out[v].len;
+			TM_STATS_BEGIN(TM_PHASE_FORMAT);
+			int er = encode_block(x, recon, q, u, npoin, w->errbound[v], &w->out[v]);
+			TM_STATS_END(TM_PHASE_FORMAT);
+			if (er != 0) {
+				perror("Encoding block");
+				return -1;
+			}
+			w->len[v][t - w->t0] = w->out[v].len - before;
+		}
+	}
+	return 0;
+}
+
+int telemac_archive_write(const resfile_t *src, const char *outname, const float *errbound, int keyint, int nthreads, int verbose) {
+/*!
+ * @brief Write a compressed archive of an opened results file
+ *
+ * Variables are encoded in parallel, one keyframe interval at a time. Each
+ * source record is read once.
+ *
+ * @param src		Opened results file (or restart chain)
+ * @param outname	Archive file to create
+ * @param errbound	Absolute error bound for each variable. Zero stores a variable losslessly.
+ * @param keyint	Timesteps between keyframes
+ * @param nthreads	Number of threads (see telemac_parallel_for())
+ * @param verbose	Non-zero for verbose output
+ * @retval 0		Success
+ * @retval -1		Failure
+ */
+	const telemac_data_t *results = &src->tmdat;
+	uint32_t nvar = results->nbv_1 + results->nbv_2;
+	uint32_t npoin = results->npoin;
+	uint32_t nt = results->nt;
+	if (keyint < 1) {
+		keyint = TELEMAC_ARCHIVE_KEYINT;
+	}
+	if (nthreads < 1) {
+		nthreads = telemac_default_threads();
+	}
+
+	FILE *out = fopen(outname, "wb");
+	if (out == NULL) {
+		perror(outname);
+		return -1;
+	}
+	if (write_telemac_header(out, results) != 0) {
+		perror("Writing archive header");
+		fclose(out);
+		return -1;
+	}
+
+	uint32_t hdr[5] = {TELEMAC_ARCHIVE_VERSION, keyint, nt, nvar, npoin};
+	fwrite(TELEMAC_ARCHIVE_MAGIC, 1, 8, out);
+	fwrite(hdr, sizeof(uint32_t), 5, out);
+	fwrite(errbound, sizeof(float), nvar, out);
+
+	size_t nblk = (size_t)nt * nvar;
+	float *times = calloc(sizeof(float), (nt ? nt : 1));
+	uint64_t *offset = calloc(sizeof(uint64_t), (nblk ? nblk : 1));
+	uint32_t *length = calloc(sizeof(uint32_t), (nblk ? nblk : 1));
+	bitbuf_t *bufs = calloc(sizeof(bitbuf_t), nvar);
+	uint32_t **len = calloc(sizeof(uint32_t *), nvar);
+	float **scratch = calloc(sizeof(float *), nthreads);
+	int rv = 0;
+	if (times == NULL || offset == NULL || length == NULL || bufs == NULL || len == NULL || scratch == NULL) {
+		perror("telemac_archive_write");
+		rv = -1;
+	}
+	for (uint32_t v = 0; rv == 0 && v < nvar; v++) {
+		if ((len[v] = calloc(sizeof(uint32_t), keyint)) == NULL) {
+			rv = -1;
+		}
+	}
+	for (int i = 0; rv == 0 && i < nthreads; i++) {
+		if ((scratch[i] = malloc(4 * sizeof(float) * (npoin ? npoin : 1))) == NULL) {
+			rv = -1;
+		}
+	}
+
+	for (uint32_t t = 0; rv == 0 && t < nt; t++) {
+		if (get_telemac_timestamp((resfile_t *)src, t, &times[t]) != 0) {
+			rv = -1;
+		}
+	}
+
+	uint64_t raw = 0;
+	for (uint32_t t0 = 0; rv == 0 && t0 < nt; t0 += keyint) {
+		pack_work_t w = {src, errbound, t0, (t0 + keyint < nt ? t0 + keyint : nt), bufs, len, scratch, 0};
+		if (telemac_parallel_for(nthreads, nvar, 1, pack_task, &w) != 0) {
+			fprintf(stderr, "Failed to encode timesteps %d to %d\n", w.t0, w.t1 - 1);
+			rv = -1;
+			break;
+		}
+		TM_STATS_BEGIN(TM_PHASE_WRITE);
+		for (uint32_t v = 0; v < nvar; v++) {
+			uint64_t pos = ftello(out);
+			for (int t = w.t0; t < w.t1; t++) {
+				offset[(size_t)t * nvar + v] = pos;
+				length[(size_t)t * nvar + v] = len[v][t - w.t0];
+				pos += len[v][t - w.t0];
+			}
+			if (fwrite(bufs[v].data, 1, bufs[v].len, out) != bufs[v].len) {
+				perror("Writing archive");
+				rv = -1;
+				break;
+			}
+			TM_STATS_ADD(TM_COUNT_BYTES_WRITTEN, bufs[v].len);
+		}
+		TM_STATS_END(TM_PHASE_WRITE);
+		raw += (uint64_t)(w.t1 - w.t0) * nvar * npoin * sizeof(float);
+		if (verbose) {
+			fprintf(stdout, "Encoded timesteps %d to %d\n", w.t0, w.t1 - 1);
+		}
+	}
+
+	if (rv == 0) {
+		uint64_t indexstart = ftello(out);
+		fwrite(times, sizeof(float), nt, out);
+		fwrite(offset, sizeof(uint64_t), nblk, out);
+		fwrite(length, sizeof(uint32_t), nblk, out);
+		fwrite(&indexstart, sizeof(indexstart), 1, out);
+		fwrite(TELEMAC_ARCHIVE_MAGIC, 1, 8, out);
+		uint64_t packed = ftello(out) - indexstart;
+		for (size_t b = 0; b < nblk; b++) {
+			packed += length[b];
+		}
+		fprintf(stdout, "Compressed %llu bytes of results to %llu bytes (%.1fx)\n", (unsigned long long)raw,
+				(unsigned long long)packed, (packed ? (double)raw / packed : 0));
+	}
+
+	if (fclose(out) != 0) {
+		perror("Closing archive");
+		rv = -1;
+	}
+	for (uint32_t v = 0; bufs != NULL && v < nvar; v++) {
+		free(bufs[v].data);
+	}
+	for (uint32_t v = 0; len != NULL && v < nvar; v++) {
+		free(len[v]);
+	}
+	for (int i = 0; scratch != NULL && i < nthreads; i++) {
+		free(scratch[i]);
+	}
+	free(bufs);
+	free(len);
+	free(scratch);
+	free(times);
+	free(offset);
+	free(length);
+	if (rv != 0) {
+		unlink(outname);
+	}
+	return rv;
+}
@@ -0,0 +1,83 @@
+/******************************************************************************
+telemac-archive - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Error-bounded compressed archives of TELEMAC results
+ */
+
+#ifndef TELEMAC_ARCHIVE_H
+#define TELEMAC_ARCHIVE_H
+
+#include <stdint.h>
+#include "telemac-loader.h"
+
+/*!
+ * @defgroup archive Compressed archives
+ * @brief Lossy, error-bounded storage of results with random access
+ *
+ * An archive begins with the same header and mesh records as a SELAFIN file,
+ * followed by compressed timestep data in place of the usual results records.
+ * open_telemac() recognises archives, after which get_telemac_data(),
+ * read_telemac_data() and read_telemac_var() decode results transparently.
+ *
+ * Each variable is predicted from its reconstructed value at the previous
+ * timestep. The prediction residual is quantised to a multiple of twice the
+ * error bound for that variable, so that each decoded value is within the
+ * error bound of the original (plus float rounding). Quantised residuals are
+ * Rice coded in groups of 64 values.
+ *
+ * Every keyint timesteps a keyframe is stored, predicted from zero. The blocks
+ * for one variable between two keyframes are stored contiguously, and an index
+ * at the end of the file gives the offset of every block, so any timestep and
+ * variable can be decoded with a single read.
+ *
+ * Decoding state is kept per thread, so threads may read from the same
+ * archive concurrently.
+ * @{
+ */
+
+//! Magic string identifying the archive data section and trailer
+#define TELEMAC_ARCHIVE_MAGIC "TMQARCH1"
+//! Archive format version
+#define TELEMAC_ARCHIVE_VERSION 1
+//! Default number of timesteps between keyframes
+#define TELEMAC_ARCHIVE_KEYINT 16
+
+//! State for an opened archive. Referenced from resfile_t.
+typedef struct telemac_archive {
+	uint32_t keyint; //!< Timesteps between keyframes
+	uint32_t nt; //!< Number of timesteps
+	uint32_t nvar; //!< Number of variables
+	uint32_t npoin; //!< Values per variable
+	float *errbound; //!< Absolute error bound for each variable
+	float *times; //!< Timestamp of each timestep
+	uint64_t *offset; //!< Offset of each block, indexed by (t * nvar + var)
+	uint32_t *length; //!< Length of each block, indexed by (t * nvar + var)
+	uint64_t id; //!< Unique identifier, used to match per-thread decoding state
+} telemac_archive_t;
+
+int telemac_archive_detect(resfile_t *rfile);
+int telemac_archive_open(resfile_t *rfile, int verbose);
+int telemac_archive_read_var(const resfile_t *rfile, int timestep, int var, float *out);
+void telemac_archive_close(resfile_t *rfile);
+int telemac_archive_write(const resfile_t *src, const char *outname, const float *errbound, int keyint, int nthreads, int verbose);
+
+/*! @} */
+#endif // TELEMAC_ARCHIVE_H
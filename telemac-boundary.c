@@ -0,0 +1,310 @@
+/******************************************************************************
+telemac-boundary - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <math.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-mesh.h"
+#include "telemac-layers.h"
+
+/*!
+ * @file
+ * @brief Extract time series of results at the boundary nodes
+ *
+ * Boundary nodes are found from IPOBO and ordered along each boundary (see
+ * telemac_get_boundary()). Their positions are written to one file, and the
+ * values of each variable at every timestep to a second file, for use as
+ * boundary conditions of a nested model.
+ *
+ * Only the parts of each variable record holding boundary nodes are read.
+ * The nodes are sorted and grouped into runs, joining runs separated by
+ * fewer than a given number of interior nodes, and each run is read with a
+ * single positioned read.
+ *
+ * Returns zero on success and EXIT_FAILURE if an error occurs.
+ */
+
+//! Default largest gap (in nodes) read through rather than starting a new run
+#define BOUNDARY_GAP 1024
+
+//! A contiguous range of nodes read from each variable record
+typedef struct {
+	uint32_t first; //!< First node
+	uint32_t count; //!< Number of nodes
+} run_t;
+
+//! A node to extract, and its position in the output
+typedef struct {
+	uint32_t node; //!< Node number in results file
+	uint32_t out; //!< Column in output
+} pick_t;
+
+static int pick_cmp(const void *a, const void *b) {
+//! qsort() comparison: order by node number
+	uint32_t x = ((const pick_t *)a)->node;
+	uint32_t y = ((const pick_t *)b)->node;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+	char *prefix = NULL;
+	bool verbose = false;
+	bool binaryout = false;
+	int loop = -1;
+	long gap = BOUNDARY_GAP;
+	int *vars = NULL;
+	int nvars = 0;
+
+	const char *usage = "Usage: %s [-V n] [-B k] [-b] [-g nodes] [-o prefix] [-v] [--stats[=json]] <filename> [filename...]\n"
+		"\t-V\tVariable to extract (default: all). May be repeated\n"
+		"\t-B\tExtract only boundary k (numbered from 0, in IPOBO order)\n"
+		"\t-b\tBinary output of time series (native doubles)\n"
+		"\t-g\tLargest run of interior nodes to read through (default: 1024)\n"
+		"\t-o\tOutput file prefix (default: input file name)\n"
+		"\t-v\tVerbose output\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "V:B:bg:o:v")) != -1) {
+		switch (go) {
+			case 'V':
+				vars = realloc(vars, sizeof(int) * (nvars + 1));
+				if (vars == NULL) {
+					perror("Parsing options");
+					return EXIT_FAILURE;
+				}
+				vars[nvars++] = atoi(optarg);
+				break;
+			case 'B':
+				loop = atoi(optarg);
+				break;
+			case 'b':
+				binaryout = true;
+				break;
+			case 'g':
+				gap = atol(optarg);
+				break;
+			case 'o':
+				prefix = optarg;
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 1) {
+		fprintf(stderr, "Must provide a file (or restart chain of files) to process\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	resfile_t rfs = {NULL, 0, 0, 0};
+	int rval = open_telemac_chain(&rfs, &argv[optind], argc - optind, false);
+	if (rfs.file == NULL || rval < 0) {
+		fprintf(stderr, "Unable to open %s (%d)\n", argv[optind], rval);
+		return EXIT_FAILURE;
+	}
+	telemac_data_t *mesh = &rfs.tmdat;
+	int nvar = mesh->nbv_1 + mesh->nbv_2;
+
+	if (nvars == 0) {
+		vars = calloc(sizeof(int), nvar);
+		if (vars == NULL) {
+			perror("Allocating variable list");
+			return EXIT_FAILURE;
+		}
+		for (nvars = 0; nvars < nvar; nvars++) {
+			vars[nvars] = nvars;
+		}
+	}
+	for (int j = 0; j < nvars; j++) {
+		if (vars[j] < 0 || vars[j] >= nvar) {
+			fprintf(stderr, "Variable %d out of range (%d variables)\n", vars[j], nvar);
+			return EXIT_FAILURE;
+		}
+	}
+
+	telemac_layers_t layers;
+	telemac_boundary_t bnd;
+	if (telemac_get_layers(mesh, &layers) != 0 || telemac_get_boundary(&rfs, &bnd) != 0) {
+		return EXIT_FAILURE;
+	}
+	if (loop >= (int)bnd.nloop) {
+		fprintf(stderr, "Boundary %d out of range (%u boundaries)\n", loop, bnd.nloop);
+		return EXIT_FAILURE;
+	}
+	uint32_t lfirst = (loop < 0 ? 0 : loop);
+	uint32_t llast = (loop < 0 ? bnd.nloop : (uint32_t)loop + 1);
+	uint32_t nb = bnd.start[llast] - bnd.start[lfirst];
+	uint32_t npick = nb * layers.nplan;
+
+	if (prefix == NULL) {
+		char *base = strdup(argv[optind]);
+		prefix = strdup(basename(base));
+		free(base);
+	}
+
+	// Node list: every plane of each boundary node, in boundary order
+	char *nodesname = NULL;
+	asprintf(&nodesname, "%s.boundary.csv", prefix);
+	FILE *nodesfile = fopen(nodesname, "w");
+	pick_t *pick = calloc(sizeof(pick_t), npick + 1);
+	if (nodesfile == NULL || pick == NULL) {
+		perror("Writing boundary node list");
+		return EXIT_FAILURE;
+	}
+	fprintf(nodesfile, "column,boundary,index,node,plane,x,y,distance\n");
+	uint32_t col = 0;
+	for (uint32_t k = 0; k < layers.nplan; k++) {
+		for (uint32_t l = lfirst; l < llast; l++) {
+			double dist = 0;
+			for (uint32_t i = bnd.start[l]; i < bnd.start[l + 1]; i++) {
+				uint32_t n = bnd.node[i];
+				if (i > bnd.start[l]) {
+					uint32_t p = bnd.node[i - 1];
+					dist += hypot(mesh->X[n] - mesh->X[p], mesh->Y[n] - mesh->Y[p]);
+				}
+				uint32_t node = n + k * layers.npoin2;
+				fprintf(nodesfile, "%u,%u,%u,%u,%u,%.10f,%.10f,%.10f\n", col, l, i - bnd.start[l], node, k, mesh->X[n], mesh->Y[n], dist);
+				pick[col].node = node;
+				pick[col].out = col;
+				col++;
+			}
+		}
+	}
+	fclose(nodesfile);
+	telemac_stats_add_file(nodesname);
+
+	// Group the nodes into runs in file order
+	qsort(pick, npick, sizeof(pick_t), pick_cmp);
+	run_t *runs = calloc(sizeof(run_t), npick + 1);
+	if (runs == NULL) {
+		perror("Allocating runs");
+		return EXIT_FAILURE;
+	}
+	uint32_t nruns = 0;
+	uint32_t maxrun = 0;
+	uint64_t span = 0;
+	for (uint32_t i = 0; i < npick; i++) {
+		uint32_t n = pick[i].node;
+		if (nruns > 0 && n <= runs[nruns - 1].first + runs[nruns - 1].count + gap) {
+			runs[nruns - 1].count = n - runs[nruns - 1].first + 1;
+		} else {
+			runs[nruns].first = n;
+			runs[nruns++].count = 1;
+		}
+	}
+	for (uint32_t r = 0; r < nruns; r++) {
+		maxrun = (runs[r].count > maxrun ? runs[r].count : maxrun);
+		span += runs[r].count;
+	}
+	fprintf(stdout, "%u boundary nodes on %u boundaries (%u values per variable), read as %u runs covering %.1f%% of each record\n",
+			nb, llast - lfirst, npick, nruns, 100.0 * span / (mesh->npoin ? mesh->npoin : 1));
+	if (verbose) {
+		for (uint32_t l = lfirst; l < llast; l++) {
+			fprintf(stdout, "\tBoundary %u: %u nodes from node %u\n", l, bnd.start[l + 1] - bnd.start[l], bnd.node[bnd.start[l]] + 1);
+		}
+	}
+
+	char *seriesname = NULL;
+	asprintf(&seriesname, "%s.boundary.%s", prefix, (binaryout ? "dat" : "series.csv"));
+	FILE *series = fopen(seriesname, (binaryout ? "wb" : "w"));
+	float *buf = calloc(sizeof(float), maxrun + 1);
+	double *vals = calloc(sizeof(double), (size_t)npick * nvars + 1);
+	if (series == NULL || buf == NULL || vals == NULL) {
+		perror("Opening time series output");
+		return EXIT_FAILURE;
+	}
+	if (!binaryout) {
+		fprintf(series, "step,time,variable");
+		for (uint32_t c = 0; c < npick; c++) {
+			fprintf(series, ",%u", c);
+		}
+		fprintf(series, "\n");
+	}
+
+	for (int t = 0; t < (int)mesh->nt; t++) {
+		float time = 0;
+		if (get_telemac_timestamp(&rfs, t, &time) != 0) {
+			fprintf(stderr, "Unable to read time of timestep %d\n", t);
+			return EXIT_FAILURE;
+		}
+		for (int j = 0; j < nvars; j++) {
+			double *row = &vals[(size_t)j * npick];
+			uint32_t p = 0;
+			for (uint32_t r = 0; r < nruns; r++) {
+				if (read_telemac_var_range(&rfs, t, vars[j], runs[r].first, runs[r].count, buf) != 0) {
+					fprintf(stderr, "Unable to read variable %d at timestep %d\n", vars[j], t);
+					return EXIT_FAILURE;
+				}
+				for (; p < npick && pick[p].node < runs[r].first + runs[r].count; p++) {
+					row[pick[p].out] = buf[pick[p].node - runs[r].first];
+				}
+			}
+		}
+
+		TM_STATS_BEGIN(TM_PHASE_FORMAT);
+		if (binaryout) {
+			double dt = time;
+			fwrite(&dt, sizeof(double), 1, series);
+			fwrite(vals, sizeof(double), (size_t)npick * nvars, series);
+		} else {
+			for (int j = 0; j < nvars; j++) {
+				fprintf(series, "%d,%f,%d", t, time, vars[j]);
+				for (uint32_t c = 0; c < npick; c++) {
+					fprintf(series, ",%.8g", vals[(size_t)j * npick + c]);
+				}
+				fprintf(series, "\n");
+			}
+		}
+		TM_STATS_END(TM_PHASE_FORMAT);
+	}
+	if (fclose(series) != 0) {
+		perror("Writing time series output");
+		return EXIT_FAILURE;
+	}
+	telemac_stats_add_file(seriesname);
+	fprintf(stdout, "Wrote %s and %s\n", nodesname, seriesname);
+
+	free(nodesname);
+	free(seriesname);
+	free(buf);
+	free(vals);
+	free(runs);
+	free(pick);
+	free(vars);
+	telemac_boundary_free(&bnd);
+	close_telemac(&rfs);
+	return EXIT_SUCCESS;
+}
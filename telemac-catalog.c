@@ -0,0 +1,634 @@
+/******************************************************************************
+telemac-catalog - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <limits.h>
+#include <ftw.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-thread.h"
+
+/*!
+ * @file
+ * @brief Maintain and query an index of SELAFIN result files
+ *
+ * In scan mode, walks one or more directory trees and records summary
+ * information (title, variables, mesh dimensions, date, number of timesteps,
+ * time range and bounding box) for each SELAFIN file found. Files are opened
+ * in header-only mode (see open_telemac_header()) and processed in parallel.
+ * Files whose size and modification time match the existing index entry are
+ * not re-read. Files found not to be SELAFIN files are also recorded, with
+ * only their size and modification time, so that they are not probed again
+ * until they change.
+ *
+ * In query mode, the index is searched without opening any result files.
+ *
+ * Returns zero on success and non-zero if an error occurs
+ */
+
+//! Magic string at the start of the index file, followed by the version
+#define CATALOG_MAGIC "#telemac-catalog "
+//! Index format version. Version 2 adds entries for files which are not SELAFIN files.
+#define CATALOG_VERSION 2
+//! Title field marking an index entry for a file which is not a SELAFIN file
+#define CATALOG_NOT_SELAFIN "-"
+
+//! Summary of a single results file
+typedef struct {
+	char *path; //!< Absolute path to file
+	long long size; //!< File size in bytes
+	long long mtime_sec; //!< Modification time (seconds)
+	long long mtime_nsec; //!< Modification time (nanoseconds)
+	char title[73]; //!< Simulation title, trailing spaces removed
+	bool hasdate; //!< Set if the file includes a start date
+	datetime_t date; //!< Simulation start date
+	uint32_t nbv_1; //!< Number of linear variables
+	uint32_t nbv_2; //!< Number of quadratic variables
+	char *vars; //!< Variable names, separated by '|'
+	uint32_t nelem; //!< Number of elements
+	uint32_t npoin; //!< Number of nodes
+	uint32_t ndp; //!< Nodes per element
+	uint32_t nt; //!< Number of timesteps
+	float tstart; //!< First timestamp
+	float tend; //!< Last timestamp
+	float bbox[4]; //!< Minimum and maximum X and Y coordinates
+	bool valid; //!< Set once the entry holds a file summary
+	bool selafin; //!< Set if the file is a SELAFIN file. Otherwise only path, size and time are held.
+	bool stale; //!< Set if the file must be (re-)read during a scan
+} catalog_entry_t;
+
+//! Growable array of catalog entries
+typedef struct {
+	catalog_entry_t *e; //!< Entries
+	size_t n; //!< Number of entries in use
+	size_t cap; //!< Allocated entries
+} catalog_t;
+
+static catalog_t found = {NULL, 0, 0}; //!< Files found by nftw() during a scan
+static int verbose = 0; //!< Verbosity level
+
+static catalog_entry_t *catalog_add(catalog_t *cat) {
+//! Append a zeroed entry to a catalog, returning NULL on allocation failure
+	if (cat->n == cat->cap) {
+		size_t ncap = (cat->cap ? 2 * cat->cap : 256);
+		catalog_entry_t *ne = realloc(cat->e, ncap * sizeof(catalog_entry_t));
+		if (ne == NULL) {
+			perror("catalog_add");
+			return NULL;
+		}
+		cat->e = ne;
+		cat->cap = ncap;
+	}
+	memset(&cat->e[cat->n], 0, sizeof(catalog_entry_t));
+	return &cat->e[cat->n++];
+}
+
+static int entry_cmp(const void *a, const void *b) {
+//! Order catalog entries by path
+	return strcmp(((const catalog_entry_t *)a)->path, ((const catalog_entry_t *)b)->path);
+}
+
+static void sanitise(char *s, char bad, char good) {
+//! Replace characters that would break the index format
+	for (; *s; s++) {
+		if (*s == bad || *s == '\t' || *s == '\n' || *s == '\r') {
+			*s = good;
+		}
+	}
+}
+
+static void rtrim(char *s) {
+//! Remove trailing spaces
+	size_t l = strlen(s);
+	while (l > 0 && s[l - 1] == ' ') {
+		s[--l] = '\0';
+	}
+}
+
+static int load_catalog(const char *indexfile, catalog_t *cat) {
+/*!
+ * @brief Read an existing index file
+ * @param indexfile	Path to index
+ * @param cat		Catalog to populate
+ * @retval 0	Success, or index does not exist
+ * @retval -1	Index could not be read or is not a catalog
+ */
+	FILE *idx = fopen(indexfile, "r");
+	if (idx == NULL) {
+		return 0;
+	}
+
+	char *line = NULL;
+	size_t llen = 0;
+	ssize_t r = getline(&line, &llen, idx);
+	int version = 0;
+	if (r >= 0 && strncmp(line, CATALOG_MAGIC, strlen(CATALOG_MAGIC)) == 0) {
+		version = atoi(line + strlen(CATALOG_MAGIC));
+	}
+	if (version < 1 || version > CATALOG_VERSION) {
+		fprintf(stderr, "%s is not a telemac-catalog index\n", indexfile);
+		free(line);
+		fclose(idx);
+		return -1;
+	}
+
+	while ((r = getline(&line, &llen, idx)) > 0) {
+		if (line[r - 1] == '\n') {
+			line[r - 1] = '\0';
+		}
+		char *f[19];
+		char *p = line;
+		int nf = 0;
+		while (nf < 19 && (f[nf] = strsep(&p, "\t")) != NULL) {
+			nf++;
+		}
+		bool selafin = (nf == 19);
+		if (!selafin && !(nf == 5 && strcmp(f[4], CATALOG_NOT_SELAFIN) == 0)) {
+			fprintf(stderr, "Skipping malformed index entry\n");
+			continue;
+		}
+		catalog_entry_t *e = catalog_add(cat);
+		if (e == NULL) {
+			free(line);
+			fclose(idx);
+			return -1;
+		}
+		e->path = strdup(f[0]);
+		e->size = atoll(f[1]);
+		e->mtime_sec = atoll(f[2]);
+		e->mtime_nsec = atoll(f[3]);
+		e->valid = true;
+		if (!selafin) {
+			continue;
+		}
+		e->selafin = true;
+		snprintf(e->title, sizeof(e->title), "%s", f[4]);
+		e->hasdate = (sscanf(f[5], "%u-%u-%u %u:%u:%u", &e->date.year, &e->date.month, &e->date.day,
+					&e->date.hour, &e->date.minute, &e->date.second) == 6);
+		e->nbv_1 = strtoul(f[6], NULL, 10);
+		e->nbv_2 = strtoul(f[7], NULL, 10);
+		e->vars = strdup(f[8]);
+		e->nelem = strtoul(f[9], NULL, 10);
+		e->npoin = strtoul(f[10], NULL, 10);
+		e->ndp = strtoul(f[11], NULL, 10);
+		e->nt = strtoul(f[12], NULL, 10);
+		e->tstart = strtof(f[13], NULL);
+		e->tend = strtof(f[14], NULL);
+		for (int i = 0; i < 4; i++) {
+			e->bbox[i] = strtof(f[15 + i], NULL);
+		}
+	}
+	free(line);
+	fclose(idx);
+	qsort(cat->e, cat->n, sizeof(catalog_entry_t), entry_cmp);
+	return 0;
+}
+
+static int save_catalog(const char *indexfile, catalog_t *cat) {
+/*!
+ * @brief Write the index, replacing any existing file atomically
+ * @param indexfile	Path to index
+ * @param cat		Catalog to write. Only valid entries are written.
+ * @returns 0 on success
+ */
+	char *tmpname = NULL;
+	asprintf(&tmpname, "%s.tmp", indexfile);
+	FILE *idx = fopen(tmpname, "w");
+	if (idx == NULL) {
+		perror("Unable to open index for writing");
+		free(tmpname);
+		return -1;
+	}
+
+	fprintf(idx, "%s%d\n", CATALOG_MAGIC, CATALOG_VERSION);
+	for (size_t i = 0; i < cat->n; i++) {
+		catalog_entry_t *e = &cat->e[i];
+		if (!e->valid) {
+			continue;
+		}
+		if (!e->selafin) {
+			fprintf(idx, "%s\t%lld\t%lld\t%lld\t%s\n", e->path, e->size, e->mtime_sec, e->mtime_nsec, CATALOG_NOT_SELAFIN);
+			continue;
+		}
+		fprintf(idx, "%s\t%lld\t%lld\t%lld\t%s\t", e->path, e->size, e->mtime_sec, e->mtime_nsec, e->title);
+		if (e->hasdate) {
+			fprintf(idx, "%04u-%02u-%02u %02u:%02u:%02u\t", e->date.year, e->date.month, e->date.day,
+					e->date.hour, e->date.minute, e->date.second);
+		} else {
+			fprintf(idx, "-\t");
+		}
+		fprintf(idx, "%u\t%u\t%s\t%u\t%u\t%u\t%u\t%.9g\t%.9g\t%.9g\t%.9g\t%.9g\t%.9g\n", e->nbv_1, e->nbv_2, e->vars,
+				e->nelem, e->npoin, e->ndp, e->nt, e->tstart, e->tend, e->bbox[0], e->bbox[1], e->bbox[2], e->bbox[3]);
+	}
+
+	if (fclose(idx) != 0 || rename(tmpname, indexfile) != 0) {
+		perror("Unable to save index");
+		unlink(tmpname);
+		free(tmpname);
+		return -1;
+	}
+	free(tmpname);
+	return 0;
+}
+
+static int found_file(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+//! nftw() callback: record each regular file found
+	if (typeflag != FTW_F || !S_ISREG(sb->st_mode)) {
+		return 0;
+	}
+	catalog_entry_t *e = catalog_add(&found);
+	if (e == NULL) {
+		return -1;
+	}
+	e->path = strdup(fpath);
+	e->size = sb->st_size;
+	e->mtime_sec = sb->st_mtim.tv_sec;
+	e->mtime_nsec = sb->st_mtim.tv_nsec;
+	e->stale = true;
+	return 0;
+}
+
+static bool is_selafin(FILE *f) {
+//! Check for the R1 record marker and SERAFIN format string
+	unsigned char head[4 + 80];
+	if (fread(head, 1, sizeof(head), f) != sizeof(head)) {
+		return false;
+	}
+	uint32_t marker = 0;
+	memcpy(&marker, head, 4);
+	return (int_swap(marker) == 80 && memcmp(head + 4 + 72, "SERAFIN", 7) == 0);
+}
+
+static int read_range(resfile_t *rfs, float *buf, float *lo, float *hi) {
+//! Read the next coordinate record into buf and find its range
+	telemac_data_t *results = &rfs->tmdat;
+	if (fortran_read(buf, sizeof(float), results->npoin, rfs->file) != results->npoin) {
+		return -1;
+	}
+	*lo = INFINITY;
+	*hi = -INFINITY;
+	for (uint32_t i = 0; i < results->npoin; i++) {
+		float v = float_swap(buf[i]);
+		*lo = fminf(*lo, v);
+		*hi = fmaxf(*hi, v);
+	}
+	return 0;
+}
+
+static int summarise(catalog_entry_t *e) {
+/*!
+ * @brief Populate a catalog entry from its results file
+ *
+ * Opens the file in header-only mode, reads the first and last timestamps and
+ * the X and Y records needed for the bounding box. IKLE and IPOBO are skipped.
+ *
+ * @param e	Entry with path set
+ * @retval 0	Success (e->valid and e->selafin set)
+ * @retval 1	Not a SELAFIN file (e->valid set)
+ * @retval -1	Error reading file
+ */
+	FILE *f = fopen(e->path, "rb");
+	if (f == NULL) {
+		perror(e->path);
+		return -1;
+	}
+	if (!is_selafin(f)) {
+		fclose(f);
+		e->valid = true;
+		return 1;
+	}
+
+	resfile_t rfs = {f, 0, 0, 0};
+	if (open_telemac_header(&rfs, (verbose > 1)) != 0) {
+		fprintf(stderr, "%s: unable to read header\n", e->path);
+		close_telemac(&rfs);
+		return -1;
+	}
+	telemac_data_t *results = &rfs.tmdat;
+
+	snprintf(e->title, sizeof(e->title), "%s", results->title);
+	rtrim(e->title);
+	sanitise(e->title, '\t', ' ');
+	e->hasdate = (results->iparam[9] == 1);
+	e->date = results->date;
+	e->nbv_1 = results->nbv_1;
+	e->nbv_2 = results->nbv_2;
+	e->nelem = results->nelem;
+	e->npoin = results->npoin;
+	e->ndp = results->ndp;
+	e->nt = results->nt;
+
+	size_t vlen = 1 + 33 * results->nbv_1;
+	e->vars = calloc(vlen, 1);
+	for (uint32_t i = 0; e->vars != NULL && i < results->nbv_1; i++) {
+		char name[33];
+		snprintf(name, sizeof(name), "%s", results->var_names[i]);
+		rtrim(name);
+		sanitise(name, '|', '/');
+		if (i) {
+			strcat(e->vars, "|");
+		}
+		strcat(e->vars, name);
+	}
+
+	int rv = 0;
+	e->tstart = NAN;
+	e->tend = NAN;
+	if (results->nt > 0) {
+		if (get_telemac_timestamp(&rfs, 0, &e->tstart) != 0 || get_telemac_timestamp(&rfs, results->nt - 1, &e->tend) != 0) {
+			rv = -1;
+		}
+	}
+
+	// Skip IKLE and IPOBO records, then read X and Y
+	off_t xstart = rfs.meshstart + 8 + (off_t)sizeof(uint32_t) * results->nelem * results->ndp + 8 + (off_t)sizeof(uint32_t) * results->npoin;
+	float *buf = malloc(sizeof(float) * (results->npoin ? results->npoin : 1));
+	if (buf == NULL || fseeko(f, xstart, SEEK_SET) != 0
+			|| read_range(&rfs, buf, &e->bbox[0], &e->bbox[1]) != 0
+			|| read_range(&rfs, buf, &e->bbox[2], &e->bbox[3]) != 0) {
+		fprintf(stderr, "%s: unable to read coordinates\n", e->path);
+		rv = -1;
+	}
+	free(buf);
+	close_telemac(&rfs);
+
+	if (rv == 0) {
+		e->valid = true;
+		e->selafin = true;
+		if (verbose) {
+			fprintf(stdout, "Indexed %s\n", e->path);
+		}
+	}
+	return rv;
+}
+
+static int summarise_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: summarise stale entries in range
+	catalog_entry_t *entries = (catalog_entry_t *)ctx;
+	for (size_t i = start; i < end; i++) {
+		if (entries[i].stale) {
+			summarise(&entries[i]);
+		}
+	}
+	return 0;
+}
+
+static bool under_root(const char *path, char **roots, int nroots) {
+//! Check whether path lies within one of the scanned roots
+	for (int r = 0; r < nroots; r++) {
+		size_t l = strlen(roots[r]);
+		if (strncmp(path, roots[r], l) == 0 && (path[l] == '/' || path[l] == '\0' || roots[r][l - 1] == '/')) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int scan(const char *indexfile, char **paths, int npaths, int nthreads) {
+/*!
+ * @brief Update the index with the contents of the given paths
+ *
+ * @param indexfile	Path to index
+ * @param paths		Files or directories to scan
+ * @param npaths	Number of entries in paths
+ * @param nthreads	Number of threads to use when reading files
+ * @returns 0 on success
+ */
+	catalog_t old = {NULL, 0, 0};
+	if (load_catalog(indexfile, &old) != 0) {
+		return -1;
+	}
+
+	char **roots = calloc(sizeof(char *), npaths);
+	for (int r = 0; r < npaths; r++) {
+		roots[r] = realpath(paths[r], NULL);
+		if (roots[r] == NULL) {
+			perror(paths[r]);
+			return -1;
+		}
+		if (nftw(roots[r], found_file, 64, FTW_PHYS) != 0) {
+			fprintf(stderr, "Error scanning %s\n", roots[r]);
+			return -1;
+		}
+	}
+
+	// Files unchanged since the last scan are copied from the old index
+	size_t reused = 0;
+	for (size_t i = 0; i < found.n; i++) {
+		catalog_entry_t *e = &found.e[i];
+		catalog_entry_t *o = bsearch(e, old.e, old.n, sizeof(catalog_entry_t), entry_cmp);
+		if (o != NULL && o->size == e->size && o->mtime_sec == e->mtime_sec && o->mtime_nsec == e->mtime_nsec) {
+			char *path = e->path;
+			*e = *o;
+			e->path = path;
+			e->stale = false;
+			o->valid = false; // Now owned by e
+			reused++;
+		}
+	}
+
+	if (telemac_parallel_for(nthreads, found.n, 16, summarise_task, found.e) != 0) {
+		return -1;
+	}
+
+	// Keep old entries outside the scanned paths
+	size_t kept = 0;
+	for (size_t i = 0; i < old.n; i++) {
+		if (old.e[i].valid && !under_root(old.e[i].path, roots, npaths)) {
+			catalog_entry_t *e = catalog_add(&found);
+			if (e == NULL) {
+				return -1;
+			}
+			*e = old.e[i];
+			kept++;
+		}
+	}
+	qsort(found.e, found.n, sizeof(catalog_entry_t), entry_cmp);
+
+	size_t nvalid = 0;
+	size_t nother = 0;
+	for (size_t i = 0; i < found.n; i++) {
+		nvalid += found.e[i].valid;
+		nother += (found.e[i].valid && !found.e[i].selafin);
+	}
+	fprintf(stdout, "%zu files indexed (%zu read, %zu unchanged, %zu outside scanned paths), %zu of which are not SELAFIN files\n",
+			nvalid, nvalid - reused - kept, reused, kept, nother);
+
+	for (int r = 0; r < npaths; r++) {
+		free(roots[r]);
+	}
+	free(roots);
+	return save_catalog(indexfile, &found);
+}
+
+//! Query filters. NULL or NaN fields are not applied.
+typedef struct {
+	char **text; //!< Substrings matched against path or title (all must match)
+	int ntext; //!< Number of text filters
+	const char *var; //!< Substring matched against variable names
+	float px; //!< X coordinate that must lie within bounding box
+	float py; //!< Y coordinate that must lie within bounding box
+	float time; //!< Time that must lie within the simulated range
+} query_t;
+
+static bool matches(const catalog_entry_t *e, const query_t *q) {
+//! Test an entry against the query filters
+	if (!e->selafin) {
+		return false;
+	}
+	for (int i = 0; i < q->ntext; i++) {
+		if (strstr(e->path, q->text[i]) == NULL && strcasestr(e->title, q->text[i]) == NULL) {
+			return false;
+		}
+	}
+	if (q->var != NULL && strcasestr(e->vars, q->var) == NULL) {
+		return false;
+	}
+	if (!isnan(q->px) && (q->px < e->bbox[0] || q->px > e->bbox[1] || q->py < e->bbox[2] || q->py > e->bbox[3])) {
+		return false;
+	}
+	if (!isnan(q->time) && (q->time < e->tstart || q->time > e->tend)) {
+		return false;
+	}
+	return true;
+}
+
+static int query(const char *indexfile, const query_t *q, bool longout) {
+/*!
+ * @brief Print index entries matching a query
+ * @param indexfile	Path to index
+ * @param q		Query filters
+ * @param longout	Print all fields for each entry
+ * @returns 0 if at least one entry matched
+ */
+	catalog_t cat = {NULL, 0, 0};
+	if (load_catalog(indexfile, &cat) != 0) {
+		return -1;
+	}
+
+	size_t nmatch = 0;
+	for (size_t i = 0; i < cat.n; i++) {
+		catalog_entry_t *e = &cat.e[i];
+		if (!matches(e, q)) {
+			continue;
+		}
+		nmatch++;
+		if (!longout) {
+			fprintf(stdout, "%s\t%u\t%+f\t%+f\t%s\n", e->path, e->nt, e->tstart, e->tend, e->title);
+			continue;
+		}
+		fprintf(stdout, "%s\n\tTitle:\t\t%s\n", e->path, e->title);
+		if (e->hasdate) {
+			fprintf(stdout, "\tDate:\t\t%04u-%02u-%02u %02u:%02u:%02u\n", e->date.year, e->date.month, e->date.day,
+					e->date.hour, e->date.minute, e->date.second);
+		}
+		fprintf(stdout, "\tVariables:\t%s\n", e->vars);
+		fprintf(stdout, "\tMesh:\t\t%u nodes, %u elements, %u nodes per element\n", e->npoin, e->nelem, e->ndp);
+		fprintf(stdout, "\tTimesteps:\t%u (t = %+f to %+f)\n", e->nt, e->tstart, e->tend);
+		fprintf(stdout, "\tX range:\t%+f, %+f\n\tY range:\t%+f, %+f\n", e->bbox[0], e->bbox[1], e->bbox[2], e->bbox[3]);
+		fprintf(stdout, "\tSize:\t\t%lld bytes\n", e->size);
+	}
+	if (verbose) {
+		fprintf(stderr, "%zu of %zu entries matched\n", nmatch, cat.n);
+	}
+	return (nmatch > 0 ? 0 : 1);
+}
+
+int main(int argc, char **argv) {
+	const char *indexfile = "telemac-catalog.idx";
+	bool scanmode = false;
+	bool longout = false;
+	int nthreads = 0;
+	query_t q = {NULL, 0, NULL, NAN, NAN, NAN};
+
+	const char *usage = "Usage:\n"
+		"\t%s [-i index] [-j n] [-v] -s path [path...]\n"
+		"\t%s [-i index] [-l] [-V var] [-p x,y] [-T t] [text...]\n"
+		"\t-i\tIndex file (default: telemac-catalog.idx)\n"
+		"\t-s\tScan mode: add or update all SELAFIN files found under each path\n"
+		"\t-j\tNumber of threads to use when scanning (default: number of CPUs)\n"
+		"\t-v\tVerbose output\n"
+		"\t-l\tLong output\n"
+		"\t-V\tOnly list files with a variable name containing var\n"
+		"\t-p\tOnly list files whose bounding box contains point x,y\n"
+		"\t-T\tOnly list files whose time range includes t\n"
+		"\ttext\tOnly list files whose path or title contain each text\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "i:sj:vlV:p:T:")) != -1) {
+		switch (go) {
+			case 'i':
+				indexfile = optarg;
+				break;
+			case 's':
+				scanmode = true;
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'v':
+				verbose++;
+				break;
+			case 'l':
+				longout = true;
+				break;
+			case 'V':
+				q.var = optarg;
+				break;
+			case 'p':
+				if (sscanf(optarg, "%f,%f", &q.px, &q.py) != 2) {
+					fprintf(stderr, "Point must be given as x,y\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'T':
+				q.time = strtof(optarg, NULL);
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0], argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (scanmode) {
+		if (argc - optind < 1) {
+			fprintf(stderr, "Must specify at least one path to scan\n");
+			fprintf(stderr, usage, argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+		return (scan(indexfile, &argv[optind], argc - optind, nthreads) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	q.text = &argv[optind];
+	q.ntext = argc - optind;
+	int qr = query(indexfile, &q, longout);
+	return (qr < 0 ? EXIT_FAILURE : qr);
+}
@@ -0,0 +1,237 @@
+/******************************************************************************
+telemac-check - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-scan.h"
+
+/*!
+ * @file
+ * @brief Check results files for damaged records and non-finite values
+ *
+ * Every timestep of each file is checked in parallel (see telemac-scan.h),
+ * reporting the last timestep of the valid prefix, any records whose markers
+ * are wrong, records holding NaN or infinite values and any incomplete
+ * timestep at the end of the file. The valid prefix may be copied to a new
+ * file.
+ *
+ * Returns zero if no problems were found, and EXIT_FAILURE otherwise.
+ */
+
+static int copy_prefix(FILE *from, const char *outname, off_t len) {
+/*!
+ * @brief Copy the first len bytes of a file to a new file
+ *
+ * The output is not truncated until it has been checked not to be the input
+ * file (under any name).
+ *
+ * @returns 0 on success, -1 on failure
+ */
+	int out = open(outname, O_WRONLY | O_CREAT, 0644);
+	if (out < 0) {
+		perror(outname);
+		return -1;
+	}
+	int in = fileno(from);
+	struct stat sin;
+	struct stat sout;
+	if (fstat(in, &sin) != 0 || fstat(out, &sout) != 0) {
+		perror(outname);
+		close(out);
+		return -1;
+	}
+	if (sin.st_dev == sout.st_dev && sin.st_ino == sout.st_ino) {
+		fprintf(stderr, "%s is the file being checked. Choose a different output file\n", outname);
+		close(out);
+		return -1;
+	}
+	if (ftruncate(out, 0) != 0) {
+		perror(outname);
+		close(out);
+		return -1;
+	}
+	off_t inoff = 0;
+	char buf[65536];
+	TM_STATS_BEGIN(TM_PHASE_WRITE);
+	while (inoff < len) {
+		size_t want = (len - inoff > (off_t)(1 << 30) ? (size_t)(1 << 30) : (size_t)(len - inoff));
+		ssize_t got = copy_file_range(in, &inoff, out, NULL, want, 0);
+		if (got < 0) {
+			// Not supported between these files: copy through a buffer instead
+			got = pread(in, buf, (want > sizeof(buf) ? sizeof(buf) : want), inoff);
+			if (got > 0 && write(out, buf, got) != got) {
+				got = -1;
+			}
+			inoff += (got > 0 ? got : 0);
+		}
+		if (got <= 0) {
+			TM_STATS_END(TM_PHASE_WRITE);
+			perror(outname);
+			close(out);
+			return -1;
+		}
+		TM_STATS_ADD(TM_COUNT_WRITE_CALLS, 1);
+	}
+	TM_STATS_END(TM_PHASE_WRITE);
+	if (close(out) != 0) {
+		perror(outname);
+		return -1;
+	}
+	telemac_stats_add_file(outname);
+	return 0;
+}
+
+static int check_file(const char *filename, int nthreads, int maxlist, bool quiet, const char *outname) {
+/*!
+ * @brief Check one file and print a report
+ * @retval 0	No problems found
+ * @retval 1	Problems found
+ * @retval -1	File could not be checked
+ */
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) {
+		perror(filename);
+		return -1;
+	}
+	resfile_t rfs = {f, 0, 0, 0};
+	if (open_telemac_header(&rfs, false) != 0) {
+		fprintf(stderr, "%s: unable to read header\n", filename);
+		close_telemac(&rfs);
+		return -1;
+	}
+	telemac_data_t *results = &rfs.tmdat;
+	if (rfs.archive != NULL) {
+		fprintf(stdout, "%s: compressed archive, not checked\n", filename);
+		close_telemac(&rfs);
+		return 0;
+	}
+
+	telemac_scan_t scan;
+	if (telemac_scan(&rfs, nthreads, &scan) != 0) {
+		fprintf(stderr, "%s: unable to check file\n", filename);
+		close_telemac(&rfs);
+		return -1;
+	}
+	bool damaged = (scan.nbad > 0 || scan.trailing > 0);
+	int rv = (damaged || scan.nnonfinite > 0 ? 1 : 0);
+
+	fprintf(stdout, "%s: %s\n", filename, (damaged ? "DAMAGED" : (rv ? "NON-FINITE VALUES" : "OK")));
+	fprintf(stdout, "\t%u timesteps, %d variables, %u nodes\n", scan.nt, scan.nvar, results->npoin);
+	if (scan.nvalid > 0) {
+		fprintf(stdout, "\tValid prefix: %u timesteps (last valid timestep %u)\n", scan.nvalid, scan.nvalid - 1);
+	} else {
+		fprintf(stdout, "\tValid prefix: no timesteps\n");
+	}
+	fprintf(stdout, "\tRecords with bad markers: %ju\n", (uintmax_t)scan.nbad);
+	fprintf(stdout, "\tRecords with NaN or infinite values: %ju\n", (uintmax_t)scan.nnonfinite);
+	fprintf(stdout, "\tBytes after last complete timestep: %jd\n", (intmax_t)scan.trailing);
+
+	int nunit = (scan.nvar > 0 ? scan.nvar : 1);
+	int listed = 0;
+	for (size_t u = 0; !quiet && u < (size_t)scan.nt * nunit; u++) {
+		if (!scan.bad[u] && scan.nonfinite[u] == 0) {
+			continue;
+		}
+		if (listed++ == maxlist) {
+			fprintf(stdout, "\t...\n");
+			break;
+		}
+		int v = u % nunit;
+		const char *name = (scan.nvar == 0 ? "" : (v < (int)results->nbv_1 ? results->var_names[v] : "(quadratic)"));
+		if (scan.bad[u]) {
+			fprintf(stdout, "\tTimestep %zu, variable %d (%.16s): bad record markers\n", u / nunit, v, name);
+		} else {
+			fprintf(stdout, "\tTimestep %zu, variable %d (%.16s): %u NaN or infinite values\n",
+					u / nunit, v, name, scan.nonfinite[u]);
+		}
+	}
+
+	if (outname != NULL) {
+		off_t len = rfs.datastart + (off_t)scan.nvalid * rfs.datasize;
+		if (copy_prefix(f, outname, len) != 0) {
+			rv = -1;
+		} else {
+			fprintf(stdout, "Wrote %u timesteps to %s\n", scan.nvalid, outname);
+		}
+	}
+	telemac_scan_free(&scan);
+	close_telemac(&rfs);
+	return rv;
+}
+
+int main(int argc, char **argv) {
+	char *outname = NULL;
+	bool quiet = false;
+	int maxlist = 10;
+	int nthreads = 0;
+
+	const char *usage = "Usage: %s [-j n] [-n max] [-q] [-o output] [--stats[=json]] <filename> [filename...]\n"
+		"\t-j\tNumber of threads (default: number of CPUs)\n"
+		"\t-n\tList at most this many damaged records for each file (default: 10)\n"
+		"\t-q\tOnly print a summary for each file\n"
+		"\t-o\tCopy the valid prefix of the file to a new file (one input file only)\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "j:n:qo:")) != -1) {
+		switch (go) {
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'n':
+				maxlist = atoi(optarg);
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			case 'o':
+				outname = optarg;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 1 || (outname != NULL && argc - optind > 1)) {
+		fprintf(stderr, "Must provide a file to check (or exactly one file with -o)\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_SUCCESS;
+	for (int i = optind; i < argc; i++) {
+		if (check_file(argv[i], nthreads, maxlist, quiet, outname) != 0) {
+			status = EXIT_FAILURE;
+		}
+	}
+	return status;
+}
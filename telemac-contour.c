@@ -0,0 +1,292 @@
+/******************************************************************************
+telemac-contour - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "telemac-contour.h"
+#include "telemac-layers.h"
+#include "telemac-stats.h"
+
+//! No matching segment end
+#define CONTOUR_NONE UINT32_MAX
+
+//! One end of a contour segment, on an edge of the mesh
+typedef struct {
+	uint64_t edge; //!< Edge as (lower node << 32) | higher node
+	uint32_t level; //!< Level index
+	uint32_t id; //!< Segment * 2 + end
+} contour_end_t;
+
+//! Segments found in the mesh, before joining into lines
+typedef struct {
+	uint32_t nseg; //!< Number of segments
+	uint32_t size; //!< Allocated segments
+	contour_end_t *ends; //!< Both ends of each segment
+	double *x; //!< X coordinate of each end
+	double *y; //!< Y coordinate of each end
+} contour_segs_t;
+
+static int end_cmp(const void *a, const void *b) {
+//! qsort() comparison: order by level, then edge, then segment
+	const contour_end_t *x = (const contour_end_t *)a;
+	const contour_end_t *y = (const contour_end_t *)b;
+	if (x->level != y->level) {
+		return (x->level > y->level) - (x->level < y->level);
+	}
+	if (x->edge != y->edge) {
+		return (x->edge > y->edge) - (x->edge < y->edge);
+	}
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+static void edge_point(const telemac_contour_mesh_t *cmesh, const float *values, uint32_t a, uint32_t b, double level,
+		uint64_t *edge, double *x, double *y) {
+//! Crossing point of a level on the edge a-b, always calculated from the lower numbered node
+	if (a > b) {
+		uint32_t t = a;
+		a = b;
+		b = t;
+	}
+	double f = (level - values[a]) / ((double)values[b] - values[a]);
+	*edge = ((uint64_t)a << 32) | b;
+	*x = cmesh->X[a] + f * ((double)cmesh->X[b] - cmesh->X[a]);
+	*y = cmesh->Y[a] + f * ((double)cmesh->Y[b] - cmesh->Y[a]);
+}
+
+static int add_segment(contour_segs_t *s, const telemac_contour_mesh_t *cmesh, const float *values,
+		const uint32_t n[3], double level, uint32_t lidx) {
+//! Add the segment of a level crossing a triangle
+	if (s->nseg == s->size) {
+		uint32_t size = (s->size ? 2 * s->size : 1024);
+		contour_end_t *ends = realloc(s->ends, sizeof(contour_end_t) * 2 * size);
+		double *x = realloc(s->x, sizeof(double) * 2 * size);
+		double *y = realloc(s->y, sizeof(double) * 2 * size);
+		if (ends != NULL) {
+			s->ends = ends;
+		}
+		if (x != NULL) {
+			s->x = x;
+		}
+		if (y != NULL) {
+			s->y = y;
+		}
+		if (ends == NULL || x == NULL || y == NULL) {
+			return -1;
+		}
+		s->size = size;
+	}
+	uint32_t id = 2 * s->nseg;
+	for (int k = 0; k < 3; k++) {
+		uint32_t a = n[k];
+		uint32_t b = n[(k + 1) % 3];
+		if ((values[a] >= level) != (values[b] >= level)) {
+			edge_point(cmesh, values, a, b, level, &s->ends[id].edge, &s->x[id], &s->y[id]);
+			s->ends[id].level = lidx;
+			s->ends[id].id = id;
+			id++;
+		}
+	}
+	s->nseg++;
+	return 0;
+}
+
+int telemac_contour_prepare(const telemac_data_t *results, telemac_contour_mesh_t *cmesh) {
+/*!
+ * @brief Split the mesh into triangles for contouring
+ *
+ * @param results	Results file header and mesh
+ * @param cmesh	Output: triangles, to be released with telemac_contour_mesh_free()
+ * @returns	0 on success, -1 on failure
+ */
+	telemac_layers_t layers;
+	memset(cmesh, 0, sizeof(telemac_contour_mesh_t));
+	if (results->state != 2 || telemac_get_layers(results, &layers) != 0) {
+		fprintf(stderr, "telemac_contour_prepare: mesh not loaded\n");
+		return -1;
+	}
+	size_t maxtri = 2 * (size_t)layers.nelem2 + 1;
+	for (int k = 0; k < 3; k++) {
+		cmesh->tri[k] = calloc(sizeof(uint32_t), maxtri);
+		if (cmesh->tri[k] == NULL) {
+			perror("telemac_contour_prepare");
+			telemac_contour_mesh_free(cmesh);
+			return -1;
+		}
+	}
+	TM_STATS_ALLOC(3 * sizeof(uint32_t) * maxtri);
+	cmesh->ntri = telemac_plane_triangles(results, &layers, cmesh->tri);
+	cmesh->X = results->X;
+	cmesh->Y = results->Y;
+	return 0;
+}
+
+void telemac_contour_mesh_free(telemac_contour_mesh_t *cmesh) {
+//! Release triangles prepared by telemac_contour_prepare()
+	for (int k = 0; k < 3; k++) {
+		free(cmesh->tri[k]);
+		cmesh->tri[k] = NULL;
+	}
+	cmesh->ntri = 0;
+}
+
+static uint32_t trace(const contour_segs_t *s, const uint32_t *partner, uint8_t *used, uint32_t id, telemac_contour_t *out) {
+//! Follow joined segments from one end of a segment, appending points to out and returning the final partner
+	out->x[out->npts] = s->x[id];
+	out->y[out->npts++] = s->y[id];
+	uint32_t p = id;
+	do {
+		used[p >> 1] = 1;
+		uint32_t other = p ^ 1;
+		out->x[out->npts] = s->x[other];
+		out->y[out->npts++] = s->y[other];
+		p = partner[other];
+	} while (p != CONTOUR_NONE && !used[p >> 1]);
+	return p;
+}
+
+int telemac_contour(const telemac_contour_mesh_t *cmesh, const float *values, const double *levels, int nlevels, telemac_contour_t *out) {
+/*!
+ * @brief Trace contour lines of nodal values
+ *
+ * Lines are returned in order of level. For each level, lines ending at the
+ * edge of the mesh (or at nodes with NaN values) come first, followed by
+ * closed loops. The output does not depend on anything but the mesh, values
+ * and levels, so contours of different timesteps can be traced in parallel.
+ *
+ * @param cmesh	Triangles from telemac_contour_prepare()
+ * @param values	Nodal values (of a single plane, for 3D meshes)
+ * @param levels	Contour levels, in ascending order
+ * @param nlevels	Number of levels
+ * @param out	Output: lines, to be released with telemac_contour_free()
+ * @returns	0 on success, -1 on failure
+ */
+	memset(out, 0, sizeof(telemac_contour_t));
+	for (int l = 1; l < nlevels; l++) {
+		if (!(levels[l] >= levels[l - 1])) {
+			fprintf(stderr, "telemac_contour: levels must be in ascending order\n");
+			return -1;
+		}
+	}
+
+	// Segments: only levels between the smallest and largest value of each triangle are considered
+	contour_segs_t s = {0, 0, NULL, NULL, NULL};
+	int rv = 0;
+	for (uint32_t t = 0; t < cmesh->ntri && rv == 0 && nlevels > 0; t++) {
+		uint32_t n[3] = {cmesh->tri[0][t], cmesh->tri[1][t], cmesh->tri[2][t]};
+		float v0 = values[n[0]], v1 = values[n[1]], v2 = values[n[2]];
+		if (isnan(v0) || isnan(v1) || isnan(v2)) {
+			continue;
+		}
+		float vmin = fminf(v0, fminf(v1, v2));
+		float vmax = fmaxf(v0, fmaxf(v1, v2));
+		if (vmax < levels[0] || !(vmin < levels[nlevels - 1])) {
+			continue;
+		}
+		// First level above vmin: levels in (vmin, vmax] cross the triangle
+		int lo = 0, hi = nlevels;
+		while (lo < hi) {
+			int mid = lo + (hi - lo) / 2;
+			if (levels[mid] > vmin) {
+				hi = mid;
+			} else {
+				lo = mid + 1;
+			}
+		}
+		for (int l = lo; l < nlevels && levels[l] <= vmax && rv == 0; l++) {
+			rv = add_segment(&s, cmesh, values, n, levels[l], l);
+		}
+	}
+
+	// Join segment ends on the same edge, then follow them into lines
+	uint32_t nend = 2 * s.nseg;
+	contour_end_t *sorted = malloc(sizeof(contour_end_t) * (nend + 1));
+	uint32_t *partner = malloc(sizeof(uint32_t) * (nend + 1));
+	uint8_t *used = calloc(1, s.nseg + 1);
+	out->start = malloc(sizeof(uint32_t) * (s.nseg + 1));
+	out->level = malloc(sizeof(uint32_t) * (s.nseg + 1));
+	out->closed = malloc(s.nseg + 1);
+	out->x = malloc(sizeof(double) * (nend + 1));
+	out->y = malloc(sizeof(double) * (nend + 1));
+	if (rv != 0 || sorted == NULL || partner == NULL || used == NULL || out->start == NULL || out->level == NULL
+			|| out->closed == NULL || out->x == NULL || out->y == NULL) {
+		perror("telemac_contour");
+		rv = -1;
+	} else {
+		if (nend > 0) {
+			memcpy(sorted, s.ends, sizeof(contour_end_t) * nend);
+		}
+		qsort(sorted, nend, sizeof(contour_end_t), end_cmp);
+		for (uint32_t i = 0; i < nend; i++) {
+			partner[i] = CONTOUR_NONE;
+		}
+		for (uint32_t i = 0; i + 1 < nend; i++) {
+			if (sorted[i].level == sorted[i + 1].level && sorted[i].edge == sorted[i + 1].edge) {
+				partner[sorted[i].id] = sorted[i + 1].id;
+				partner[sorted[i + 1].id] = sorted[i].id;
+				i++;
+			}
+		}
+
+		for (uint32_t a = 0; a < nend;) {
+			uint32_t b = a;
+			while (b < nend && sorted[b].level == sorted[a].level) {
+				b++;
+			}
+			// Open lines start from unmatched ends, then what remains is closed loops
+			for (int pass = 0; pass < 2; pass++) {
+				for (uint32_t i = a; i < b; i++) {
+					uint32_t id = sorted[i].id;
+					if (used[id >> 1] || (pass == 0 && partner[id] != CONTOUR_NONE)) {
+						continue;
+					}
+					out->start[out->nline] = out->npts;
+					out->level[out->nline] = sorted[i].level;
+					uint32_t last = trace(&s, partner, used, id, out);
+					out->closed[out->nline++] = (pass == 1 && last != CONTOUR_NONE && (last >> 1) == (id >> 1));
+				}
+			}
+			a = b;
+		}
+		out->start[out->nline] = out->npts;
+	}
+
+	free(sorted);
+	free(partner);
+	free(used);
+	free(s.ends);
+	free(s.x);
+	free(s.y);
+	if (rv != 0) {
+		telemac_contour_free(out);
+	}
+	return rv;
+}
+
+void telemac_contour_free(telemac_contour_t *lines) {
+//! Release contour lines
+	free(lines->start);
+	free(lines->level);
+	free(lines->closed);
+	free(lines->x);
+	free(lines->y);
+	memset(lines, 0, sizeof(telemac_contour_t));
+}
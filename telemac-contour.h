@@ -0,0 +1,75 @@
+/******************************************************************************
+telemac-contour - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Contour lines of nodal values
+ */
+
+#ifndef TELEMAC_CONTOUR_H
+#define TELEMAC_CONTOUR_H
+
+#include <stdint.h>
+#include "telemac-loader.h"
+
+/*!
+ * @defgroup contour Contouring
+ * @brief Contour lines traced through the triangles of the mesh
+ *
+ * Each triangle is checked against the levels lying between the smallest and
+ * largest of its nodal values, found by binary search of the sorted levels,
+ * so triangles that cannot contain a contour cost only three comparisons.
+ * A node is above a level if its value is greater than or equal to it, and a
+ * contour crosses each edge joining a node above the level to one below.
+ * The crossing point is calculated in the same way from both triangles
+ * sharing an edge, so the segments are joined into polylines by matching
+ * edges rather than by comparing coordinates.
+ *
+ * Quadrilaterals are split into two triangles. For 3D meshes the triangles
+ * of the bottom plane are used, and values are those of a single plane (see
+ * telemac_read_plane()).
+ * @{
+ */
+
+//! Triangles of the mesh, prepared once for contouring many sets of values
+typedef struct {
+	uint32_t ntri; //!< Number of triangles
+	uint32_t *tri[3]; //!< Nodes of each triangle (numbered from 0)
+	const float *X; //!< Node X coordinates (borrowed from the results file)
+	const float *Y; //!< Node Y coordinates (borrowed from the results file)
+} telemac_contour_mesh_t;
+
+//! Contour lines for a set of levels
+typedef struct {
+	uint32_t nline; //!< Number of polylines
+	uint32_t npts; //!< Total number of points
+	uint32_t *start; //!< First point of each line (nline + 1 entries)
+	uint32_t *level; //!< Level (index into the sorted levels) of each line
+	uint8_t *closed; //!< Non-zero if the line is a closed loop (first point repeated at the end)
+	double *x; //!< Point X coordinates
+	double *y; //!< Point Y coordinates
+} telemac_contour_t;
+
+int telemac_contour_prepare(const telemac_data_t *results, telemac_contour_mesh_t *cmesh);
+void telemac_contour_mesh_free(telemac_contour_mesh_t *cmesh);
+int telemac_contour(const telemac_contour_mesh_t *cmesh, const float *values, const double *levels, int nlevels, telemac_contour_t *out);
+void telemac_contour_free(telemac_contour_t *lines);
+
+/*! @} */
+#endif // TELEMAC_CONTOUR_H
@@ -0,0 +1,408 @@
+/******************************************************************************
+telemac-diff - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "telemac-loader.h"
+#include "telemac-writer.h"
+#include "telemac-stats.h"
+#include "telemac-stream.h"
+#include "telemac-thread.h"
+
+/*!
+ * @file
+ * @brief Compare two results files on the same mesh
+ *
+ * Opens a baseline and a candidate results file, checks that their meshes
+ * match and compares each variable at every timestep present in both files.
+ * For each variable the maximum absolute difference (with the node, position
+ * and time at which it occurs), RMS difference and mean difference (bias) over
+ * all matched timesteps are reported. Differences which are not a number
+ * (e.g. where one file holds a NaN) are counted separately and excluded from
+ * the RMS and mean.
+ *
+ * The two files are read concurrently by background threads while the
+ * differences for the previous timestep are computed. Optionally, the
+ * difference fields (candidate - baseline) are written to a SELAFIN file.
+ *
+ * Returns zero on success, 2 if a tolerance was given and exceeded (or any
+ * difference is not a number), and EXIT_FAILURE if an error occurs.
+ */
+
+//! Number of values accumulated in single precision before adding to the totals
+#define DIFF_BLOCK 4096
+//! Number of independent accumulators in the difference kernel
+#define DIFF_LANES 8
+
+//! Accumulated error metrics for one variable
+typedef struct {
+	double sum; //!< Sum of differences
+	double sumsq; //!< Sum of squared differences
+	uint64_t n; //!< Number of values compared, excluding NaN differences
+	uint64_t nnan; //!< Number of differences which are NaN
+	float maxabs; //!< Largest absolute difference
+	int maxnode; //!< Node at which maxabs occurs
+	int maxstep; //!< Timestep (in baseline file) at which maxabs occurs
+	float maxtime; //!< Time at which maxabs occurs
+} diff_metric_t;
+
+//! Work shared between threads for one pair of timesteps
+typedef struct {
+	float **a; //!< Baseline frame
+	float **b; //!< Candidate frame
+	float **d; //!< Difference output, one array per variable
+	diff_metric_t *m; //!< Metrics, one per variable
+	uint32_t npoin; //!< Values per variable
+	int step; //!< Baseline timestep number
+	float time; //!< Baseline timestamp
+} diff_work_t;
+
+static float diff_kernel(const float *restrict a, const float *restrict b, float *restrict d, size_t n,
+		double *sum, double *sumsq, uint64_t *nnan) {
+/*!
+ * @brief Compute d = b - a, accumulating sums and finding the largest |d|
+ *
+ * NaN differences are counted in nnan and left out of the sums and maximum.
+ *
+ * Uses DIFF_LANES independent partial results so that the loop can be
+ * vectorised without relying on re-association of the floating point
+ * reductions.
+ *
+ * @param a	Baseline values
+ * @param b	Candidate values
+ * @param d	Output differences
+ * @param n	Number of values
+ * @param sum	Incremented by the sum of differences
+ * @param sumsq	Incremented by the sum of squared differences
+ * @param nnan	Incremented by the number of NaN differences
+ * @returns	Largest absolute difference
+ */
+	float lmax[DIFF_LANES] = {0};
+	uint32_t lnan[DIFF_LANES] = {0};
+	double dsum = 0;
+	double dsq = 0;
+
+	for (size_t blk = 0; blk < n; blk += DIFF_BLOCK) {
+		size_t end = (blk + DIFF_BLOCK < n ? blk + DIFF_BLOCK : n);
+		float lsum[DIFF_LANES] = {0};
+		float lsq[DIFF_LANES] = {0};
+		size_t i = blk;
+		for (; i + DIFF_LANES <= end; i += DIFF_LANES) {
+			for (int l = 0; l < DIFF_LANES; l++) {
+				float x = b[i + l] - a[i + l];
+				float ax = fabsf(x);
+				bool num = (x == x);
+				d[i + l] = x;
+				lsum[l] += (num ? x : 0);
+				lsq[l] += (num ? x * x : 0);
+				lnan[l] += !num;
+				lmax[l] = (ax > lmax[l] ? ax : lmax[l]);
+			}
+		}
+		for (; i < end; i++) {
+			float x = b[i] - a[i];
+			bool num = (x == x);
+			d[i] = x;
+			lsum[0] += (num ? x : 0);
+			lsq[0] += (num ? x * x : 0);
+			lnan[0] += !num;
+			lmax[0] = (fabsf(x) > lmax[0] ? fabsf(x) : lmax[0]);
+		}
+		for (int l = 0; l < DIFF_LANES; l++) {
+			dsum += lsum[l];
+			dsq += lsq[l];
+		}
+	}
+
+	float m = 0;
+	for (int l = 0; l < DIFF_LANES; l++) {
+		m = (lmax[l] > m ? lmax[l] : m);
+		*nnan += lnan[l];
+	}
+	*sum += dsum;
+	*sumsq += dsq;
+	return m;
+}
+
+static int diff_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: compare a range of variables
+	diff_work_t *w = (diff_work_t *)ctx;
+	for (size_t j = start; j < end; j++) {
+		diff_metric_t *m = &w->m[j];
+		uint64_t nnan = 0;
+		float stepmax = diff_kernel(w->a[j], w->b[j], w->d[j], w->npoin, &m->sum, &m->sumsq, &nnan);
+		m->n += w->npoin - nnan;
+		m->nnan += nnan;
+		if (stepmax > m->maxabs || m->maxnode < 0) {
+			for (uint32_t i = 0; i < w->npoin; i++) {
+				if (fabsf(w->d[j][i]) == stepmax) {
+					m->maxnode = i;
+					break;
+				}
+			}
+			m->maxabs = stepmax;
+			m->maxstep = w->step;
+			m->maxtime = w->time;
+		}
+	}
+	return 0;
+}
+
+static int open_input(resfile_t *rfs, const char *filename, bool force, bool verbose) {
+//! Open one of the input files, reading all of its timestamps
+	rfs->file = fopen(filename, "rb");
+	if (rfs->file == NULL) {
+		perror(filename);
+		return -1;
+	}
+	int rv = open_telemac(rfs, verbose);
+	if (rv != 0) {
+		fprintf(stderr, "%s: open_telemac returned %d\n", filename, rv);
+		if (rv < 0 || !force) {
+			return -1;
+		}
+	}
+	for (int t = 0; t < rfs->tmdat.nt; t++) {
+		if (get_telemac_timestamp(rfs, t, &rfs->tmdat.timestamp[t]) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	char *outname = NULL;
+	bool verbose = false;
+	bool force = false;
+	int nthreads = 0;
+	float timetol = 1e-3;
+	float tol = NAN;
+
+	const char *usage = "Usage: %s [-v] [-F] [-j n] [-T dt] [-t tol] [-o diff.slf] [--stats[=json]] <baseline> <candidate>\n"
+		"\t-v\tVerbose output: report metrics at each timestep\n"
+		"\t-F\tForce mode. Attempt to continue on certain errors\n"
+		"\t-j\tNumber of threads to use (default: number of CPUs)\n"
+		"\t-T\tMaximum difference in time for timesteps to be matched (default: 0.001)\n"
+		"\t-t\tExit with status 2 if any absolute difference exceeds tol or is NaN\n"
+		"\t-o\tWrite difference fields (candidate - baseline) to a SELAFIN file\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "vFj:T:t:o:")) != -1) {
+		switch (go) {
+			case 'v':
+				verbose = true;
+				break;
+			case 'F':
+				force = true;
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'T':
+				timetol = strtof(optarg, NULL);
+				break;
+			case 't':
+				tol = strtof(optarg, NULL);
+				break;
+			case 'o':
+				outname = optarg;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind != 2) {
+		fprintf(stderr, "Must specify a baseline and a candidate file\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	resfile_t base = {NULL, 0, 0, 0};
+	resfile_t cand = {NULL, 0, 0, 0};
+	if (open_input(&base, argv[optind], force, false) != 0 || open_input(&cand, argv[optind + 1], force, false) != 0) {
+		return EXIT_FAILURE;
+	}
+	telemac_data_t *ma = &base.tmdat;
+	telemac_data_t *mb = &cand.tmdat;
+
+	if (ma->npoin != mb->npoin || ma->nelem != mb->nelem || ma->ndp != mb->ndp
+			|| ma->nbv_1 + ma->nbv_2 != mb->nbv_1 + mb->nbv_2) {
+		fprintf(stderr, "Mesh dimensions or number of variables differ\n");
+		return EXIT_FAILURE;
+	}
+	uint64_t hasha = 0;
+	uint64_t hashb = 0;
+	if (telemac_mesh_hash(base.file, base.meshstart, ma, &hasha) != 0 || telemac_mesh_hash(cand.file, cand.meshstart, mb, &hashb) != 0) {
+		fprintf(stderr, "Unable to read mesh records\n");
+		return EXIT_FAILURE;
+	}
+	if (hasha != hashb) {
+		fprintf(stderr, "Meshes differ (IKLE, X or Y)\n");
+		if (!force) {
+			return EXIT_FAILURE;
+		}
+	}
+	for (uint32_t j = 0; j < ma->nbv_1; j++) {
+		if (strncmp(ma->var_names[j], mb->var_names[j], 16) != 0) {
+			fprintf(stderr, "Warning: variable %d is '%s' in baseline but '%s' in candidate\n", j, ma->var_names[j], mb->var_names[j]);
+		}
+	}
+
+	// Match timesteps by time (both are in increasing time order)
+	int *sa = calloc(sizeof(int), (ma->nt ? ma->nt : 1));
+	int *sb = calloc(sizeof(int), (ma->nt ? ma->nt : 1));
+	if (sa == NULL || sb == NULL) {
+		perror("Allocating timestep lists");
+		return EXIT_FAILURE;
+	}
+	int nmatch = 0;
+	for (int i = 0, k = 0; i < ma->nt && k < mb->nt; ) {
+		float dt = mb->timestamp[k] - ma->timestamp[i];
+		if (fabsf(dt) <= timetol) {
+			sa[nmatch] = i++;
+			sb[nmatch++] = k++;
+		} else if (dt < 0) {
+			k++;
+		} else {
+			i++;
+		}
+	}
+	fprintf(stdout, "%d of %d baseline timesteps and %d candidate timesteps matched\n", nmatch, ma->nt, mb->nt);
+	if (nmatch == 0) {
+		return EXIT_FAILURE;
+	}
+
+	int nvar = ma->nbv_1 + ma->nbv_2;
+	FILE *outfile = NULL;
+	telemac_data_t outhdr = *ma;
+	if (outname != NULL) {
+		outfile = fopen(outname, "wb");
+		if (outfile == NULL) {
+			perror("Unable to open difference output file");
+			return EXIT_FAILURE;
+		}
+		snprintf(outhdr.title, sizeof(outhdr.title), "Difference: candidate - baseline");
+		if (write_telemac_header(outfile, &outhdr) != 0) {
+			perror("Writing difference file header");
+			return EXIT_FAILURE;
+		}
+	}
+
+	diff_metric_t *metrics = calloc(sizeof(diff_metric_t), nvar);
+	float **d = alloc_telemac_data(&base);
+	if (metrics == NULL || d == NULL) {
+		perror("Allocating difference arrays");
+		return EXIT_FAILURE;
+	}
+	for (int j = 0; j < nvar; j++) {
+		metrics[j].maxnode = -1;
+	}
+
+	telemac_stream_t *stra = telemac_stream_open(&base, sa, nmatch, NULL);
+	telemac_stream_t *strb = telemac_stream_open(&cand, sb, nmatch, NULL);
+	if (stra == NULL || strb == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	int rv = EXIT_SUCCESS;
+	for (int k = 0; k < nmatch && rv == EXIT_SUCCESS; k++) {
+		diff_work_t w = {NULL, NULL, d, metrics, ma->npoin, 0, 0};
+		w.a = telemac_stream_next(stra, &w.step, &w.time);
+		w.b = telemac_stream_next(strb, NULL, NULL);
+		if (w.a == NULL || w.b == NULL) {
+			fprintf(stderr, "Unable to read timestep pair %d\n", k);
+			rv = EXIT_FAILURE;
+			break;
+		}
+
+		TM_STATS_BEGIN(TM_PHASE_FORMAT);
+		telemac_parallel_for(nthreads, nvar, 1, diff_task, &w);
+		TM_STATS_END(TM_PHASE_FORMAT);
+
+		if (verbose) {
+			fprintf(stdout, "Step %d (t = %+f):", w.step, w.time);
+			for (int j = 0; j < nvar; j++) {
+				fprintf(stdout, "\t%g", metrics[j].maxabs);
+			}
+			fprintf(stdout, "\n");
+		}
+
+		if (outfile != NULL) {
+			TM_STATS_BEGIN(TM_PHASE_WRITE);
+			int wr = write_telemac_timestep(outfile, &outhdr, w.time, d);
+			TM_STATS_END(TM_PHASE_WRITE);
+			if (wr != 0) {
+				perror("Writing difference file");
+				rv = EXIT_FAILURE;
+			}
+		}
+	}
+	// Stop the readers before returning, as they use base and cand
+	telemac_stream_close(stra);
+	telemac_stream_close(strb);
+	if (rv != EXIT_SUCCESS) {
+		return rv;
+	}
+
+	if (outfile != NULL && fclose(outfile) != 0) {
+		perror("Closing difference file");
+		return EXIT_FAILURE;
+	}
+
+	bool exceeded = false;
+	fprintf(stdout, "\n%-32s %14s %10s %14s %14s %14s %14s %14s %10s\n", "Variable", "Max |diff|", "Node", "X", "Y", "Time", "RMS", "Bias", "NaN");
+	for (int j = 0; j < nvar; j++) {
+		diff_metric_t *m = &metrics[j];
+		const char *name = (j < (int)ma->nbv_1 ? ma->var_names[j] : "(quadratic)");
+		double rms = (m->n ? sqrt(m->sumsq / m->n) : 0);
+		double bias = (m->n ? m->sum / m->n : 0);
+		float x = (m->maxnode >= 0 ? ma->X[m->maxnode] : NAN);
+		float y = (m->maxnode >= 0 ? ma->Y[m->maxnode] : NAN);
+		fprintf(stdout, "%-32s %14.6e %10d %+14.4f %+14.4f %+14.4f %14.6e %+14.6e %10llu\n", name, m->maxabs, m->maxnode,
+				x, y, m->maxtime, rms, bias, (unsigned long long)m->nnan);
+		if (!isnan(tol) && (m->maxabs > tol || m->nnan > 0)) {
+			exceeded = true;
+		}
+	}
+
+	free_telemac_data(&base, d);
+	free(metrics);
+	free(sa);
+	free(sb);
+	close_telemac(&base);
+	close_telemac(&cand);
+
+	if (exceeded) {
+		fprintf(stdout, "\nTolerance %g exceeded\n", tol);
+		return 2;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,738 @@
+/******************************************************************************
+telemac-expr - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <math.h>
+
+#include "telemac-expr.h"
+#include "telemac-thread.h"
+
+/*!
+ * @file
+ * @brief Derived variables calculated from stored results
+ *
+ * Expressions are parsed by recursive descent directly into reverse Polish
+ * order. Constant sub-expressions are folded as they are emitted, and binary
+ * operations with a constant right hand side take it as an immediate operand
+ * rather than from the stack.
+ */
+
+//! Length of the name part of a SELAFIN variable name (the rest holds units)
+#define NAME_LENGTH 16
+
+//! Usual TELEMAC letters for common variables, with English and French names
+static const char *aliases[][3] = {
+	{"U", "VELOCITY U", "VITESSE U"},
+	{"V", "VELOCITY V", "VITESSE V"},
+	{"W", "VELOCITY W", "VITESSE W"},
+	{"H", "WATER DEPTH", "HAUTEUR D'EAU"},
+	{"S", "FREE SURFACE", "SURFACE LIBRE"},
+	{"B", "BOTTOM", "FOND"},
+	{"Z", "ELEVATION Z", "COTE Z"},
+	{"Q", "SCALAR FLOWRATE", "DEBIT SCALAIRE"},
+	{"F", "FROUDE NUMBER", "FROUDE"},
+	{"M", "SCALAR VELOCITY", "VITESSE SCALAIRE"},
+};
+
+//! Functions available in expressions
+static const struct {
+	const char *name; //!< Function name
+	telemac_expr_op_t op; //!< Operation
+	int nargs; //!< Number of arguments
+} functions[] = {
+	{"sqrt", EXPR_SQRT, 1},
+	{"abs", EXPR_ABS, 1},
+	{"exp", EXPR_EXP, 1},
+	{"log", EXPR_LOG, 1},
+	{"sin", EXPR_SIN, 1},
+	{"cos", EXPR_COS, 1},
+	{"min", EXPR_MIN, 2},
+	{"max", EXPR_MAX, 2},
+	{"atan2", EXPR_ATAN2, 2},
+	{"if", EXPR_IF, 3},
+};
+
+//! Parser state
+typedef struct {
+	const char *s; //!< Expression text
+	size_t pos; //!< Current position in s
+	const telemac_data_t *results; //!< Results file, for variable names
+	telemac_expr_t *expr; //!< Expression being compiled
+	int cap; //!< Allocated size of expr->ins
+	int sp; //!< Stack depth after the operations emitted so far
+	char *err; //!< Error message buffer
+	size_t errlen; //!< Size of err
+	bool failed; //!< Set once an error has been reported
+} parser_t;
+
+static void parse_error(parser_t *p, const char *fmt, ...) {
+//! Record the first error found, with its position
+	if (p->failed) {
+		return;
+	}
+	p->failed = true;
+	if (p->err == NULL || p->errlen == 0) {
+		return;
+	}
+	char msg[256];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	snprintf(p->err, p->errlen, "%s at position %zu in '%s'", msg, p->pos + 1, p->s);
+}
+
+static void skip_space(parser_t *p) {
+//! Advance past white space
+	while (isspace((unsigned char)p->s[p->pos])) {
+		p->pos++;
+	}
+}
+
+static float apply_scalar(telemac_expr_op_t op, float a, float b, float c) {
+//! Apply an operation to scalar operands. Used for constant folding.
+	switch (op) {
+		case EXPR_ADD: return a + b;
+		case EXPR_SUB: return a - b;
+		case EXPR_MUL: return a * b;
+		case EXPR_DIV: return a / b;
+		case EXPR_POW: return powf(a, b);
+		case EXPR_LT: return (a < b);
+		case EXPR_GT: return (a > b);
+		case EXPR_LE: return (a <= b);
+		case EXPR_GE: return (a >= b);
+		case EXPR_MIN: return fminf(a, b);
+		case EXPR_MAX: return fmaxf(a, b);
+		case EXPR_ATAN2: return atan2f(a, b);
+		case EXPR_NEG: return -a;
+		case EXPR_SQR: return a * a;
+		case EXPR_SQRT: return sqrtf(a);
+		case EXPR_ABS: return fabsf(a);
+		case EXPR_EXP: return expf(a);
+		case EXPR_LOG: return logf(a);
+		case EXPR_SIN: return sinf(a);
+		case EXPR_COS: return cosf(a);
+		case EXPR_IF: return (a != 0 ? b : c);
+		default: return NAN;
+	}
+}
+
+static telemac_expr_ins_t *last_ins(parser_t *p, int back) {
+//! Return an emitted operation, counting back from the most recent (1)
+	if (p->expr->nins < back) {
+		return NULL;
+	}
+	return &p->expr->ins[p->expr->nins - back];
+}
+
+static bool is_const(const telemac_expr_ins_t *in) {
+//! True if in pushes a constant
+	return (in != NULL && in->op == EXPR_CONST);
+}
+
+static void emit(parser_t *p, telemac_expr_ins_t in, int stack) {
+/*!
+ * @brief Append an operation
+ * @param p	Parser state
+ * @param in	Operation
+ * @param stack	Change in stack depth caused by the operation
+ */
+	if (p->failed) {
+		return;
+	}
+	if (p->expr->nins == p->cap) {
+		int ncap = (p->cap ? 2 * p->cap : 16);
+		telemac_expr_ins_t *ni = realloc(p->expr->ins, sizeof(telemac_expr_ins_t) * ncap);
+		if (ni == NULL) {
+			parse_error(p, "Out of memory");
+			return;
+		}
+		p->expr->ins = ni;
+		p->cap = ncap;
+	}
+	p->expr->ins[p->expr->nins++] = in;
+	p->sp += stack;
+	if (p->sp > p->expr->depth) {
+		p->expr->depth = p->sp;
+	}
+}
+
+static void emit_const(parser_t *p, float value) {
+//! Push a constant
+	telemac_expr_ins_t in = {EXPR_CONST, false, -1, value};
+	emit(p, in, 1);
+}
+
+static void emit_unary(parser_t *p, telemac_expr_op_t op) {
+//! Apply a single argument operation to the top of the stack
+	telemac_expr_ins_t *a = last_ins(p, 1);
+	if (p->failed) {
+		return;
+	}
+	if (is_const(a)) {
+		a->value = apply_scalar(op, a->value, 0, 0);
+		return;
+	}
+	telemac_expr_ins_t in = {op, false, -1, 0};
+	emit(p, in, 0);
+}
+
+static void emit_binary(parser_t *p, telemac_expr_op_t op) {
+//! Apply a two argument operation to the top two stack entries
+	telemac_expr_ins_t *a = last_ins(p, 2);
+	telemac_expr_ins_t *b = last_ins(p, 1);
+	if (p->failed) {
+		return;
+	}
+	if (is_const(a) && is_const(b)) {
+		a->value = apply_scalar(op, a->value, b->value, 0);
+		p->expr->nins--;
+		p->sp--;
+		return;
+	}
+	if (is_const(b)) {
+		// Constant right hand side becomes an immediate operand
+		float value = b->value;
+		p->expr->nins--;
+		p->sp--;
+		if (op == EXPR_POW && value == 2) {
+			emit_unary(p, EXPR_SQR);
+		} else if (op == EXPR_POW && value == 0.5) {
+			emit_unary(p, EXPR_SQRT);
+		} else if (op == EXPR_POW && value == 1) {
+			// Nothing to do
+		} else {
+			telemac_expr_ins_t in = {op, true, -1, value};
+			emit(p, in, 0);
+		}
+		return;
+	}
+	telemac_expr_ins_t in = {op, false, -1, 0};
+	emit(p, in, -1);
+}
+
+static bool name_matches(const char *varname, const char *query, size_t len) {
+/*!
+ * @brief Compare a variable name with a name given in an expression
+ *
+ * The comparison ignores case and trailing spaces, treats underscores in the
+ * query as spaces, and matches either the name part (first 16 characters)
+ * or the full name including units.
+ */
+	size_t vlen = strlen(varname);
+	for (int pass = 0; pass < 2; pass++) {
+		size_t n = (pass == 0 && vlen > NAME_LENGTH ? NAME_LENGTH : vlen);
+		while (n > 0 && varname[n - 1] == ' ') {
+			n--;
+		}
+		if (n != len) {
+			continue;
+		}
+		bool same = true;
+		for (size_t i = 0; i < n && same; i++) {
+			char q = (query[i] == '_' ? ' ' : query[i]);
+			same = (toupper((unsigned char)varname[i]) == toupper((unsigned char)q));
+		}
+		if (same) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int find_variable(const telemac_data_t *results, const char *name, size_t len) {
+//! Find a stored variable by name or TELEMAC letter. Returns -1 if not found.
+	for (int j = 0; j < (int)results->nbv_1; j++) {
+		if (name_matches(results->var_names[j], name, len)) {
+			return j;
+		}
+	}
+	for (size_t a = 0; a < sizeof(aliases) / sizeof(aliases[0]); a++) {
+		if (strlen(aliases[a][0]) != len || strncasecmp(aliases[a][0], name, len) != 0) {
+			continue;
+		}
+		for (int k = 1; k < 3; k++) {
+			for (int j = 0; j < (int)results->nbv_1; j++) {
+				if (name_matches(results->var_names[j], aliases[a][k], strlen(aliases[a][k]))) {
+					return j;
+				}
+			}
+		}
+	}
+	return -1;
+}
+
+static void emit_variable(parser_t *p, int var) {
+//! Push a stored variable and note that it is required
+	telemac_expr_ins_t in = {EXPR_VAR, false, var, 0};
+	p->expr->uses[var] = true;
+	emit(p, in, 1);
+}
+
+static void parse_expr(parser_t *p);
+
+static void parse_call(parser_t *p, const char *name, size_t len) {
+//! Parse a function call, with the position at the opening parenthesis
+	int f = -1;
+	for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+		if (strlen(functions[i].name) == len && strncasecmp(functions[i].name, name, len) == 0) {
+			f = i;
+		}
+	}
+	if (f < 0) {
+		parse_error(p, "Unknown function '%.*s'", (int)len, name);
+		return;
+	}
+	p->pos++; // (
+	for (int a = 0; a < functions[f].nargs && !p->failed; a++) {
+		if (a > 0) {
+			skip_space(p);
+			if (p->s[p->pos] != ',') {
+				parse_error(p, "Expected ',' (%s takes %d arguments)", functions[f].name, functions[f].nargs);
+				return;
+			}
+			p->pos++;
+		}
+		parse_expr(p);
+	}
+	skip_space(p);
+	if (p->s[p->pos] != ')') {
+		parse_error(p, "Expected ')' (%s takes %d arguments)", functions[f].name, functions[f].nargs);
+		return;
+	}
+	p->pos++;
+
+	if (functions[f].nargs == 1) {
+		emit_unary(p, functions[f].op);
+	} else if (functions[f].nargs == 2) {
+		emit_binary(p, functions[f].op);
+	} else if (!p->failed) {
+		telemac_expr_ins_t *c = last_ins(p, 1);
+		telemac_expr_ins_t *b = last_ins(p, 2);
+		telemac_expr_ins_t *a = last_ins(p, 3);
+		if (is_const(a) && is_const(b) && is_const(c)) {
+			a->value = apply_scalar(functions[f].op, a->value, b->value, c->value);
+			p->expr->nins -= 2;
+			p->sp -= 2;
+			return;
+		}
+		telemac_expr_ins_t in = {functions[f].op, false, -1, 0};
+		emit(p, in, -2);
+	}
+}
+
+static void parse_primary(parser_t *p) {
+//! Parse a number, variable, constant, function call or parenthesised expression
+	skip_space(p);
+	const char *s = p->s + p->pos;
+	if (*s == '(') {
+		p->pos++;
+		parse_expr(p);
+		skip_space(p);
+		if (p->s[p->pos] != ')') {
+			parse_error(p, "Expected ')'");
+			return;
+		}
+		p->pos++;
+	} else if (isdigit((unsigned char)*s) || *s == '.') {
+		char *end = NULL;
+		float value = strtof(s, &end);
+		if (end == s) {
+			parse_error(p, "Bad number");
+			return;
+		}
+		p->pos += end - s;
+		emit_const(p, value);
+	} else if (*s == '$') {
+		char *end = NULL;
+		long var = strtol(s + 1, &end, 10);
+		if (end == s + 1 || var < 0 || var >= p->expr->nvar) {
+			parse_error(p, "Bad variable number");
+			return;
+		}
+		p->pos += end - s;
+		emit_variable(p, var);
+	} else if (*s == '[') {
+		const char *close = strchr(s, ']');
+		if (close == NULL) {
+			parse_error(p, "Expected ']'");
+			return;
+		}
+		int var = find_variable(p->results, s + 1, close - s - 1);
+		if (var < 0) {
+			parse_error(p, "Unknown variable '%.*s'", (int)(close - s - 1), s + 1);
+			return;
+		}
+		p->pos += close - s + 1;
+		emit_variable(p, var);
+	} else if (isalpha((unsigned char)*s) || *s == '_') {
+		size_t len = 0;
+		while (isalnum((unsigned char)s[len]) || s[len] == '_') {
+			len++;
+		}
+		p->pos += len;
+		skip_space(p);
+		if (p->s[p->pos] == '(') {
+			parse_call(p, s, len);
+			return;
+		}
+		int var = find_variable(p->results, s, len);
+		if (var >= 0) {
+			emit_variable(p, var);
+		} else if (len == 2 && strncasecmp(s, "pi", 2) == 0) {
+			emit_const(p, M_PI);
+		} else if (len == 1 && (*s == 'g' || *s == 'G')) {
+			emit_const(p, 9.81);
+		} else if (len == 1 && (*s == 'x' || *s == 'X')) {
+			telemac_expr_ins_t in = {EXPR_X, false, -1, 0};
+			emit(p, in, 1);
+		} else if (len == 1 && (*s == 'y' || *s == 'Y')) {
+			telemac_expr_ins_t in = {EXPR_Y, false, -1, 0};
+			emit(p, in, 1);
+		} else {
+			p->pos -= len;
+			parse_error(p, "Unknown variable '%.*s'", (int)len, s);
+		}
+	} else {
+		parse_error(p, (*s ? "Unexpected '%c'" : "Unexpected end of expression"), *s);
+	}
+}
+
+static void parse_unary(parser_t *p);
+
+static void parse_power(parser_t *p) {
+//! Parse a primary expression, optionally raised to a power (right associative)
+	parse_primary(p);
+	skip_space(p);
+	if (!p->failed && p->s[p->pos] == '^') {
+		p->pos++;
+		parse_unary(p);
+		emit_binary(p, EXPR_POW);
+	}
+}
+
+static void parse_unary(parser_t *p) {
+//! Parse an optionally negated power expression
+	skip_space(p);
+	if (p->s[p->pos] == '-') {
+		p->pos++;
+		parse_unary(p);
+		emit_unary(p, EXPR_NEG);
+	} else if (p->s[p->pos] == '+') {
+		p->pos++;
+		parse_unary(p);
+	} else {
+		parse_power(p);
+	}
+}
+
+static void parse_term(parser_t *p) {
+//! Parse products and quotients
+	parse_unary(p);
+	while (!p->failed) {
+		skip_space(p);
+		char c = p->s[p->pos];
+		if (c != '*' && c != '/') {
+			return;
+		}
+		p->pos++;
+		parse_unary(p);
+		emit_binary(p, (c == '*' ? EXPR_MUL : EXPR_DIV));
+	}
+}
+
+static void parse_sum(parser_t *p) {
+//! Parse sums and differences
+	parse_term(p);
+	while (!p->failed) {
+		skip_space(p);
+		char c = p->s[p->pos];
+		if (c != '+' && c != '-') {
+			return;
+		}
+		p->pos++;
+		parse_term(p);
+		emit_binary(p, (c == '+' ? EXPR_ADD : EXPR_SUB));
+	}
+}
+
+static void parse_expr(parser_t *p) {
+//! Parse a full expression, including a comparison
+	parse_sum(p);
+	skip_space(p);
+	const char *s = p->s + p->pos;
+	telemac_expr_op_t op;
+	if (s[0] == '<' && s[1] == '=') {
+		op = EXPR_LE;
+	} else if (s[0] == '>' && s[1] == '=') {
+		op = EXPR_GE;
+	} else if (s[0] == '<') {
+		op = EXPR_LT;
+	} else if (s[0] == '>') {
+		op = EXPR_GT;
+	} else {
+		return;
+	}
+	p->pos += (s[1] == '=' ? 2 : 1);
+	parse_sum(p);
+	emit_binary(p, op);
+}
+
+telemac_expr_t *telemac_expr_compile(const char *definition, const telemac_data_t *results, char *err, size_t errlen) {
+/*!
+ * @brief Compile a derived variable definition
+ *
+ * @param definition	Definition, in the form `NAME=expression`
+ * @param results	Results file data, with variable names loaded
+ * @param err		Buffer for an error message, or NULL
+ * @param errlen	Size of err
+ * @retval telemac_expr_t*	Compiled expression, to be freed with telemac_expr_free()
+ * @retval NULL		Definition not valid (reason given in err)
+ */
+	const char *eq = strchr(definition, '=');
+	if (eq == NULL || eq == definition) {
+		if (err != NULL) {
+			snprintf(err, errlen, "Expected NAME=expression, got '%s'", definition);
+		}
+		return NULL;
+	}
+
+	telemac_expr_t *expr = calloc(sizeof(telemac_expr_t), 1);
+	if (expr == NULL) {
+		perror("telemac_expr_compile");
+		return NULL;
+	}
+	expr->nvar = results->nbv_1 + results->nbv_2;
+	expr->name = strndup(definition, eq - definition);
+	expr->uses = calloc(sizeof(bool), (expr->nvar ? expr->nvar : 1));
+	if (expr->name == NULL || expr->uses == NULL) {
+		perror("telemac_expr_compile");
+		telemac_expr_free(expr);
+		return NULL;
+	}
+
+	parser_t p = {eq + 1, 0, results, expr, 0, 0, err, errlen, false};
+	parse_expr(&p);
+	skip_space(&p);
+	if (!p.failed && p.s[p.pos] != '\0') {
+		parse_error(&p, "Unexpected '%c'", p.s[p.pos]);
+	}
+	if (p.failed) {
+		telemac_expr_free(expr);
+		return NULL;
+	}
+	return expr;
+}
+
+void telemac_expr_uses(const telemac_expr_t *expr, bool *vars) {
+/*!
+ * @brief Mark the stored variables needed to evaluate an expression
+ *
+ * Entries of vars for variables referenced by expr are set to true. Other
+ * entries are left unchanged, so that the requirements of several
+ * expressions may be combined.
+ *
+ * @param expr	Compiled expression
+ * @param vars	Array of (nbv_1 + nbv_2) flags
+ */
+	for (int j = 0; j < expr->nvar; j++) {
+		if (expr->uses[j]) {
+			vars[j] = true;
+		}
+	}
+}
+
+//! Apply f to each of n values, with operands av and bv (a stack entry or the immediate value)
+#define EXPR_LOOP(f) do { \
+		if (in->imm) { \
+			const float bv = in->value; \
+			for (size_t i = 0; i < n; i++) { const float av = a[i]; d[i] = (f); } \
+		} else { \
+			const float *b = ptr[sp - 1]; \
+			for (size_t i = 0; i < n; i++) { const float av = a[i]; const float bv = b[i]; d[i] = (f); } \
+		} \
+	} while (0)
+
+//! Apply f to each of n values, with operand av
+#define EXPR_LOOP1(f) do { \
+		for (size_t i = 0; i < n; i++) { const float av = a[i]; d[i] = (f); } \
+	} while (0)
+
+int telemac_expr_eval(const telemac_expr_t *expr, const telemac_data_t *results, float **data, float *out, size_t start, size_t end) {
+/*!
+ * @brief Evaluate an expression for a range of nodes
+ *
+ * Nodes are processed in blocks of TELEMAC_EXPR_BLOCK. Stored variables and
+ * coordinates are referenced in place, and each operation writes into a
+ * stack of block sized buffers.
+ *
+ * @param expr	Compiled expression
+ * @param results	Results file data (for X and Y)
+ * @param data	Stored variables. Entries for variables used by expr must not be NULL.
+ * @param out	Output array of npoin values
+ * @param start	First node to evaluate
+ * @param end	One past the last node to evaluate
+ * @returns	0 on success, -1 on allocation failure
+ */
+	int depth = (expr->depth > 0 ? expr->depth : 1);
+	float (*rows)[TELEMAC_EXPR_BLOCK] = malloc(sizeof(float) * TELEMAC_EXPR_BLOCK * depth);
+	const float **ptr = malloc(sizeof(float *) * depth);
+	if (rows == NULL || ptr == NULL) {
+		free(rows);
+		free(ptr);
+		return -1;
+	}
+
+	for (size_t base = start; base < end; base += TELEMAC_EXPR_BLOCK) {
+		size_t n = (end - base < TELEMAC_EXPR_BLOCK ? end - base : TELEMAC_EXPR_BLOCK);
+		int sp = 0;
+		for (int k = 0; k < expr->nins; k++) {
+			const telemac_expr_ins_t *in = &expr->ins[k];
+			switch (in->op) {
+				case EXPR_VAR:
+					ptr[sp++] = data[in->var] + base;
+					continue;
+				case EXPR_X:
+					ptr[sp++] = results->X + base;
+					continue;
+				case EXPR_Y:
+					ptr[sp++] = results->Y + base;
+					continue;
+				case EXPR_CONST:
+					for (size_t i = 0; i < n; i++) {
+						rows[sp][i] = in->value;
+					}
+					ptr[sp] = rows[sp];
+					sp++;
+					continue;
+				default:
+					break;
+			}
+
+			if (in->op == EXPR_IF) {
+				const float *c = ptr[sp - 3];
+				const float *a = ptr[sp - 2];
+				const float *b = ptr[sp - 1];
+				float *d = rows[sp - 3];
+				for (size_t i = 0; i < n; i++) {
+					d[i] = (c[i] != 0 ? a[i] : b[i]);
+				}
+				sp -= 2;
+				ptr[sp - 1] = d;
+				continue;
+			}
+
+			// Binary operations take their left operand from the entry below the top
+			bool binary = (in->op < EXPR_NEG && !in->imm);
+			const float *a = ptr[sp - (binary ? 2 : 1)];
+			float *d = rows[sp - (binary ? 2 : 1)];
+			switch (in->op) {
+				case EXPR_ADD: EXPR_LOOP(av + bv); break;
+				case EXPR_SUB: EXPR_LOOP(av - bv); break;
+				case EXPR_MUL: EXPR_LOOP(av * bv); break;
+				case EXPR_DIV: EXPR_LOOP(av / bv); break;
+				case EXPR_POW: EXPR_LOOP(powf(av, bv)); break;
+				case EXPR_LT: EXPR_LOOP(av < bv ? 1.0f : 0.0f); break;
+				case EXPR_GT: EXPR_LOOP(av > bv ? 1.0f : 0.0f); break;
+				case EXPR_LE: EXPR_LOOP(av <= bv ? 1.0f : 0.0f); break;
+				case EXPR_GE: EXPR_LOOP(av >= bv ? 1.0f : 0.0f); break;
+				case EXPR_MIN: EXPR_LOOP(bv < av ? bv : av); break;
+				case EXPR_MAX: EXPR_LOOP(bv > av ? bv : av); break;
+				case EXPR_ATAN2: EXPR_LOOP(atan2f(av, bv)); break;
+				case EXPR_NEG: EXPR_LOOP1(-av); break;
+				case EXPR_SQR: EXPR_LOOP1(av * av); break;
+				case EXPR_SQRT: EXPR_LOOP1(sqrtf(av)); break;
+				case EXPR_ABS: EXPR_LOOP1(fabsf(av)); break;
+				case EXPR_EXP: EXPR_LOOP1(expf(av)); break;
+				case EXPR_LOG: EXPR_LOOP1(logf(av)); break;
+				case EXPR_SIN: EXPR_LOOP1(sinf(av)); break;
+				case EXPR_COS: EXPR_LOOP1(cosf(av)); break;
+				default: break;
+			}
+			if (binary) {
+				sp--;
+			}
+			ptr[sp - 1] = d;
+		}
+		memcpy(out + base, ptr[0], sizeof(float) * n);
+	}
+	free(rows);
+	free(ptr);
+	return 0;
+}
+
+//! Work shared between threads by telemac_expr_eval_all()
+typedef struct {
+	telemac_expr_t **exprs; //!< Expressions
+	int nexpr; //!< Number of expressions
+	const telemac_data_t *results; //!< Results file data
+	float **data; //!< Stored variables
+	float **out; //!< Output arrays, one per expression
+} expr_work_t;
+
+static int expr_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: evaluate all expressions over a range of nodes
+	expr_work_t *w = (expr_work_t *)ctx;
+	for (int e = 0; e < w->nexpr; e++) {
+		if (telemac_expr_eval(w->exprs[e], w->results, w->data, w->out[e], start, end) != 0) {
+			perror("telemac_expr_eval");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int telemac_expr_eval_all(telemac_expr_t **exprs, int nexpr, const telemac_data_t *results, float **data, float **out, int nthreads) {
+/*!
+ * @brief Evaluate several expressions over all nodes
+ *
+ * The nodes are divided between threads. Each thread evaluates every
+ * expression over its share of nodes in turn, while the stored variables
+ * they have in common are still in cache.
+ *
+ * @param exprs	Compiled expressions
+ * @param nexpr	Number of expressions
+ * @param results	Results file data
+ * @param data	Stored variables. Entries for variables used must not be NULL.
+ * @param out	Output arrays, one per expression, each of npoin values
+ * @param nthreads	Number of threads (see telemac_parallel_for())
+ * @returns	0 on success, -1 on failure
+ */
+	if (nexpr == 0) {
+		return 0;
+	}
+	expr_work_t w = {exprs, nexpr, results, data, out};
+	return telemac_parallel_for(nthreads, results->npoin, 16 * TELEMAC_EXPR_BLOCK, expr_task, &w);
+}
+
+void telemac_expr_free(telemac_expr_t *expr) {
+//! Release a compiled expression
+	if (expr == NULL) {
+		return;
+	}
+	free(expr->name);
+	free(expr->ins);
+	free(expr->uses);
+	free(expr);
+}
@@ -0,0 +1,112 @@
+/******************************************************************************
+telemac-expr - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Derived variables calculated from stored results
+ */
+
+#ifndef TELEMAC_EXPR_H
+#define TELEMAC_EXPR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "telemac-loader.h"
+
+/*!
+ * @defgroup expr Derived variables
+ * @brief Expressions evaluated over the stored variables at each timestep
+ *
+ * A derived variable is defined as `NAME=expression`, for example
+ * `SPEED=sqrt(U^2+V^2)`. Expressions are compiled once into a list of
+ * operations, which is then applied to blocks of TELEMAC_EXPR_BLOCK nodes at
+ * a time, so that each operation is a simple loop over arrays.
+ *
+ * Expressions may use:
+ * - Numbers, and the constants `pi` and `g` (9.81)
+ * - Stored variables, by number (`$2`), by name in brackets
+ *   (`[WATER DEPTH]`), by name with spaces replaced by underscores
+ *   (`WATER_DEPTH`), or by the usual TELEMAC letters (`U`, `V`, `W`, `H`,
+ *   `S`, `B`, `Z`, `Q`, `F`, `M`)
+ * - The node coordinates `X` and `Y`, where not the name of a variable
+ * - Operators `+ - * / ^`, comparisons `< > <= >=` (giving 1 or 0) and
+ *   parentheses
+ * - Functions `sqrt`, `abs`, `exp`, `log`, `sin`, `cos`, `min`, `max`,
+ *   `atan2` and `if(condition, a, b)`
+ * @{
+ */
+
+//! Number of nodes processed by each pass over the operation list
+#define TELEMAC_EXPR_BLOCK 512
+
+//! Operation codes
+typedef enum {
+	EXPR_VAR, //!< Push stored variable
+	EXPR_X, //!< Push X coordinates
+	EXPR_Y, //!< Push Y coordinates
+	EXPR_CONST, //!< Push constant
+	EXPR_ADD, //!< Add
+	EXPR_SUB, //!< Subtract
+	EXPR_MUL, //!< Multiply
+	EXPR_DIV, //!< Divide
+	EXPR_POW, //!< Raise to power
+	EXPR_LT, //!< Less than
+	EXPR_GT, //!< Greater than
+	EXPR_LE, //!< Less than or equal
+	EXPR_GE, //!< Greater than or equal
+	EXPR_MIN, //!< Minimum
+	EXPR_MAX, //!< Maximum
+	EXPR_ATAN2, //!< Two argument arctangent
+	EXPR_NEG, //!< Negate
+	EXPR_SQR, //!< Square
+	EXPR_SQRT, //!< Square root
+	EXPR_ABS, //!< Absolute value
+	EXPR_EXP, //!< Exponential
+	EXPR_LOG, //!< Natural logarithm
+	EXPR_SIN, //!< Sine
+	EXPR_COS, //!< Cosine
+	EXPR_IF //!< Select second or third argument by first
+} telemac_expr_op_t;
+
+//! A single operation
+typedef struct {
+	telemac_expr_op_t op; //!< Operation
+	bool imm; //!< For binary operations: right hand operand is value, not taken from stack
+	int var; //!< Variable number for EXPR_VAR
+	float value; //!< Constant for EXPR_CONST, or immediate operand
+} telemac_expr_ins_t;
+
+//! A compiled derived variable
+typedef struct {
+	char *name; //!< Name of derived variable
+	telemac_expr_ins_t *ins; //!< Operations, in reverse Polish order
+	int nins; //!< Number of operations
+	int depth; //!< Largest number of stack entries required
+	int nvar; //!< Number of stored variables in results file
+	bool *uses; //!< Stored variables referenced, indexed by variable number
+} telemac_expr_t;
+
+telemac_expr_t *telemac_expr_compile(const char *definition, const telemac_data_t *results, char *err, size_t errlen);
+void telemac_expr_uses(const telemac_expr_t *expr, bool *vars);
+int telemac_expr_eval(const telemac_expr_t *expr, const telemac_data_t *results, float **data, float *out, size_t start, size_t end);
+int telemac_expr_eval_all(telemac_expr_t **exprs, int nexpr, const telemac_data_t *results, float **data, float **out, int nthreads);
+void telemac_expr_free(telemac_expr_t *expr);
+
+/*! @} */
+#endif // TELEMAC_EXPR_H
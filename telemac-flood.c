@@ -0,0 +1,338 @@
+/******************************************************************************
+telemac-flood - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <math.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-thread.h"
+#include "telemac-stream.h"
+#include "telemac-writer.h"
+
+/*!
+ * @file
+ * @brief Flood arrival time, duration and peak maps
+ *
+ * Makes a single pass over the timesteps, reading only the water depth and
+ * velocity variables, and keeps a running state for each node: the time the
+ * depth first reaches a threshold, the total time at or above it, and the
+ * largest depth, speed and depth * speed with the times they occur. Memory
+ * use depends only on the number of nodes, however many timesteps there are.
+ *
+ * Times at which the depth crosses the threshold are interpolated linearly
+ * between timesteps. Nodes that never reach the threshold have an arrival
+ * time of -1. The results are written as a single timestep of a SELAFIN file
+ * on the same mesh.
+ *
+ * Returns zero on success and EXIT_FAILURE if an error occurs.
+ */
+
+//! Nodes updated by each task
+#define FLOOD_CHUNK 16384
+
+//! Output variables
+enum {
+	OUT_ARRIVAL, //!< Time depth first reaches the threshold
+	OUT_DURATION, //!< Time at or above the threshold
+	OUT_DEPTH, //!< Largest depth
+	OUT_DEPTH_TIME, //!< Time of largest depth
+	OUT_SPEED, //!< Largest speed
+	OUT_SPEED_TIME, //!< Time of largest speed
+	OUT_DV, //!< Largest depth * speed
+	OUT_COUNT //!< Number of output variables
+};
+
+//! Output variable names and units
+static char *out_names[OUT_COUNT] = {
+	"ARRIVAL TIME    S               ",
+	"WET DURATION    S               ",
+	"MAXIMUM DEPTH   M               ",
+	"TIME OF MAX H   S               ",
+	"MAXIMUM SPEED   M/S             ",
+	"TIME OF MAX V   S               ",
+	"MAXIMUM H*V     M2/S            "
+};
+
+//! Running state of every node, and the current timestep
+typedef struct {
+	float *out[OUT_COUNT]; //!< Output fields
+	double *duration; //!< Wet duration, accumulated in double precision
+	float *prev; //!< Depth at the previous timestep
+	const float *depth; //!< Depth at this timestep
+	const float *u; //!< Velocity U at this timestep, or NULL
+	const float *v; //!< Velocity V at this timestep, or NULL
+	float threshold; //!< Depth threshold
+	double time; //!< Time of this timestep
+	double prevtime; //!< Time of the previous timestep
+	bool first; //!< Set for the first timestep
+} flood_t;
+
+static int find_var(const telemac_data_t *results, const char *en, const char *fr) {
+//! Find a variable by its English or French name, returning -1 if not present
+	for (int j = 0; j < (int)results->nbv_1; j++) {
+		if (strncmp(results->var_names[j], en, strlen(en)) == 0 || strncmp(results->var_names[j], fr, strlen(fr)) == 0) {
+			return j;
+		}
+	}
+	return -1;
+}
+
+static int update_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: update the state of a range of nodes
+	flood_t *f = (flood_t *)ctx;
+	const float *restrict depth = f->depth;
+	float *restrict prev = f->prev;
+	float *restrict arrival = f->out[OUT_ARRIVAL];
+	double *restrict duration = f->duration;
+	float *restrict hmax = f->out[OUT_DEPTH];
+	float *restrict htime = f->out[OUT_DEPTH_TIME];
+	const float thr = f->threshold;
+	const double t = f->time;
+	const double tp = f->prevtime;
+
+	for (size_t i = start; i < end; i++) {
+		float d = depth[i];
+		bool wet = (d >= thr);
+		if (f->first) {
+			arrival[i] = (wet ? t : -1);
+			duration[i] = 0;
+			hmax[i] = d;
+			htime[i] = t;
+		} else {
+			float dp = prev[i];
+			bool wetp = (dp >= thr);
+			if (wet && wetp) {
+				duration[i] += t - tp;
+			} else if (wet != wetp) {
+				// Crossing time interpolated between the two timesteps
+				double tc = tp + (t - tp) * ((double)thr - dp) / ((double)d - dp);
+				duration[i] += (wet ? t - tc : tc - tp);
+				if (wet && arrival[i] < 0) {
+					arrival[i] = tc;
+				}
+			}
+			if (d > hmax[i]) {
+				hmax[i] = d;
+				htime[i] = t;
+			}
+		}
+		prev[i] = d;
+	}
+
+	if (f->u != NULL && f->v != NULL) {
+		const float *restrict u = f->u;
+		const float *restrict v = f->v;
+		float *restrict smax = f->out[OUT_SPEED];
+		float *restrict stime = f->out[OUT_SPEED_TIME];
+		float *restrict dv = f->out[OUT_DV];
+		for (size_t i = start; i < end; i++) {
+			float s = sqrtf(u[i] * u[i] + v[i] * v[i]);
+			float h = (depth[i] > 0 ? depth[i] : 0);
+			if (f->first || s > smax[i]) {
+				smax[i] = s;
+				stime[i] = t;
+			}
+			if (f->first || h * s > dv[i]) {
+				dv[i] = h * s;
+			}
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	char *outname = NULL;
+	int dvar = -1;
+	int uvar = -1;
+	int vvar = -1;
+	int nthreads = 0;
+	float threshold = 0.01;
+
+	const char *usage = "Usage: %s [-V n] [-u n] [-v n] [-T threshold] [-j n] [-o output] [--stats[=json]] <filename> [filename...]\n"
+		"\t-V\tWater depth variable (default: WATER DEPTH or HAUTEUR D'EAU)\n"
+		"\t-u\tVelocity U variable (default: VELOCITY U or VITESSE U)\n"
+		"\t-v\tVelocity V variable (default: VELOCITY V or VITESSE V)\n"
+		"\t-T\tDepth threshold for a node to be flooded (default: 0.01)\n"
+		"\t-j\tNumber of threads to use (default: number of CPUs)\n"
+		"\t-o\tOutput file (default: input name with .flood.slf)\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "V:u:v:T:j:o:")) != -1) {
+		switch (go) {
+			case 'V':
+				dvar = atoi(optarg);
+				break;
+			case 'u':
+				uvar = atoi(optarg);
+				break;
+			case 'v':
+				vvar = atoi(optarg);
+				break;
+			case 'T':
+				threshold = strtof(optarg, NULL);
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'o':
+				outname = optarg;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 1) {
+		fprintf(stderr, "Must provide a file (or restart chain of files) to process\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	resfile_t rfs = {NULL, 0, 0, 0};
+	int rval = open_telemac_chain(&rfs, &argv[optind], argc - optind, false);
+	if (rfs.file == NULL || rval < 0) {
+		fprintf(stderr, "Unable to open %s (%d)\n", argv[optind], rval);
+		return EXIT_FAILURE;
+	}
+	telemac_data_t *mesh = &rfs.tmdat;
+	int nvar = mesh->nbv_1 + mesh->nbv_2;
+
+	dvar = (dvar < 0 ? find_var(mesh, "WATER DEPTH", "HAUTEUR D'EAU") : dvar);
+	uvar = (uvar < 0 ? find_var(mesh, "VELOCITY U", "VITESSE U") : uvar);
+	vvar = (vvar < 0 ? find_var(mesh, "VELOCITY V", "VITESSE V") : vvar);
+	if (dvar < 0 || dvar >= nvar || uvar >= nvar || vvar >= nvar) {
+		fprintf(stderr, "Water depth or velocity variable not found or out of range (%d variables)\n", nvar);
+		return EXIT_FAILURE;
+	}
+	if (mesh->nt < 1) {
+		fprintf(stderr, "No timesteps in %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	bool velocity = (uvar >= 0 && vvar >= 0);
+	int nout = (velocity ? OUT_COUNT : OUT_SPEED);
+	if (!velocity) {
+		fprintf(stderr, "Velocity variables not found: writing depth results only\n");
+	}
+
+	flood_t f;
+	memset(&f, 0, sizeof(flood_t));
+	f.threshold = threshold;
+	f.first = true;
+	f.duration = calloc(sizeof(double), mesh->npoin + 1);
+	f.prev = calloc(sizeof(float), mesh->npoin + 1);
+	bool fail = (f.duration == NULL || f.prev == NULL);
+	for (int k = 0; k < nout; k++) {
+		f.out[k] = calloc(sizeof(float), mesh->npoin + 1);
+		fail |= (f.out[k] == NULL);
+	}
+	bool *need = calloc(sizeof(bool), nvar);
+	if (fail || need == NULL) {
+		perror("Allocating node state");
+		return EXIT_FAILURE;
+	}
+	TM_STATS_ALLOC((sizeof(double) + sizeof(float) * (nout + 1)) * (size_t)mesh->npoin);
+
+	need[dvar] = true;
+	if (velocity) {
+		need[uvar] = true;
+		need[vvar] = true;
+	}
+	telemac_stream_t *str = telemac_stream_open(&rfs, NULL, 0, need);
+	if (str == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	uint64_t nwet = 0;
+	for (int k = 0; k < (int)mesh->nt; k++) {
+		float time = 0;
+		float **data = telemac_stream_next(str, NULL, &time);
+		if (data == NULL) {
+			fprintf(stderr, "Unable to read timestep %d\n", k);
+			return EXIT_FAILURE;
+		}
+		f.depth = data[dvar];
+		f.u = (velocity ? data[uvar] : NULL);
+		f.v = (velocity ? data[vvar] : NULL);
+		f.prevtime = f.time;
+		f.time = time;
+		TM_STATS_BEGIN(TM_PHASE_FORMAT);
+		rval = telemac_parallel_for(nthreads, mesh->npoin, FLOOD_CHUNK, update_task, &f);
+		TM_STATS_END(TM_PHASE_FORMAT);
+		if (rval != 0) {
+			return EXIT_FAILURE;
+		}
+		f.first = false;
+	}
+	telemac_stream_close(str);
+
+	for (uint32_t i = 0; i < mesh->npoin; i++) {
+		f.out[OUT_DURATION][i] = f.duration[i];
+		nwet += (f.out[OUT_ARRIVAL][i] >= 0 || f.duration[i] > 0);
+	}
+
+	// Write a single timestep, at the time of the last timestep read
+	if (outname == NULL) {
+		char *base = strdup(argv[optind]);
+		asprintf(&outname, "%s.flood.slf", basename(base));
+		free(base);
+	}
+	telemac_data_t outmesh = *mesh;
+	outmesh.nbv_1 = nout;
+	outmesh.nbv_2 = 0;
+	outmesh.var_names = out_names;
+	FILE *outfile = fopen(outname, "wb");
+	if (outfile == NULL) {
+		perror("Unable to open output file");
+		return EXIT_FAILURE;
+	}
+	TM_STATS_BEGIN(TM_PHASE_WRITE);
+	rval = write_telemac_header(outfile, &outmesh);
+	if (rval == 0) {
+		rval = write_telemac_timestep(outfile, &outmesh, f.time, f.out);
+	}
+	TM_STATS_END(TM_PHASE_WRITE);
+	if (rval != 0 || fclose(outfile) != 0) {
+		perror("Writing output");
+		return EXIT_FAILURE;
+	}
+	telemac_stats_add_file(outname);
+	fprintf(stdout, "%lu of %u nodes reached a depth of %g over %u timesteps. Wrote %s\n",
+			(unsigned long)nwet, mesh->npoin, threshold, mesh->nt, outname);
+
+	for (int k = 0; k < nout; k++) {
+		free(f.out[k]);
+	}
+	free(f.duration);
+	free(f.prev);
+	free(need);
+	close_telemac(&rfs);
+	return EXIT_SUCCESS;
+}
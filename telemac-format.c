@@ -0,0 +1,222 @@
+/******************************************************************************
+telemac-format - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "telemac-format.h"
+
+/*!
+ * @file
+ * @brief Fast number formatting for text exports
+ *
+ * Floats are formatted from their exact binary value using integer
+ * arithmetic, rounding half to even as glibc does, so the output matches
+ * printf() byte for byte. Values too large for 64-bit arithmetic at the
+ * requested precision fall back to snprintf().
+ */
+
+//! Powers of ten up to the largest precision handled without snprintf()
+static const uint64_t powers[] = {1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+	10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL};
+
+size_t telemac_format_uint(char *buf, uint64_t value) {
+/*!
+ * @brief Format an unsigned integer, as printf("%llu")
+ * @param buf	Output buffer of at least 21 bytes. The result is NUL terminated.
+ * @param value	Value to format
+ * @returns	Number of characters written, excluding the terminating NUL
+ */
+	char tmp[20];
+	size_t n = 0;
+	do {
+		tmp[n++] = '0' + (value % 10);
+		value /= 10;
+	} while (value != 0);
+	for (size_t i = 0; i < n; i++) {
+		buf[i] = tmp[n - 1 - i];
+	}
+	buf[n] = '\0';
+	return n;
+}
+
+size_t telemac_format_fixed(char *buf, float value, int prec, bool plus) {
+/*!
+ * @brief Format a float in fixed point notation, as printf("%.*f") or printf("%+.*f")
+ *
+ * The value is promoted to double, as it would be when passed to printf().
+ *
+ * @param buf	Output buffer of at least TELEMAC_FORMAT_MAX bytes (for prec up to 16). The result is NUL terminated.
+ * @param value	Value to format
+ * @param prec	Number of digits after the decimal point
+ * @param plus	Include a '+' sign for positive values
+ * @returns	Number of characters written, excluding the terminating NUL
+ */
+	uint32_t bits = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t biased = (bits >> 23) & 0xff;
+	if (biased == 0xff || prec < 0 || prec > 16) {
+		return snprintf(buf, TELEMAC_FORMAT_MAX, (plus ? "%+.*f" : "%.*f"), prec, value);
+	}
+
+	// value = m * 2^e exactly
+	uint64_t m = (biased == 0 ? (bits & 0x7fffff) : ((bits & 0x7fffff) | 0x800000));
+	int e = (biased == 0 ? -149 : (int)biased - 150);
+
+	// Scaled value, m * 10^prec * 2^e, rounded half to even
+	uint64_t p10 = powers[prec];
+	if (m > UINT64_MAX / p10) {
+		return snprintf(buf, TELEMAC_FORMAT_MAX, (plus ? "%+.*f" : "%.*f"), prec, value);
+	}
+	uint64_t n = m * p10;
+	if (e >= 0) {
+		if (e >= 64 || n > (UINT64_MAX >> e)) {
+			return snprintf(buf, TELEMAC_FORMAT_MAX, (plus ? "%+.*f" : "%.*f"), prec, value);
+		}
+		n <<= e;
+	} else if (-e >= 64) {
+		n = (-e == 64 && n > (1ULL << 63) ? 1 : 0);
+	} else {
+		int s = -e;
+		uint64_t q = n >> s;
+		uint64_t r = n & ((1ULL << s) - 1);
+		uint64_t half = 1ULL << (s - 1);
+		if (r > half || (r == half && (q & 1))) {
+			q++;
+		}
+		n = q;
+	}
+
+	size_t len = 0;
+	if (bits >> 31) {
+		buf[len++] = '-';
+	} else if (plus) {
+		buf[len++] = '+';
+	}
+	len += telemac_format_uint(&buf[len], n / p10);
+	if (prec > 0) {
+		uint64_t f = n % p10;
+		buf[len++] = '.';
+		for (int i = prec - 1; i >= 0; i--) {
+			buf[len + i] = '0' + (f % 10);
+			f /= 10;
+		}
+		len += prec;
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+size_t telemac_format_general(char *buf, float value, int prec) {
+/*!
+ * @brief Format a float with a number of significant digits, as printf("%.*g")
+ *
+ * Values written in fixed point are formatted with telemac_format_fixed() at
+ * the precision giving @p prec significant digits, and trailing zeros are
+ * removed. Values needing an exponent fall back to snprintf().
+ *
+ * @param buf	Output buffer of at least TELEMAC_FORMAT_MAX bytes (for prec up to 13). The result is NUL terminated.
+ * @param value	Value to format
+ * @param prec	Number of significant digits (0 is taken as 1)
+ * @returns	Number of characters written, excluding the terminating NUL
+ */
+	prec = (prec == 0 ? 1 : prec);
+	if (!isfinite(value) || prec < 0 || prec > 13) {
+		return snprintf(buf, TELEMAC_FORMAT_MAX, "%.*g", prec, value);
+	}
+
+	// Decimal exponent, estimated then corrected from the digits written
+	int x = (value == 0 ? 0 : (int)floor(log10(fabs((double)value))));
+	size_t len = 0;
+	for (int tries = 0; tries < 3; tries++) {
+		if (x < -4 || x >= prec) {
+			return snprintf(buf, TELEMAC_FORMAT_MAX, "%.*g", prec, value);
+		}
+		len = telemac_format_fixed(buf, value, prec - 1 - x, false);
+		const char *d = (buf[0] == '-' ? &buf[1] : buf);
+		int actual = 0;
+		if (d[0] != '0') {
+			actual = (int)strcspn(d, ".") - 1;
+		} else if (value != 0) {
+			actual = -1 - (int)strspn(&d[2], "0");
+		}
+		if (actual == x) {
+			break;
+		}
+		x = actual;
+		len = 0;
+	}
+	if (len == 0) {
+		return snprintf(buf, TELEMAC_FORMAT_MAX, "%.*g", prec, value);
+	}
+
+	// Remove trailing zeros, and the decimal point if nothing follows it
+	if (memchr(buf, '.', len) != NULL) {
+		while (buf[len - 1] == '0') {
+			len--;
+		}
+		if (buf[len - 1] == '.') {
+			len--;
+		}
+		buf[len] = '\0';
+	}
+	return len;
+}
+
+void telemac_format_json_string(FILE *file, const char *str) {
+/*!
+ * @brief Write a string as a quoted JSON string
+ *
+ * Quotes, backslashes and control characters are escaped. Bytes outside
+ * ASCII are taken as ISO 8859-1 (as in many SELAFIN variable names) and
+ * written as \\u escapes, so the output is valid whatever the input encoding.
+ *
+ * @param file	Output file
+ * @param str	NUL terminated string
+ */
+	fputc('"', file);
+	for (const unsigned char *c = (const unsigned char *)str; *c != '\0'; c++) {
+		switch (*c) {
+			case '"':
+				fputs("\\\"", file);
+				break;
+			case '\\':
+				fputs("\\\\", file);
+				break;
+			case '\n':
+				fputs("\\n", file);
+				break;
+			case '\r':
+				fputs("\\r", file);
+				break;
+			case '\t':
+				fputs("\\t", file);
+				break;
+			default:
+				if (*c < 0x20 || *c >= 0x7f) {
+					fprintf(file, "\\u%04x", *c);
+				} else {
+					fputc(*c, file);
+				}
+		}
+	}
+	fputc('"', file);
+}
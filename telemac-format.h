@@ -0,0 +1,44 @@
+/******************************************************************************
+telemac-format - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Fast number formatting for text exports
+ *
+ * Produces exactly the same text as the equivalent printf() conversions, but
+ * without parsing a format string or going through stdio for each value.
+ */
+
+#ifndef TELEMAC_FORMAT_H
+#define TELEMAC_FORMAT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//! Size of buffer needed by telemac_format_fixed() for any float value
+#define TELEMAC_FORMAT_MAX 64
+
+size_t telemac_format_fixed(char *buf, float value, int prec, bool plus);
+size_t telemac_format_general(char *buf, float value, int prec);
+size_t telemac_format_uint(char *buf, uint64_t value);
+void telemac_format_json_string(FILE *file, const char *str);
+
+#endif // TELEMAC_FORMAT_H
@@ -0,0 +1,283 @@
+/******************************************************************************
+telemac-frames - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "telemac-frames.h"
+#include "telemac-thread.h"
+#include "telemac-stats.h"
+
+//! Nodes interpolated by each task
+#define FRAMES_CHUNK 16384
+
+//! Arguments for interpolating one time
+typedef struct {
+	const telemac_frames_t *fr; //!< Frames
+	float **a; //!< Values at the earlier timestep
+	float **b; //!< Values at the later timestep, or NULL to copy a
+	float w; //!< Weight of the later timestep
+	float **out; //!< Interpolated values
+} frames_task_t;
+
+static int frames_task(void *ctx, size_t start, size_t end, int thread) {
+//! Interpolate nodes start to end - 1 of each variable (see telemac_parallel_for())
+	(void)thread;
+	const frames_task_t *ft = ctx;
+	for (int v = 0; v < ft->fr->nvars; v++) {
+		const float *a = ft->a[v];
+		float *out = ft->out[v];
+		if (ft->b == NULL) {
+			memcpy(&out[start], &a[start], sizeof(float) * (end - start));
+			continue;
+		}
+		const float *b = ft->b[v];
+		const float w1 = ft->w;
+		const float w0 = 1 - ft->w;
+		for (size_t k = start; k < end; k++) {
+			out[k] = w0 * a[k] + w1 * b[k];
+		}
+	}
+	return 0;
+}
+
+static int frames_load(telemac_frames_t *fr, int step, int keep) {
+/*!
+ * @brief Make sure timestep @p step is held, without replacing timestep @p keep
+ * @returns Frame holding the timestep, or a negative value if it could not be read
+ */
+	for (int s = 0; s < 2; s++) {
+		if (fr->step[s] == step) {
+			return s;
+		}
+	}
+	int s = (fr->step[0] == keep ? 1 : 0);
+	for (int v = 0; v < fr->nvars; v++) {
+		fr->read[fr->vars[v]] = fr->frame[s][v];
+	}
+	int rv = read_telemac_data(fr->rfile, step, fr->read, NULL);
+	for (int v = 0; v < fr->nvars; v++) {
+		fr->read[fr->vars[v]] = NULL;
+	}
+	if (rv != 0) {
+		fr->step[s] = -1;
+		return (rv < 0 ? rv : -2);
+	}
+	fr->step[s] = step;
+	fr->nread++;
+	return s;
+}
+
+int telemac_frames_open(telemac_frames_t *fr, const resfile_t *rfile, const int *vars, int nvars) {
+/*!
+ * @brief Prepare to interpolate variables of a results file in time
+ *
+ * The time of every timestep is read, but no values are read until needed.
+ *
+ * @param fr	Frames to set up. Free with telemac_frames_close().
+ * @param rfile	Opened results file or restart chain
+ * @param vars	Variable numbers to interpolate
+ * @param nvars	Number of variables
+ * @retval 0	Success
+ * @retval -1	Bad or repeated variable number, or no timesteps
+ * @retval -2	Memory could not be allocated or timestamps could not be read
+ */
+	const telemac_data_t *results = &rfile->tmdat;
+	int nvar = results->nbv_1 + results->nbv_2;
+	memset(fr, 0, sizeof(*fr));
+	fr->rfile = rfile;
+	fr->step[0] = fr->step[1] = -1;
+	if (results->nt == 0 || nvars < 1) {
+		return -1;
+	}
+	for (int v = 0; v < nvars; v++) {
+		if (vars[v] < 0 || vars[v] >= nvar) {
+			fprintf(stderr, "telemac_frames_open: variable %d out of range (%d variables)\n", vars[v], nvar);
+			return -1;
+		}
+		// Each variable has one read slot, so a repeated variable would leave a copy unfilled
+		for (int u = 0; u < v; u++) {
+			if (vars[u] == vars[v]) {
+				fprintf(stderr, "telemac_frames_open: variable %d given more than once\n", vars[v]);
+				return -1;
+			}
+		}
+	}
+
+	fr->nvars = nvars;
+	fr->vars = calloc(sizeof(int), nvars);
+	fr->times = calloc(sizeof(float), results->nt);
+	fr->read = calloc(sizeof(float *), nvar);
+	fr->frame[0] = calloc(sizeof(float *), nvars);
+	fr->frame[1] = calloc(sizeof(float *), nvars);
+	if (fr->vars == NULL || fr->times == NULL || fr->read == NULL || fr->frame[0] == NULL || fr->frame[1] == NULL) {
+		perror("telemac_frames_open");
+		telemac_frames_close(fr);
+		return -2;
+	}
+	memcpy(fr->vars, vars, sizeof(int) * nvars);
+	for (int s = 0; s < 2; s++) {
+		for (int v = 0; v < nvars; v++) {
+			fr->frame[s][v] = calloc(sizeof(float), results->npoin);
+			if (fr->frame[s][v] == NULL) {
+				perror("telemac_frames_open");
+				telemac_frames_close(fr);
+				return -2;
+			}
+		}
+	}
+	TM_STATS_ALLOC(2 * sizeof(float) * nvars * (size_t)results->npoin);
+
+	// With every entry of read NULL, only the timestamp is read
+	for (uint32_t t = 0; t < results->nt; t++) {
+		if (read_telemac_data(rfile, t, fr->read, &fr->times[t]) != 0) {
+			fprintf(stderr, "telemac_frames_open: unable to read time of timestep %u\n", t);
+			telemac_frames_close(fr);
+			return -2;
+		}
+	}
+	return 0;
+}
+
+static float frames_find(const telemac_frames_t *fr, double time, int *lo) {
+/*!
+ * @brief Find the last timestep at or before a time
+ * @returns Weight of the timestep after it, or 0 if the time is outside the file
+ */
+	int nt = fr->rfile->tmdat.nt;
+	*lo = 0;
+	if (time >= fr->times[nt - 1]) {
+		*lo = nt - 1;
+		return 0;
+	}
+	if (time <= fr->times[0]) {
+		return 0;
+	}
+	int hi = nt - 1;
+	while (hi - *lo > 1) {
+		int mid = *lo + (hi - *lo) / 2;
+		if (fr->times[mid] <= time) {
+			*lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return (time - fr->times[*lo]) / ((double)fr->times[*lo + 1] - fr->times[*lo]);
+}
+
+int telemac_frames_at(telemac_frames_t *fr, double time, float **out, int nthreads) {
+/*!
+ * @brief Interpolate the variables to a given time
+ *
+ * @param fr	Frames from telemac_frames_open()
+ * @param time	Time to interpolate to
+ * @param out	One array of npoin values for each variable, in the order given to telemac_frames_open()
+ * @param nthreads	Number of threads (values below 1 use all CPUs)
+ * @retval 0	Success
+ * @retval -1	Bad state
+ * @retval -2	Timestep could not be read
+ */
+	const telemac_data_t *results = &fr->rfile->tmdat;
+	if (fr->times == NULL) {
+		return -1;
+	}
+
+	// Last timestep at or before the time, and the weight of the one after
+	int lo = 0;
+	float w = frames_find(fr, time, &lo);
+
+	int sa = frames_load(fr, lo, (w > 0 ? lo + 1 : -1));
+	if (sa < 0) {
+		return -2;
+	}
+	int sb = -1;
+	if (w > 0) {
+		sb = frames_load(fr, lo + 1, lo);
+		if (sb < 0) {
+			return -2;
+		}
+	}
+
+	frames_task_t ft = {fr, fr->frame[sa], (sb >= 0 ? fr->frame[sb] : NULL), w, out};
+	TM_STATS_BEGIN(TM_PHASE_FORMAT);
+	int rv = telemac_parallel_for(nthreads, results->npoin, FRAMES_CHUNK, frames_task, &ft);
+	TM_STATS_END(TM_PHASE_FORMAT);
+	return (rv == 0 ? 0 : -1);
+}
+
+int telemac_frames_bracket(telemac_frames_t *fr, double time, float ***before, float ***after, double *t0, double *t1) {
+/*!
+ * @brief Hold the two timesteps either side of a time, without interpolating
+ *
+ * For callers that interpolate in time themselves, such as particle
+ * tracking, which needs values at several times between the same pair of
+ * timesteps. The pair is the last timestep at or before the time and the
+ * one after it, so a time equal to a timestep gives the interval that
+ * starts there. At or after the last timestep (or before the first), both
+ * are the same timestep and @p t0 equals @p t1.
+ *
+ * The arrays returned remain valid until the next call for these frames.
+ *
+ * @param fr	Frames from telemac_frames_open()
+ * @param time	Time to bracket
+ * @param[out] before	Values of each variable at the earlier timestep
+ * @param[out] after	Values of each variable at the later timestep
+ * @param[out] t0	Time of the earlier timestep
+ * @param[out] t1	Time of the later timestep
+ * @retval 0	Success
+ * @retval -1	Bad state
+ * @retval -2	Timestep could not be read
+ */
+	const telemac_data_t *results = &fr->rfile->tmdat;
+	if (fr->times == NULL) {
+		return -1;
+	}
+	int lo = 0;
+	frames_find(fr, time, &lo);
+	int hi = (lo + 1 < (int)results->nt && time >= fr->times[0] ? lo + 1 : lo);
+	int sa = frames_load(fr, lo, hi);
+	int sb = (sa < 0 ? sa : frames_load(fr, hi, lo));
+	if (sa < 0 || sb < 0) {
+		return -2;
+	}
+	*before = fr->frame[sa];
+	*after = fr->frame[sb];
+	*t0 = fr->times[lo];
+	*t1 = fr->times[hi];
+	return 0;
+}
+
+void telemac_frames_close(telemac_frames_t *fr) {
+/*!
+ * @brief Free the frames and timestamps
+ * @param fr	Frames from telemac_frames_open()
+ */
+	for (int s = 0; s < 2; s++) {
+		for (int v = 0; v < fr->nvars && fr->frame[s] != NULL; v++) {
+			free(fr->frame[s][v]);
+		}
+		free(fr->frame[s]);
+	}
+	free(fr->vars);
+	free(fr->times);
+	free(fr->read);
+	memset(fr, 0, sizeof(*fr));
+	fr->step[0] = fr->step[1] = -1;
+}
@@ -0,0 +1,64 @@
+/******************************************************************************
+telemac-frames - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Values interpolated in time between timesteps
+ */
+
+#ifndef TELEMAC_FRAMES_H
+#define TELEMAC_FRAMES_H
+
+#include <stdint.h>
+#include "telemac-loader.h"
+
+/*!
+ * @defgroup frames Interpolation in time
+ * @brief Values of selected variables at any time, from a sliding window of two timesteps
+ *
+ * Values at a given time are interpolated linearly between the two timesteps
+ * either side of it. The two timesteps are held in memory, so when times are
+ * requested in increasing order each timestep of the file is read at most
+ * once, however many times fall between a pair of timesteps. Timesteps may be
+ * irregularly spaced. Times before the first or after the last timestep take
+ * the values of that timestep.
+ *
+ * Only the selected variables are read, using the reentrant loader functions.
+ * @{
+ */
+
+//! Sliding window of two timesteps
+typedef struct {
+	const resfile_t *rfile; //!< Results file
+	int nvars; //!< Number of variables held
+	int *vars; //!< Variable numbers held
+	float *times; //!< Time of each timestep
+	int step[2]; //!< Timestep held in each frame, or -1 if empty
+	float **frame[2]; //!< Values of each variable (nvars arrays of npoin) in each frame
+	float **read; //!< Pointers for read_telemac_data(), NULL for variables not held
+	uint32_t nread; //!< Number of timesteps read
+} telemac_frames_t;
+
+int telemac_frames_open(telemac_frames_t *fr, const resfile_t *rfile, const int *vars, int nvars);
+int telemac_frames_at(telemac_frames_t *fr, double time, float **out, int nthreads);
+int telemac_frames_bracket(telemac_frames_t *fr, double time, float ***before, float ***after, double *t0, double *t1);
+void telemac_frames_close(telemac_frames_t *fr);
+
+/*! @} */
+#endif // TELEMAC_FRAMES_H
@@ -0,0 +1,352 @@
+/******************************************************************************
+telemac-geom - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "telemac-geom.h"
+#include "telemac-thread.h"
+#include "telemac-stats.h"
+
+/*!
+ * @file
+ * @brief Element geometry and spatial derivatives
+ *
+ * For a linear triangle with nodes (x0, y0), (x1, y1), (x2, y2) and area A,
+ * the shape function derivatives are dN0/dx = (y1 - y2) / 2A and
+ * dN0/dy = (x2 - x1) / 2A (and similarly for the other nodes, in cyclic
+ * order). The gradient of a field on the triangle is the sum of the nodal
+ * values multiplied by these derivatives.
+ */
+
+//! Number of triangles handled by each call to a kernel task
+#define GEOM_CHUNK 16384
+
+static telemac_geom_t *geom_build(const telemac_data_t *results) {
+//! Calculate triangle geometry from the mesh in results
+	uint32_t per = (results->ndp == 3 ? 1 : 2);
+	if (results->ndp != 3 && results->ndp != 4 && results->ndp != 6) {
+		fprintf(stderr, "Element geometry: unsupported element type (%d nodes)\n", results->ndp);
+		return NULL;
+	}
+
+	telemac_geom_t *geom = calloc(sizeof(telemac_geom_t), 1);
+	if (geom == NULL) {
+		perror("Allocating element geometry");
+		return NULL;
+	}
+	geom->ntri = results->nelem * per;
+	geom->npoin = results->npoin;
+	geom->per_elem = per;
+
+	size_t n = (geom->ntri ? geom->ntri : 1);
+	bool failed = false;
+	for (int k = 0; k < 3; k++) {
+		geom->node[k] = calloc(sizeof(uint32_t), n);
+		geom->dndx[k] = calloc(sizeof(float), n);
+		geom->dndy[k] = calloc(sizeof(float), n);
+		failed |= (geom->node[k] == NULL || geom->dndx[k] == NULL || geom->dndy[k] == NULL);
+	}
+	geom->area = calloc(sizeof(float), n);
+	geom->nodearea = calloc(sizeof(float), (geom->npoin ? geom->npoin : 1));
+	if (failed || geom->area == NULL || geom->nodearea == NULL) {
+		perror("Allocating element geometry");
+		telemac_geom_free(geom);
+		return NULL;
+	}
+	TM_STATS_ALLOC(n * (3 * sizeof(uint32_t) + 7 * sizeof(float)) + geom->npoin * sizeof(float));
+
+	// Local node numbers of each triangle within an element
+	static const int split[3][2][3] = {
+		{{0, 1, 2}, {0, 1, 2}}, // Triangle
+		{{0, 1, 2}, {0, 2, 3}}, // Quadrilateral
+		{{0, 1, 2}, {3, 4, 5}}, // Prism: bottom and top faces
+	};
+	int type = (results->ndp == 3 ? 0 : (results->ndp == 4 ? 1 : 2));
+
+	for (uint32_t e = 0; e < results->nelem; e++) {
+		const uint32_t *ik = &results->ikle[e * results->ndp];
+		for (uint32_t s = 0; s < per; s++) {
+			uint32_t t = e * per + s;
+			uint32_t nd[3];
+			for (int k = 0; k < 3; k++) {
+				nd[k] = ik[split[type][s][k]] - 1;
+				if (nd[k] >= results->npoin) {
+					fprintf(stderr, "Element geometry: element %d refers to node %d (of %d)\n", e, nd[k] + 1, results->npoin);
+					telemac_geom_free(geom);
+					return NULL;
+				}
+				geom->node[k][t] = nd[k];
+			}
+			double x0 = results->X[nd[0]], y0 = results->Y[nd[0]];
+			double x1 = results->X[nd[1]], y1 = results->Y[nd[1]];
+			double x2 = results->X[nd[2]], y2 = results->Y[nd[2]];
+			double twice = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+			if (twice == 0) {
+				continue; // Degenerate: no contribution
+			}
+			geom->area[t] = 0.5 * (twice > 0 ? twice : -twice);
+			geom->dndx[0][t] = (y1 - y2) / twice;
+			geom->dndx[1][t] = (y2 - y0) / twice;
+			geom->dndx[2][t] = (y0 - y1) / twice;
+			geom->dndy[0][t] = (x2 - x1) / twice;
+			geom->dndy[1][t] = (x0 - x2) / twice;
+			geom->dndy[2][t] = (x1 - x0) / twice;
+			for (int k = 0; k < 3; k++) {
+				geom->nodearea[nd[k]] += geom->area[t];
+			}
+		}
+	}
+	return geom;
+}
+
+const telemac_geom_t *telemac_get_geom(resfile_t *rfile) {
+/*!
+ * @brief Return the element geometry for an opened results file
+ *
+ * The geometry is calculated on the first call after the mesh has been
+ * loaded and kept until close_telemac() is called.
+ *
+ * @param rfile	Results file with mesh loaded
+ * @retval telemac_geom_t*	Element geometry
+ * @retval NULL	Mesh not loaded, unsupported elements or allocation failure
+ */
+	if (rfile->geom != NULL) {
+		return rfile->geom;
+	}
+	if (rfile->tmdat.state != 2) {
+		fprintf(stderr, "telemac_get_geom: mesh not loaded\n");
+		return NULL;
+	}
+	TM_STATS_BEGIN(TM_PHASE_MESH);
+	rfile->geom = geom_build(&rfile->tmdat);
+	TM_STATS_END(TM_PHASE_MESH);
+	return rfile->geom;
+}
+
+void telemac_geom_free(telemac_geom_t *geom) {
+//! Release element geometry
+	if (geom == NULL) {
+		return;
+	}
+	for (int k = 0; k < 3; k++) {
+		free(geom->node[k]);
+		free(geom->dndx[k]);
+		free(geom->dndy[k]);
+	}
+	free(geom->area);
+	free(geom->nodearea);
+	free(geom);
+}
+
+//! Arguments for the per-triangle kernels
+typedef struct {
+	const telemac_geom_t *geom; //!< Element geometry
+	const float *a; //!< First input field (nodal)
+	const float *b; //!< Second input field (nodal), if used
+	float *out1; //!< First output (per triangle), or NULL
+	float *out2; //!< Second output (per triangle), or NULL
+} geom_work_t;
+
+static int gradient_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: gradient over a range of triangles
+	geom_work_t *w = (geom_work_t *)ctx;
+	const telemac_geom_t *g = w->geom;
+	const uint32_t *restrict n0 = g->node[0], *restrict n1 = g->node[1], *restrict n2 = g->node[2];
+	const float *restrict dx0 = g->dndx[0], *restrict dx1 = g->dndx[1], *restrict dx2 = g->dndx[2];
+	const float *restrict dy0 = g->dndy[0], *restrict dy1 = g->dndy[1], *restrict dy2 = g->dndy[2];
+	const float *restrict f = w->a;
+	float *restrict gx = w->out1;
+	float *restrict gy = w->out2;
+	for (size_t t = start; t < end; t++) {
+		float f0 = f[n0[t]], f1 = f[n1[t]], f2 = f[n2[t]];
+		gx[t] = f0 * dx0[t] + f1 * dx1[t] + f2 * dx2[t];
+		gy[t] = f0 * dy0[t] + f1 * dy1[t] + f2 * dy2[t];
+	}
+	return 0;
+}
+
+int telemac_geom_gradient(const telemac_geom_t *geom, const float *f, float *gx, float *gy, int nthreads) {
+/*!
+ * @brief Gradient of a nodal field on each triangle
+ *
+ * @param geom	Element geometry
+ * @param f	Nodal values
+ * @param gx	Output: X component for each triangle
+ * @param gy	Output: Y component for each triangle
+ * @param nthreads	Number of threads (see telemac_parallel_for())
+ * @returns	0 on success, -1 on failure
+ */
+	geom_work_t w = {geom, f, NULL, gx, gy};
+	return telemac_parallel_for(nthreads, geom->ntri, GEOM_CHUNK, gradient_task, &w);
+}
+
+static int vorticity_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: vorticity and divergence over a range of triangles
+	geom_work_t *w = (geom_work_t *)ctx;
+	const telemac_geom_t *g = w->geom;
+	const uint32_t *restrict n0 = g->node[0], *restrict n1 = g->node[1], *restrict n2 = g->node[2];
+	const float *restrict dx0 = g->dndx[0], *restrict dx1 = g->dndx[1], *restrict dx2 = g->dndx[2];
+	const float *restrict dy0 = g->dndy[0], *restrict dy1 = g->dndy[1], *restrict dy2 = g->dndy[2];
+	const float *restrict u = w->a;
+	const float *restrict v = w->b;
+	float *restrict vort = w->out1;
+	float *restrict div = w->out2;
+	for (size_t t = start; t < end; t++) {
+		float u0 = u[n0[t]], u1 = u[n1[t]], u2 = u[n2[t]];
+		float v0 = v[n0[t]], v1 = v[n1[t]], v2 = v[n2[t]];
+		float dudx = u0 * dx0[t] + u1 * dx1[t] + u2 * dx2[t];
+		float dudy = u0 * dy0[t] + u1 * dy1[t] + u2 * dy2[t];
+		float dvdx = v0 * dx0[t] + v1 * dx1[t] + v2 * dx2[t];
+		float dvdy = v0 * dy0[t] + v1 * dy1[t] + v2 * dy2[t];
+		if (vort != NULL) {
+			vort[t] = dvdx - dudy;
+		}
+		if (div != NULL) {
+			div[t] = dudx + dvdy;
+		}
+	}
+	return 0;
+}
+
+int telemac_geom_vorticity(const telemac_geom_t *geom, const float *u, const float *v, float *vort, float *div, int nthreads) {
+/*!
+ * @brief Vorticity and divergence of a nodal vector field on each triangle
+ *
+ * @param geom	Element geometry
+ * @param u	X component at each node
+ * @param v	Y component at each node
+ * @param vort	Output: vorticity (dv/dx - du/dy) for each triangle, or NULL
+ * @param div	Output: divergence (du/dx + dv/dy) for each triangle, or NULL
+ * @param nthreads	Number of threads (see telemac_parallel_for())
+ * @returns	0 on success, -1 on failure
+ */
+	geom_work_t w = {geom, u, v, vort, div};
+	return telemac_parallel_for(nthreads, geom->ntri, GEOM_CHUNK, vorticity_task, &w);
+}
+
+//! Arguments for telemac_geom_to_nodes() tasks
+typedef struct {
+	const telemac_geom_t *geom; //!< Element geometry
+	const float *tri; //!< Values for each triangle
+	float *node; //!< Output values for each node
+	float **acc; //!< Per-thread accumulators, npoin values each
+	int nacc; //!< Number of accumulators
+} nodal_work_t;
+
+static int scatter_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: add area weighted triangle values to the thread's accumulator
+	nodal_work_t *w = (nodal_work_t *)ctx;
+	const telemac_geom_t *g = w->geom;
+	float *restrict acc = w->acc[thread];
+	for (size_t t = start; t < end; t++) {
+		float val = g->area[t] * w->tri[t];
+		acc[g->node[0][t]] += val;
+		acc[g->node[1][t]] += val;
+		acc[g->node[2][t]] += val;
+	}
+	return 0;
+}
+
+static int reduce_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: combine accumulators for a range of nodes
+	nodal_work_t *w = (nodal_work_t *)ctx;
+	const float *restrict area = w->geom->nodearea;
+	float *restrict node = w->node;
+	for (size_t n = start; n < end; n++) {
+		node[n] = 0;
+	}
+	for (int a = 0; a < w->nacc; a++) {
+		const float *restrict acc = w->acc[a];
+		for (size_t n = start; n < end; n++) {
+			node[n] += acc[n];
+		}
+	}
+	for (size_t n = start; n < end; n++) {
+		node[n] = (area[n] > 0 ? node[n] / area[n] : 0);
+	}
+	return 0;
+}
+
+int telemac_geom_to_nodes(const telemac_geom_t *geom, const float *tri, float *node, int nthreads) {
+/*!
+ * @brief Area weighted average of triangle values at each node
+ *
+ * Each thread accumulates its share of triangles into a private array, and
+ * the arrays are then summed in parallel over nodes, so no locking is needed.
+ *
+ * @param geom	Element geometry
+ * @param tri	Values for each triangle
+ * @param node	Output: value at each node
+ * @param nthreads	Number of threads (see telemac_parallel_for())
+ * @returns	0 on success, -1 on failure
+ */
+	if (nthreads < 1) {
+		nthreads = telemac_default_threads();
+	}
+	nodal_work_t w = {geom, tri, node, calloc(sizeof(float *), nthreads), nthreads};
+	int rv = (w.acc == NULL ? -1 : 0);
+	for (int a = 0; rv == 0 && a < nthreads; a++) {
+		w.acc[a] = calloc(sizeof(float), (geom->npoin ? geom->npoin : 1));
+		if (w.acc[a] == NULL) {
+			rv = -1;
+		}
+	}
+	if (rv == 0) {
+		// Each accumulator is private to one worker, so no locking is needed
+		rv = telemac_parallel_for(nthreads, geom->ntri, 0, scatter_task, &w);
+	}
+	if (rv == 0) {
+		rv = telemac_parallel_for(nthreads, geom->npoin, GEOM_CHUNK, reduce_task, &w);
+	}
+	if (rv != 0) {
+		perror("telemac_geom_to_nodes");
+	}
+	for (int a = 0; w.acc != NULL && a < nthreads; a++) {
+		free(w.acc[a]);
+	}
+	free(w.acc);
+	return rv;
+}
+
+void telemac_geom_elements(const telemac_geom_t *geom, const float *tri, float *elem) {
+/*!
+ * @brief Combine triangle values into values for each mesh element
+ *
+ * For triangular meshes the values are copied. Otherwise the values of the
+ * triangles making up each element are averaged, weighted by area.
+ *
+ * @param geom	Element geometry
+ * @param tri	Values for each triangle
+ * @param elem	Output: value for each mesh element
+ */
+	uint32_t nelem = geom->ntri / geom->per_elem;
+	if (geom->per_elem == 1) {
+		memcpy(elem, tri, sizeof(float) * nelem);
+		return;
+	}
+	for (uint32_t e = 0; e < nelem; e++) {
+		float a0 = geom->area[2 * e];
+		float a1 = geom->area[2 * e + 1];
+		float a = a0 + a1;
+		elem[e] = (a > 0 ? (a0 * tri[2 * e] + a1 * tri[2 * e + 1]) / a : 0);
+	}
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+telemac-geom - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Element geometry and spatial derivatives
+ */
+
+#ifndef TELEMAC_GEOM_H
+#define TELEMAC_GEOM_H
+
+#include <stdint.h>
+#include "telemac-loader.h"
+
+/*!
+ * @defgroup geom Element geometry
+ * @brief Precomputed element geometry for horizontal gradients
+ *
+ * Derivatives are calculated on linear triangles. Triangular meshes are used
+ * as they are, quadrilaterals are split into two triangles, and each 3D prism
+ * contributes its bottom and top faces, so that gradients are horizontal and
+ * are found on every plane.
+ *
+ * Geometry is stored as separate arrays for each quantity (structure of
+ * arrays) so that the kernels stream through memory with unit stride.
+ * Element results are given for each triangle; see telemac_geom_elements()
+ * for values for each mesh element.
+ * @{
+ */
+
+//! Geometry of the triangles making up a mesh
+typedef struct telemac_geom {
+	uint32_t ntri; //!< Number of triangles
+	uint32_t npoin; //!< Number of nodes
+	uint32_t per_elem; //!< Triangles for each mesh element (1 or 2), stored consecutively
+	uint32_t *node[3]; //!< Nodes of each triangle (numbered from 0)
+	float *area; //!< Area of each triangle
+	float *dndx[3]; //!< X derivative of the shape function of each node of each triangle
+	float *dndy[3]; //!< Y derivative of the shape function of each node of each triangle
+	float *nodearea; //!< Total area of the triangles around each node
+} telemac_geom_t;
+
+const telemac_geom_t *telemac_get_geom(resfile_t *rfile);
+void telemac_geom_free(telemac_geom_t *geom);
+int telemac_geom_gradient(const telemac_geom_t *geom, const float *f, float *gx, float *gy, int nthreads);
+int telemac_geom_vorticity(const telemac_geom_t *geom, const float *u, const float *v, float *vort, float *div, int nthreads);
+int telemac_geom_to_nodes(const telemac_geom_t *geom, const float *tri, float *node, int nthreads);
+void telemac_geom_elements(const telemac_geom_t *geom, const float *tri, float *elem);
+
+/*! @} */
+#endif // TELEMAC_GEOM_H
@@ -0,0 +1,255 @@
+/******************************************************************************
+telemac-hist - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "telemac-hist.h"
+#include "telemac-thread.h"
+#include "telemac-stats.h"
+
+//! Nodes updated by each task
+#define HIST_CHUNK 16384
+
+//! Nodes binned together before their counts are incremented
+#define HIST_BLOCK 256
+
+//! Arguments for adding a timestep or finding a percentile
+typedef struct {
+	const telemac_hist_t *h; //!< Histograms
+	const float *values; //!< Values at this timestep
+	double time; //!< Time of this timestep
+	double p; //!< Percentile
+	float *out; //!< Percentile of each node
+} hist_task_t;
+
+int telemac_hist_init(telemac_hist_t *h, uint32_t npoin, uint32_t nbins, float lo, float hi, uint32_t nt, const float *thr, int nthr) {
+/*!
+ * @brief Allocate empty histograms
+ *
+ * @param h	Histograms to set up. Free with telemac_hist_free().
+ * @param npoin	Number of nodes
+ * @param nbins	Bins for each node
+ * @param lo	Lower limit of the first bin
+ * @param hi	Upper limit of the last bin
+ * @param nt	Most timesteps that will be added
+ * @param thr	Thresholds for the time at or above (may be NULL if nthr is 0)
+ * @param nthr	Number of thresholds
+ * @retval 0	Success
+ * @retval -1	Bad arguments
+ * @retval -2	Memory could not be allocated
+ */
+	memset(h, 0, sizeof(*h));
+	if (nbins < 1 || !(hi > lo) || nthr < 0) {
+		fprintf(stderr, "telemac_hist_init: need at least one bin and an upper limit above the lower\n");
+		return -1;
+	}
+	h->npoin = npoin;
+	h->nbins = nbins;
+	h->lo = lo;
+	h->hi = hi;
+	h->nthr = nthr;
+	size_t ncount = (size_t)npoin * nbins;
+	size_t width = (nt <= UINT16_MAX ? sizeof(uint16_t) : sizeof(uint32_t));
+	if (width == sizeof(uint16_t)) {
+		h->count16 = calloc(sizeof(uint16_t), ncount + 1);
+	} else {
+		h->count32 = calloc(sizeof(uint32_t), ncount + 1);
+	}
+	h->min = calloc(sizeof(float), npoin + 1);
+	h->max = calloc(sizeof(float), npoin + 1);
+	h->thr = calloc(sizeof(float), nthr + 1);
+	h->above = calloc(sizeof(double), (size_t)npoin * nthr + 1);
+	h->prev = calloc(sizeof(float), npoin + 1);
+	if ((h->count16 == NULL && h->count32 == NULL) || h->min == NULL || h->max == NULL
+			|| h->thr == NULL || h->above == NULL || h->prev == NULL) {
+		perror("telemac_hist_init");
+		telemac_hist_free(h);
+		return -2;
+	}
+	TM_STATS_ALLOC(width * ncount + (3 * sizeof(float) + nthr * sizeof(double)) * (size_t)npoin);
+	if (nthr > 0) {
+		memcpy(h->thr, thr, sizeof(float) * nthr);
+	}
+	for (uint32_t i = 0; i < npoin; i++) {
+		h->min[i] = INFINITY;
+		h->max[i] = -INFINITY;
+	}
+	return 0;
+}
+
+static int add_task(void *ctx, size_t start, size_t end, int thread) {
+//! Add one timestep to nodes start to end - 1 (see telemac_parallel_for())
+	(void)thread;
+	const hist_task_t *ht = ctx;
+	const telemac_hist_t *h = ht->h;
+	const uint32_t nbins = h->nbins;
+	const float lo = h->lo;
+	const float scale = nbins / ((double)h->hi - h->lo);
+	const float top = nbins - 1;
+	uint32_t bin[HIST_BLOCK];
+
+	for (size_t b = start; b < end; b += HIST_BLOCK) {
+		size_t n = (end - b < HIST_BLOCK ? end - b : HIST_BLOCK);
+		const float *restrict v = &ht->values[b];
+		// NaN fails the first comparison and is counted in the first bin
+		for (size_t j = 0; j < n; j++) {
+			float f = (v[j] - lo) * scale;
+			f = (f > 0 ? f : 0);
+			f = (f < top ? f : top);
+			bin[j] = (uint32_t)f;
+		}
+		if (h->count16 != NULL) {
+			uint16_t *c = &h->count16[b * nbins];
+			for (size_t j = 0; j < n; j++) {
+				c[j * nbins + bin[j]]++;
+			}
+		} else {
+			uint32_t *c = &h->count32[b * nbins];
+			for (size_t j = 0; j < n; j++) {
+				c[j * nbins + bin[j]]++;
+			}
+		}
+	}
+
+	const float *restrict v = ht->values;
+	float *restrict mn = h->min;
+	float *restrict mx = h->max;
+	for (size_t i = start; i < end; i++) {
+		mn[i] = (v[i] < mn[i] ? v[i] : mn[i]);
+		mx[i] = (v[i] > mx[i] ? v[i] : mx[i]);
+	}
+
+	if (h->nsamples == 0 || h->nthr == 0) {
+		memcpy(&h->prev[start], &v[start], sizeof(float) * (end - start));
+		return 0;
+	}
+	const float *restrict prev = h->prev;
+	const double t = ht->time;
+	const double tp = h->time;
+	for (int k = 0; k < h->nthr; k++) {
+		const float thr = h->thr[k];
+		double *restrict above = &h->above[(size_t)k * h->npoin];
+		for (size_t i = start; i < end; i++) {
+			bool now = (v[i] >= thr);
+			bool before = (prev[i] >= thr);
+			if (now && before) {
+				above[i] += t - tp;
+			} else if (now != before) {
+				// Crossing time interpolated between the two timesteps
+				double tc = tp + (t - tp) * ((double)thr - prev[i]) / ((double)v[i] - prev[i]);
+				above[i] += (now ? t - tc : tc - tp);
+			}
+		}
+	}
+	memcpy(&h->prev[start], &v[start], sizeof(float) * (end - start));
+	return 0;
+}
+
+int telemac_hist_add(telemac_hist_t *h, const float *values, double time, int nthreads) {
+/*!
+ * @brief Add one timestep to the histograms
+ *
+ * @param h	Histograms from telemac_hist_init()
+ * @param values	Value of each node
+ * @param time	Time of the timestep. Timesteps must be added in increasing order of time.
+ * @param nthreads	Number of threads (values below 1 use all CPUs)
+ * @retval 0	Success
+ * @retval -1	Failure, or more timesteps than the counts can hold
+ */
+	if (h->count16 != NULL && h->nsamples >= UINT16_MAX) {
+		fprintf(stderr, "telemac_hist_add: more timesteps than given to telemac_hist_init()\n");
+		return -1;
+	}
+	hist_task_t ht = {h, values, time, 0, NULL};
+	TM_STATS_BEGIN(TM_PHASE_FORMAT);
+	int rv = telemac_parallel_for(nthreads, h->npoin, HIST_CHUNK, add_task, &ht);
+	TM_STATS_END(TM_PHASE_FORMAT);
+	if (rv != 0) {
+		return -1;
+	}
+	h->nsamples++;
+	h->time = time;
+	return 0;
+}
+
+static int percentile_task(void *ctx, size_t start, size_t end, int thread) {
+//! Find the percentile of nodes start to end - 1 (see telemac_parallel_for())
+	(void)thread;
+	const hist_task_t *ht = ctx;
+	const telemac_hist_t *h = ht->h;
+	const double width = ((double)h->hi - h->lo) / h->nbins;
+	const double target = ht->p / 100 * h->nsamples;
+	for (size_t i = start; i < end; i++) {
+		double cum = 0;
+		double value = h->hi;
+		for (uint32_t k = 0; k < h->nbins; k++) {
+			size_t c = (size_t)i * h->nbins + k;
+			double count = (h->count16 != NULL ? h->count16[c] : h->count32[c]);
+			if (count > 0 && cum + count >= target) {
+				value = h->lo + (k + (target - cum) / count) * width;
+				break;
+			}
+			cum += count;
+		}
+		value = (value < h->min[i] ? h->min[i] : value);
+		value = (value > h->max[i] ? h->max[i] : value);
+		ht->out[i] = (h->nsamples > 0 ? value : 0);
+	}
+	return 0;
+}
+
+int telemac_hist_percentile(const telemac_hist_t *h, double p, float *out, int nthreads) {
+/*!
+ * @brief Estimate a percentile of every node from its histogram
+ *
+ * @param h	Histograms from telemac_hist_init()
+ * @param p	Percentile, from 0 (the minimum) to 100 (the maximum)
+ * @param out	Percentile of each node (npoin values). Zero if no timesteps have been added.
+ * @param nthreads	Number of threads (values below 1 use all CPUs)
+ * @retval 0	Success
+ * @retval -1	Failure
+ */
+	if (p < 0 || p > 100) {
+		fprintf(stderr, "telemac_hist_percentile: percentile %g out of range\n", p);
+		return -1;
+	}
+	hist_task_t ht = {h, NULL, 0, p, out};
+	TM_STATS_BEGIN(TM_PHASE_FORMAT);
+	int rv = telemac_parallel_for(nthreads, h->npoin, HIST_CHUNK, percentile_task, &ht);
+	TM_STATS_END(TM_PHASE_FORMAT);
+	return (rv == 0 ? 0 : -1);
+}
+
+void telemac_hist_free(telemac_hist_t *h) {
+/*!
+ * @brief Free histograms
+ * @param h	Histograms from telemac_hist_init()
+ */
+	free(h->count16);
+	free(h->count32);
+	free(h->min);
+	free(h->max);
+	free(h->thr);
+	free(h->above);
+	free(h->prev);
+	memset(h, 0, sizeof(*h));
+}
@@ -0,0 +1,81 @@
+/******************************************************************************
+telemac-hist - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Streaming per-node histograms, percentiles and time above thresholds
+ */
+
+#ifndef TELEMAC_HIST_H
+#define TELEMAC_HIST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * @defgroup hist Streaming histograms
+ * @brief Percentiles and exceedance of each node over a whole run, one timestep at a time
+ *
+ * Each node keeps a histogram of its values with a fixed number of equal
+ * bins between a lower and upper limit, along with its exact minimum and
+ * maximum and the time spent at or above each of a set of thresholds. The
+ * histograms of all nodes are held in a single array (node by node, each
+ * node's bins together), using 16-bit counts when there are fewer than
+ * 65536 timesteps and 32-bit counts otherwise. Memory use is therefore
+ * proportional to the number of nodes and bins, whatever the number of
+ * timesteps.
+ *
+ * Each timestep is added in parallel over ranges of nodes. Bin numbers for
+ * a block of nodes are found in a loop without branches, which the compiler
+ * can vectorise, before the counts are incremented.
+ *
+ * Percentiles treat every timestep as one sample of equal weight. They are
+ * interpolated linearly within the bin that holds them and limited to the
+ * node's minimum and maximum, so the error is less than one bin width.
+ * Values outside the limits are counted in the first or last bin. Times
+ * at which a value crosses a threshold are interpolated linearly between
+ * timesteps.
+ * @{
+ */
+
+//! Histograms and exceedance of every node
+typedef struct {
+	uint32_t npoin; //!< Number of nodes
+	uint32_t nbins; //!< Bins for each node
+	float lo; //!< Lower limit of the first bin
+	float hi; //!< Upper limit of the last bin
+	uint32_t nsamples; //!< Timesteps added
+	uint16_t *count16; //!< Counts of each bin of each node, if fewer than 65536 timesteps are expected
+	uint32_t *count32; //!< Counts of each bin of each node, otherwise
+	float *min; //!< Smallest value of each node
+	float *max; //!< Largest value of each node
+	int nthr; //!< Number of thresholds
+	float *thr; //!< Thresholds
+	double *above; //!< Time at or above each threshold (nthr arrays of npoin values)
+	float *prev; //!< Value of each node at the last timestep added
+	double time; //!< Time of the last timestep added
+} telemac_hist_t;
+
+int telemac_hist_init(telemac_hist_t *h, uint32_t npoin, uint32_t nbins, float lo, float hi, uint32_t nt, const float *thr, int nthr);
+int telemac_hist_add(telemac_hist_t *h, const float *values, double time, int nthreads);
+int telemac_hist_percentile(const telemac_hist_t *h, double p, float *out, int nthreads);
+void telemac_hist_free(telemac_hist_t *h);
+
+/*! @} */
+#endif // TELEMAC_HIST_H
@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
 #include <string.h>
 #include <libgen.h>
 #include "telemac-loader.h"
+#include "telemac-stats.h"
 
 /*!
  * @file
@@ -39,13 +40,16 @@ int main (int argc, char** argv) {
 	char *basefilename = NULL;
 	int verbose = 0;
 	int force = 0;
+	int headeronly = 0;
 
-	const char *usage = "Usage: %s [-v] [-f] filename\n\t-v\tVerbose output\n\t-f\tForce mode\n";
+	const char *usage = "Usage: %s [-v] [-f] [-H] [--stats[=json]] filename [filename...]\n\t-v\tVerbose output\n\t-f\tForce mode\n\t-H\tHeader only: do not read mesh or results\n\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
 
 	telemac_data_t results;
 
 	int go = 0;
-	while ((go = getopt(argc, argv, "vf")) != -1) {
+	while ((go = getopt(argc, argv, "vfH")) != -1) {
 		switch (go) {
 			case 'v':
 				verbose++;
@@ -53,6 +57,9 @@ int main (int argc, char** argv) {
 			case 'f':
 				force = 1;
 				break;
+			case 'H':
+				headeronly = 1;
+				break;
 			case '?':
 				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
 			default:
@@ -61,26 +68,38 @@ int main (int argc, char** argv) {
 		}
 	}
 
-	if (argc - optind != 1) {
-		fprintf(stderr, "Must specify a single input file\n");
+	int nfiles = argc - optind;
+	if (nfiles < 1 || (headeronly && nfiles != 1)) {
+		fprintf(stderr, "Must specify a single input file, or a restart chain of files (not in header only mode)\n");
 		fprintf(stderr, usage, argv[0]);
 		return EXIT_FAILURE;
 	}
 	filename = argv[optind];
 
-	resfile = fopen(filename, "rb");
-	if (resfile == NULL) {
-		perror("Unable to open file");
-		return EXIT_FAILURE;
-	}
-
 	basefilename=basename(filename);
 
 	printf("\nOpening results file %s:\n", basefilename);
-	resfile_t rfs = {resfile, 0, 0, 0};
+	if (nfiles > 1) {
+		printf("Restart chain of %d files\n", nfiles);
+	}
+	resfile_t rfs = {NULL, 0, 0, 0};
 
 	// Call open_telemac, but only pass on verbose option if verbose set to 2 or more
-	int rval = open_telemac(&rfs, (verbose > 1 ? 1 : 0));
+	int rval = 0;
+	if (headeronly) {
+		resfile = fopen(filename, "rb");
+		if (resfile == NULL) {
+			perror("Unable to open file");
+			return EXIT_FAILURE;
+		}
+		rfs.file = resfile;
+		rval = open_telemac_header(&rfs, (verbose > 1 ? 1 : 0));
+	} else {
+		rval = open_telemac_chain(&rfs, &argv[optind], nfiles, (verbose > 1 ? 1 : 0));
+		if (rfs.file == NULL) {
+			return EXIT_FAILURE;
+		}
+	}
 	results = rfs.tmdat;
 	if (verbose) {
 		printf("open_telemac returned %d\n", rval);
@@ -109,12 +128,25 @@ int main (int argc, char** argv) {
 	for (int n = 0; n < results.nbv_1; n++) {
 		printf("\t%d: %s\n", n, results.var_names[n]);
 	}
-	printf("\nCoordinate Range:\n\tX: %+f, %+f\n\tY: %+f, %+f\n", results.XYrange[0], results.XYrange[1], results.XYrange[2], results.XYrange[3]);
+	if (!headeronly) {
+		printf("\nCoordinate Range:\n\tX: %+f, %+f\n\tY: %+f, %+f\n", results.XYrange[0], results.XYrange[1], results.XYrange[2], results.XYrange[3]);
+	}
 
 	printf("\n%d Nodes\n%d Elements\n%d nodes per element\n", results.npoin, results.nelem, results.ndp);
 
 	printf("\nSimulation Times:\n");
-	if (verbose == 1) {
+	if (headeronly) {
+		float tstart = 0, tend = 0;
+		printf("\t%d timesteps\n", results.nt);
+		if (results.nt > 0) {
+			if (get_telemac_timestamp(&rfs, 0, &tstart) != 0 || get_telemac_timestamp(&rfs, results.nt - 1, &tend) != 0) {
+				fprintf(stderr, "Error reading timestamps\n");
+				return EXIT_FAILURE;
+			}
+			printf("\tSimulation start: t = %+f\n", tstart);
+			printf("\tSimulation end:   t = %+f\n", tend);
+		}
+	} else if (verbose == 1) {
 		for (int t = 0; t < results.nt; t++) {
 			float **data = NULL;
 			data = get_telemac_data(&rfs, t, verbose);
@@ -145,7 +177,7 @@ int main (int argc, char** argv) {
 		printf("\tRun again with verbose flag to list individual timestamps\n");
 	}
 
-	fclose(resfile);
+	close_telemac(&rfs);
 	printf("\nEnd.\n");
 
 	return EXIT_SUCCESS;
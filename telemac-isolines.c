@@ -0,0 +1,388 @@
+/******************************************************************************
+telemac-isolines - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-thread.h"
+#include "telemac-layers.h"
+#include "telemac-expr.h"
+#include "telemac-contour.h"
+#include "telemac-format.h"
+
+/*!
+ * @file
+ * @brief Write contour lines of a variable at each timestep
+ *
+ * Contours of a stored variable, or of a derived variable given as an
+ * expression (see telemac-expr.h), are traced directly through the mesh
+ * (see telemac_contour()) and written to one GeoJSON or CSV file per
+ * timestep. Timesteps are divided between threads, each reading, tracing and
+ * writing its own timesteps, so output is identical for any number of
+ * threads.
+ *
+ * Returns zero on success and EXIT_FAILURE if an error occurs.
+ */
+
+//! Shared state for contouring timesteps in parallel
+typedef struct {
+	const resfile_t *rfile; //!< Results file
+	const telemac_layers_t *layers; //!< 3D layout
+	const telemac_contour_mesh_t *cmesh; //!< Triangles
+	const telemac_expr_t *expr; //!< Derived variable, or NULL
+	const bool *need; //!< Stored variables used by expr
+	int var; //!< Stored variable, if expr is NULL
+	const char *name; //!< Quantity name, for output
+	uint32_t plane; //!< Plane of 3D results
+	const double *levels; //!< Sorted contour levels
+	int nlevels; //!< Number of levels
+	int first; //!< First timestep
+	int every; //!< Timestep interval
+	bool csv; //!< CSV rather than GeoJSON output
+	const char *base; //!< Output path and file name prefix
+	const float *times; //!< Time of each contoured timestep
+	float ***data; //!< Per thread buffers for stored variables
+	float **values; //!< Per thread buffers for contoured values
+	uint64_t nlines; //!< Total lines written
+} isolines_t;
+
+static int write_lines(const isolines_t *c, int t, float time, const telemac_contour_t *lines) {
+//! Write the lines of one timestep as GeoJSON or CSV
+	char *name = NULL;
+	asprintf(&name, "%s.%s.t%d.%s", c->base, c->name, t, (c->csv ? "csv" : "geojson"));
+	FILE *file = fopen(name, "w");
+	if (file == NULL) {
+		perror(name);
+		free(name);
+		return -1;
+	}
+	TM_STATS_BEGIN(TM_PHASE_FORMAT);
+	if (c->csv) {
+		fprintf(file, "line,level,closed,point,x,y\n");
+		for (uint32_t l = 0; l < lines->nline; l++) {
+			for (uint32_t p = lines->start[l]; p < lines->start[l + 1]; p++) {
+				fprintf(file, "%u,%.8g,%d,%u,%.10g,%.10g\n", l, c->levels[lines->level[l]], lines->closed[l],
+						p - lines->start[l], lines->x[p], lines->y[p]);
+			}
+		}
+	} else {
+		fprintf(file, "{\"type\":\"FeatureCollection\",\"features\":[");
+		for (uint32_t l = 0; l < lines->nline; l++) {
+			fprintf(file, "%s\n{\"type\":\"Feature\",\"properties\":{\"variable\":", (l ? "," : ""));
+			telemac_format_json_string(file, c->name);
+			fprintf(file, ",\"level\":%.8g,\"step\":%d,\"time\":%.8g,\"closed\":%s},"
+					"\"geometry\":{\"type\":\"LineString\",\"coordinates\":[",
+					c->levels[lines->level[l]], t, time, (lines->closed[l] ? "true" : "false"));
+			for (uint32_t p = lines->start[l]; p < lines->start[l + 1]; p++) {
+				fprintf(file, "%s[%.10g,%.10g]", (p > lines->start[l] ? "," : ""), lines->x[p], lines->y[p]);
+			}
+			fprintf(file, "]}}");
+		}
+		fprintf(file, "\n]}\n");
+	}
+	TM_STATS_END(TM_PHASE_FORMAT);
+	int rv = fclose(file);
+	telemac_stats_add_file(name);
+	free(name);
+	return (rv ? -1 : 0);
+}
+
+static int step_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: contour a range of timesteps
+	isolines_t *c = (isolines_t *)ctx;
+	const telemac_data_t *mesh = &c->rfile->tmdat;
+	float **data = c->data[thread];
+	float *values = c->values[thread];
+	size_t offset = (size_t)c->plane * c->layers->npoin2;
+
+	for (size_t i = start; i < end; i++) {
+		int t = c->first + (int)i * c->every;
+
+		const float *v = values;
+		if (c->expr == NULL) {
+			if (telemac_read_plane(c->rfile, c->layers, t, c->var, c->plane, values) != 0) {
+				fprintf(stderr, "Unable to read variable %d at timestep %d\n", c->var, t);
+				return -1;
+			}
+		} else {
+			for (int j = 0; j < c->expr->nvar; j++) {
+				if (c->need[j] && read_telemac_var(c->rfile, t, j, data[j]) != 0) {
+					fprintf(stderr, "Unable to read variable %d at timestep %d\n", j, t);
+					return -1;
+				}
+			}
+			if (telemac_expr_eval(c->expr, mesh, data, values, offset, offset + c->layers->npoin2) != 0) {
+				fprintf(stderr, "Unable to evaluate %s at timestep %d\n", c->name, t);
+				return -1;
+			}
+			v = values + offset;
+		}
+
+		telemac_contour_t lines;
+		if (telemac_contour(c->cmesh, v, c->levels, c->nlevels, &lines) != 0) {
+			return -1;
+		}
+		int rv = write_lines(c, t, c->times[i], &lines);
+		__atomic_fetch_add(&c->nlines, lines.nline, __ATOMIC_RELAXED);
+		telemac_contour_free(&lines);
+		if (rv != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int level_cmp(const void *a, const void *b) {
+//! qsort() comparison: ascending doubles
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+	char *outputdir = ".";
+	char *definition = NULL;
+	bool verbose = false;
+	bool csv = false;
+	int var = 0;
+	int step = -1;
+	int every = 1;
+	int plane = -1;
+	int nthreads = 0;
+	double *levels = NULL;
+	int nlevels = 0;
+
+	const char *usage = "Usage: %s -l level[,level...] [-V n | -e NAME=expr] [-t step] [-f n] [-p plane] [-c] [-j n] [-o dir] [-v] [--stats[=json]] <filename> [filename...]\n"
+		"\t-l\tContour levels, separated by commas. May be repeated\n"
+		"\t-V\tVariable to contour (default: 0)\n"
+		"\t-e\tContour a derived variable (see telemac-vtu)\n"
+		"\t-t\tContour a single timestep (default: all)\n"
+		"\t-f\tContour every n^th timestep\n"
+		"\t-p\tPlane of 3D results (0 = bottom, default -1 = surface)\n"
+		"\t-c\tWrite CSV instead of GeoJSON\n"
+		"\t-j\tNumber of threads to use (default: number of CPUs)\n"
+		"\t-o\tOutput directory\n"
+		"\t-v\tVerbose output\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "l:V:e:t:f:p:cj:o:v")) != -1) {
+		switch (go) {
+			case 'l':
+				for (char *s = optarg; *s != '\0';) {
+					char *end = NULL;
+					double level = strtod(s, &end);
+					if (end == s) {
+						fprintf(stderr, "Invalid contour level '%s'\n", s);
+						return EXIT_FAILURE;
+					}
+					levels = realloc(levels, sizeof(double) * (nlevels + 1));
+					if (levels == NULL) {
+						perror("Parsing options");
+						return EXIT_FAILURE;
+					}
+					levels[nlevels++] = level;
+					s = (*end == ',' ? end + 1 : end);
+				}
+				break;
+			case 'V':
+				var = atoi(optarg);
+				break;
+			case 'e':
+				definition = optarg;
+				break;
+			case 't':
+				step = atoi(optarg);
+				break;
+			case 'f':
+				every = atoi(optarg);
+				break;
+			case 'p':
+				plane = atoi(optarg);
+				break;
+			case 'c':
+				csv = true;
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'o':
+				outputdir = optarg;
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (nlevels < 1 || every < 1 || argc - optind < 1) {
+		fprintf(stderr, "Must give contour levels and a file (or restart chain of files) to process\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+	qsort(levels, nlevels, sizeof(double), level_cmp);
+
+	resfile_t rfs = {NULL, 0, 0, 0};
+	int rval = open_telemac_chain(&rfs, &argv[optind], argc - optind, false);
+	if (rfs.file == NULL || rval < 0) {
+		fprintf(stderr, "Unable to open %s (%d)\n", argv[optind], rval);
+		return EXIT_FAILURE;
+	}
+	telemac_data_t *mesh = &rfs.tmdat;
+	int nvar = mesh->nbv_1 + mesh->nbv_2;
+
+	telemac_expr_t *expr = NULL;
+	bool *need = calloc(sizeof(bool), nvar + 1);
+	char *name = NULL;
+	if (need == NULL) {
+		perror("Allocating variable list");
+		return EXIT_FAILURE;
+	}
+	if (definition != NULL) {
+		char err[256];
+		expr = telemac_expr_compile(definition, mesh, err, sizeof(err));
+		if (expr == NULL) {
+			fprintf(stderr, "Invalid expression '%s': %s\n", definition, err);
+			return EXIT_FAILURE;
+		}
+		telemac_expr_uses(expr, need);
+		name = strdup(expr->name);
+	} else {
+		if (var < 0 || var >= nvar) {
+			fprintf(stderr, "Variable %d out of range (%d variables)\n", var, nvar);
+			return EXIT_FAILURE;
+		}
+		asprintf(&name, "var%d", var);
+	}
+	if (step >= (int)mesh->nt) {
+		fprintf(stderr, "Timestep %d out of range (0 - %d)\n", step, mesh->nt - 1);
+		return EXIT_FAILURE;
+	}
+
+	telemac_layers_t layers;
+	telemac_contour_mesh_t cmesh;
+	if (telemac_get_layers(mesh, &layers) != 0) {
+		return EXIT_FAILURE;
+	}
+	plane = (plane < 0 ? plane + (int)layers.nplan : plane);
+	if (plane < 0 || plane >= (int)layers.nplan) {
+		fprintf(stderr, "Plane out of range (%u planes)\n", layers.nplan);
+		return EXIT_FAILURE;
+	}
+	TM_STATS_BEGIN(TM_PHASE_MESH);
+	rval = telemac_contour_prepare(mesh, &cmesh);
+	TM_STATS_END(TM_PHASE_MESH);
+	if (rval != 0) {
+		return EXIT_FAILURE;
+	}
+
+	int first = (step < 0 ? 0 : step);
+	int nsteps = (step < 0 ? ((int)mesh->nt + every - 1) / every : 1);
+	if (nthreads < 1) {
+		nthreads = telemac_default_threads();
+	}
+	nthreads = (nthreads > nsteps ? (nsteps > 0 ? nsteps : 1) : nthreads);
+
+	// Timestamps are read first, as get_telemac_timestamp() uses the shared file position
+	float *times = calloc(sizeof(float), nsteps + 1);
+	if (times == NULL) {
+		perror("Allocating timestamps");
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < nsteps; i++) {
+		if (get_telemac_timestamp(&rfs, first + i * every, &times[i]) != 0) {
+			fprintf(stderr, "Unable to read time of timestep %d\n", first + i * every);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Each thread needs a buffer for the contoured values, and for the stored variables used by an expression
+	float ***data = calloc(sizeof(float **), nthreads);
+	float **values = calloc(sizeof(float *), nthreads);
+	if (data == NULL || values == NULL) {
+		perror("Allocating buffers");
+		return EXIT_FAILURE;
+	}
+	for (int th = 0; th < nthreads; th++) {
+		data[th] = calloc(sizeof(float *), nvar + 1);
+		values[th] = calloc(sizeof(float), mesh->npoin + 1);
+		if (data[th] == NULL || values[th] == NULL) {
+			perror("Allocating buffers");
+			return EXIT_FAILURE;
+		}
+		for (int j = 0; j < nvar; j++) {
+			if (need[j]) {
+				data[th][j] = calloc(sizeof(float), mesh->npoin + 1);
+				if (data[th][j] == NULL) {
+					perror("Allocating buffers");
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+	char *base = strdup(argv[optind]);
+	char *basefilename = NULL;
+	asprintf(&basefilename, "%s/%s", outputdir, basename(base));
+	free(base);
+
+	if (verbose) {
+		fprintf(stdout, "Contouring %s at %d levels over %d timesteps with %d threads (%u triangles)\n",
+				(expr ? definition : (var < (int)mesh->nbv_1 ? mesh->var_names[var] : "(quadratic)")), nlevels, nsteps, nthreads, cmesh.ntri);
+	}
+
+	isolines_t c = {&rfs, &layers, &cmesh, expr, need, var, name, (uint32_t)plane, levels, nlevels,
+		first, every, csv, basefilename, times, data, values, 0};
+	if (telemac_parallel_for(nthreads, nsteps, 1, step_task, &c) != 0) {
+		return EXIT_FAILURE;
+	}
+	fprintf(stdout, "Wrote %lu lines to %d files\n", (unsigned long)c.nlines, nsteps);
+
+	for (int th = 0; th < nthreads; th++) {
+		for (int j = 0; j < nvar; j++) {
+			free(data[th][j]);
+		}
+		free(data[th]);
+		free(values[th]);
+	}
+	free(data);
+	free(values);
+	free(times);
+	free(basefilename);
+	free(name);
+	free(need);
+	free(levels);
+	telemac_expr_free(expr);
+	telemac_contour_mesh_free(&cmesh);
+	close_telemac(&rfs);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,294 @@
+/******************************************************************************
+telemac-layers - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "telemac-layers.h"
+#include "telemac-stats.h"
+
+/*!
+ * @file
+ * @brief Access to the horizontal planes of 3D results
+ *
+ * All reads are of whole planes or single values, using
+ * read_telemac_var_range(), so extracting a plane reads 1/NPLAN of each
+ * record, and a depth average holds only two planes in memory at a time.
+ */
+
+int telemac_get_layers(const telemac_data_t *results, telemac_layers_t *layers) {
+/*!
+ * @brief Find the number of planes and the size of each plane
+ *
+ * @param results	Results file header and mesh
+ * @param layers	Output: mesh layout
+ * @retval 0	Success
+ * @retval -1	The mesh dimensions do not match the number of planes
+ */
+	layers->nplan = 1;
+	layers->npoin2 = results->npoin;
+	layers->nelem2 = results->nelem;
+	if (results->ndp != 6) {
+		return 0;
+	}
+
+	uint32_t nplan = results->iparam[6];
+	if (nplan < 2 || results->npoin % nplan != 0 || results->nelem % (nplan - 1) != 0) {
+		fprintf(stderr, "3D mesh of %u nodes and %u prisms does not match NPLAN = %u\n", results->npoin, results->nelem, nplan);
+		return -1;
+	}
+	layers->nplan = nplan;
+	layers->npoin2 = results->npoin / nplan;
+	layers->nelem2 = results->nelem / (nplan - 1);
+	return 0;
+}
+
+int telemac_find_elevation(const telemac_data_t *results) {
+/*!
+ * @brief Find the elevation variable of a 3D results file
+ *
+ * TELEMAC-3D writes the elevation of each node (ELEVATION Z, or COTE Z) as
+ * its first variable; the name is checked in case it has been moved.
+ *
+ * @param results	Results file header
+ * @returns	Variable number
+ */
+	for (int j = 0; j < (int)results->nbv_1; j++) {
+		if (strncmp(results->var_names[j], "ELEVATION Z", 11) == 0 || strncmp(results->var_names[j], "COTE Z", 6) == 0) {
+			return j;
+		}
+	}
+	return 0;
+}
+
+int telemac_layers_mesh(const telemac_data_t *results, const telemac_layers_t *layers, telemac_data_t *mesh2d) {
+/*!
+ * @brief Build the 2D mesh of one plane, for writing 2D results
+ *
+ * The header fields of results are copied, and the triangles of the first
+ * layer of prisms are used for the connectivity. Variable names are shared
+ * with results rather than copied, and there are no timesteps. Release with
+ * telemac_layers_free_mesh().
+ *
+ * @param results	3D results file header and mesh
+ * @param layers	Mesh layout (see telemac_get_layers())
+ * @param mesh2d	Output: 2D header and mesh
+ * @retval 0	Success
+ * @retval -1	Allocation failure
+ */
+	*mesh2d = *results;
+	mesh2d->npoin = layers->npoin2;
+	mesh2d->nelem = layers->nelem2;
+	mesh2d->ndp = 3;
+	mesh2d->iparam[6] = 0;
+	mesh2d->nt = 0;
+	mesh2d->timestamp = NULL;
+	mesh2d->ikle = calloc(sizeof(uint32_t), 3 * (size_t)layers->nelem2 + 1);
+	mesh2d->ipobo = calloc(sizeof(uint32_t), layers->npoin2 + 1);
+	mesh2d->X = calloc(sizeof(float), layers->npoin2 + 1);
+	mesh2d->Y = calloc(sizeof(float), layers->npoin2 + 1);
+	if (mesh2d->ikle == NULL || mesh2d->ipobo == NULL || mesh2d->X == NULL || mesh2d->Y == NULL) {
+		perror("Allocating 2D mesh");
+		telemac_layers_free_mesh(mesh2d);
+		return -1;
+	}
+
+	for (uint32_t e = 0; e < layers->nelem2; e++) {
+		for (int k = 0; k < 3; k++) {
+			mesh2d->ikle[3 * e + k] = results->ikle[(size_t)e * results->ndp + k];
+		}
+	}
+	memcpy(mesh2d->ipobo, results->ipobo, sizeof(uint32_t) * layers->npoin2);
+	memcpy(mesh2d->X, results->X, sizeof(float) * layers->npoin2);
+	memcpy(mesh2d->Y, results->Y, sizeof(float) * layers->npoin2);
+	return 0;
+}
+
+void telemac_layers_free_mesh(telemac_data_t *mesh2d) {
+//! Release a mesh built by telemac_layers_mesh()
+	free(mesh2d->ikle);
+	free(mesh2d->ipobo);
+	free(mesh2d->X);
+	free(mesh2d->Y);
+	mesh2d->ikle = NULL;
+	mesh2d->ipobo = NULL;
+	mesh2d->X = NULL;
+	mesh2d->Y = NULL;
+}
+
+uint32_t telemac_plane_triangles(const telemac_data_t *results, const telemac_layers_t *layers, uint32_t *tri[3]) {
+/*!
+ * @brief Split the elements of one plane into triangles
+ *
+ * Triangles are copied, quadrilaterals are split into nodes 0-1-2 and 0-2-3,
+ * and for 3D meshes the lower face of each prism in the first layer is used.
+ * Node numbers are from zero and refer to the bottom plane; add
+ * plane * npoin2 to use them with another plane.
+ *
+ * @param results	Results file header and mesh
+ * @param layers	Layout from telemac_get_layers()
+ * @param tri	Three arrays of at least 2 * nelem2 node numbers for the triangles
+ * @retval uint32_t	Number of triangles
+ */
+	static const int split[2][2][3] = {
+		{{0, 1, 2}, {0, 1, 2}}, // Triangles and prisms
+		{{0, 1, 2}, {0, 2, 3}}, // Quadrilaterals
+	};
+	int type = (results->ndp == 4 ? 1 : 0);
+	uint32_t per = (results->ndp == 4 ? 2 : 1);
+	uint32_t ntri = 0;
+	for (uint32_t e = 0; e < layers->nelem2; e++) {
+		const uint32_t *ik = &results->ikle[(size_t)e * results->ndp];
+		for (uint32_t s = 0; s < per; s++) {
+			for (int k = 0; k < 3; k++) {
+				tri[k][ntri] = ik[split[type][s][k]] - 1;
+			}
+			ntri++;
+		}
+	}
+	return ntri;
+}
+
+int telemac_read_plane(const resfile_t *rfile, const telemac_layers_t *layers, int timestep, int var, uint32_t plane, float *out) {
+/*!
+ * @brief Read one horizontal plane of a variable
+ *
+ * @param rfile	Opened results file
+ * @param layers	Mesh layout (see telemac_get_layers())
+ * @param timestep	Timestep to read
+ * @param var	Variable number
+ * @param plane	Plane number, from 0 at the bottom
+ * @param out	Buffer of npoin2 values
+ * @returns	0 on success, or a negative value as read_telemac_var_range()
+ */
+	if (plane >= layers->nplan) {
+		fprintf(stderr, "Plane %u out of range (%u planes)\n", plane, layers->nplan);
+		return -1;
+	}
+	return read_telemac_var_range(rfile, timestep, var, plane * layers->npoin2, layers->npoin2, out);
+}
+
+int telemac_read_profile(const resfile_t *rfile, const telemac_layers_t *layers, int timestep, int var, uint32_t node, float *out) {
+/*!
+ * @brief Read the values of a variable at each plane above a 2D node
+ *
+ * @param rfile	Opened results file
+ * @param layers	Mesh layout (see telemac_get_layers())
+ * @param timestep	Timestep to read
+ * @param var	Variable number
+ * @param node	Node number in the 2D mesh (from 0)
+ * @param out	Buffer of nplan values, from the bottom plane up
+ * @returns	0 on success, or a negative value as read_telemac_var_range()
+ */
+	if (node >= layers->npoin2) {
+		fprintf(stderr, "Node %u out of range (%u nodes in each plane)\n", node, layers->npoin2);
+		return -1;
+	}
+	for (uint32_t k = 0; k < layers->nplan; k++) {
+		int rv = read_telemac_var_range(rfile, timestep, var, k * layers->npoin2 + node, 1, &out[k]);
+		if (rv != 0) {
+			return rv;
+		}
+	}
+	return 0;
+}
+
+int telemac_depth_average(const resfile_t *rfile, const telemac_layers_t *layers, int timestep, int zvar,
+		const int *vars, int nvars, float **out, float *depth) {
+/*!
+ * @brief Average variables over the depth of each column of nodes
+ *
+ * Values are integrated over the elevation with the trapezium rule and
+ * divided by the thickness of the column. Where the column has no thickness
+ * (e.g. dry nodes) the value at the surface is used.
+ *
+ * Planes are read one at a time, from the bottom up, so only two planes of
+ * each variable are held in memory.
+ *
+ * @param rfile	Opened results file
+ * @param layers	Mesh layout (see telemac_get_layers())
+ * @param timestep	Timestep to read
+ * @param zvar	Elevation variable (see telemac_find_elevation())
+ * @param vars	Variables to average
+ * @param nvars	Number of entries in vars
+ * @param out	Output: nvars arrays of npoin2 values
+ * @param depth	If not NULL, set to the thickness of each column
+ * @retval 0	Success
+ * @retval -1	Bad arguments
+ * @retval -2	Read or allocation failure
+ */
+	const uint32_t n2 = layers->npoin2;
+	float *buf = calloc(sizeof(float), 2 * (size_t)n2 * (nvars + 1) + 1);
+	float *zbot = calloc(sizeof(float), n2 + 1);
+	if (buf == NULL || zbot == NULL) {
+		perror("telemac_depth_average");
+		free(buf);
+		free(zbot);
+		return -2;
+	}
+	TM_STATS_ALLOC(sizeof(float) * (2 * (size_t)n2 * (nvars + 1) + n2));
+
+	// buf holds the lower then upper plane of z, then of each variable
+	float *lo = buf;
+	float *hi = buf + (size_t)n2 * (nvars + 1);
+	int rv = telemac_read_plane(rfile, layers, timestep, zvar, 0, lo);
+	for (int v = 0; rv == 0 && v < nvars; v++) {
+		rv = telemac_read_plane(rfile, layers, timestep, vars[v], 0, lo + (size_t)n2 * (v + 1));
+		memset(out[v], 0, sizeof(float) * n2);
+	}
+	if (rv == 0) {
+		memcpy(zbot, lo, sizeof(float) * n2);
+	}
+
+	for (uint32_t k = 1; rv == 0 && k < layers->nplan; k++) {
+		rv = telemac_read_plane(rfile, layers, timestep, zvar, k, hi);
+		for (int v = 0; rv == 0 && v < nvars; v++) {
+			rv = telemac_read_plane(rfile, layers, timestep, vars[v], k, hi + (size_t)n2 * (v + 1));
+		}
+		if (rv != 0) {
+			break;
+		}
+		for (int v = 0; v < nvars; v++) {
+			const float *flo = lo + (size_t)n2 * (v + 1);
+			const float *fhi = hi + (size_t)n2 * (v + 1);
+			float *acc = out[v];
+			for (uint32_t i = 0; i < n2; i++) {
+				acc[i] += 0.5f * (flo[i] + fhi[i]) * (hi[i] - lo[i]);
+			}
+		}
+		float *swap = lo;
+		lo = hi;
+		hi = swap;
+	}
+
+	// lo now holds the surface plane
+	for (uint32_t i = 0; rv == 0 && i < n2; i++) {
+		float h = lo[i] - zbot[i];
+		for (int v = 0; v < nvars; v++) {
+			out[v][i] = (h > 0 ? out[v][i] / h : lo[(size_t)n2 * (v + 1) + i]);
+		}
+		if (depth != NULL) {
+			depth[i] = h;
+		}
+	}
+	free(buf);
+	free(zbot);
+	return (rv == 0 ? 0 : (rv == -1 ? -1 : -2));
+}
@@ -0,0 +1,62 @@
+/******************************************************************************
+telemac-layers - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Access to the horizontal planes of 3D results
+ */
+
+#ifndef TELEMAC_LAYERS_H
+#define TELEMAC_LAYERS_H
+
+#include <stdint.h>
+#include "telemac-loader.h"
+
+/*!
+ * @defgroup layers 3D planes
+ * @brief Planes, vertical profiles and depth averages of 3D results
+ *
+ * TELEMAC-3D meshes are made of NPLAN copies of a 2D mesh stacked
+ * vertically, with NPLAN stored in IPARAM(7). Nodes are numbered plane by
+ * plane from the bottom, so each plane of a variable is a contiguous part of
+ * its record and can be read on its own with read_telemac_var_range().
+ * Prisms are numbered layer by layer in the same way, with nodes 0-2 of each
+ * prism on the lower plane.
+ * @{
+ */
+
+//! Layout of a 3D mesh
+typedef struct {
+	uint32_t nplan; //!< Number of planes (1 for 2D meshes)
+	uint32_t npoin2; //!< Nodes in each plane
+	uint32_t nelem2; //!< Elements in each layer of prisms (or all elements, for 2D meshes)
+} telemac_layers_t;
+
+int telemac_get_layers(const telemac_data_t *results, telemac_layers_t *layers);
+int telemac_find_elevation(const telemac_data_t *results);
+int telemac_layers_mesh(const telemac_data_t *results, const telemac_layers_t *layers, telemac_data_t *mesh2d);
+void telemac_layers_free_mesh(telemac_data_t *mesh2d);
+uint32_t telemac_plane_triangles(const telemac_data_t *results, const telemac_layers_t *layers, uint32_t *tri[3]);
+int telemac_read_plane(const resfile_t *rfile, const telemac_layers_t *layers, int timestep, int var, uint32_t plane, float *out);
+int telemac_read_profile(const resfile_t *rfile, const telemac_layers_t *layers, int timestep, int var, uint32_t node, float *out);
+int telemac_depth_average(const resfile_t *rfile, const telemac_layers_t *layers, int timestep, int zvar,
+		const int *vars, int nvars, float **out, float *depth);
+
+/*! @} */
+#endif // TELEMAC_LAYERS_H
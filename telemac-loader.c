@@ -21,15 +21,27 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <math.h>
+#include <limits.h>
+#include <stdbool.h>
 
 #include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-archive.h"
+#include "telemac-geom.h"
+#include "telemac-mesh.h"
+#include "telemac-scan.h"
 
 /*!
  * @file
  * @brief TELEMAC SELAFIN file reader
  */
 
+//! Records in a timestep read by read_telemac_data() without allocating memory
+#define READ_STACK_RECORDS 32
+
 uint32_t int_swap(const uint32_t input) {
 /*!
  * @brief Swap byte order of an integer
@@ -70,6 +82,34 @@ float float_swap(const float value){
 	return out;
 }
 
+void float_swap_array(float *values, size_t n) {
+/*!
+ * @brief Swap byte order of an array of floats in place
+ *
+ * Equivalent to calling float_swap() on each element, but written so that the
+ * compiler can vectorise the loop.
+ * @param values	Array to convert
+ * @param n		Number of elements
+ */
+	uint32_t *v = (uint32_t *)values;
+	for (size_t i = 0; i < n; i++) {
+		v[i] = __builtin_bswap32(v[i]);
+	}
+}
+
+off_t telemac_step_size(const telemac_data_t *results) {
+/*!
+ * @brief Size on disk of the records making up a single timestep
+ *
+ * Each timestep consists of a timestamp record followed by one record per
+ * variable, each record having a leading and trailing length marker.
+ *
+ * @param results	telemac_data_t with header (state 1) information set
+ * @returns		Size of one timestep in bytes
+ */
+	return (8 + sizeof(uint32_t) + (off_t)(results->nbv_1 + results->nbv_2) * (sizeof(float) * results->npoin + 8));
+}
+
 int fortran_read(void* cstruct, size_t csize, size_t num, FILE* fromfile) {
 /*!
  * @brief Read data from a FORTRAN formatted file
@@ -92,6 +132,9 @@ int fortran_read(void* cstruct, size_t csize, size_t num, FILE* fromfile) {
 
 	fread(&end_rec, sizeof(end_rec), 1, fromfile);
 
+	TM_STATS_ADD(TM_COUNT_READ_CALLS, 3);
+	TM_STATS_ADD(TM_COUNT_BYTES_READ, 2 * sizeof(uint32_t) + csize * counter);
+
 	if (start_rec != end_rec) {
 		fprintf(stderr, "Error: Reading requested record\n");
 		fprintf(stderr, "\t Start and end of record yield different lengths. Variable length wrong?\n");
@@ -110,21 +153,44 @@ int open_telemac(resfile_t *rfile, int verbose) {
  *
  * File structure taken from the TELEMAC user guide.
  *
+ * Compressed archives (see telemac-archive.h) are recognised after the mesh
+ * has been read, and opened with telemac_archive_open().
+ *
+ * If the `TELEMAC_SALVAGE` environment variable is set, every timestep is
+ * checked with telemac_salvage() and only the valid prefix of the file is
+ * used, ignoring any incomplete timestep at the end.
+ *
  * @param rfile	Pointer to results structure
  * @param verbose	Non-zero for verbose output
- * @returns		EXIT_SUCCESS/EXIT_FAILURE
+ * @returns		EXIT_SUCCESS/EXIT_FAILURE, or a negative value below
+ * @retval -1		Failed to read header
+ * @retval -2		Failed to read mesh
+ * @retval -3		`TELEMAC_SALVAGE` is set and the file could not be scanned (see telemac_salvage())
+ * @retval -4		Malformed or unsupported compressed archive
+ * @retval -5		Memory allocation failure opening compressed archive
  */
 
-	if (get_telemac_header(rfile, verbose) < 0) {
+	TM_STATS_BEGIN(TM_PHASE_HEADER);
+	int hr = get_telemac_header(rfile, verbose);
+	TM_STATS_END(TM_PHASE_HEADER);
+	if (hr < 0) {
 		perror("get_telemac_header");
 		return -1;
 	}
 
-	if (get_telemac_mesh(rfile, verbose) < 0) {
+	TM_STATS_BEGIN(TM_PHASE_MESH);
+	int mr = get_telemac_mesh(rfile, verbose);
+	TM_STATS_END(TM_PHASE_MESH);
+	if (mr < 0) {
 		perror("get_telemac_mesh");
 		return -2;
 	}
 
+	if (telemac_archive_detect(rfile)) {
+		int ar = telemac_archive_open(rfile, verbose);
+		return (ar == 0 ? 0 : (ar == -2 ? -5 : -4));
+	}
+
 	telemac_data_t *results = &rfile->tmdat;
 	int fsr = fseeko(rfile->file, rfile->datastart + rfile->datasize * (results->nt), SEEK_SET);
 	if (fsr != 0) {
@@ -132,18 +198,79 @@ int open_telemac(resfile_t *rfile, int verbose) {
 		perror("open_telemac");
 		return EXIT_FAILURE|fsr;
 	}
+	if (telemac_salvage_enabled()) {
+		return (telemac_salvage(rfile, 0) < 0 ? -3 : EXIT_SUCCESS);
+	}
 	char tmp = NULL;
 	int fr = fread(&tmp, sizeof(char), 1, rfile->file);
 	if (fr && !feof(rfile->file)) {
 		off_t floc = ftello(rfile->file);
 		fprintf(stderr, "Extra results->data at end of file:\n");
 		fprintf(stderr, "EoF expected at 0x%jx\n", (intmax_t)floc);
+		fprintf(stderr, "Set " TELEMAC_SALVAGE_ENV "=1 to use only the complete timesteps\n");
 		return EXIT_FAILURE|0x3;
 	}
 
 	return EXIT_SUCCESS;
 }
 
+int open_telemac_header(resfile_t *rfile, int verbose) {
+/*!
+ * @brief Open a TELEMAC results file, reading only the file header
+ *
+ * Reads records up to and including R6, then derives the location of the
+ * simulation results and the number of timesteps from the mesh dimensions
+ * without reading IKLE, IPOBO or the coordinates. The telemac_data_t
+ * structure is left in state 1; get_telemac_mesh() may be called later to
+ * load the mesh if required.
+ *
+ * Timestamps may be read with get_telemac_timestamp().
+ *
+ * @param rfile	Pointer to results structure
+ * @param verbose	Non-zero for verbose output
+ * @retval 0	Success
+ * @retval -1	Failed to read header
+ * @retval -2	Failed to determine file size
+ * @retval -3	Failed to open compressed archive
+ */
+	TM_STATS_BEGIN(TM_PHASE_HEADER);
+	int hr = get_telemac_header(rfile, verbose);
+	TM_STATS_END(TM_PHASE_HEADER);
+	if (hr < 0) {
+		perror("get_telemac_header");
+		return -1;
+	}
+
+	telemac_data_t *results = &rfile->tmdat;
+
+	struct stat buf;
+	if (fstat(fileno(rfile->file), &buf) != 0) {
+		perror("open_telemac_header: fstat");
+		return -2;
+	}
+
+	// IKLE, IPOBO, X and Y records, each with a leading and trailing marker
+	off_t meshsize = (8 + (off_t)sizeof(uint32_t) * results->nelem * results->ndp)
+		+ (8 + (off_t)sizeof(uint32_t) * results->npoin)
+		+ 2 * (8 + (off_t)sizeof(float) * results->npoin);
+
+	rfile->datastart = rfile->meshstart + meshsize;
+	rfile->datasize = telemac_step_size(results);
+	if (telemac_archive_detect(rfile)) {
+		return (telemac_archive_open(rfile, verbose) == 0 ? 0 : -3);
+	}
+	if (buf.st_size < rfile->datastart) {
+		results->nt = 0;
+	} else {
+		results->nt = (buf.st_size - rfile->datastart) / rfile->datasize;
+	}
+
+	if (verbose) {
+		fprintf(stdout, "Results start at 0x%jx. Number of timesteps: \t%d\n", (intmax_t)rfile->datastart, results->nt);
+	}
+	return 0;
+}
+
 int get_telemac_header(resfile_t * rfile, int verbose) {
 //! Process file header and set up results structures
 
@@ -172,8 +299,8 @@ int get_telemac_header(resfile_t * rfile, int verbose) {
 
 	R1 resfile_r1;
 	if (fortran_read(&resfile_r1, sizeof(R1), 1, rfile->file) == 1) {
-		snprintf(results->title, 72, "%s", resfile_r1.title);
-		snprintf(results->format, 8, "%s", resfile_r1.format);
+		snprintf(results->title, 72, "%.72s", resfile_r1.title);
+		snprintf(results->format, 8, "%.8s", resfile_r1.format);
 		if (verbose) {
 			fprintf(stdout, "Record 1:\n\tTitle:\t%s\n\tFormat:\t%s\n", results->title, results->format);
 		}
@@ -308,6 +435,7 @@ int get_telemac_mesh(resfile_t *rfile, int verbose) {
 	}
 
 	results->ikle = calloc(sizeof(uint32_t), results->nelem*results->ndp);
+	TM_STATS_ALLOC(sizeof(uint32_t) * results->nelem * results->ndp);
 	if (results->ikle == NULL) {
 		perror("Unable to allocate first dimension of IKLE");
 		return -1;
@@ -329,6 +457,7 @@ int get_telemac_mesh(resfile_t *rfile, int verbose) {
 	}
 
 	results->ipobo = calloc(sizeof(uint32_t), results->npoin);
+	TM_STATS_ALLOC(sizeof(uint32_t) * results->npoin);
 	if (results->ipobo == NULL) {
 		perror("Unable to allocate results->ipobo");
 		return -2;
@@ -348,6 +477,7 @@ int get_telemac_mesh(resfile_t *rfile, int verbose) {
 	}
 
 	results->X = calloc(sizeof(float), results->npoin);
+	TM_STATS_ALLOC(sizeof(float) * results->npoin);
 
 	if (results->X == NULL) {
 		perror("Failed to allocate memory for X coordinates");
@@ -382,6 +512,7 @@ int get_telemac_mesh(resfile_t *rfile, int verbose) {
 	}
 
 	results->Y = calloc(sizeof(float), results->npoin);
+	TM_STATS_ALLOC(sizeof(float) * results->npoin);
 
 	if (results->Y == NULL) {
 		perror("Failed to allocate memory for Y coordinates");
@@ -426,13 +557,14 @@ int get_telemac_mesh(resfile_t *rfile, int verbose) {
 		fprintf(stdout, "Mesh data ends at position %jd. File size is %jd\n", (intmax_t)ftello(rfile->file), (intmax_t)size);
 	}
 
-	rfile->datasize = (8 + sizeof(uint32_t) + (results->nbv_1 + results->nbv_2) * (sizeof(float) * results->npoin + 8));
+	rfile->datasize = telemac_step_size(results);
 	results->nt = ((long long)(size - ftello(rfile->file)) / rfile->datasize);
 	if (verbose) {
 		fprintf(stdout, "Number of timesteps: \t%d\n", results->nt);
 	}
 
 	results->timestamp = calloc(sizeof(float), results->nt);
+	TM_STATS_ALLOC(sizeof(float) * results->nt);
 	if (results->timestamp == NULL) {
 		perror("Unable to allocate timestamp array");
 		return -5;
@@ -468,19 +600,48 @@ float** get_telemac_data(resfile_t *rfile, int timestep, int verbose) {
 		return NULL;
 	}
 
-	if (fseeko(rfile->file, rfile->datastart + timestep * rfile->datasize, SEEK_SET) != 0) {
+	if (rfile->archive != NULL) {
+		float **data = alloc_telemac_data(rfile);
+		if (data == NULL || read_telemac_data(rfile, timestep, data, &results->timestamp[timestep]) != 0) {
+			if (data != NULL) {
+				free_telemac_data(rfile, data);
+			}
+			return NULL;
+		}
+		if (verbose) {
+			fprintf(stdout, "Step: \t%d\t\tTime: \t%f\n", timestep, results->timestamp[timestep]);
+		}
+		return data;
+	}
+
+	FILE *file = NULL;
+	off_t offset = 0;
+	if (telemac_locate(rfile, timestep, &file, &offset) != 0) {
+		return NULL;
+	}
+
+	TM_STATS_BEGIN(TM_PHASE_READ);
+	TM_STATS_ADD(TM_COUNT_SEEK_CALLS, 1);
+	if (fseeko(file, offset, SEEK_SET) != 0) {
+		TM_STATS_END(TM_PHASE_READ);
 		fprintf(stderr, "Unable to seek to start of timestep\n");
 		perror("get_telemac_data");
 		return NULL;
 	}
 
-	fortran_read(&results->timestamp[timestep], sizeof(float), 1, rfile->file);
+	int nread = fortran_read(&results->timestamp[timestep], sizeof(float), 1, file);
+	TM_STATS_END(TM_PHASE_READ);
+	if (nread != 1) {
+		fprintf(stderr, "get_telemac_data: unable to read timestamp for step %d\n", timestep);
+		return NULL;
+	}
 	results->timestamp[timestep] = float_swap(results->timestamp[timestep]);
 	if (verbose) {
 		fprintf(stdout, "Step: \t%d\t\tTime: \t%f\n", timestep, results->timestamp[timestep]);
 	}
 	float **data = NULL;
 	data = calloc(sizeof(float *), (results->nbv_1 + results->nbv_2));
+	TM_STATS_ALLOC(sizeof(float *) * (results->nbv_1 + results->nbv_2));
 
 	if (data == NULL) {
 		perror("get_telemac_data: Allocating data[]");
@@ -490,15 +651,28 @@ float** get_telemac_data(resfile_t *rfile, int timestep, int verbose) {
 	for (int j = 0; j < (results->nbv_1 + results->nbv_2); j++) {
 		data[j] = NULL;
 		data[j] = calloc(sizeof(float), results->npoin);
+		TM_STATS_ALLOC(sizeof(float) * results->npoin);
 		if (data[j] == NULL) {
 			free(data);
 			perror("get_telemac_data: Allocating data[][]");
 			return NULL;
 		}
-		fortran_read(data[j], sizeof(float), results->npoin, rfile->file);
+		TM_STATS_BEGIN(TM_PHASE_READ);
+		nread = fortran_read(data[j], sizeof(float), results->npoin, file);
+		TM_STATS_END(TM_PHASE_READ);
+		if (nread != (int)results->npoin) {
+			fprintf(stderr, "get_telemac_data: unable to read variable %d for step %d\n", j, timestep);
+			for (int k = 0; k <= j; k++) {
+				free(data[k]);
+			}
+			free(data);
+			return NULL;
+		}
+		TM_STATS_BEGIN(TM_PHASE_SWAP);
 		for (int i = 0; i < results->npoin; i++) {
 			data[j][i] = float_swap(data[j][i]);
 		}
+		TM_STATS_END(TM_PHASE_SWAP);
 	}
 	return data;
 }
@@ -521,3 +695,702 @@ void free_telemac_data(resfile_t *rfile, float **data) {
 	free(data);
 	data = NULL;
 }
+
+int get_telemac_timestamp(resfile_t *rfile, int timestep, float *timestamp) {
+//! Read the timestamp for a single timestep
+
+/*!
+ * Reads only the timestamp record at the start of the requested timestep.
+ * May be used after either open_telemac() or open_telemac_header().
+ *
+ * @param rfile	A resfile_t structure with datastart and datasize set
+ * @param timestep	Timestep to read
+ * @param timestamp	Location to store the timestamp
+ * @retval 0	Success
+ * @retval -1	Timestep out of range or file not opened
+ * @retval -2	Failed to seek to or read timestamp
+ */
+	telemac_data_t *results = &rfile->tmdat;
+
+	if (results->state < 1 || rfile->datasize == 0 || timestep < 0 || timestep >= results->nt) {
+		fprintf(stderr, "get_telemac_timestamp: timestep %d not available\n", timestep);
+		return -1;
+	}
+	if (rfile->archive != NULL) {
+		*timestamp = results->timestamp[timestep];
+		return 0;
+	}
+
+	FILE *file = NULL;
+	off_t offset = 0;
+	if (telemac_locate(rfile, timestep, &file, &offset) != 0) {
+		return -1;
+	}
+
+	TM_STATS_ADD(TM_COUNT_SEEK_CALLS, 1);
+	if (fseeko(file, offset, SEEK_SET) != 0) {
+		perror("get_telemac_timestamp");
+		return -2;
+	}
+
+	float ts = 0;
+	if (fortran_read(&ts, sizeof(float), 1, file) != 1) {
+		fprintf(stderr, "get_telemac_timestamp: unable to read timestamp for step %d\n", timestep);
+		return -2;
+	}
+	*timestamp = float_swap(ts);
+	if (results->timestamp != NULL) {
+		results->timestamp[timestep] = *timestamp;
+	}
+	return 0;
+}
+
+void close_telemac(resfile_t *rfile) {
+//! Close a results file and free all memory held by its telemac_data_t
+
+/*!
+ * Frees the variable names, mesh arrays and timestamps allocated by
+ * open_telemac(), open_telemac_header() and get_telemac_mesh(), then closes
+ * the file handle. Data returned by get_telemac_data() must be released
+ * separately with free_telemac_data().
+ *
+ * @param rfile	Results file to close
+ */
+	telemac_data_t *results = &rfile->tmdat;
+
+	telemac_archive_close(rfile);
+	telemac_geom_free(rfile->geom);
+	rfile->geom = NULL;
+	telemac_adjacency_free(rfile->adj);
+	rfile->adj = NULL;
+	if (results->var_names != NULL) {
+		for (int i = 0; i < results->nbv_1; i++) {
+			free(results->var_names[i]);
+		}
+		free(results->var_names);
+		results->var_names = NULL;
+	}
+	free(results->ikle);
+	free(results->ipobo);
+	free(results->X);
+	free(results->Y);
+	free(results->timestamp);
+	results->ikle = NULL;
+	results->ipobo = NULL;
+	results->X = NULL;
+	results->Y = NULL;
+	results->timestamp = NULL;
+	results->state = 0;
+
+	// Segment 0 shares rfile->file
+	for (int i = 1; i < rfile->nseg; i++) {
+		fclose(rfile->seg[i].file);
+	}
+	free(rfile->seg);
+	rfile->seg = NULL;
+	rfile->nseg = 0;
+
+	if (rfile->file != NULL) {
+		fclose(rfile->file);
+		rfile->file = NULL;
+	}
+}
+
+int telemac_locate(const resfile_t *rfile, int timestep, FILE **file, off_t *offset) {
+//! Find the file and offset holding a timestep
+
+/*!
+ * For a single file, this is the open file handle and an offset from the start
+ * of the results. For a restart chain, the segment holding the timestep is
+ * found first.
+ *
+ * @param rfile	Opened results file or restart chain
+ * @param timestep	Timestep to locate
+ * @param file	Set to the file handle holding the timestep
+ * @param offset	Set to the offset of the start of the timestep record
+ * @retval 0	Success
+ * @retval -1	Timestep out of range
+ */
+	if (timestep < 0 || timestep >= rfile->tmdat.nt) {
+		fprintf(stderr, "Timestep %d out of range (0 - %d)\n", timestep, (int)rfile->tmdat.nt - 1);
+		return -1;
+	}
+
+	if (rfile->nseg == 0) {
+		*file = rfile->file;
+		*offset = rfile->datastart + timestep * rfile->datasize;
+		return 0;
+	}
+
+	// Binary search for last segment starting at or before timestep
+	int lo = 0;
+	int hi = rfile->nseg - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (rfile->seg[mid].first <= (uint32_t)timestep) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	const telemac_segment_t *sg = &rfile->seg[lo];
+	*file = sg->file;
+	*offset = sg->datastart + (off_t)(timestep - sg->first + sg->skip) * rfile->datasize;
+	return 0;
+}
+
+int telemac_mesh_hash(FILE *file, off_t meshstart, const telemac_data_t *results, uint64_t *hash) {
+//! Hash the IKLE, X and Y records of a results file
+
+/*!
+ * Computes a 64-bit FNV-1a hash of the raw (unswapped) IKLE, X and Y record
+ * contents, reading through a small fixed buffer. IPOBO is not included. The
+ * mesh arrays in results are not used or modified, so this may be called
+ * after only get_telemac_header() or open_telemac_header().
+ *
+ * @param file	Open results file
+ * @param meshstart	Offset to start of mesh records
+ * @param results	Header information for the file
+ * @param hash	Output: hash value
+ * @retval 0	Success
+ * @retval -1	Read error
+ */
+	const uint64_t prime = 0x100000001b3ULL;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	unsigned char buf[65536];
+
+	off_t ikle = meshstart + 4;
+	off_t iklesize = (off_t)sizeof(uint32_t) * results->nelem * results->ndp;
+	off_t x = ikle + iklesize + 4 + 4 + (off_t)sizeof(uint32_t) * results->npoin + 8;
+	off_t xysize = (off_t)sizeof(float) * results->npoin;
+	off_t y = x + xysize + 8;
+
+	off_t starts[3] = {ikle, x, y};
+	off_t sizes[3] = {iklesize, xysize, xysize};
+	for (int r = 0; r < 3; r++) {
+		TM_STATS_ADD(TM_COUNT_SEEK_CALLS, 1);
+		if (fseeko(file, starts[r], SEEK_SET) != 0) {
+			return -1;
+		}
+		off_t remaining = sizes[r];
+		while (remaining > 0) {
+			size_t want = (remaining < (off_t)sizeof(buf) ? (size_t)remaining : sizeof(buf));
+			size_t got = fread(buf, 1, want, file);
+			TM_STATS_ADD(TM_COUNT_READ_CALLS, 1);
+			TM_STATS_ADD(TM_COUNT_BYTES_READ, got);
+			if (got != want) {
+				return -1;
+			}
+			for (size_t i = 0; i < got; i++) {
+				h = (h ^ buf[i]) * prime;
+			}
+			remaining -= got;
+		}
+	}
+	*hash = h;
+	return 0;
+}
+
+int open_telemac_chain(resfile_t *rfile, char **filenames, int nfiles, int verbose) {
+//! Open a restart chain of results files as a single results file
+
+/*!
+ * The first file is opened with open_telemac(), and its mesh is used for the
+ * whole chain. Each further file is opened in header-only mode and checked to
+ * have the same variables and mesh dimensions, and the same IKLE, X and Y
+ * contents (compared via telemac_mesh_hash()). Its mesh is not loaded.
+ *
+ * Timesteps from all files are presented as a single continuous range. Where
+ * a file starts with timesteps at or before the last time already covered by
+ * the chain (e.g. the initial state of a restarted run), those timesteps are
+ * skipped. All timestamps are read when the chain is opened.
+ *
+ * The files are opened by this function and closed by close_telemac(). With
+ * a single file name, this is equivalent to opening the file and calling
+ * open_telemac(), and the value returned by open_telemac() is passed back.
+ *
+ * @param rfile	Results structure to populate. Must be zero initialised.
+ * @param filenames	Files making up the chain, in time order
+ * @param nfiles	Number of files
+ * @param verbose	Non-zero for verbose output
+ * @retval 0	Success
+ * @retval >0	Non-fatal error from open_telemac() on the first file (e.g. trailing data)
+ * @retval -1	Failed to open or read first file
+ * @retval -2	Failed to open or read a later file
+ * @retval -3	Later file does not match the first
+ * @retval -4	Memory allocation failure
+ */
+	rfile->file = fopen(filenames[0], "rb");
+	if (rfile->file == NULL) {
+		perror(filenames[0]);
+		return -1;
+	}
+	int rv = open_telemac(rfile, verbose);
+	if (nfiles == 1) {
+		return rv;
+	}
+	if (rv < 0) {
+		fprintf(stderr, "%s: open_telemac returned %d\n", filenames[0], rv);
+		return -1;
+	}
+	if (rfile->archive != NULL) {
+		fprintf(stderr, "%s: compressed archives cannot be part of a restart chain\n", filenames[0]);
+		return -1;
+	}
+
+	telemac_data_t *results = &rfile->tmdat;
+	uint64_t hash = 0;
+	if (telemac_mesh_hash(rfile->file, rfile->meshstart, results, &hash) != 0) {
+		fprintf(stderr, "%s: unable to read mesh\n", filenames[0]);
+		return -1;
+	}
+
+	rfile->seg = calloc(sizeof(telemac_segment_t), nfiles);
+	TM_STATS_ALLOC(sizeof(telemac_segment_t) * nfiles);
+	if (rfile->seg == NULL) {
+		perror("open_telemac_chain: allocating segments");
+		return -4;
+	}
+	rfile->nseg = 1;
+	rfile->seg[0].file = rfile->file;
+	rfile->seg[0].datastart = rfile->datastart;
+	rfile->seg[0].first = 0;
+	rfile->seg[0].skip = 0;
+	rfile->seg[0].nt = results->nt;
+
+	// Read all timestamps of the first file
+	for (int t = 0; t < results->nt; t++) {
+		if (get_telemac_timestamp(rfile, t, &results->timestamp[t]) != 0) {
+			return -1;
+		}
+	}
+
+	for (int f = 1; f < nfiles; f++) {
+		resfile_t next = {NULL, 0, 0, 0};
+		next.file = fopen(filenames[f], "rb");
+		if (next.file == NULL) {
+			perror(filenames[f]);
+			return -2;
+		}
+		if (open_telemac_header(&next, verbose) != 0) {
+			fprintf(stderr, "%s: unable to read header\n", filenames[f]);
+			close_telemac(&next);
+			return -2;
+		}
+		if (next.archive != NULL) {
+			fprintf(stderr, "%s: compressed archives cannot be part of a restart chain\n", filenames[f]);
+			close_telemac(&next);
+			return -2;
+		}
+		telemac_data_t *nd = &next.tmdat;
+		if (nd->nbv_1 != results->nbv_1 || nd->nbv_2 != results->nbv_2 || nd->nelem != results->nelem
+				|| nd->npoin != results->npoin || nd->ndp != results->ndp) {
+			fprintf(stderr, "%s: mesh dimensions or variables do not match %s\n", filenames[f], filenames[0]);
+			close_telemac(&next);
+			return -3;
+		}
+		uint64_t nexthash = 0;
+		if (telemac_mesh_hash(next.file, next.meshstart, nd, &nexthash) != 0) {
+			fprintf(stderr, "%s: unable to read mesh\n", filenames[f]);
+			close_telemac(&next);
+			return -2;
+		}
+		if (nexthash != hash) {
+			fprintf(stderr, "%s: mesh does not match %s\n", filenames[f], filenames[0]);
+			close_telemac(&next);
+			return -3;
+		}
+
+		float *ts = realloc(results->timestamp, sizeof(float) * (results->nt + nd->nt));
+		if (ts == NULL) {
+			perror("open_telemac_chain: allocating timestamps");
+			close_telemac(&next);
+			return -4;
+		}
+		results->timestamp = ts;
+
+		// Skip timesteps already covered by earlier files
+		float last = (results->nt > 0 ? results->timestamp[results->nt - 1] : -INFINITY);
+		uint32_t skip = 0;
+		uint32_t used = 0;
+		for (uint32_t t = 0; t < nd->nt; t++) {
+			float tv = 0;
+			if (get_telemac_timestamp(&next, t, &tv) != 0) {
+				close_telemac(&next);
+				return -2;
+			}
+			if (used == 0 && tv <= last) {
+				skip++;
+				continue;
+			}
+			results->timestamp[results->nt + used] = tv;
+			used++;
+		}
+
+		if (verbose) {
+			fprintf(stdout, "%s: %d timesteps, %d skipped as already covered\n", filenames[f], nd->nt, skip);
+		}
+
+		telemac_segment_t *sg = &rfile->seg[rfile->nseg++];
+		sg->file = next.file;
+		sg->datastart = next.datastart;
+		sg->first = results->nt;
+		sg->skip = skip;
+		sg->nt = used;
+		results->nt += used;
+
+		// Keep the file handle for the segment, release everything else
+		next.file = NULL;
+		close_telemac(&next);
+	}
+
+	if (verbose) {
+		fprintf(stdout, "Restart chain of %d files, %d timesteps in total\n", rfile->nseg, results->nt);
+	}
+	return rv;
+}
+
+float **alloc_telemac_data(const resfile_t *rfile) {
+//! Allocate an array suitable for read_telemac_data()
+
+/*!
+ * The array has one entry for each variable, each holding npoin values. It has
+ * the same layout as the arrays returned by get_telemac_data() and may be
+ * released with free_telemac_data().
+ *
+ * @param rfile	Opened results file
+ * @retval float**	Allocated array
+ * @retval NULL	Allocation failed
+ */
+	const telemac_data_t *results = &rfile->tmdat;
+	uint32_t nvar = results->nbv_1 + results->nbv_2;
+	float **data = calloc(sizeof(float *), nvar);
+	TM_STATS_ALLOC(sizeof(float *) * nvar);
+	if (data == NULL) {
+		perror("alloc_telemac_data");
+		return NULL;
+	}
+	for (uint32_t j = 0; j < nvar; j++) {
+		data[j] = calloc(sizeof(float), results->npoin);
+		TM_STATS_ALLOC(sizeof(float) * results->npoin);
+		if (data[j] == NULL) {
+			perror("alloc_telemac_data");
+			for (uint32_t k = 0; k < j; k++) {
+				free(data[k]);
+			}
+			free(data);
+			return NULL;
+		}
+	}
+	return data;
+}
+
+static int check_markers(const uint32_t *markers, int nrec, const uint32_t *expected) {
+//! Check pairs of record markers against their expected lengths
+	for (int r = 0; r < nrec; r++) {
+		uint32_t start = int_swap(markers[2 * r]);
+		uint32_t end = int_swap(markers[2 * r + 1]);
+		if (start != end || start != expected[r]) {
+			fprintf(stderr, "Error: record markers do not match expected length (start: %u, end: %u, expected: %u)\n",
+					start, end, expected[r]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int read_telemac_var(const resfile_t *rfile, int timestep, int var, float *out) {
+//! Read a single variable for a given timestep into a caller supplied buffer
+
+/*!
+ * The variable record is read with a single positioned read, without moving
+ * the file position, so this function may be called from several threads
+ * at once for the same file. The record markers are checked.
+ *
+ * @param rfile	Opened results file
+ * @param timestep	Timestep to read
+ * @param var	Variable number
+ * @param out	Buffer of at least npoin values
+ * @retval 0	Success
+ * @retval -1	Bad state, timestep or variable
+ * @retval -2	Read failed or file too short
+ * @retval -3	Record markers do not match
+ */
+	const telemac_data_t *results = &rfile->tmdat;
+	if (results->state != 2 || var < 0 || var >= (int)(results->nbv_1 + results->nbv_2)) {
+		fprintf(stderr, "read_telemac_var: bad state or variable (state %d, var %d)\n", results->state, var);
+		return -1;
+	}
+	if (rfile->archive != NULL) {
+		return telemac_archive_read_var(rfile, timestep, var, out);
+	}
+
+	FILE *file = NULL;
+	off_t offset = 0;
+	if (telemac_locate(rfile, timestep, &file, &offset) != 0) {
+		return -1;
+	}
+	offset += 12 + (off_t)var * (sizeof(float) * results->npoin + 8);
+
+	uint32_t markers[2];
+	size_t len = sizeof(float) * results->npoin;
+	struct iovec iov[3] = {
+		{&markers[0], sizeof(uint32_t)},
+		{out, len},
+		{&markers[1], sizeof(uint32_t)}
+	};
+
+	TM_STATS_BEGIN(TM_PHASE_READ);
+	ssize_t got = preadv(fileno(file), iov, 3, offset);
+	TM_STATS_END(TM_PHASE_READ);
+	TM_STATS_ADD(TM_COUNT_READ_CALLS, 1);
+	if (got != (ssize_t)(len + 8)) {
+		fprintf(stderr, "read_telemac_var: short read for variable %d at timestep %d\n", var, timestep);
+		return -2;
+	}
+	TM_STATS_ADD(TM_COUNT_BYTES_READ, got);
+
+	uint32_t expected = len;
+	if (check_markers(markers, 1, &expected) != 0) {
+		return -3;
+	}
+
+	TM_STATS_BEGIN(TM_PHASE_SWAP);
+	float_swap_array(out, results->npoin);
+	TM_STATS_END(TM_PHASE_SWAP);
+	return 0;
+}
+
+int read_telemac_var_range(const resfile_t *rfile, int timestep, int var, uint32_t first, uint32_t count, float *out) {
+//! Read part of a single variable for a given timestep
+
+/*!
+ * Reads values for nodes first to first + count - 1 with a single positioned
+ * read of just those values, so that (for example) one plane of a 3D results
+ * file can be read without the rest of the record. Record markers are not
+ * part of the range and so are not checked. For compressed archives the
+ * whole variable is decoded and the range copied.
+ *
+ * @param rfile	Opened results file
+ * @param timestep	Timestep to read
+ * @param var	Variable number
+ * @param first	First node to read
+ * @param count	Number of nodes to read
+ * @param out	Buffer of at least count values
+ * @retval 0	Success
+ * @retval -1	Bad state, timestep, variable or range
+ * @retval -2	Read failed or file too short
+ */
+	const telemac_data_t *results = &rfile->tmdat;
+	if (results->state != 2 || var < 0 || var >= (int)(results->nbv_1 + results->nbv_2)
+			|| first > results->npoin || count > results->npoin - first) {
+		fprintf(stderr, "read_telemac_var_range: bad state, variable or range (state %d, var %d, nodes %u+%u)\n",
+				results->state, var, first, count);
+		return -1;
+	}
+	if (rfile->archive != NULL) {
+		float *all = malloc(sizeof(float) * (results->npoin ? results->npoin : 1));
+		if (all == NULL) {
+			perror("read_telemac_var_range");
+			return -2;
+		}
+		int rv = telemac_archive_read_var(rfile, timestep, var, all);
+		if (rv == 0) {
+			memcpy(out, &all[first], sizeof(float) * count);
+		}
+		free(all);
+		return rv;
+	}
+
+	FILE *file = NULL;
+	off_t offset = 0;
+	if (telemac_locate(rfile, timestep, &file, &offset) != 0) {
+		return -1;
+	}
+	offset += 12 + (off_t)var * (sizeof(float) * results->npoin + 8) + 4 + (off_t)first * sizeof(float);
+
+	size_t len = sizeof(float) * count;
+	TM_STATS_BEGIN(TM_PHASE_READ);
+	ssize_t got = pread(fileno(file), out, len, offset);
+	TM_STATS_END(TM_PHASE_READ);
+	TM_STATS_ADD(TM_COUNT_READ_CALLS, 1);
+	if (got != (ssize_t)len) {
+		fprintf(stderr, "read_telemac_var_range: short read for variable %d at timestep %d\n", var, timestep);
+		return -2;
+	}
+	TM_STATS_ADD(TM_COUNT_BYTES_READ, got);
+
+	TM_STATS_BEGIN(TM_PHASE_SWAP);
+	float_swap_array(out, count);
+	TM_STATS_END(TM_PHASE_SWAP);
+	return 0;
+}
+
+int read_telemac_data(const resfile_t *rfile, int timestep, float **data, float *timestamp) {
+//! Read simulation results for a given timestep into caller supplied buffers
+
+/*!
+ * A reentrant alternative to get_telemac_data(). Data is read using
+ * positioned reads into the arrays provided, which may be re-used between
+ * calls, and the file position and telemac_data_t structure are not modified.
+ * Record markers are checked.
+ *
+ * If every entry in data is non-NULL, the whole timestep is read with a single
+ * vectored read. Entries set to NULL are skipped, and in that case each
+ * requested variable is read separately with read_telemac_var().
+ * For uncompressed files, no memory is allocated unless there are more than
+ * READ_STACK_RECORDS - 1 variables, so buffers may be re-used to read a whole
+ * run without allocating.
+ *
+ * @param rfile	Opened results file
+ * @param timestep	Timestep to read
+ * @param data	Array of (nbv_1 + nbv_2) pointers, each to npoin values or NULL.
+ *		See alloc_telemac_data().
+ * @param timestamp	If not NULL, set to the time of this timestep
+ * @retval 0	Success
+ * @retval -1	Bad state or timestep
+ * @retval -2	Read failed or file too short
+ * @retval -3	Record markers do not match
+ */
+	const telemac_data_t *results = &rfile->tmdat;
+	if (results->state != 2) {
+		fprintf(stderr, "read_telemac_data called with bad results state (Want state >= 2, got %d)\n", results->state);
+		return -1;
+	}
+
+	if (rfile->archive != NULL) {
+		if (timestep < 0 || timestep >= results->nt) {
+			return -1;
+		}
+		if (timestamp != NULL) {
+			*timestamp = results->timestamp[timestep];
+		}
+		for (int j = 0; j < (int)(results->nbv_1 + results->nbv_2); j++) {
+			int rv = (data[j] != NULL ? telemac_archive_read_var(rfile, timestep, j, data[j]) : 0);
+			if (rv != 0) {
+				return rv;
+			}
+		}
+		return 0;
+	}
+
+	FILE *file = NULL;
+	off_t offset = 0;
+	if (telemac_locate(rfile, timestep, &file, &offset) != 0) {
+		return -1;
+	}
+
+	int nvar = results->nbv_1 + results->nbv_2;
+	bool all = true;
+	for (int j = 0; j < nvar; j++) {
+		if (data[j] == NULL) {
+			all = false;
+		}
+	}
+
+	if (!all) {
+		if (timestamp != NULL) {
+			float ts = 0;
+			uint32_t markers[2];
+			struct iovec iov[3] = {{&markers[0], 4}, {&ts, 4}, {&markers[1], 4}};
+			uint32_t expected = sizeof(float);
+			TM_STATS_ADD(TM_COUNT_READ_CALLS, 1);
+			if (preadv(fileno(file), iov, 3, offset) != 12) {
+				return -2;
+			}
+			TM_STATS_ADD(TM_COUNT_BYTES_READ, 12);
+			if (check_markers(markers, 1, &expected) != 0) {
+				return -3;
+			}
+			*timestamp = float_swap(ts);
+		}
+		for (int j = 0; j < nvar; j++) {
+			if (data[j] != NULL) {
+				int rv = read_telemac_var(rfile, timestep, j, data[j]);
+				if (rv != 0) {
+					return rv;
+				}
+			}
+		}
+		return 0;
+	}
+
+	// Timestamp record, then one record per variable, each with two markers
+	int nrec = nvar + 1;
+	uint32_t stack_markers[2 * READ_STACK_RECORDS];
+	uint32_t stack_expected[READ_STACK_RECORDS];
+	struct iovec stack_iov[3 * READ_STACK_RECORDS];
+	uint32_t *markers = stack_markers;
+	uint32_t *expected = stack_expected;
+	struct iovec *iov = stack_iov;
+	bool heap = (nrec > READ_STACK_RECORDS);
+	if (heap) {
+		markers = calloc(sizeof(uint32_t), 2 * nrec);
+		expected = calloc(sizeof(uint32_t), nrec);
+		iov = calloc(sizeof(struct iovec), 3 * nrec);
+		TM_STATS_ALLOC((sizeof(uint32_t) * 3 + sizeof(struct iovec) * 3) * nrec);
+		if (markers == NULL || expected == NULL || iov == NULL) {
+			perror("read_telemac_data");
+			free(markers);
+			free(expected);
+			free(iov);
+			return -2;
+		}
+	}
+
+	float ts = 0;
+	for (int r = 0; r < nrec; r++) {
+		iov[3 * r].iov_base = &markers[2 * r];
+		iov[3 * r].iov_len = sizeof(uint32_t);
+		iov[3 * r + 1].iov_base = (r == 0 ? (void *)&ts : (void *)data[r - 1]);
+		iov[3 * r + 1].iov_len = (r == 0 ? sizeof(float) : sizeof(float) * results->npoin);
+		iov[3 * r + 2].iov_base = &markers[2 * r + 1];
+		iov[3 * r + 2].iov_len = sizeof(uint32_t);
+		expected[r] = iov[3 * r + 1].iov_len;
+	}
+
+	int rv = 0;
+	int niov = 3 * nrec;
+	int done = 0;
+	TM_STATS_BEGIN(TM_PHASE_READ);
+	while (done < niov) {
+		int batch = (niov - done > IOV_MAX ? IOV_MAX : niov - done);
+		ssize_t want = 0;
+		for (int i = done; i < done + batch; i++) {
+			want += iov[i].iov_len;
+		}
+		ssize_t got = preadv(fileno(file), &iov[done], batch, offset);
+		TM_STATS_ADD(TM_COUNT_READ_CALLS, 1);
+		if (got != want) {
+			fprintf(stderr, "read_telemac_data: short read at timestep %d\n", timestep);
+			rv = -2;
+			break;
+		}
+		TM_STATS_ADD(TM_COUNT_BYTES_READ, got);
+		offset += got;
+		done += batch;
+	}
+	TM_STATS_END(TM_PHASE_READ);
+
+	if (rv == 0 && check_markers(markers, nrec, expected) != 0) {
+		rv = -3;
+	}
+
+	if (rv == 0) {
+		TM_STATS_BEGIN(TM_PHASE_SWAP);
+		for (int j = 0; j < nvar; j++) {
+			float_swap_array(data[j], results->npoin);
+		}
+		TM_STATS_END(TM_PHASE_SWAP);
+		if (timestamp != NULL) {
+			*timestamp = float_swap(ts);
+		}
+	}
+
+	if (heap) {
+		free(markers);
+		free(expected);
+		free(iov);
+	}
+	return rv;
+}
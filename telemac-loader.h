@@ -26,6 +26,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
 #define TELEMAC_PARSE_H
 
 #include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /*!
  * @defgroup records SELAFIN record structures
  * @brief Data structures corresponding to records in the saved results files
@@ -111,12 +116,32 @@ typedef struct telemac_data {
 
 } telemac_data_t;
 
+//! One file of a restart chain
+
+/*!
+ * Maps a contiguous range of timesteps in a chain on to the timesteps stored
+ * in one file. Leading timesteps that repeat times already covered by
+ * earlier files in the chain are skipped.
+ */
+typedef struct {
+	FILE *file; //!< Open file handle
+	off_t datastart; //!< Offset to start of simulation results in this file
+	uint32_t first; //!< First timestep of the chain stored in this file
+	uint32_t skip; //!< Number of leading timesteps in this file not used
+	uint32_t nt; //!< Number of timesteps used from this file
+} telemac_segment_t;
+
 //! Results file information
 
 /*! 
  * The offsets of different sections within the file represented in *file
  * are stored for re-use in various functions, along with the associated
  * telemac_data_t structure being populated or read from.
+ *
+ * A resfile_t may also represent a restart chain of files sharing the same
+ * mesh (see open_telemac_chain()). In that case *file, meshstart and
+ * datastart refer to the first file in the chain, and timesteps are mapped to
+ * the underlying files using the segment table.
  */
 typedef struct {
 	FILE *file; //!< Open file handle
@@ -124,16 +149,37 @@ typedef struct {
 	off_t datastart; //!< Offset to start of simulation results
 	off_t datasize; //!< Size of simulation data for each timestep
 	telemac_data_t tmdat; //!< telemac_data_t corresponding to this file
+	int nseg; //!< Number of files in restart chain, or 0 for a single file
+	telemac_segment_t *seg; //!< Restart chain segments, or NULL for a single file
+	struct telemac_archive *archive; //!< Compressed archive state, or NULL for a SELAFIN file
+	struct telemac_geom *geom; //!< Element geometry, or NULL if not yet calculated. See telemac_get_geom()
+	struct telemac_adjacency *adj; //!< Mesh adjacency, or NULL if not yet built. See telemac_get_adjacency()
 } resfile_t;
 
 /*! @} */
 
 uint32_t int_swap(const uint32_t input);
 float float_swap(float value);
+void float_swap_array(float *values, size_t n);
 int fortran_read(void* cstruct, size_t csize, size_t num, FILE* fromfile);
+off_t telemac_step_size(const telemac_data_t *results);
 int open_telemac(resfile_t *rfile, int verbose);
+int open_telemac_header(resfile_t *rfile, int verbose);
 int get_telemac_header(resfile_t *rfile, int verbose);
 int get_telemac_mesh(resfile_t *rfile, int verbose);
 float **get_telemac_data(resfile_t *rfile, int timestep, int verbose);
 void free_telemac_data(resfile_t *rfile, float **data);
+int get_telemac_timestamp(resfile_t *rfile, int timestep, float *timestamp);
+int telemac_locate(const resfile_t *rfile, int timestep, FILE **file, off_t *offset);
+int telemac_mesh_hash(FILE *file, off_t meshstart, const telemac_data_t *results, uint64_t *hash);
+int open_telemac_chain(resfile_t *rfile, char **filenames, int nfiles, int verbose);
+float **alloc_telemac_data(const resfile_t *rfile);
+int read_telemac_var(const resfile_t *rfile, int timestep, int var, float *out);
+int read_telemac_var_range(const resfile_t *rfile, int timestep, int var, uint32_t first, uint32_t count, float *out);
+int read_telemac_data(const resfile_t *rfile, int timestep, float **data, float *timestamp);
+void close_telemac(resfile_t *rfile);
+
+#ifdef __cplusplus
+}
+#endif
 #endif // TELEMAC_PARSE_H
@@ -0,0 +1,359 @@
+/******************************************************************************
+telemac-loader - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief C++17 interface to the SELAFIN file reader
+ *
+ * Wraps the reentrant functions of telemac-loader.h in move-only handles,
+ * which release everything they hold when destroyed:
+ *
+ * - telemac::file opens a results file or restart chain and closes it with
+ *   close_telemac(). Its mesh arrays, variable names and timestamps are
+ *   views into the telemac_data_t, without copies.
+ * - telemac::frame holds the buffers for one timestep, allocated once, and
+ *   reads timesteps into them with read_telemac_data().
+ * - telemac::steps, from file::timesteps(), is a range over timesteps,
+ *   reading each one into a single frame, so that a loop over a whole run
+ *   makes no allocations.
+ *
+ * Frames hold values as float (as stored) or double, chosen by their
+ * template parameter; double frames convert each timestep after reading it.
+ * Errors are reported by throwing telemac::error.
+ *
+ * @code
+ * telemac::file f("results.slf");
+ * for (const auto &fr : f.timesteps<double>()) {
+ * 	auto depth = fr[4];
+ * 	// depth[n] is the value at node n at time fr.time()
+ * }
+ * @endcode
+ *
+ * Several frames of the same file may be read at once from different
+ * threads. A file must outlive its frames and ranges. Programs using this
+ * header are linked with the library objects, as the tools are.
+ */
+
+#ifndef TELEMAC_LOADER_HPP
+#define TELEMAC_LOADER_HPP
+
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <sys/types.h>
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+
+#include "telemac-loader.h"
+
+namespace telemac {
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+//! View of a contiguous array
+template <typename T>
+using span = std::span<T>;
+#else
+//! View of a contiguous array, as std::span, which is not available before C++20
+template <typename T>
+class span {
+public:
+	constexpr span() noexcept = default;
+	//! View @p n elements starting at @p data
+	constexpr span(T *data, std::size_t n) noexcept : ptr(data), len(n) {}
+	constexpr T *data() const noexcept { return ptr; }
+	constexpr std::size_t size() const noexcept { return len; }
+	constexpr bool empty() const noexcept { return len == 0; }
+	constexpr T &operator[](std::size_t i) const noexcept { return ptr[i]; }
+	constexpr T *begin() const noexcept { return ptr; }
+	constexpr T *end() const noexcept { return ptr + len; }
+private:
+	T *ptr = nullptr; //!< First element
+	std::size_t len = 0; //!< Number of elements
+};
+#endif
+
+//! Failure to open or read a results file
+class error : public std::runtime_error {
+public:
+	//! Error described by @p what, with the value returned by the loader function
+	error(const std::string &what, int code) : std::runtime_error(what), rc(code) {}
+	//! Value returned by the loader function that failed
+	int code() const noexcept { return rc; }
+private:
+	int rc; //!< Value returned by the loader function
+};
+
+template <typename T> class frame;
+template <typename T> class steps;
+
+//! Open results file or restart chain
+class file {
+public:
+	//! Open a single results file (SELAFIN file or archive)
+	explicit file(const std::string &name, int verbose = 0) : file(std::vector<std::string>{name}, verbose) {}
+
+	//! As file(const std::vector<std::string> &, int), for a braced list of names
+	explicit file(std::initializer_list<std::string> names, int verbose = 0) : file(std::vector<std::string>(names), verbose) {}
+
+	//! Open a restart chain of results files, in time order (see open_telemac_chain())
+	explicit file(const std::vector<std::string> &names, int verbose = 0) : rf(new resfile_t()) {
+		if (names.empty()) {
+			throw error("No results files given", -1);
+		}
+		std::vector<char *> argv;
+		for (const auto &n : names) {
+			argv.push_back(const_cast<char *>(n.c_str()));
+		}
+		int rc = open_telemac_chain(rf.get(), argv.data(), static_cast<int>(argv.size()), verbose);
+		if (rc < 0 || rf->tmdat.state != 2) {
+			throw error("Unable to open " + names[0], rc);
+		}
+		// Timestamps are otherwise only read with the data (as in telemac-parse)
+		std::vector<float *> none(nvar(), nullptr);
+		for (std::size_t t = 0; t < nt(); t++) {
+			rc = read_telemac_data(rf.get(), static_cast<int>(t), none.data(), &rf->tmdat.timestamp[t]);
+			if (rc != 0) {
+				throw error("Unable to read timestep " + std::to_string(t) + " of " + names[0], rc);
+			}
+		}
+	}
+
+	file(file &&) noexcept = default;
+	file &operator=(file &&) noexcept = default;
+	file(const file &) = delete;
+	file &operator=(const file &) = delete;
+
+	//! Underlying results file, for use with the C functions
+	const resfile_t *get() const noexcept { return rf.get(); }
+	//! Header and mesh
+	const telemac_data_t &data() const noexcept { return rf->tmdat; }
+
+	//! Number of nodes
+	std::size_t npoin() const noexcept { return rf->tmdat.npoin; }
+	//! Number of elements
+	std::size_t nelem() const noexcept { return rf->tmdat.nelem; }
+	//! Nodes in each element
+	std::size_t ndp() const noexcept { return rf->tmdat.ndp; }
+	//! Number of variables stored at each timestep
+	std::size_t nvar() const noexcept { return rf->tmdat.nbv_1 + rf->tmdat.nbv_2; }
+	//! Number of timesteps
+	std::size_t nt() const noexcept { return rf->tmdat.nt; }
+
+	//! X coordinate of each node
+	span<const float> x() const noexcept { return {rf->tmdat.X, npoin()}; }
+	//! Y coordinate of each node
+	span<const float> y() const noexcept { return {rf->tmdat.Y, npoin()}; }
+	//! Nodes of each element, ndp() for each, numbered from 1
+	span<const uint32_t> ikle() const noexcept { return {rf->tmdat.ikle, nelem() * ndp()}; }
+	//! Time of each timestep
+	span<const float> times() const noexcept { return {rf->tmdat.timestamp, nt()}; }
+	//! Name and unit of variable @p v, padded with spaces. Quadratic variables have no name and give "(quadratic)".
+	std::string_view var_name(std::size_t v) const {
+		if (v >= nvar()) {
+			throw std::out_of_range("Variable number out of range");
+		}
+		return (v < rf->tmdat.nbv_1 ? std::string_view(rf->tmdat.var_names[v]) : std::string_view("(quadratic)"));
+	}
+
+	//! Buffers for one timestep of every variable
+	template <typename T = float>
+	frame<T> make_frame() const { return frame<T>(*this); }
+
+	//! Timesteps @p first to @p last - 1 (default: every timestep), read in turn into one frame
+	template <typename T = float>
+	steps<T> timesteps(std::size_t first = 0, std::size_t last = SIZE_MAX) const {
+		return steps<T>(*this, first, (last < nt() ? last : nt()));
+	}
+
+	//! As timesteps(), reading only the variables for which @p vars is true
+	template <typename T = float>
+	steps<T> timesteps(const std::vector<bool> &vars, std::size_t first = 0, std::size_t last = SIZE_MAX) const {
+		return steps<T>(*this, vars, first, (last < nt() ? last : nt()));
+	}
+
+private:
+	//! Closes and frees a results file
+	struct closer {
+		void operator()(resfile_t *r) const noexcept {
+			close_telemac(r);
+			delete r;
+		}
+	};
+	std::unique_ptr<resfile_t, closer> rf; //!< Results file, at a fixed address for the frames reading it
+};
+
+//! Values of every variable (or a chosen few) at one timestep
+template <typename T = float>
+class frame {
+	static_assert(std::is_same_v<T, float> || std::is_same_v<T, double>, "Frames hold float or double values");
+public:
+	//! Buffers for every variable of @p f
+	explicit frame(const file &f) : frame(f, std::vector<bool>(f.nvar(), true)) {}
+
+	//! Buffers for the variables of @p f for which @p vars is true. Only those variables are read.
+	frame(const file &f, const std::vector<bool> &vars) : rf(f.get()), npoin(f.npoin()),
+			ptrs(new float *[f.nvar()]()), read(f.nvar()) {
+		std::size_t n = 0;
+		for (std::size_t v = 0; v < f.nvar(); v++) {
+			n += (v < vars.size() && vars[v]);
+		}
+		store.reset(new float[n * npoin]);
+		if constexpr (std::is_same_v<T, double>) {
+			conv.reset(new double[n * npoin]);
+		}
+		std::size_t k = 0;
+		for (std::size_t v = 0; v < f.nvar(); v++) {
+			if (v < vars.size() && vars[v]) {
+				ptrs[v] = &store[k * npoin];
+				read[v] = k++;
+			} else {
+				read[v] = SIZE_MAX;
+			}
+		}
+	}
+
+	frame(frame &&) noexcept = default;
+	frame &operator=(frame &&) noexcept = default;
+	frame(const frame &) = delete;
+	frame &operator=(const frame &) = delete;
+
+	//! Read timestep @p t into this frame, replacing the values held
+	void load(std::size_t t) {
+		int rc = read_telemac_data(rf, static_cast<int>(t), ptrs.get(), &when);
+		if (rc != 0) {
+			step = SIZE_MAX;
+			throw error("Unable to read timestep " + std::to_string(t), rc);
+		}
+		if constexpr (std::is_same_v<T, double>) {
+			for (std::size_t v = 0; v < read.size(); v++) {
+				if (read[v] != SIZE_MAX) {
+					const float *in = ptrs[v];
+					double *out = &conv[read[v] * npoin];
+					for (std::size_t i = 0; i < npoin; i++) {
+						out[i] = in[i];
+					}
+				}
+			}
+		}
+		step = t;
+	}
+
+	//! Values of variable @p v at each node, or an empty span if the variable is not read
+	span<const T> operator[](std::size_t v) const noexcept {
+		if (v >= read.size() || read[v] == SIZE_MAX) {
+			return {};
+		}
+		if constexpr (std::is_same_v<T, double>) {
+			return {&conv[read[v] * npoin], npoin};
+		} else {
+			return {ptrs[v], npoin};
+		}
+	}
+
+	//! Timestep held, or SIZE_MAX if none has been read
+	std::size_t timestep() const noexcept { return step; }
+	//! Time of the timestep held
+	float time() const noexcept { return when; }
+	//! Number of variables in the file
+	std::size_t nvar() const noexcept { return read.size(); }
+	//! Number of nodes
+	std::size_t size() const noexcept { return npoin; }
+	//! Buffers as stored (float), for use with the C functions. Entries for variables not read are NULL.
+	float *const *data() const noexcept { return ptrs.get(); }
+
+private:
+	const resfile_t *rf; //!< Results file read
+	std::size_t npoin; //!< Number of nodes
+	std::unique_ptr<float[]> store; //!< Values as read, one block of npoin for each variable read
+	std::unique_ptr<double[]> conv; //!< Values converted to double (double frames only)
+	std::unique_ptr<float *[]> ptrs; //!< Start of each variable in store, or NULL if not read
+	std::vector<std::size_t> read; //!< Block of each variable in store and conv, or SIZE_MAX if not read
+	std::size_t step = SIZE_MAX; //!< Timestep held
+	float when = 0; //!< Time of the timestep held
+};
+
+//! Range of timesteps, each read in turn into a single frame
+template <typename T = float>
+class steps {
+public:
+	//! Timesteps @p first to @p last - 1 of @p f
+	steps(const file &f, std::size_t first, std::size_t last) : fr(f), first(first), last(last < first ? first : last) {}
+
+	//! Timesteps @p first to @p last - 1 of @p f, reading only the variables for which @p vars is true
+	steps(const file &f, const std::vector<bool> &vars, std::size_t first, std::size_t last)
+		: fr(f, vars), first(first), last(last < first ? first : last) {}
+
+	steps(steps &&) noexcept = default;
+	steps &operator=(steps &&) noexcept = default;
+	steps(const steps &) = delete;
+	steps &operator=(const steps &) = delete;
+
+	//! Position in the range. Moving to a timestep reads it into the range's frame.
+	class iterator {
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = frame<T>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const frame<T> *;
+		using reference = const frame<T> &;
+
+		iterator(steps *r, std::size_t t) : r(r), t(t) { fetch(); }
+		reference operator*() const noexcept { return r->fr; }
+		pointer operator->() const noexcept { return &r->fr; }
+		iterator &operator++() {
+			t++;
+			fetch();
+			return *this;
+		}
+		bool operator==(const iterator &o) const noexcept { return t == o.t; }
+		bool operator!=(const iterator &o) const noexcept { return t != o.t; }
+	private:
+		//! Read the current timestep, unless at the end or already held
+		void fetch() {
+			if (t < r->last && r->fr.timestep() != t) {
+				r->fr.load(t);
+			}
+		}
+		steps *r; //!< Range
+		std::size_t t; //!< Timestep
+	};
+
+	iterator begin() { return iterator(this, first); }
+	iterator end() { return iterator(this, last); }
+	//! Number of timesteps in the range
+	std::size_t size() const noexcept { return last - first; }
+
+private:
+	frame<T> fr; //!< Buffers the timesteps are read into
+	std::size_t first; //!< First timestep
+	std::size_t last; //!< One past the last timestep
+};
+
+} // namespace telemac
+
+#endif // TELEMAC_LOADER_HPP
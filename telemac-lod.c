@@ -0,0 +1,462 @@
+/******************************************************************************
+telemac-lod - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <libxml/xmlwriter.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-layers.h"
+#include "telemac-writer.h"
+#include "telemac-simplify.h"
+
+/*!
+ * @file
+ * @brief Simplified preview of results
+ *
+ * Simplifies the mesh once (see telemac-simplify.h) and then writes each
+ * timestep on the simplified mesh, copying each value from the original node
+ * kept at each simplified node. Results are written as a SELAFIN file, or as
+ * VTU files with a PVD collection for Paraview.
+ *
+ * Returns zero on success and EXIT_FAILURE if an error occurs.
+ */
+
+static int write_vtu(const char *name, const telemac_data_t *coarse, const float *z, float **data) {
+/*!
+ * @brief Write one timestep of the simplified mesh as a VTU file
+ *
+ * @param name	Output file name
+ * @param coarse	Simplified mesh, with variable names
+ * @param z	Node heights, or NULL for a flat mesh
+ * @param data	Values of each variable at each node
+ * @returns 0 on success, -1 on failure
+ */
+	TM_STATS_BEGIN(TM_PHASE_FORMAT);
+	xmlTextWriterPtr vtuFile = xmlNewTextWriterFilename(name, 0);
+	if (vtuFile == NULL) {
+		TM_STATS_END(TM_PHASE_FORMAT);
+		return -1;
+	}
+	xmlTextWriterSetIndent(vtuFile, 1);
+	xmlTextWriterStartDocument(vtuFile, NULL, "UTF-8", NULL);
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "VTKFile");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "UnstructuredGrid");
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "UnstructuredGrid");
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "Piece");
+	xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "NumberOfPoints", "%u", coarse->npoin);
+	xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "NumberOfCells", "%u", coarse->nelem);
+
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "Points");
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "Coordinates");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "NumberOfComponents", BAD_CAST "3");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+	for (uint32_t p = 0; p < coarse->npoin; p++) {
+		xmlTextWriterWriteFormatString(vtuFile, "%+.10f %+.10f %+.10f\n", coarse->X[p], coarse->Y[p], (z != NULL ? z[p] : 0));
+	}
+	xmlTextWriterEndElement(vtuFile); //DataArray
+	xmlTextWriterEndElement(vtuFile); //Points
+
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "Cells");
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "connectivity");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Int32");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+	for (uint32_t e = 0; e < coarse->nelem; e++) {
+		const uint32_t *ik = &coarse->ikle[3 * (size_t)e];
+		xmlTextWriterWriteFormatString(vtuFile, "%u %u %u \n", ik[0] - 1, ik[1] - 1, ik[2] - 1);
+	}
+	xmlTextWriterEndElement(vtuFile); //DataArray
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "types");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Int32");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+	for (uint32_t e = 0; e < coarse->nelem; e++) {
+		xmlTextWriterWriteString(vtuFile, BAD_CAST "5 ");
+	}
+	xmlTextWriterEndElement(vtuFile); //DataArray
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "offsets");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Int32");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+	for (uint32_t e = 0; e < coarse->nelem; e++) {
+		xmlTextWriterWriteFormatString(vtuFile, "%u ", 3 * (e + 1));
+	}
+	xmlTextWriterEndElement(vtuFile); //DataArray
+	xmlTextWriterEndElement(vtuFile); //Cells
+
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "PointData");
+	for (uint32_t d = 0; d < coarse->nbv_1; d++) {
+		xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+		xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "Name", "%s", coarse->var_names[d]);
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+		for (uint32_t p = 0; p < coarse->npoin; p++) {
+			xmlTextWriterWriteFormatString(vtuFile, "%+.10f ", data[d][p]);
+		}
+		xmlTextWriterEndElement(vtuFile); //DataArray
+	}
+	xmlTextWriterEndElement(vtuFile); //PointData
+	xmlTextWriterEndElement(vtuFile); //Piece
+	xmlTextWriterEndElement(vtuFile); //UnstructuredGrid
+	xmlTextWriterEndElement(vtuFile); //VTKFile
+	TM_STATS_END(TM_PHASE_FORMAT);
+
+	TM_STATS_BEGIN(TM_PHASE_WRITE);
+	int rv = xmlTextWriterEndDocument(vtuFile);
+	xmlFreeTextWriter(vtuFile);
+	TM_STATS_END(TM_PHASE_WRITE);
+	if (rv < 0) {
+		return -1;
+	}
+	telemac_stats_add_file(name);
+	return 0;
+}
+
+static int write_pvd(const char *name, const char *base, const int *steps, const float *times, int nsteps) {
+/*!
+ * @brief Write a PVD collection of the VTU files for each timestep
+ * @returns 0 on success, -1 on failure
+ */
+	xmlTextWriterPtr pvdFile = xmlNewTextWriterFilename(name, 0);
+	if (pvdFile == NULL) {
+		return -1;
+	}
+	xmlTextWriterSetIndent(pvdFile, 1);
+	xmlTextWriterStartDocument(pvdFile, NULL, "UTF-8", NULL);
+	xmlTextWriterStartElement(pvdFile, BAD_CAST "VTKFile");
+	xmlTextWriterWriteAttribute(pvdFile, BAD_CAST "type", BAD_CAST "Collection");
+	xmlTextWriterStartElement(pvdFile, BAD_CAST "Collection");
+	for (int i = 0; i < nsteps; i++) {
+		xmlTextWriterStartElement(pvdFile, BAD_CAST "DataSet");
+		xmlTextWriterWriteFormatAttribute(pvdFile, BAD_CAST "timestep", "%.10f", times[i]);
+		xmlTextWriterWriteAttribute(pvdFile, BAD_CAST "part", BAD_CAST "0");
+		xmlTextWriterWriteFormatAttribute(pvdFile, BAD_CAST "file", "%s.lod.t%d.vtu", base, steps[i]);
+		xmlTextWriterEndElement(pvdFile); //DataSet
+	}
+	xmlTextWriterEndElement(pvdFile); //Collection
+	xmlTextWriterEndElement(pvdFile); //VTKFile
+	int rv = xmlTextWriterEndDocument(pvdFile);
+	xmlFreeTextWriter(pvdFile);
+	if (rv < 0) {
+		return -1;
+	}
+	telemac_stats_add_file(name);
+	return 0;
+}
+
+static int write_map(const char *name, const telemac_simplified_t *simple) {
+/*!
+ * @brief Write the original node kept at each simplified node, as "node\\toriginal" lines
+ * @returns 0 on success, -1 on failure
+ */
+	FILE *file = fopen(name, "w");
+	if (file == NULL) {
+		return -1;
+	}
+	fprintf(file, "%u\n", simple->npoin);
+	for (uint32_t k = 0; k < simple->npoin; k++) {
+		fprintf(file, "%u\t%u\n", k, simple->node[k]);
+	}
+	if (fclose(file) != 0) {
+		return -1;
+	}
+	telemac_stats_add_file(name);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	char *outputdir = ".";
+	bool verbose = false;
+	bool vtu = false;
+	bool map = false;
+	long target = -1;
+	double ratio = 0.01;
+	int zvar = -1;
+	int step = -1;
+	int every = 1;
+	int plane = -1;
+
+	const char *usage = "Usage: %s [-n elements|-r ratio] [-z n] [-t step] [-f n] [-p plane] [-P] [-m] [-o dir] [-v] [--stats[=json]] <filename> [filename...]\n"
+		"\t-n\tNumber of triangles in the simplified mesh\n"
+		"\t-r\tNumber of triangles as a fraction of the original (default: 0.01)\n"
+		"\t-z\tVariable giving the height of the surface to preserve, such as the bottom (default: flat)\n"
+		"\t-t\tWrite a single timestep (default: all)\n"
+		"\t-f\tWrite every n^th timestep\n"
+		"\t-p\tPlane of 3D results (0 = bottom, default -1 = surface)\n"
+		"\t-P\tWrite VTU files and a PVD file for Paraview instead of a SELAFIN file\n"
+		"\t-m\tWrite the original node for each simplified node to a text file\n"
+		"\t-o\tOutput directory\n"
+		"\t-v\tVerbose output\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "n:r:z:t:f:p:Pmo:v")) != -1) {
+		switch (go) {
+			case 'n':
+				target = atol(optarg);
+				break;
+			case 'r':
+				ratio = strtod(optarg, NULL);
+				break;
+			case 'z':
+				zvar = atoi(optarg);
+				break;
+			case 't':
+				step = atoi(optarg);
+				break;
+			case 'f':
+				every = atoi(optarg);
+				break;
+			case 'p':
+				plane = atoi(optarg);
+				break;
+			case 'P':
+				vtu = true;
+				break;
+			case 'm':
+				map = true;
+				break;
+			case 'o':
+				outputdir = optarg;
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (every < 1 || !(ratio > 0 && ratio <= 1) || target == 0 || argc - optind < 1) {
+		fprintf(stderr, "Must give a file (or restart chain of files) to process and a positive target size\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	resfile_t rfs = {NULL, 0, 0, 0};
+	int rval = open_telemac_chain(&rfs, &argv[optind], argc - optind, false);
+	if (rfs.file == NULL || rval < 0) {
+		fprintf(stderr, "Unable to open %s (%d)\n", argv[optind], rval);
+		return EXIT_FAILURE;
+	}
+	telemac_data_t *mesh = &rfs.tmdat;
+	int nvar = mesh->nbv_1;
+
+	if (zvar >= nvar) {
+		fprintf(stderr, "Variable %d out of range (%d variables)\n", zvar, nvar);
+		return EXIT_FAILURE;
+	}
+	if (step >= (int)mesh->nt) {
+		fprintf(stderr, "Timestep %d out of range (0 - %d)\n", step, mesh->nt - 1);
+		return EXIT_FAILURE;
+	}
+	telemac_layers_t layers;
+	if (telemac_get_layers(mesh, &layers) != 0) {
+		return EXIT_FAILURE;
+	}
+	plane = (plane < 0 ? plane + (int)layers.nplan : plane);
+	if (plane < 0 || plane >= (int)layers.nplan) {
+		fprintf(stderr, "Plane out of range (%u planes)\n", layers.nplan);
+		return EXIT_FAILURE;
+	}
+
+	float *fine = calloc(sizeof(float), layers.npoin2 + 1);
+	if (fine == NULL) {
+		perror("Allocating values");
+		return EXIT_FAILURE;
+	}
+	int first = (step < 0 ? 0 : step);
+	if (zvar >= 0) {
+		int rv = (layers.nplan > 1 ? telemac_read_plane(&rfs, &layers, first, zvar, plane, fine)
+				: read_telemac_var(&rfs, first, zvar, fine));
+		if (rv != 0) {
+			fprintf(stderr, "Unable to read variable %d at timestep %d\n", zvar, first);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Simplify once, then gather values for every timestep
+	uint32_t ntri = (mesh->ndp == 4 ? 2 : 1) * layers.nelem2;
+	if (target < 0) {
+		target = (long)(ratio * ntri + 0.5);
+	}
+	telemac_simplified_t simple;
+	if (telemac_simplify(mesh, (zvar >= 0 ? fine : NULL), (target > 0 ? target : 1), &simple) != 0) {
+		fprintf(stderr, "Unable to simplify mesh\n");
+		return EXIT_FAILURE;
+	}
+	fprintf(stdout, "Simplified %u triangles to %u, keeping %u of %u nodes\n", ntri, simple.ntri, simple.npoin, layers.npoin2);
+
+	// Header and mesh of the simplified results
+	telemac_data_t coarse = *mesh;
+	coarse.nbv_2 = 0;
+	coarse.nelem = simple.ntri;
+	coarse.npoin = simple.npoin;
+	coarse.ndp = 3;
+	coarse.iparam[6] = 0;
+	coarse.ikle = calloc(sizeof(uint32_t), 3 * (size_t)simple.ntri + 1);
+	coarse.ipobo = calloc(sizeof(uint32_t), simple.npoin + 1);
+	coarse.X = calloc(sizeof(float), simple.npoin + 1);
+	coarse.Y = calloc(sizeof(float), simple.npoin + 1);
+	float **data = calloc(sizeof(float *), nvar + 1);
+	float *times = calloc(sizeof(float), mesh->nt + 1);
+	int *steps = calloc(sizeof(int), mesh->nt + 1);
+	if (coarse.ikle == NULL || coarse.ipobo == NULL || coarse.X == NULL || coarse.Y == NULL || data == NULL
+			|| times == NULL || steps == NULL) {
+		perror("Allocating simplified mesh");
+		return EXIT_FAILURE;
+	}
+	for (uint32_t e = 0; e < simple.ntri; e++) {
+		for (int k = 0; k < 3; k++) {
+			coarse.ikle[3 * (size_t)e + k] = simple.tri[k][e] + 1;
+		}
+	}
+	for (uint32_t k = 0; k < simple.npoin; k++) {
+		uint32_t n = simple.node[k];
+		coarse.X[k] = mesh->X[n];
+		coarse.Y[k] = mesh->Y[n];
+		coarse.ipobo[k] = (mesh->ipobo != NULL ? mesh->ipobo[n] : 0);
+	}
+	for (int j = 0; j < nvar; j++) {
+		data[j] = calloc(sizeof(float), simple.npoin + 1);
+		if (data[j] == NULL) {
+			perror("Allocating simplified mesh");
+			return EXIT_FAILURE;
+		}
+	}
+
+	char *base = strdup(argv[optind]);
+	char *basefilename = NULL;
+	asprintf(&basefilename, "%s/%s", outputdir, basename(base));
+
+	if (map) {
+		char *name = NULL;
+		asprintf(&name, "%s.lod.map.txt", basefilename);
+		if (write_map(name, &simple) != 0) {
+			perror(name);
+			return EXIT_FAILURE;
+		}
+		free(name);
+	}
+
+	char *outname = NULL;
+	FILE *outfile = NULL;
+	if (!vtu) {
+		asprintf(&outname, "%s.lod.slf", basefilename);
+		outfile = fopen(outname, "wb");
+		if (outfile == NULL) {
+			perror("Unable to open output file");
+			return EXIT_FAILURE;
+		}
+		TM_STATS_BEGIN(TM_PHASE_WRITE);
+		rval = write_telemac_header(outfile, &coarse);
+		TM_STATS_END(TM_PHASE_WRITE);
+		if (rval != 0) {
+			perror("Writing output");
+			return EXIT_FAILURE;
+		}
+	}
+
+	int nsteps = 0;
+	for (int t = first; t < (step < 0 ? (int)mesh->nt : step + 1); t += every) {
+		if (verbose) {
+			fprintf(stdout, "Writing timestep %d\n", t);
+		}
+		if (get_telemac_timestamp(&rfs, t, &times[nsteps]) != 0) {
+			fprintf(stderr, "Unable to read timestep %d\n", t);
+			return EXIT_FAILURE;
+		}
+		for (int j = 0; j < nvar; j++) {
+			int rv = (layers.nplan > 1 ? telemac_read_plane(&rfs, &layers, t, j, plane, fine)
+					: read_telemac_var(&rfs, t, j, fine));
+			if (rv != 0) {
+				fprintf(stderr, "Unable to read variable %d at timestep %d\n", j, t);
+				return EXIT_FAILURE;
+			}
+			for (uint32_t k = 0; k < simple.npoin; k++) {
+				data[j][k] = fine[simple.node[k]];
+			}
+		}
+
+		if (vtu) {
+			char *name = NULL;
+			asprintf(&name, "%s.lod.t%d.vtu", basefilename, t);
+			if (write_vtu(name, &coarse, (zvar >= 0 ? data[zvar] : NULL), data) != 0) {
+				fprintf(stderr, "Unable to write %s\n", name);
+				return EXIT_FAILURE;
+			}
+			free(name);
+		} else {
+			TM_STATS_BEGIN(TM_PHASE_WRITE);
+			rval = write_telemac_timestep(outfile, &coarse, times[nsteps], data);
+			TM_STATS_END(TM_PHASE_WRITE);
+			if (rval != 0) {
+				perror("Writing output");
+				return EXIT_FAILURE;
+			}
+		}
+		steps[nsteps++] = t;
+	}
+
+	if (vtu) {
+		asprintf(&outname, "%s.lod.pvd", basefilename);
+		if (write_pvd(outname, basename(base), steps, times, nsteps) != 0) {
+			fprintf(stderr, "Unable to write %s\n", outname);
+			return EXIT_FAILURE;
+		}
+	} else {
+		if (fclose(outfile) != 0) {
+			perror("Writing output");
+			return EXIT_FAILURE;
+		}
+		telemac_stats_add_file(outname);
+	}
+	fprintf(stdout, "Wrote %d timesteps to %s\n", nsteps, outname);
+
+	for (int j = 0; j < nvar; j++) {
+		free(data[j]);
+	}
+	free(data);
+	free(times);
+	free(steps);
+	free(fine);
+	free(coarse.ikle);
+	free(coarse.ipobo);
+	free(coarse.X);
+	free(coarse.Y);
+	free(outname);
+	free(basefilename);
+	free(base);
+	telemac_simplified_free(&simple);
+	close_telemac(&rfs);
+	return EXIT_SUCCESS;
+}
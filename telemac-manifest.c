@@ -0,0 +1,309 @@
+/******************************************************************************
+telemac-manifest - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "telemac-manifest.h"
+#include "telemac-stats.h"
+
+/*!
+ * @file
+ * @brief Records of exported timesteps, for incremental exports
+ */
+
+//! Size of the buffer used to checksum timesteps
+#define MANIFEST_BUFSIZE (1 << 20)
+
+//! FNV-1a offset basis
+#define FNV_BASIS 0xcbf29ce484222325ULL
+
+//! FNV-1a prime
+#define FNV_PRIME 0x100000001b3ULL
+
+static uint64_t hash_words(uint64_t h, const void *data, size_t len) {
+//! Continue an FNV-1a hash over len bytes, taking 8 bytes at a time
+	const unsigned char *p = data;
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t w = 0;
+		memcpy(&w, &p[i], 8);
+		h = (h ^ w) * FNV_PRIME;
+	}
+	for (; i < len; i++) {
+		h = (h ^ p[i]) * FNV_PRIME;
+	}
+	return h;
+}
+
+int telemac_manifest_open(telemac_manifest_t *mf, const char *path, const resfile_t *rfile, const char *settings) {
+/*!
+ * @brief Read the manifest for an export, if it exists
+ *
+ * Entries are discarded if the manifest was written for a different mesh or
+ * different settings, or for timesteps the source no longer has.
+ *
+ * @param mf	Manifest to set up. Release with telemac_manifest_close().
+ * @param path	Manifest file
+ * @param rfile	Opened source file or restart chain
+ * @param settings	Description of the export options which affect the output
+ * @retval 0	Success (including when there is no manifest yet)
+ * @retval -1	Manifest exists but is not a manifest
+ * @retval -2	Memory could not be allocated
+ * @retval -3	Source mesh could not be read
+ */
+	const telemac_data_t *results = &rfile->tmdat;
+	memset(mf, 0, sizeof(*mf));
+	mf->path = strdup(path);
+	mf->nt = results->nt;
+	mf->step = calloc(sizeof(telemac_manifest_step_t), mf->nt + 1);
+	if (mf->path == NULL || mf->step == NULL) {
+		perror("telemac_manifest_open");
+		telemac_manifest_close(mf);
+		return -2;
+	}
+	TM_STATS_ALLOC(sizeof(telemac_manifest_step_t) * mf->nt);
+	clock_gettime(CLOCK_MONOTONIC, &mf->saved);
+
+	uint64_t mesh = 0;
+	if (rfile->archive == NULL) {
+		if (telemac_mesh_hash(rfile->file, rfile->meshstart, results, &mesh) != 0) {
+			fprintf(stderr, "telemac_manifest_open: unable to read mesh\n");
+			telemac_manifest_close(mf);
+			return -3;
+		}
+	} else {
+		mesh = hash_words(FNV_BASIS, results->X, sizeof(float) * results->npoin);
+		mesh = hash_words(mesh, results->Y, sizeof(float) * results->npoin);
+		mesh = hash_words(mesh, results->ikle, sizeof(uint32_t) * results->nelem * results->ndp);
+	}
+	mf->key = hash_words(mesh, settings, strlen(settings));
+
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return 0;
+	}
+	char *line = NULL;
+	size_t llen = 0;
+	ssize_t r = getline(&line, &llen, file);
+	if (r < 0 || strncmp(line, TELEMAC_MANIFEST_MAGIC, strlen(TELEMAC_MANIFEST_MAGIC)) != 0) {
+		fprintf(stderr, "%s is not a manifest\n", path);
+		free(line);
+		fclose(file);
+		return -1;
+	}
+	uint64_t key = 0;
+	if (getline(&line, &llen, file) < 0 || (key = strtoull(line, NULL, 16)) != mf->key) {
+		fprintf(stdout, "Mesh or settings changed since %s was written: exporting every timestep\n", path);
+		free(line);
+		fclose(file);
+		return 0;
+	}
+	while (getline(&line, &llen, file) > 0) {
+		unsigned long t = 0;
+		float time = 0;
+		uint64_t hash = 0;
+		uint64_t size = 0;
+		if (sscanf(line, "%lu\t%f\t%" SCNx64 "\t%" SCNu64, &t, &time, &hash, &size) != 4) {
+			fprintf(stderr, "Skipping malformed manifest entry\n");
+			continue;
+		}
+		if (t < mf->nt) {
+			telemac_manifest_set(mf, t, time, hash, size);
+		}
+	}
+	free(line);
+	fclose(file);
+	return 0;
+}
+
+bool telemac_manifest_current(const telemac_manifest_t *mf, int t, uint64_t hash, uint64_t size) {
+/*!
+ * @brief Check whether a timestep has already been exported from the same data
+ *
+ * @param mf	Manifest
+ * @param t	Timestep
+ * @param hash	Checksum of the timestep now (see telemac_step_hash())
+ * @param size	Total size of the timestep's output files now (see telemac_output_size())
+ * @returns	true if the timestep need not be written again
+ */
+	if (t < 0 || (uint32_t)t >= mf->nt || hash == 0 || size == UINT64_MAX) {
+		return false;
+	}
+	const telemac_manifest_step_t *st = &mf->step[t];
+	return (st->done && st->hash == hash && st->size == size);
+}
+
+void telemac_manifest_set(telemac_manifest_t *mf, int t, float time, uint64_t hash, uint64_t size) {
+/*!
+ * @brief Record that a timestep has been exported
+ *
+ * @param mf	Manifest
+ * @param t	Timestep
+ * @param time	Time of the timestep
+ * @param hash	Checksum of the timestep (see telemac_step_hash())
+ * @param size	Total size of the files written (see telemac_output_size())
+ */
+	if (t < 0 || (uint32_t)t >= mf->nt) {
+		return;
+	}
+	telemac_manifest_step_t *st = &mf->step[t];
+	st->done = (hash != 0 && size != UINT64_MAX);
+	st->time = time;
+	st->hash = hash;
+	st->size = size;
+}
+
+int telemac_manifest_save(telemac_manifest_t *mf, bool force) {
+/*!
+ * @brief Write the manifest, replacing any existing file atomically
+ *
+ * @param mf	Manifest
+ * @param force	Write now. Otherwise, the manifest is only written if
+ *		TELEMAC_MANIFEST_INTERVAL seconds have passed since the last save.
+ * @retval 0	Success, or not yet due
+ * @retval -1	Manifest could not be written
+ */
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!force && now.tv_sec - mf->saved.tv_sec < TELEMAC_MANIFEST_INTERVAL) {
+		return 0;
+	}
+	mf->saved = now;
+
+	char *tmpname = NULL;
+	if (asprintf(&tmpname, "%s.tmp", mf->path) < 0) {
+		return -1;
+	}
+	FILE *file = fopen(tmpname, "w");
+	if (file == NULL) {
+		perror("Unable to open manifest for writing");
+		free(tmpname);
+		return -1;
+	}
+	fprintf(file, "%s\n%016" PRIx64 "\n", TELEMAC_MANIFEST_MAGIC, mf->key);
+	for (uint32_t t = 0; t < mf->nt; t++) {
+		const telemac_manifest_step_t *st = &mf->step[t];
+		if (st->done) {
+			fprintf(file, "%u\t%.9g\t%016" PRIx64 "\t%" PRIu64 "\n", t, st->time, st->hash, st->size);
+		}
+	}
+	if (fclose(file) != 0 || rename(tmpname, mf->path) != 0) {
+		perror("Unable to save manifest");
+		unlink(tmpname);
+		free(tmpname);
+		return -1;
+	}
+	free(tmpname);
+	return 0;
+}
+
+void telemac_manifest_close(telemac_manifest_t *mf) {
+/*!
+ * @brief Release a manifest, without saving it
+ * @param mf	Manifest
+ */
+	free(mf->path);
+	free(mf->step);
+	memset(mf, 0, sizeof(*mf));
+}
+
+uint64_t telemac_step_hash(const resfile_t *rfile, int t) {
+/*!
+ * @brief Checksum the records of a timestep
+ *
+ * Computes an FNV-1a hash, taken 8 bytes at a time, of the raw timestamp
+ * and variable records of the timestep. For compressed archives, the
+ * decoded values are hashed instead.
+ *
+ * @param rfile	Opened results file or restart chain
+ * @param t	Timestep
+ * @returns	Checksum, or 0 if the timestep could not be read
+ */
+	const telemac_data_t *results = &rfile->tmdat;
+	uint64_t h = FNV_BASIS;
+	if (rfile->archive != NULL) {
+		float **data = alloc_telemac_data(rfile);
+		float ts = 0;
+		if (data == NULL || read_telemac_data(rfile, t, data, &ts) != 0) {
+			if (data != NULL) {
+				free_telemac_data((resfile_t *)rfile, data);
+			}
+			return 0;
+		}
+		h = hash_words(h, &ts, sizeof(float));
+		for (uint32_t j = 0; j < results->nbv_1 + results->nbv_2; j++) {
+			h = hash_words(h, data[j], sizeof(float) * results->npoin);
+		}
+		free_telemac_data((resfile_t *)rfile, data);
+		return h;
+	}
+
+	FILE *file = NULL;
+	off_t offset = 0;
+	if (telemac_locate(rfile, t, &file, &offset) != 0) {
+		return 0;
+	}
+	char *buf = malloc(MANIFEST_BUFSIZE);
+	if (buf == NULL) {
+		perror("telemac_step_hash");
+		return 0;
+	}
+	off_t remaining = rfile->datasize;
+	TM_STATS_BEGIN(TM_PHASE_READ);
+	while (remaining > 0) {
+		size_t want = (remaining < MANIFEST_BUFSIZE ? (size_t)remaining : MANIFEST_BUFSIZE);
+		ssize_t got = pread(fileno(file), buf, want, offset);
+		TM_STATS_ADD(TM_COUNT_READ_CALLS, 1);
+		if (got != (ssize_t)want) {
+			TM_STATS_END(TM_PHASE_READ);
+			free(buf);
+			return 0;
+		}
+		TM_STATS_ADD(TM_COUNT_BYTES_READ, got);
+		h = hash_words(h, buf, want);
+		offset += want;
+		remaining -= want;
+	}
+	TM_STATS_END(TM_PHASE_READ);
+	free(buf);
+	return (h != 0 ? h : 1);
+}
+
+uint64_t telemac_output_size(char *const *files, int nfiles) {
+/*!
+ * @brief Total size of a set of output files
+ * @param files	File names
+ * @param nfiles	Number of files
+ * @returns	Total size in bytes, or UINT64_MAX if any file does not exist
+ */
+	uint64_t total = 0;
+	for (int i = 0; i < nfiles; i++) {
+		struct stat buf;
+		if (stat(files[i], &buf) != 0) {
+			return UINT64_MAX;
+		}
+		total += buf.st_size;
+	}
+	return total;
+}
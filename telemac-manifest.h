@@ -0,0 +1,86 @@
+/******************************************************************************
+telemac-manifest - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Records of exported timesteps, for incremental exports
+ */
+
+#ifndef TELEMAC_MANIFEST_H
+#define TELEMAC_MANIFEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "telemac-loader.h"
+
+/*!
+ * @defgroup manifest Incremental exports
+ * @brief Skip timesteps which have already been exported
+ *
+ * A manifest records, for each timestep written by an export, a checksum of
+ * the timestep's records in the source file and the total size of the files
+ * written for it. When the export is run again, a timestep is written only
+ * if it is missing from the manifest, its checksum has changed, or its
+ * output files are missing or have changed size. Timesteps appended to the
+ * source since the last run are therefore the only ones written.
+ *
+ * The manifest also holds a key made from the source mesh and the export
+ * settings, and is discarded if either changes. It is saved atomically
+ * (written to a temporary file and renamed) at intervals during the export,
+ * so an interrupted export can be resumed.
+ *
+ * The manifest is a text file: a header line, the key in hexadecimal, then
+ * one line per exported timestep of the form `t<TAB>time<TAB>checksum<TAB>size`.
+ * @{
+ */
+
+//! First line of a manifest file
+#define TELEMAC_MANIFEST_MAGIC "#telemac-manifest 1"
+
+//! Minimum interval between saves of a manifest during an export, in seconds
+#define TELEMAC_MANIFEST_INTERVAL 1
+
+//! Manifest entry for one timestep
+typedef struct {
+	bool done; //!< Set if the timestep has been exported
+	float time; //!< Time of the timestep
+	uint64_t hash; //!< Checksum of the timestep's records (see telemac_step_hash())
+	uint64_t size; //!< Total size of the files written for the timestep
+} telemac_manifest_step_t;
+
+//! Exported timesteps of one export
+typedef struct {
+	char *path; //!< Manifest file
+	uint64_t key; //!< Hash of the source mesh and export settings
+	uint32_t nt; //!< Number of timesteps in the source
+	telemac_manifest_step_t *step; //!< Entry for each timestep
+	struct timespec saved; //!< Time of the last save
+} telemac_manifest_t;
+
+int telemac_manifest_open(telemac_manifest_t *mf, const char *path, const resfile_t *rfile, const char *settings);
+bool telemac_manifest_current(const telemac_manifest_t *mf, int t, uint64_t hash, uint64_t size);
+void telemac_manifest_set(telemac_manifest_t *mf, int t, float time, uint64_t hash, uint64_t size);
+int telemac_manifest_save(telemac_manifest_t *mf, bool force);
+void telemac_manifest_close(telemac_manifest_t *mf);
+uint64_t telemac_step_hash(const resfile_t *rfile, int t);
+uint64_t telemac_output_size(char *const *files, int nfiles);
+
+/*! @} */
+#endif // TELEMAC_MANIFEST_H
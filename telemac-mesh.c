@@ -0,0 +1,707 @@
+/******************************************************************************
+telemac-mesh - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "telemac-mesh.h"
+#include "telemac-layers.h"
+#include "telemac-thread.h"
+#include "telemac-stats.h"
+
+/*!
+ * @file
+ * @brief Mesh adjacency and connected region labelling
+ *
+ * The node to element lists are built by counting, a prefix sum and a fill.
+ * Element neighbours are then found for each element in parallel by
+ * gathering the elements around its nodes and keeping those that appear
+ * often enough to share an edge or face.
+ *
+ * Regions are labelled with a lock-free union-find: each element points
+ * towards a representative with a lower number, and roots are joined with an
+ * atomic compare-and-swap, so every worker can merge neighbours at once.
+ */
+
+//! Number of elements handled by each call to a task
+#define MESH_CHUNK 4096
+
+//! Arguments for the element neighbour tasks
+typedef struct {
+	const telemac_data_t *results; //!< Mesh
+	telemac_adjacency_t *adj; //!< Adjacency being built
+	uint32_t **scratch; //!< Per-thread candidate lists
+	uint32_t shared; //!< Nodes two elements must share to be neighbours
+	bool fill; //!< False to count neighbours, true to store them
+} nbr_work_t;
+
+static int nbr_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: count or store the neighbours of a range of elements
+	nbr_work_t *w = (nbr_work_t *)ctx;
+	const telemac_adjacency_t *adj = w->adj;
+	const uint32_t ndp = w->results->ndp;
+	uint32_t *cand = w->scratch[thread];
+
+	for (size_t e = start; e < end; e++) {
+		const uint32_t *ik = &w->results->ikle[e * ndp];
+		uint32_t nc = 0;
+		for (uint32_t k = 0; k < ndp; k++) {
+			uint32_t n = ik[k] - 1;
+			for (uint32_t i = adj->node_start[n]; i < adj->node_start[n + 1]; i++) {
+				if (adj->node_elem[i] != e) {
+					cand[nc++] = adj->node_elem[i];
+				}
+			}
+		}
+		// Short lists: insertion sort, then count repeats
+		for (uint32_t i = 1; i < nc; i++) {
+			uint32_t c = cand[i];
+			uint32_t j = i;
+			for (; j > 0 && cand[j - 1] > c; j--) {
+				cand[j] = cand[j - 1];
+			}
+			cand[j] = c;
+		}
+		uint32_t found = 0;
+		for (uint32_t i = 0; i < nc; ) {
+			uint32_t j = i;
+			while (j < nc && cand[j] == cand[i]) {
+				j++;
+			}
+			if (j - i >= w->shared) {
+				if (w->fill) {
+					adj->elem_nbr[adj->elem_start[e] + found] = cand[i];
+				}
+				found++;
+			}
+			i = j;
+		}
+		if (!w->fill) {
+			adj->elem_start[e + 1] = found;
+		}
+	}
+	return 0;
+}
+
+static telemac_adjacency_t *adjacency_build(const telemac_data_t *results, int nthreads) {
+//! Build node and element adjacency for the mesh in results
+	telemac_adjacency_t *adj = calloc(sizeof(telemac_adjacency_t), 1);
+	if (adj == NULL) {
+		perror("Allocating mesh adjacency");
+		return NULL;
+	}
+	adj->npoin = results->npoin;
+	adj->nelem = results->nelem;
+	size_t nref = (size_t)results->nelem * results->ndp;
+	adj->node_start = calloc(sizeof(uint32_t), results->npoin + 1);
+	adj->node_elem = calloc(sizeof(uint32_t), (nref ? nref : 1));
+	adj->elem_start = calloc(sizeof(uint32_t), results->nelem + 1);
+	if (adj->node_start == NULL || adj->node_elem == NULL || adj->elem_start == NULL) {
+		perror("Allocating mesh adjacency");
+		telemac_adjacency_free(adj);
+		return NULL;
+	}
+
+	// Node to element: count, prefix sum, then fill in element order
+	for (size_t i = 0; i < nref; i++) {
+		uint32_t n = results->ikle[i] - 1;
+		if (n >= results->npoin) {
+			fprintf(stderr, "Mesh adjacency: element %zu refers to node %u (of %u)\n", i / results->ndp, n + 1, results->npoin);
+			telemac_adjacency_free(adj);
+			return NULL;
+		}
+		adj->node_start[n + 1]++;
+	}
+	uint32_t maxdeg = 0;
+	for (uint32_t n = 0; n < results->npoin; n++) {
+		maxdeg = (adj->node_start[n + 1] > maxdeg ? adj->node_start[n + 1] : maxdeg);
+		adj->node_start[n + 1] += adj->node_start[n];
+	}
+	uint32_t *next = calloc(sizeof(uint32_t), (results->npoin ? results->npoin : 1));
+	if (next == NULL) {
+		perror("Allocating mesh adjacency");
+		telemac_adjacency_free(adj);
+		return NULL;
+	}
+	memcpy(next, adj->node_start, sizeof(uint32_t) * results->npoin);
+	for (size_t i = 0; i < nref; i++) {
+		uint32_t n = results->ikle[i] - 1;
+		adj->node_elem[next[n]++] = i / results->ndp;
+	}
+	free(next);
+
+	// Element to element, in parallel over elements
+	if (nthreads < 1) {
+		nthreads = telemac_default_threads();
+	}
+	nbr_work_t w = {results, adj, calloc(sizeof(uint32_t *), nthreads), (results->ndp == 6 ? 3 : 2), false};
+	int rv = (w.scratch == NULL ? -1 : 0);
+	for (int t = 0; rv == 0 && t < nthreads; t++) {
+		w.scratch[t] = calloc(sizeof(uint32_t), (size_t)results->ndp * maxdeg + 1);
+		rv = (w.scratch[t] == NULL ? -1 : 0);
+	}
+	if (rv == 0) {
+		rv = telemac_parallel_for(nthreads, results->nelem, MESH_CHUNK, nbr_task, &w);
+	}
+	if (rv == 0) {
+		for (uint32_t e = 0; e < results->nelem; e++) {
+			adj->elem_start[e + 1] += adj->elem_start[e];
+		}
+		adj->elem_nbr = calloc(sizeof(uint32_t), (adj->elem_start[results->nelem] ? adj->elem_start[results->nelem] : 1));
+		rv = (adj->elem_nbr == NULL ? -1 : 0);
+	}
+	if (rv == 0) {
+		w.fill = true;
+		rv = telemac_parallel_for(nthreads, results->nelem, MESH_CHUNK, nbr_task, &w);
+	}
+	for (int t = 0; w.scratch != NULL && t < nthreads; t++) {
+		free(w.scratch[t]);
+	}
+	free(w.scratch);
+	if (rv != 0) {
+		perror("Building mesh adjacency");
+		telemac_adjacency_free(adj);
+		return NULL;
+	}
+	TM_STATS_ALLOC(sizeof(uint32_t) * (results->npoin + 1 + nref + results->nelem + 1 + adj->elem_start[results->nelem]));
+	return adj;
+}
+
+const telemac_adjacency_t *telemac_get_adjacency(resfile_t *rfile, int nthreads) {
+/*!
+ * @brief Return the node and element adjacency for an opened results file
+ *
+ * The adjacency is built on the first call after the mesh has been loaded
+ * and kept until close_telemac() is called.
+ *
+ * @param rfile	Results file with mesh loaded
+ * @param nthreads	Number of threads (see telemac_parallel_for())
+ * @retval telemac_adjacency_t*	Mesh adjacency
+ * @retval NULL	Mesh not loaded, invalid connectivity or allocation failure
+ */
+	if (rfile->adj != NULL) {
+		return rfile->adj;
+	}
+	if (rfile->tmdat.state != 2) {
+		fprintf(stderr, "telemac_get_adjacency: mesh not loaded\n");
+		return NULL;
+	}
+	TM_STATS_BEGIN(TM_PHASE_MESH);
+	rfile->adj = adjacency_build(&rfile->tmdat, nthreads);
+	TM_STATS_END(TM_PHASE_MESH);
+	return rfile->adj;
+}
+
+void telemac_adjacency_free(telemac_adjacency_t *adj) {
+//! Release mesh adjacency
+	if (adj == NULL) {
+		return;
+	}
+	free(adj->node_start);
+	free(adj->node_elem);
+	free(adj->elem_start);
+	free(adj->elem_nbr);
+	free(adj);
+}
+
+//! A boundary node and its IPOBO number, for sorting
+typedef struct {
+	uint32_t ipobo; //!< Position along the boundaries
+	uint32_t node; //!< Node number
+} bnode_t;
+
+static int bnode_cmp(const void *a, const void *b) {
+//! qsort() comparison: order boundary nodes by IPOBO
+	uint32_t x = ((const bnode_t *)a)->ipobo;
+	uint32_t y = ((const bnode_t *)b)->ipobo;
+	return (x > y) - (x < y);
+}
+
+static bool has_nodes(const telemac_data_t *results, uint32_t e, uint32_t a, uint32_t b) {
+//! True if element e contains nodes a and b (numbered from 1)
+	const uint32_t *ik = &results->ikle[(size_t)e * results->ndp];
+	bool fa = false;
+	bool fb = false;
+	for (uint32_t k = 0; k < results->ndp; k++) {
+		fa |= (ik[k] == a);
+		fb |= (ik[k] == b);
+	}
+	return fa && fb;
+}
+
+static bool is_partner(const uint32_t *pstart, const uint32_t *part, uint32_t n, uint32_t m) {
+//! True if nodes n and m (numbered from 0) are joined by a boundary edge
+	for (uint32_t i = pstart[n]; i < pstart[n + 1]; i++) {
+		if (part[i] == m) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int telemac_get_boundary(resfile_t *rfile, telemac_boundary_t *bnd) {
+/*!
+ * @brief Find the boundary nodes of a mesh, in order along each boundary
+ *
+ * Nodes with a non-zero IPOBO are ordered by IPOBO. A new boundary is started
+ * wherever two consecutive nodes are not joined by a boundary edge (an
+ * element edge not shared with a neighbouring element). Nodes where the
+ * boundary touches itself may have more than two boundary edges, all of which
+ * are considered. For 3D meshes, the boundary of the bottom plane is given. Release with telemac_boundary_free().
+ *
+ * @param rfile	Results file with mesh loaded
+ * @param bnd	Output: boundary nodes
+ * @retval 0	Success
+ * @retval -1	Mesh not loaded, or IPOBO does not hold boundary numbers
+ * @retval -2	Allocation failure
+ */
+	const telemac_data_t *results = &rfile->tmdat;
+	memset(bnd, 0, sizeof(telemac_boundary_t));
+	telemac_layers_t layers;
+	if (results->state != 2 || telemac_get_layers(results, &layers) != 0) {
+		fprintf(stderr, "telemac_get_boundary: mesh not loaded\n");
+		return -1;
+	}
+	if (results->iparam[7] != 0 || results->iparam[8] != 0) {
+		// Partitioned results store global node numbers (KNOLG) in place of IPOBO
+		fprintf(stderr, "IPOBO holds global node numbers in partitioned results\n");
+		return -1;
+	}
+	const telemac_adjacency_t *adj = telemac_get_adjacency(rfile, 0);
+	if (adj == NULL) {
+		return -2;
+	}
+
+	uint32_t n2 = layers.npoin2;
+	bnode_t *bn = calloc(sizeof(bnode_t), n2 + 1);
+	uint32_t *pstart = calloc(sizeof(uint32_t), (size_t)n2 + 2);
+	if (bn == NULL || pstart == NULL) {
+		perror("telemac_get_boundary");
+		free(bn);
+		free(pstart);
+		return -2;
+	}
+	for (uint32_t n = 0; n < n2; n++) {
+		if (results->ipobo[n] != 0) {
+			bn[bnd->nnode].ipobo = results->ipobo[n];
+			bn[bnd->nnode++].node = n;
+		}
+	}
+	if (bnd->nnode == 0) {
+		fprintf(stderr, "No boundary nodes numbered in IPOBO\n");
+		free(bn);
+		free(pstart);
+		return -1;
+	}
+	qsort(bn, bnd->nnode, sizeof(bnode_t), bnode_cmp);
+
+	// Find the boundary edges of each node: count them, then record the partners
+	static const uint32_t edges[2][4][2] = {
+		{{0, 1}, {1, 2}, {2, 0}, {0, 0}}, // Triangles, and the bottom face of prisms
+		{{0, 1}, {1, 2}, {2, 3}, {3, 0}}, // Quadrilaterals
+	};
+	int type = (results->ndp == 4 ? 1 : 0);
+	int nedge = (results->ndp == 4 ? 4 : 3);
+	uint32_t *part = NULL;
+	for (int pass = 0; pass < 2; pass++) {
+		for (uint32_t e = 0; e < layers.nelem2; e++) {
+			const uint32_t *ik = &results->ikle[(size_t)e * results->ndp];
+			for (int k = 0; k < nedge; k++) {
+				uint32_t a = ik[edges[type][k][0]];
+				uint32_t b = ik[edges[type][k][1]];
+				bool shared = false;
+				for (uint32_t i = adj->elem_start[e]; i < adj->elem_start[e + 1] && !shared; i++) {
+					shared = has_nodes(results, adj->elem_nbr[i], a, b);
+				}
+				if (shared || a < 1 || b < 1 || a > n2 || b > n2) {
+					continue;
+				}
+				if (pass == 0) {
+					pstart[a]++;
+					pstart[b]++;
+				} else {
+					part[pstart[a - 1]++] = b - 1;
+					part[pstart[b - 1]++] = a - 1;
+				}
+			}
+		}
+		if (pass == 0) {
+			for (uint32_t n = 0; n < n2; n++) {
+				pstart[n + 1] += pstart[n];
+			}
+			part = calloc(sizeof(uint32_t), (size_t)pstart[n2] + 1);
+			if (part == NULL) {
+				perror("telemac_get_boundary");
+				free(bn);
+				free(pstart);
+				return -2;
+			}
+		}
+	}
+	// Filling advanced each start to the start of the next node
+	memmove(pstart + 1, pstart, sizeof(uint32_t) * n2);
+	pstart[0] = 0;
+
+	bnd->node = calloc(sizeof(uint32_t), bnd->nnode);
+	bnd->start = calloc(sizeof(uint32_t), bnd->nnode + 1);
+	if (bnd->node == NULL || bnd->start == NULL) {
+		perror("telemac_get_boundary");
+		free(bn);
+		free(pstart);
+		free(part);
+		telemac_boundary_free(bnd);
+		return -2;
+	}
+	for (uint32_t k = 0; k < bnd->nnode; k++) {
+		uint32_t n = bn[k].node;
+		bnd->node[k] = n;
+		if (k == 0 || !is_partner(pstart, part, n, bn[k - 1].node)) {
+			bnd->start[bnd->nloop++] = k;
+		}
+	}
+	bnd->start[bnd->nloop] = bnd->nnode;
+	free(bn);
+	free(pstart);
+	free(part);
+	return 0;
+}
+
+void telemac_boundary_free(telemac_boundary_t *bnd) {
+//! Release boundary node lists
+	free(bnd->node);
+	free(bnd->start);
+	bnd->node = NULL;
+	bnd->start = NULL;
+	bnd->nnode = 0;
+	bnd->nloop = 0;
+}
+
+//! Arguments for the region labelling tasks
+typedef struct {
+	const telemac_adjacency_t *adj; //!< Mesh adjacency
+	const uint8_t *active; //!< Non-zero for elements to be labelled
+	uint32_t *parent; //!< Union-find parent of each element
+} label_work_t;
+
+static uint32_t uf_find(uint32_t *parent, uint32_t x) {
+//! Find the root of x, halving the path on the way
+	for (;;) {
+		uint32_t p = __atomic_load_n(&parent[x], __ATOMIC_RELAXED);
+		if (p == x) {
+			return x;
+		}
+		uint32_t gp = __atomic_load_n(&parent[p], __ATOMIC_RELAXED);
+		if (gp != p) {
+			// Any ancestor is a valid parent, so losing this race is harmless
+			__atomic_compare_exchange_n(&parent[x], &p, gp, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		}
+		x = gp;
+	}
+}
+
+static void uf_union(uint32_t *parent, uint32_t a, uint32_t b) {
+//! Join the sets containing a and b, attaching the higher numbered root to the lower
+	for (;;) {
+		a = uf_find(parent, a);
+		b = uf_find(parent, b);
+		if (a == b) {
+			return;
+		}
+		if (a < b) {
+			uint32_t t = a;
+			a = b;
+			b = t;
+		}
+		uint32_t expect = a;
+		if (__atomic_compare_exchange_n(&parent[a], &expect, b, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			return;
+		}
+	}
+}
+
+static int init_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: make each element its own set
+	label_work_t *w = (label_work_t *)ctx;
+	for (size_t e = start; e < end; e++) {
+		w->parent[e] = e;
+	}
+	return 0;
+}
+
+static int union_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: join active elements with their active neighbours
+	label_work_t *w = (label_work_t *)ctx;
+	const telemac_adjacency_t *adj = w->adj;
+	for (size_t e = start; e < end; e++) {
+		if (!w->active[e]) {
+			continue;
+		}
+		for (uint32_t i = adj->elem_start[e]; i < adj->elem_start[e + 1]; i++) {
+			uint32_t f = adj->elem_nbr[i];
+			if (f < e && w->active[f]) {
+				uf_union(w->parent, e, f);
+			}
+		}
+	}
+	return 0;
+}
+
+static int flatten_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: point each element directly at its root
+	label_work_t *w = (label_work_t *)ctx;
+	for (size_t e = start; e < end; e++) {
+		w->parent[e] = uf_find(w->parent, e);
+	}
+	return 0;
+}
+
+int64_t telemac_label_regions(const telemac_adjacency_t *adj, const uint8_t *active, uint32_t *label, int nthreads) {
+/*!
+ * @brief Label connected regions of active elements
+ *
+ * Active elements connected through shared edges (or faces, for prisms) of
+ * other active elements are given the same label. Regions are numbered from
+ * 0 in order of their lowest numbered element, so labels do not depend on
+ * the number of threads.
+ *
+ * @param adj	Mesh adjacency (see telemac_get_adjacency())
+ * @param active	Non-zero for each element to be included
+ * @param label	Output: region of each element, or TELEMAC_NO_REGION
+ * @param nthreads	Number of threads (see telemac_parallel_for())
+ * @returns	Number of regions, or -1 on failure
+ */
+	label_work_t w = {adj, active, label};
+	if (telemac_parallel_for(nthreads, adj->nelem, MESH_CHUNK, init_task, &w) != 0
+			|| telemac_parallel_for(nthreads, adj->nelem, MESH_CHUNK, union_task, &w) != 0
+			|| telemac_parallel_for(nthreads, adj->nelem, MESH_CHUNK, flatten_task, &w) != 0) {
+		perror("telemac_label_regions");
+		return -1;
+	}
+
+	// Each root is the lowest element of its region, so is reached before
+	// the rest of the region and can be renumbered in place
+	int64_t nreg = 0;
+	for (uint32_t e = 0; e < adj->nelem; e++) {
+		if (!active[e]) {
+			label[e] = TELEMAC_NO_REGION;
+		} else if (label[e] == e) {
+			label[e] = nreg++;
+		} else {
+			label[e] = label[label[e]];
+		}
+	}
+	return nreg;
+}
+
+//! Element centroids, for sorting during bisection
+typedef struct {
+	const float *cx; //!< Centroid X coordinates
+	const float *cy; //!< Centroid Y coordinates
+	int axis; //!< Coordinate to sort by: 0 for X, 1 for Y
+} rcb_t;
+
+static int rcb_cmp(const void *a, const void *b, void *arg) {
+//! qsort_r() comparison: order elements by centroid coordinate, then by number
+	const rcb_t *r = (const rcb_t *)arg;
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	const float *c = (r->axis ? r->cy : r->cx);
+	if (c[x] != c[y]) {
+		return (c[x] > c[y]) - (c[x] < c[y]);
+	}
+	return (x > y) - (x < y);
+}
+
+static void rcb_split(rcb_t *r, uint32_t *idx, uint32_t n, uint32_t first, uint32_t nparts, uint32_t *epart) {
+//! Assign elements idx[0..n-1] to parts first to first + nparts - 1, halving across the wider extent
+	if (nparts <= 1 || n == 0) {
+		for (uint32_t i = 0; i < n; i++) {
+			epart[idx[i]] = first;
+		}
+		return;
+	}
+	float xmin = r->cx[idx[0]], xmax = xmin, ymin = r->cy[idx[0]], ymax = ymin;
+	for (uint32_t i = 1; i < n; i++) {
+		xmin = (r->cx[idx[i]] < xmin ? r->cx[idx[i]] : xmin);
+		xmax = (r->cx[idx[i]] > xmax ? r->cx[idx[i]] : xmax);
+		ymin = (r->cy[idx[i]] < ymin ? r->cy[idx[i]] : ymin);
+		ymax = (r->cy[idx[i]] > ymax ? r->cy[idx[i]] : ymax);
+	}
+	r->axis = (ymax - ymin > xmax - xmin);
+	qsort_r(idx, n, sizeof(uint32_t), rcb_cmp, r);
+
+	// Parts need not be a power of two: elements are divided in proportion
+	uint32_t lo = nparts / 2;
+	uint32_t k = (uint32_t)((uint64_t)n * lo / nparts);
+	rcb_split(r, idx, k, first, lo, epart);
+	rcb_split(r, idx + k, n - k, first + lo, nparts - lo, epart);
+}
+
+static int node_cmp(const void *a, const void *b) {
+//! qsort() comparison: ascending node numbers
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+int telemac_partition(const telemac_data_t *results, uint32_t nparts, telemac_partition_t *part) {
+/*!
+ * @brief Split a mesh into parts by recursive coordinate bisection
+ *
+ * Element centroids are sorted along the wider of their X and Y extents and
+ * divided in proportion to the number of parts on each side, recursively,
+ * so parts differ in size by at most one element at each level. For 3D meshes
+ * the first layer of prisms is partitioned, and each column of prisms is kept
+ * in one part.
+ *
+ * @param results	Results file header and mesh
+ * @param nparts	Number of parts
+ * @param part	Output: parts, to be released with telemac_partition_free()
+ * @returns	0 on success, -1 on failure
+ */
+	memset(part, 0, sizeof(telemac_partition_t));
+	telemac_layers_t layers;
+	if (results->state != 2 || nparts < 1 || telemac_get_layers(results, &layers) != 0) {
+		fprintf(stderr, "telemac_partition: mesh not loaded or no parts requested\n");
+		return -1;
+	}
+	uint32_t ne2 = layers.nelem2;
+	uint32_t ndp2 = (results->ndp == 6 ? 3 : results->ndp);
+	float *cx = calloc(sizeof(float), ne2 + 1);
+	float *cy = calloc(sizeof(float), ne2 + 1);
+	uint32_t *idx = calloc(sizeof(uint32_t), ne2 + 1);
+	uint32_t *epart = calloc(sizeof(uint32_t), results->nelem + 1);
+	uint32_t *stamp = malloc(sizeof(uint32_t) * (results->npoin + 1));
+	part->nparts = nparts;
+	part->ndp = results->ndp;
+	part->elem_start = calloc(sizeof(uint32_t), nparts + 1);
+	part->elem = calloc(sizeof(uint32_t), results->nelem + 1);
+	part->node_start = calloc(sizeof(uint32_t), nparts + 1);
+	part->ikle = calloc(sizeof(uint32_t), (size_t)results->nelem * results->ndp + 1);
+	int rv = 0;
+	if (cx == NULL || cy == NULL || idx == NULL || epart == NULL || stamp == NULL || part->elem_start == NULL
+			|| part->elem == NULL || part->node_start == NULL || part->ikle == NULL) {
+		perror("telemac_partition");
+		rv = -1;
+	}
+
+	TM_STATS_BEGIN(TM_PHASE_MESH);
+	if (rv == 0) {
+		for (uint32_t e = 0; e < ne2; e++) {
+			const uint32_t *ik = &results->ikle[(size_t)e * results->ndp];
+			for (uint32_t j = 0; j < ndp2; j++) {
+				cx[e] += results->X[ik[j] - 1];
+				cy[e] += results->Y[ik[j] - 1];
+			}
+			cx[e] /= ndp2;
+			cy[e] /= ndp2;
+			idx[e] = e;
+		}
+		rcb_t r = {cx, cy, 0};
+		rcb_split(&r, idx, ne2, 0, nparts, epart);
+		for (uint32_t e = ne2; e < results->nelem; e++) {
+			epart[e] = epart[e % ne2];
+		}
+
+		// Elements of each part, in increasing order
+		for (uint32_t e = 0; e < results->nelem; e++) {
+			part->elem_start[epart[e] + 1]++;
+		}
+		for (uint32_t p = 0; p < nparts; p++) {
+			part->elem_start[p + 1] += part->elem_start[p];
+		}
+		uint32_t *next = calloc(sizeof(uint32_t), nparts + 1);
+		if (next == NULL) {
+			rv = -1;
+		} else {
+			memcpy(next, part->elem_start, sizeof(uint32_t) * nparts);
+			for (uint32_t e = 0; e < results->nelem; e++) {
+				part->elem[next[epart[e]]++] = e;
+			}
+			free(next);
+		}
+	}
+
+	// Distinct nodes of each part: count, allocate, fill and sort
+	for (int pass = 0; pass < 2 && rv == 0; pass++) {
+		memset(stamp, 0xff, sizeof(uint32_t) * results->npoin);
+		for (uint32_t p = 0; p < nparts; p++) {
+			uint32_t count = 0;
+			for (uint32_t i = part->elem_start[p]; i < part->elem_start[p + 1]; i++) {
+				const uint32_t *ik = &results->ikle[(size_t)part->elem[i] * results->ndp];
+				for (uint32_t j = 0; j < results->ndp; j++) {
+					uint32_t n = ik[j] - 1;
+					if (stamp[n] != p) {
+						stamp[n] = p;
+						if (pass == 1) {
+							part->node[part->node_start[p] + count] = n;
+						}
+						count++;
+					}
+				}
+			}
+			if (pass == 0) {
+				part->node_start[p + 1] = part->node_start[p] + count;
+			} else {
+				qsort(&part->node[part->node_start[p]], count, sizeof(uint32_t), node_cmp);
+			}
+		}
+		if (pass == 0) {
+			part->node = calloc(sizeof(uint32_t), part->node_start[nparts] + 1);
+			rv = (part->node == NULL ? -1 : 0);
+		}
+	}
+
+	// Local connectivity, by searching each part's sorted node list
+	for (uint32_t p = 0; p < nparts && rv == 0; p++) {
+		const uint32_t *nodes = &part->node[part->node_start[p]];
+		size_t nn = part->node_start[p + 1] - part->node_start[p];
+		for (uint32_t i = part->elem_start[p]; i < part->elem_start[p + 1]; i++) {
+			const uint32_t *ik = &results->ikle[(size_t)part->elem[i] * results->ndp];
+			for (uint32_t j = 0; j < results->ndp; j++) {
+				uint32_t n = ik[j] - 1;
+				const uint32_t *found = bsearch(&n, nodes, nn, sizeof(uint32_t), node_cmp);
+				part->ikle[(size_t)i * results->ndp + j] = (uint32_t)(found - nodes);
+			}
+		}
+	}
+	TM_STATS_END(TM_PHASE_MESH);
+
+	free(cx);
+	free(cy);
+	free(idx);
+	free(epart);
+	free(stamp);
+	if (rv != 0) {
+		telemac_partition_free(part);
+	}
+	return rv;
+}
+
+void telemac_partition_free(telemac_partition_t *part) {
+//! Release a partition made by telemac_partition()
+	free(part->elem_start);
+	free(part->elem);
+	free(part->node_start);
+	free(part->node);
+	free(part->ikle);
+	memset(part, 0, sizeof(telemac_partition_t));
+}
@@ -0,0 +1,94 @@
+/******************************************************************************
+telemac-mesh - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Mesh adjacency and connected region labelling
+ */
+
+#ifndef TELEMAC_MESH_H
+#define TELEMAC_MESH_H
+
+#include <stdint.h>
+#include "telemac-loader.h"
+
+/*!
+ * @defgroup mesh Mesh adjacency
+ * @brief Neighbour lists for nodes and elements
+ *
+ * Adjacency is held in compressed sparse row (CSR) form: the neighbours of
+ * item i are entries start[i] to start[i+1]-1 of a single list, in increasing
+ * order. Elements are neighbours if they share an edge (2D meshes) or a face
+ * (3D prisms).
+ *
+ * Boundary nodes are taken from IPOBO, which numbers the nodes on the mesh
+ * boundaries in order (with 0 for interior nodes). The boundary edges of the
+ * elements are used to split the numbering into separate boundaries, such as
+ * the outer boundary and islands.
+ *
+ * A mesh may be split into parts of nearly equal numbers of elements by
+ * recursive coordinate bisection of the element centroids, for writing and
+ * visualising in parallel. Each part has its own numbering of the nodes used
+ * by its elements, so nodes on the edge of a part appear in both parts and
+ * no ghost elements are needed.
+ * @{
+ */
+
+//! Label given to elements outside every region
+#define TELEMAC_NO_REGION UINT32_MAX
+
+//! Node and element adjacency of a mesh
+typedef struct telemac_adjacency {
+	uint32_t npoin; //!< Number of nodes
+	uint32_t nelem; //!< Number of elements
+	uint32_t *node_start; //!< Start of each node's entries in node_elem (npoin + 1 values)
+	uint32_t *node_elem; //!< Elements containing each node
+	uint32_t *elem_start; //!< Start of each element's entries in elem_nbr (nelem + 1 values)
+	uint32_t *elem_nbr; //!< Neighbouring elements of each element
+} telemac_adjacency_t;
+
+//! Boundary nodes of a mesh, in order along each boundary
+typedef struct {
+	uint32_t nnode; //!< Number of boundary nodes
+	uint32_t nloop; //!< Number of separate boundaries
+	uint32_t *node; //!< Boundary nodes (numbered from 0), ordered by IPOBO
+	uint32_t *start; //!< Start of each boundary in node (nloop + 1 values)
+} telemac_boundary_t;
+
+//! Elements and nodes of each part of a partitioned mesh
+typedef struct {
+	uint32_t nparts; //!< Number of parts
+	uint32_t ndp; //!< Nodes in each element
+	uint32_t *elem_start; //!< Start of each part in elem (nparts + 1 values)
+	uint32_t *elem; //!< Elements of each part (numbered from 0), in increasing order
+	uint32_t *node_start; //!< Start of each part in node (nparts + 1 values)
+	uint32_t *node; //!< Node of the mesh (from 0) for each local node of each part, in increasing order
+	uint32_t *ikle; //!< Connectivity of each element in elem, as local node numbers of its part (from 0)
+} telemac_partition_t;
+
+const telemac_adjacency_t *telemac_get_adjacency(resfile_t *rfile, int nthreads);
+void telemac_adjacency_free(telemac_adjacency_t *adj);
+int telemac_get_boundary(resfile_t *rfile, telemac_boundary_t *bnd);
+void telemac_boundary_free(telemac_boundary_t *bnd);
+int64_t telemac_label_regions(const telemac_adjacency_t *adj, const uint8_t *active, uint32_t *label, int nthreads);
+int telemac_partition(const telemac_data_t *results, uint32_t nparts, telemac_partition_t *part);
+void telemac_partition_free(telemac_partition_t *part);
+
+/*! @} */
+#endif // TELEMAC_MESH_H
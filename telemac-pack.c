@@ -0,0 +1,175 @@
+/******************************************************************************
+telemac-pack - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "telemac-loader.h"
+#include "telemac-archive.h"
+#include "telemac-stats.h"
+
+/*!
+ * @file
+ * @brief Write an error-bounded compressed archive of a results file
+ *
+ * The archive can be opened by all of the other tools in place of the
+ * original results file. Each decoded value is within the requested absolute
+ * error bound of the original value. The decoded results can be compared with
+ * the original using telemac-diff.
+ */
+
+int main(int argc, char **argv) {
+	char *outname = NULL;
+	bool verbose = false;
+	bool force = false;
+	int nthreads = 0;
+	int keyint = TELEMAC_ARCHIVE_KEYINT;
+	float defbound = 1e-3;
+
+	// Per-variable bounds given as -E name:bound or -E index:bound
+	char **boundspec = NULL;
+	int nbounds = 0;
+
+	const char *usage = "Usage: %s [-v] [-F] [-j n] [-e bound] [-E var:bound] [-k keyint] [--stats[=json]] -o <archive> <filename> [filename ...]\n"
+		"\t-v\tVerbose output\n"
+		"\t-F\tForce mode. Attempt to continue on certain errors\n"
+		"\t-j\tNumber of threads to use (default: number of CPUs)\n"
+		"\t-e\tAbsolute error bound for all variables (default: 0.001). 0 stores values exactly\n"
+		"\t-E\tAbsolute error bound for one variable, given by name or number. May be repeated\n"
+		"\t-k\tNumber of timesteps between keyframes (default: 16)\n"
+		"\t-o\tArchive file to write\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "vFj:e:E:k:o:")) != -1) {
+		switch (go) {
+			case 'v':
+				verbose = true;
+				break;
+			case 'F':
+				force = true;
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'e':
+				defbound = strtof(optarg, NULL);
+				break;
+			case 'E':
+				boundspec = realloc(boundspec, sizeof(char *) * (nbounds + 1));
+				if (boundspec == NULL) {
+					perror("Parsing options");
+					return EXIT_FAILURE;
+				}
+				boundspec[nbounds++] = optarg;
+				break;
+			case 'k':
+				keyint = atoi(optarg);
+				break;
+			case 'o':
+				outname = optarg;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc || outname == NULL) {
+		fprintf(stderr, "Must specify an input file and an archive name\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!(defbound >= 0) || keyint < 1) {
+		fprintf(stderr, "Error bound must be non-negative and keyframe interval positive\n");
+		return EXIT_FAILURE;
+	}
+
+	resfile_t rfs = {NULL, 0, 0, 0};
+	int rv = open_telemac_chain(&rfs, &argv[optind], argc - optind, verbose);
+	if (rv != 0) {
+		fprintf(stderr, "open_telemac returned %d\n", rv);
+		if (rv < 0 || !force) {
+			return EXIT_FAILURE;
+		}
+	}
+	telemac_data_t *results = &rfs.tmdat;
+	int nvar = results->nbv_1 + results->nbv_2;
+
+	float *errbound = calloc(sizeof(float), nvar);
+	if (errbound == NULL) {
+		perror("Allocating error bounds");
+		return EXIT_FAILURE;
+	}
+	for (int j = 0; j < nvar; j++) {
+		errbound[j] = defbound;
+	}
+
+	for (int b = 0; b < nbounds; b++) {
+		char *sep = strrchr(boundspec[b], ':');
+		if (sep == NULL) {
+			fprintf(stderr, "Bad error bound '%s': expected var:bound\n", boundspec[b]);
+			return EXIT_FAILURE;
+		}
+		*sep = '\0';
+		float eb = strtof(sep + 1, NULL);
+		int var = -1;
+		for (int j = 0; j < (int)results->nbv_1 && var < 0; j++) {
+			// Names are padded with spaces and followed by units in the results file
+			size_t n = strlen(boundspec[b]);
+			if (n > 0 && strncasecmp(results->var_names[j], boundspec[b], n) == 0
+					&& (results->var_names[j][n] == ' ' || results->var_names[j][n] == '\0')) {
+				var = j;
+			}
+		}
+		if (var < 0) {
+			char *end = NULL;
+			long v = strtol(boundspec[b], &end, 10);
+			if (end != boundspec[b] && *end == '\0' && v >= 0 && v < nvar) {
+				var = v;
+			}
+		}
+		if (var < 0 || !(eb >= 0)) {
+			fprintf(stderr, "Bad error bound for variable '%s'\n", boundspec[b]);
+			return EXIT_FAILURE;
+		}
+		errbound[var] = eb;
+	}
+
+	if (verbose) {
+		for (int j = 0; j < nvar; j++) {
+			fprintf(stdout, "%s\terror bound %g\n", (j < (int)results->nbv_1 ? results->var_names[j] : "(quadratic)"), errbound[j]);
+		}
+	}
+
+	rv = telemac_archive_write(&rfs, outname, errbound, keyint, nthreads, verbose);
+
+	free(errbound);
+	free(boundspec);
+	close_telemac(&rfs);
+	return (rv == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
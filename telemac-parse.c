@@ -25,30 +25,267 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
 #include <unistd.h>
 
 #include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-expr.h"
+#include "telemac-thread.h"
+#include "telemac-format.h"
+#include "telemac-manifest.h"
+#include "telemac-quantise.h"
 
 /*!
  * @file
  * @brief Parse TELEMAC results data into a series of flat files
  *
  * Reads a SELAFIN file and writes data to a series of files in ASCII or binary format.
+ * Binary files hold doubles by default, or with -q, any of the reduced
+ * precision types of telemac-quantise.h.
+ *
+ * Derived variables (see telemac-expr.h) are written after the stored
+ * variables, numbered from nbv_1 upwards.
+ *
+ * Each variable file for each timestep is a separate unit of work, shared
+ * between threads. Every thread reads the variables it needs with the
+ * reentrant loader functions and formats its output into its own buffer.
+ *
+ * With -i, a manifest (see telemac-manifest.h) records the timesteps already
+ * exported, and only new or changed timesteps are written. Timesteps are then
+ * written in batches of PARSE_BATCH, with the manifest saved after each batch
+ * so that an interrupted export can be resumed.
  *
  * Returns zero on success and non-zero if an error occurs
  */
 
+//! Size of the output buffer for each thread
+#define PARSE_BUFSIZE (1 << 20)
+
+//! Number of timesteps written between manifest updates in incremental mode
+#define PARSE_BATCH 64
+
+//! Shared state for writing the variable files
+typedef struct {
+	const resfile_t *rfs; //!< Results file
+	const char *basefilename; //!< Output directory and file name prefix
+	bool binaryout; //!< Write binary rather than text files
+	telemac_values_t type; //!< Type of values in binary files
+	bool verbose; //!< Report each timestep
+	int first; //!< First variable written (0, or nbv_1 if stored variables are omitted)
+	int nout; //!< Number of variables written for each timestep
+	telemac_expr_t **exprs; //!< Derived variables
+	bool **uses; //!< Stored variables used by each derived variable
+	float ***data; //!< Stored variables used by derived variables, for each thread
+	float **values; //!< Values of the variable being written, for each thread
+	char **buf; //!< Output buffer for each thread
+	const int *steps; //!< Timesteps to write, or NULL to write every timestep
+} export_t;
+
+//! Checksums of timesteps for incremental export
+typedef struct {
+	const resfile_t *rfs; //!< Results file
+	uint64_t *hash; //!< Checksum of each timestep
+} hash_t;
+
+static int flush_buffer(const char *buf, size_t len, FILE *file) {
+/*!
+ * @brief Write out the contents of an output buffer
+ * @returns 0 on success, -1 on failure
+ */
+	TM_STATS_BEGIN(TM_PHASE_WRITE);
+	size_t written = fwrite(buf, 1, len, file);
+	TM_STATS_END(TM_PHASE_WRITE);
+	TM_STATS_ADD(TM_COUNT_WRITE_CALLS, 1);
+	return (written == len ? 0 : -1);
+}
+
+static int write_values(const float *values, uint32_t npoin, bool binaryout, telemac_values_t type, char *buf, FILE *file) {
+/*!
+ * @brief Write one variable to an output file, through a buffer of PARSE_BUFSIZE bytes
+ *
+ * Text output is one line per node, as printf("%d\t%+.10f\n"). Binary output
+ * is the values in native byte order as @p type, preceded for scaled integer
+ * types by their offset and scale as two native doubles.
+ * @returns 0 on success, -1 on failure
+ */
+	size_t len = 0;
+	if (binaryout) {
+		TM_STATS_BEGIN(TM_PHASE_FORMAT);
+		telemac_scale_t sc = telemac_values_range(type, values, npoin);
+		TM_STATS_END(TM_PHASE_FORMAT);
+		if (type == TELEMAC_VALUES_U16 || type == TELEMAC_VALUES_U8) {
+			double header[2] = {sc.offset, sc.scale};
+			if (flush_buffer((const char *)header, sizeof(header), file) != 0) {
+				return -1;
+			}
+		}
+		size_t size = telemac_values_size(type);
+		size_t per = PARSE_BUFSIZE / size;
+		for (uint32_t k = 0; k < npoin; k += per) {
+			size_t n = (npoin - k < per ? npoin - k : per);
+			TM_STATS_BEGIN(TM_PHASE_FORMAT);
+			telemac_values_pack(type, &values[k], n, sc, buf);
+			TM_STATS_END(TM_PHASE_FORMAT);
+			if (flush_buffer(buf, n * size, file) != 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	TM_STATS_BEGIN(TM_PHASE_FORMAT);
+	for (uint32_t k = 0; k < npoin; k++) {
+		if (len > PARSE_BUFSIZE - 2 * TELEMAC_FORMAT_MAX) {
+			TM_STATS_END(TM_PHASE_FORMAT);
+			if (flush_buffer(buf, len, file) != 0) {
+				return -1;
+			}
+			len = 0;
+			TM_STATS_BEGIN(TM_PHASE_FORMAT);
+		}
+		len += telemac_format_uint(&buf[len], k);
+		buf[len++] = '\t';
+		len += telemac_format_fixed(&buf[len], values[k], 10, true);
+		buf[len++] = '\n';
+	}
+	TM_STATS_END(TM_PHASE_FORMAT);
+	return flush_buffer(buf, len, file);
+}
+
+static int export_task(void *ctx, size_t start, size_t end, int thread) {
+/*!
+ * @brief Write the variable files for work units @p start to @p end - 1 (see telemac_parallel_for())
+ *
+ * Unit u is variable (first + u % nout) at timestep (u / nout), or at
+ * timestep steps[u / nout] if a list of timesteps is given.
+ */
+	const export_t *ex = ctx;
+	const telemac_data_t *results = &ex->rfs->tmdat;
+	float *values = ex->values[thread];
+	float **data = ex->data[thread];
+
+	for (size_t u = start; u < end; u++) {
+		int t = (ex->steps != NULL ? ex->steps[u / ex->nout] : (int)(u / ex->nout));
+		int i = ex->first + u % ex->nout;
+		int nbv = results->nbv_1;
+		const char *varname = (i < nbv ? results->var_names[i] : ex->exprs[i - nbv]->name);
+
+		if (ex->verbose && i == ex->first) {
+			fprintf(stdout, "Step: \t%d\t\tTime: \t%f\n", t, results->timestamp[t]);
+		}
+
+		if (i < nbv) {
+			if (read_telemac_var(ex->rfs, t, i, values) != 0) {
+				fprintf(stderr, "Unable to read timestep %d\n", t);
+				return -1;
+			}
+		} else {
+			const bool *uses = ex->uses[i - nbv];
+			for (int j = 0; j < (int)(results->nbv_1 + results->nbv_2); j++) {
+				if (uses[j] && read_telemac_var(ex->rfs, t, j, data[j]) != 0) {
+					fprintf(stderr, "Unable to read timestep %d\n", t);
+					return -1;
+				}
+			}
+			if (telemac_expr_eval(ex->exprs[i - nbv], results, data, values, 0, results->npoin) != 0) {
+				fprintf(stderr, "Unable to calculate derived variables for timestep %d\n", t);
+				return -1;
+			}
+		}
+
+		char *datafilename = NULL;
+		if (asprintf(&datafilename, "%s.var%d.t%d.%s", ex->basefilename, i, t, (ex->binaryout ? "dat" : "txt")) < 0) {
+			perror("Naming output file");
+			return -1;
+		}
+		FILE *datafile = fopen(datafilename, (ex->binaryout ? "wb+" : "w+"));
+		if (datafile == NULL) {
+			fprintf(stderr, "Unable to open output file for variable %d (%s) at timestep number %d\n", i, varname, t);
+			perror(NULL);
+			free(datafilename);
+			return -1;
+		}
+
+		int rv = write_values(values, results->npoin, ex->binaryout, ex->type, ex->buf[thread], datafile);
+		TM_STATS_BEGIN(TM_PHASE_WRITE);
+		if (fclose(datafile) != 0) {
+			rv = -1;
+		}
+		TM_STATS_END(TM_PHASE_WRITE);
+		if (rv != 0) {
+			fprintf(stderr, "Error writing results for variable %d (%s) at timestep number %d\n", i, varname, t);
+			perror(datafilename);
+			free(datafilename);
+			return -1;
+		}
+		telemac_stats_add_file(datafilename);
+		free(datafilename);
+	}
+	return 0;
+}
+
+static int hash_task(void *ctx, size_t start, size_t end, int thread) {
+/*!
+ * @brief Checksum timesteps @p start to @p end - 1 (see telemac_parallel_for())
+ */
+	(void)thread;
+	const hash_t *hs = ctx;
+	for (size_t t = start; t < end; t++) {
+		hs->hash[t] = telemac_step_hash(hs->rfs, t);
+	}
+	return 0;
+}
+
+static uint64_t step_output_size(const export_t *ex, int t) {
+/*!
+ * @brief Total size of the variable files written for timestep @p t
+ * @returns Size in bytes, or UINT64_MAX if any of the files does not exist
+ */
+	char **files = calloc(sizeof(char *), ex->nout);
+	if (files == NULL) {
+		return UINT64_MAX;
+	}
+	uint64_t size = 0;
+	for (int k = 0; k < ex->nout && size != UINT64_MAX; k++) {
+		if (asprintf(&files[k], "%s.var%d.t%d.%s", ex->basefilename, ex->first + k, t, (ex->binaryout ? "dat" : "txt")) < 0) {
+			files[k] = NULL;
+			size = UINT64_MAX;
+		}
+	}
+	if (size == 0) {
+		size = telemac_output_size(files, ex->nout);
+	}
+	for (int k = 0; k < ex->nout; k++) {
+		free(files[k]);
+	}
+	free(files);
+	return size;
+}
+
 int main (int argc, char** argv) {
-	FILE *resfile =NULL;
 	char *filename = NULL;
 	char *basefilename = NULL;
 	char *outputdir = ".";
 
 	bool verbose = false;
 	bool binaryout = false;
-
-	char *usage = "%s [-v] [-b] [-o dir] <filename>\n\t-v\tVerbose output\n\t-b\tEnable binary output of variable data\n\t-o\tOutput directory\n";
+	telemac_values_t type = TELEMAC_VALUES_DOUBLE;
+	bool stored = true;
+	bool incremental = false;
+	int nthreads = 0;
+	char **defs = NULL;
+	int ndefs = 0;
+
+	char *usage = "%s [-v] [-b] [-q type] [-e NAME=expr] [-x] [-j n] [-i] [-o dir] [--stats[=json]] <filename> [filename...]\n\t-v\tVerbose output\n\t-b\tEnable binary output of variable data\n\t-o\tOutput directory\n"
+		"\t-q\tBinary output as type: double (default), float, half, u16 or u8 (scaled integers)\n"
+		"\t-e\tAdd a derived variable, e.g. -e 'SPEED=sqrt(U^2+V^2)'. May be repeated\n"
+		"\t-x\tWrite derived variables only, reading only the stored variables they use\n"
+		"\t-j\tNumber of threads writing variable files (default: number of CPUs)\n"
+		"\t-i\tIncremental: only write timesteps not already exported, or changed since\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
 
 	opterr = 0;
 	int go = 0;
-	while ((go = getopt(argc, argv, "vbo:")) != -1) {
+	while ((go = getopt(argc, argv, "vbxie:j:o:q:")) != -1) {
 		switch (go) {
 			case 'v':
 				verbose = true;
@@ -56,6 +293,32 @@ int main (int argc, char** argv) {
 			case 'b':
 				binaryout = true;
 				break;
+			case 'q':
+				if (telemac_values_parse(optarg) < 0) {
+					fprintf(stderr, "Unrecognised value type '%s'\n", optarg);
+					fprintf(stderr, usage, argv[0]);
+					return EXIT_FAILURE;
+				}
+				type = telemac_values_parse(optarg);
+				binaryout = true;
+				break;
+			case 'x':
+				stored = false;
+				break;
+			case 'i':
+				incremental = true;
+				break;
+			case 'e':
+				defs = realloc(defs, sizeof(char *) * (ndefs + 1));
+				if (defs == NULL) {
+					perror("Parsing options");
+					return EXIT_FAILURE;
+				}
+				defs[ndefs++] = optarg;
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
 			case 'o':
 				outputdir = strdup(optarg);
 				break;
@@ -66,32 +329,54 @@ int main (int argc, char** argv) {
 		}
 	}
 
-	if (argc - optind != 1) {
-		fprintf(stderr, "Must provide a file to convert\n");
+	if (argc - optind < 1) {
+		fprintf(stderr, "Must provide a file (or restart chain of files) to convert\n");
 		fprintf(stderr, usage, argv[0]);
 		return EXIT_FAILURE;
 	}
 
 	filename = argv[optind];
-	resfile = fopen(filename, "rb");
-	if (resfile == NULL) {
-		perror("Unable to open file");
-		return EXIT_FAILURE;
-	}
-
-	resfile_t rfs = {resfile, 0, 0, 0};
+	resfile_t rfs = {NULL, 0, 0, 0};
 
 	asprintf(&basefilename, "%s/%s", outputdir, basename(filename));
 
 	fprintf(stdout, "\nOpening OpenTelemac RES file %s:\n", basefilename);
-	int rval = open_telemac(&rfs, verbose);
+	int rval = open_telemac_chain(&rfs, &argv[optind], argc - optind, verbose);
+	if (rfs.file == NULL) {
+		perror("Unable to open file");
+		return EXIT_FAILURE;
+	}
 
 	telemac_data_t results = rfs.tmdat;
 
 	fprintf(stdout, "open_telemac call returned %d\n", rval);
 
-	FILE *xfile, *yfile, *connfile, *varfile, *datafile, *tsfile;
-	char *xfilename, *yfilename, *connfilename, *varfilename, *datafilename, *tsfilename;
+	int nvar = results.nbv_1 + results.nbv_2;
+	telemac_expr_t **exprs = calloc(sizeof(telemac_expr_t *), (ndefs ? ndefs : 1));
+	bool **uses = calloc(sizeof(bool *), (ndefs ? ndefs : 1));
+	bool *need = calloc(sizeof(bool), nvar);
+	if (exprs == NULL || uses == NULL || need == NULL) {
+		perror("Allocating derived variables");
+		return EXIT_FAILURE;
+	}
+	for (int e = 0; e < ndefs; e++) {
+		char err[512];
+		exprs[e] = telemac_expr_compile(defs[e], &results, err, sizeof(err));
+		if (exprs[e] == NULL) {
+			fprintf(stderr, "Invalid derived variable: %s\n", err);
+			return EXIT_FAILURE;
+		}
+		uses[e] = calloc(sizeof(bool), nvar);
+		if (uses[e] == NULL) {
+			perror("Allocating derived variables");
+			return EXIT_FAILURE;
+		}
+		telemac_expr_uses(exprs[e], uses[e]);
+		telemac_expr_uses(exprs[e], need);
+	}
+
+	FILE *xfile, *yfile, *connfile, *varfile, *tsfile;
+	char *xfilename, *yfilename, *connfilename, *varfilename, *tsfilename;
 
 	if (verbose) {
 		fprintf(stdout, "Writing out coordinates...\n");
@@ -120,10 +405,12 @@ int main (int argc, char** argv) {
 
 	}
 
-	free(xfilename);
-	free(yfilename);
 	fclose(xfile);
 	fclose(yfile);
+	telemac_stats_add_file(xfilename);
+	telemac_stats_add_file(yfilename);
+	free(xfilename);
+	free(yfilename);
 
 	if (verbose) {
 		fprintf(stdout, "Writing out connectivity...\n");
@@ -145,8 +432,9 @@ int main (int argc, char** argv) {
 	}
 
 
-	free(connfilename);
 	fclose(connfile);
+	telemac_stats_add_file(connfilename);
+	free(connfilename);
 
 	if (verbose) {
 		fprintf(stdout, "Writing out variable names...\n");
@@ -159,84 +447,160 @@ int main (int argc, char** argv) {
 		return EXIT_FAILURE;
 	}
 
-	fprintf(varfile, "%d\n", results.nbv_1);
-	for (int i = 0; i < results.nbv_1; i++) {
+	fprintf(varfile, "%d\n", (stored ? results.nbv_1 : 0) + ndefs);
+	for (int i = 0; i < results.nbv_1 && stored; i++) {
 		fprintf(varfile,"%d\t%s\n", i, results.var_names[i]);
 	}
+	for (int e = 0; e < ndefs; e++) {
+		fprintf(varfile,"%d\t%s\n", results.nbv_1 + e, exprs[e]->name);
+	}
 
-	free(varfilename);
 	fclose(varfile);
+	telemac_stats_add_file(varfilename);
+	free(varfilename);
 
 	if (verbose) {
 		if (binaryout) {
-			fprintf(stdout, "Writing out data (binary mode)...\n");
+			fprintf(stdout, "Writing out data (binary mode, %s)...\n", telemac_values_name(type));
 		} else {
 			fprintf(stdout, "Writing out data (text mode)...\n");
 		}
 	}
 
+	// Timestamps are read first, as only the variables are read by each unit
+	float **nodata = calloc(sizeof(float *), nvar);
+	if (nodata == NULL) {
+		perror("Reading timestamps");
+		return EXIT_FAILURE;
+	}
 	for (int t = 0; t < results.nt; t++) {
-		float **data = NULL;
-		data = get_telemac_data(&rfs, t, verbose);
-		if (data == NULL) {
-			perror("NULL returned from get_telemac_data");
+		if (read_telemac_data(&rfs, t, nodata, &results.timestamp[t]) != 0) {
+			fprintf(stderr, "Unable to read timestep %d\n", t);
 			return EXIT_FAILURE;
 		}
+	}
+	free(nodata);
 
-		for (int i = 0; i<results.nbv_1; i++) {
-			if (binaryout) {
-				asprintf(&datafilename, "%s.var%d.t%d.dat", basefilename, i, t);
-				datafile = fopen(datafilename, "wb+");
-			} else {
-				asprintf(&datafilename, "%s.var%d.t%d.txt", basefilename, i, t);
-				datafile = fopen(datafilename, "w+");
+	if (nthreads < 1) {
+		nthreads = telemac_default_threads();
+	}
+	export_t ex = {&rfs, basefilename, binaryout, type, verbose, (stored ? 0 : results.nbv_1), (stored ? results.nbv_1 : 0) + ndefs,
+		exprs, uses, calloc(sizeof(float **), nthreads), calloc(sizeof(float *), nthreads), calloc(sizeof(char *), nthreads), NULL};
+	if (ex.data == NULL || ex.values == NULL || ex.buf == NULL) {
+		perror("Allocating output buffers");
+		return EXIT_FAILURE;
+	}
+	for (int th = 0; th < nthreads; th++) {
+		ex.data[th] = calloc(sizeof(float *), nvar);
+		ex.values[th] = calloc(sizeof(float), results.npoin);
+		ex.buf[th] = malloc(PARSE_BUFSIZE);
+		TM_STATS_ALLOC(sizeof(float) * results.npoin + PARSE_BUFSIZE);
+		if (ex.data[th] == NULL || ex.values[th] == NULL || ex.buf[th] == NULL) {
+			perror("Allocating output buffers");
+			return EXIT_FAILURE;
+		}
+		for (int j = 0; j < nvar; j++) {
+			if (need[j]) {
+				ex.data[th][j] = calloc(sizeof(float), results.npoin);
+				if (ex.data[th][j] == NULL) {
+					perror("Allocating output buffers");
+					return EXIT_FAILURE;
+				}
 			}
+		}
+	}
 
-			if (datafile == NULL) {
-				fprintf(stderr, "Unable to open output file for variable %d (%s) at timestep number %d\n", i, results.var_names[i], t);
-				perror(NULL);
-				return EXIT_FAILURE;
+	if (!incremental) {
+		if (telemac_parallel_for(nthreads, (size_t)results.nt * ex.nout, 1, export_task, &ex) != 0) {
+			return EXIT_FAILURE;
+		}
+	} else {
+		// The manifest is only valid for output written with the same settings
+		char *settings = NULL;
+		char *next = NULL;
+		if (asprintf(&settings, "parse binary=%d stored=%d", binaryout, stored) < 0) {
+			settings = NULL;
+		}
+		if (type != TELEMAC_VALUES_DOUBLE && settings != NULL) {
+			if (asprintf(&next, "%s values=%s", settings, telemac_values_name(type)) < 0) {
+				next = NULL;
 			}
+			free(settings);
+			settings = next;
+		}
+		for (int e = 0; e < ndefs && settings != NULL; e++) {
+			if (asprintf(&next, "%s def=%s", settings, defs[e]) < 0) {
+				next = NULL;
+			}
+			free(settings);
+			settings = next;
+		}
+		char *manifestname = NULL;
+		if (settings == NULL || asprintf(&manifestname, "%s.parse.manifest", basefilename) < 0) {
+			perror("Preparing manifest");
+			return EXIT_FAILURE;
+		}
+		telemac_manifest_t manifest;
+		if (telemac_manifest_open(&manifest, manifestname, &rfs, settings) != 0) {
+			return EXIT_FAILURE;
+		}
+		free(manifestname);
+		free(settings);
 
-			if (binaryout) {
-				double *dd = NULL;
-				dd = calloc(sizeof(double), results.npoin);
-				if (dd == NULL) {
-					fprintf(stderr, "Unable to allocate memory for double conversion\n");
-					perror("calloc");
-					return EXIT_FAILURE;
-				}
-
-				for (int k = 0; k < results.npoin; k++) {
-					dd[k] = data[i][k];
-				}
+		hash_t hs = {&rfs, calloc(sizeof(uint64_t), results.nt + 1)};
+		int *todo = calloc(sizeof(int), results.nt + 1);
+		if (hs.hash == NULL || todo == NULL) {
+			perror("Allocating manifest");
+			return EXIT_FAILURE;
+		}
+		telemac_parallel_for(nthreads, results.nt, 1, hash_task, &hs);
+		int ntodo = 0;
+		for (int t = 0; t < results.nt; t++) {
+			if (!telemac_manifest_current(&manifest, t, hs.hash[t], step_output_size(&ex, t))) {
+				todo[ntodo++] = t;
+			}
+		}
+		fprintf(stdout, "%d timesteps already exported, %d to write\n", results.nt - ntodo, ntodo);
 
-				int fwcount = fwrite(dd, sizeof(double), results.npoin, datafile);
-				if (fwcount != results.npoin) {
-					free(dd);
-					fprintf(stderr, "Error writing results for variable %d (%s) at timestep number %d\n", i, results.var_names[i], t);
-					perror("fwrite");
-					return EXIT_FAILURE;
-				}
-				free(dd);
-			} else {
-				for (int k = 0; k < results.npoin; k++) {
-					fprintf(datafile, "%d\t%+.10f\n", k, data[i][k]);
-				}
+		for (int b = 0; b < ntodo; b += PARSE_BATCH) {
+			int n = (ntodo - b < PARSE_BATCH ? ntodo - b : PARSE_BATCH);
+			ex.steps = &todo[b];
+			if (telemac_parallel_for(nthreads, (size_t)n * ex.nout, 1, export_task, &ex) != 0) {
+				telemac_manifest_save(&manifest, true);
+				return EXIT_FAILURE;
 			}
-			fclose(datafile);
-			free(datafilename);
+			for (int k = 0; k < n; k++) {
+				int t = todo[b + k];
+				telemac_manifest_set(&manifest, t, results.timestamp[t], hs.hash[t], step_output_size(&ex, t));
+			}
+			telemac_manifest_save(&manifest, false);
+		}
+		if (telemac_manifest_save(&manifest, true) != 0) {
+			return EXIT_FAILURE;
+		}
+		telemac_manifest_close(&manifest);
+		free(hs.hash);
+		free(todo);
+	}
+	for (int th = 0; th < nthreads; th++) {
+		for (int j = 0; j < nvar; j++) {
+			free(ex.data[th][j]);
 		}
-		free_telemac_data(&rfs, data);
+		free(ex.data[th]);
+		free(ex.values[th]);
+		free(ex.buf[th]);
 	}
 
 	if (verbose) {
 		fprintf(stdout, "Writing out timestamps...\n");
 	}
 
+	// Written to a temporary file and renamed, so the list of times is never incomplete
+	char *tstmpname = NULL;
 	asprintf(&tsfilename, "%s.times.txt", basefilename);
-	tsfile = fopen(tsfilename, "w+");
-	if (connfile == NULL) {
+	asprintf(&tstmpname, "%s.tmp", tsfilename);
+	tsfile = fopen(tstmpname, "w+");
+	if (tsfile == NULL) {
 		perror("Unable to open timestep output file");
 		return EXIT_FAILURE;
 	}
@@ -246,8 +610,14 @@ int main (int argc, char** argv) {
 		fprintf(tsfile,"%d\t%+.10f\n", i, results.timestamp[i]);
 	}
 
+	if (fclose(tsfile) != 0 || rename(tstmpname, tsfilename) != 0) {
+		perror("Unable to save timestep output file");
+		unlink(tstmpname);
+		return EXIT_FAILURE;
+	}
+	telemac_stats_add_file(tsfilename);
 	free(tsfilename);
-	fclose(tsfile);
+	free(tstmpname);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,507 @@
+/******************************************************************************
+telemac-particles - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "telemac-particles.h"
+#include "telemac-thread.h"
+#include "telemac-stats.h"
+
+//! Triangles visited by a walk before falling back to the grid
+#define WALK_MAX 64
+
+//! Barycentric weight below zero still accepted as inside a triangle
+#define INSIDE_EPS 1e-9
+
+//! Batches of particles advanced by each task
+#define ADVANCE_CHUNK 16
+
+//! Edge of a triangle, for finding neighbours
+typedef struct {
+	uint32_t a; //!< Lower node number
+	uint32_t b; //!< Higher node number
+	uint32_t tri; //!< Triangle
+	uint32_t k; //!< Node of the triangle opposite the edge
+} edge_t;
+
+//! Arguments for advancing particles
+typedef struct {
+	const telemac_tracker_t *tr; //!< Mesh and index
+	const telemac_flow_t *flow; //!< Velocity field
+	telemac_particles_t *p; //!< Particles
+	double time; //!< Time at the start of the first step
+	double dt; //!< Step length
+	int nsteps; //!< Number of steps
+} advance_t;
+
+//! Working arrays for one batch of particles
+typedef struct {
+	size_t n; //!< Particles in the batch
+	double x[TELEMAC_PARTICLE_BATCH]; //!< X coordinate at which velocity is wanted
+	double y[TELEMAC_PARTICLE_BATCH]; //!< Y coordinate at which velocity is wanted
+	uint32_t tri[TELEMAC_PARTICLE_BATCH]; //!< Triangle to start the search from
+	uint32_t node[3][TELEMAC_PARTICLE_BATCH]; //!< Nodes of the triangle found
+	double w[3][TELEMAC_PARTICLE_BATCH]; //!< Weights of the nodes (all zero if not found)
+	double ok[TELEMAC_PARTICLE_BATCH]; //!< 1 while the particle is inside the mesh, otherwise 0
+	double ku[4][TELEMAC_PARTICLE_BATCH]; //!< U velocity at each Runge-Kutta stage
+	double kv[4][TELEMAC_PARTICLE_BATCH]; //!< V velocity at each Runge-Kutta stage
+} batch_t;
+
+static int edge_compare(const void *pa, const void *pb) {
+//! qsort() comparison of edges by their nodes
+	const edge_t *a = pa;
+	const edge_t *b = pb;
+	if (a->a != b->a) {
+		return (a->a < b->a ? -1 : 1);
+	}
+	if (a->b != b->b) {
+		return (a->b < b->b ? -1 : 1);
+	}
+	return 0;
+}
+
+static void build_coefficients(telemac_tracker_t *tr) {
+//! Invert the coordinates of each triangle, so that weights need no division
+	for (uint32_t t = 0; t < tr->ntri; t++) {
+		uint32_t a = tr->tri[0][t], b = tr->tri[1][t], d = tr->tri[2][t];
+		double xa = tr->X[a], ya = tr->Y[a], xb = tr->X[b], yb = tr->Y[b], xd = tr->X[d], yd = tr->Y[d];
+		double det = (yb - yd) * (xa - xd) + (xd - xb) * (ya - yd);
+		double inv = (det != 0 ? 1 / det : NAN);
+		tr->coef[0][t] = (yb - yd) * inv;
+		tr->coef[1][t] = (xd - xb) * inv;
+		tr->coef[2][t] = (yd - ya) * inv;
+		tr->coef[3][t] = (xa - xd) * inv;
+	}
+}
+
+static int build_neighbours(telemac_tracker_t *tr) {
+//! Find the triangle across each edge, by sorting the edges of every triangle
+	size_t nedge = 3 * (size_t)tr->ntri;
+	edge_t *edge = calloc(sizeof(edge_t), nedge + 1);
+	if (edge == NULL) {
+		return -1;
+	}
+	for (uint32_t t = 0; t < tr->ntri; t++) {
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t a = tr->tri[(k + 1) % 3][t];
+			uint32_t b = tr->tri[(k + 2) % 3][t];
+			edge_t *e = &edge[3 * (size_t)t + k];
+			e->a = (a < b ? a : b);
+			e->b = (a < b ? b : a);
+			e->tri = t;
+			e->k = k;
+			tr->nbr[k][t] = TELEMAC_PARTICLE_OUT;
+		}
+	}
+	qsort(edge, nedge, sizeof(edge_t), edge_compare);
+	for (size_t i = 0; i + 1 < nedge; i++) {
+		const edge_t *e = &edge[i];
+		const edge_t *f = &edge[i + 1];
+		if (e->a == f->a && e->b == f->b) {
+			tr->nbr[e->k][e->tri] = f->tri;
+			tr->nbr[f->k][f->tri] = e->tri;
+			i++;
+		}
+	}
+	free(edge);
+	return 0;
+}
+
+static int build_grid(telemac_tracker_t *tr, const telemac_data_t *results) {
+//! Build a uniform grid of the triangles overlapping each cell
+	double w = results->XYrange[1] - results->XYrange[0];
+	double h = results->XYrange[3] - results->XYrange[2];
+	tr->cell = sqrt((w * h > 0 ? w * h : 1) / (tr->ntri + 1)) * 2;
+	tr->x0 = results->XYrange[0];
+	tr->y0 = results->XYrange[2];
+	tr->nx = (uint32_t)(w / tr->cell) + 1;
+	tr->ny = (uint32_t)(h / tr->cell) + 1;
+	size_t ncell = (size_t)tr->nx * tr->ny;
+	tr->cell_start = calloc(sizeof(uint32_t), ncell + 1);
+	if (tr->cell_start == NULL) {
+		return -1;
+	}
+
+	// Count, prefix sum, then fill the triangles overlapping each cell
+	for (int pass = 0; pass < 2; pass++) {
+		for (uint32_t t = 0; t < tr->ntri; t++) {
+			double xmin = INFINITY, xmax = -INFINITY, ymin = INFINITY, ymax = -INFINITY;
+			for (int k = 0; k < 3; k++) {
+				xmin = fmin(xmin, tr->X[tr->tri[k][t]]);
+				xmax = fmax(xmax, tr->X[tr->tri[k][t]]);
+				ymin = fmin(ymin, tr->Y[tr->tri[k][t]]);
+				ymax = fmax(ymax, tr->Y[tr->tri[k][t]]);
+			}
+			uint32_t c0 = (uint32_t)((xmin - tr->x0) / tr->cell), c1 = (uint32_t)((xmax - tr->x0) / tr->cell);
+			uint32_t r0 = (uint32_t)((ymin - tr->y0) / tr->cell), r1 = (uint32_t)((ymax - tr->y0) / tr->cell);
+			for (uint32_t r = r0; r <= r1 && r < tr->ny; r++) {
+				for (uint32_t c = c0; c <= c1 && c < tr->nx; c++) {
+					size_t cell = (size_t)r * tr->nx + c;
+					if (pass == 0) {
+						tr->cell_start[cell + 1]++;
+					} else {
+						tr->cell_tri[tr->cell_start[cell]++] = t;
+					}
+				}
+			}
+		}
+		if (pass == 0) {
+			for (size_t c = 0; c < ncell; c++) {
+				tr->cell_start[c + 1] += tr->cell_start[c];
+			}
+			tr->cell_tri = calloc(sizeof(uint32_t), tr->cell_start[ncell] + 1);
+			if (tr->cell_tri == NULL) {
+				return -1;
+			}
+		} else {
+			// Filling advanced each start to the next cell's start
+			memmove(&tr->cell_start[1], &tr->cell_start[0], sizeof(uint32_t) * ncell);
+			tr->cell_start[0] = 0;
+		}
+	}
+	return 0;
+}
+
+int telemac_tracker_init(telemac_tracker_t *tr, const telemac_data_t *results, const telemac_layers_t *layers) {
+/*!
+ * @brief Prepare a mesh for particle tracking
+ *
+ * @param tr	Tracker to set up. Free with telemac_tracker_free().
+ * @param results	Results file header and mesh. Must remain valid while the tracker is used.
+ * @param layers	Layout from telemac_get_layers()
+ * @retval 0	Success
+ * @retval -1	Memory could not be allocated
+ */
+	memset(tr, 0, sizeof(*tr));
+	tr->X = results->X;
+	tr->Y = results->Y;
+	TM_STATS_BEGIN(TM_PHASE_MESH);
+	int rv = 0;
+	for (int k = 0; k < 3; k++) {
+		tr->tri[k] = calloc(sizeof(uint32_t), 2 * (size_t)layers->nelem2 + 1);
+		tr->nbr[k] = calloc(sizeof(uint32_t), 2 * (size_t)layers->nelem2 + 1);
+		rv |= (tr->tri[k] == NULL || tr->nbr[k] == NULL);
+	}
+	for (int k = 0; k < 4; k++) {
+		tr->coef[k] = calloc(sizeof(double), 2 * (size_t)layers->nelem2 + 1);
+		rv |= (tr->coef[k] == NULL);
+	}
+	if (rv == 0) {
+		tr->ntri = telemac_plane_triangles(results, layers, tr->tri);
+		TM_STATS_ALLOC((6 * sizeof(uint32_t) + 4 * sizeof(double)) * (size_t)tr->ntri);
+		build_coefficients(tr);
+		rv = build_neighbours(tr);
+	}
+	if (rv == 0) {
+		rv = build_grid(tr, results);
+	}
+	TM_STATS_END(TM_PHASE_MESH);
+	if (rv != 0) {
+		perror("telemac_tracker_init");
+		telemac_tracker_free(tr);
+		return -1;
+	}
+	return 0;
+}
+
+void telemac_tracker_free(telemac_tracker_t *tr) {
+/*!
+ * @brief Free a tracker's triangles, neighbours and index
+ * @param tr	Tracker from telemac_tracker_init()
+ */
+	for (int k = 0; k < 3; k++) {
+		free(tr->tri[k]);
+		free(tr->nbr[k]);
+	}
+	for (int k = 0; k < 4; k++) {
+		free(tr->coef[k]);
+	}
+	free(tr->cell_start);
+	free(tr->cell_tri);
+	memset(tr, 0, sizeof(*tr));
+}
+
+static int weights(const telemac_tracker_t *tr, uint32_t t, double x, double y, double w[3]) {
+//! Barycentric weights of a point in a triangle, returning the node with the lowest weight, or -1 if degenerate
+	if (isnan(tr->coef[0][t])) {
+		return -1;
+	}
+	uint32_t d = tr->tri[2][t];
+	double dx = x - tr->X[d];
+	double dy = y - tr->Y[d];
+	w[0] = tr->coef[0][t] * dx + tr->coef[1][t] * dy;
+	w[1] = tr->coef[2][t] * dx + tr->coef[3][t] * dy;
+	w[2] = 1 - w[0] - w[1];
+	int k = (w[1] < w[0] ? 1 : 0);
+	return (w[2] < w[k] ? 2 : k);
+}
+
+static uint32_t grid_locate(const telemac_tracker_t *tr, double x, double y, double w[3]) {
+//! Find the triangle containing a point from the grid
+	if (!(x >= tr->x0 && y >= tr->y0)) {
+		return TELEMAC_PARTICLE_OUT;
+	}
+	uint32_t c = (uint32_t)((x - tr->x0) / tr->cell);
+	uint32_t r = (uint32_t)((y - tr->y0) / tr->cell);
+	if (c >= tr->nx || r >= tr->ny) {
+		return TELEMAC_PARTICLE_OUT;
+	}
+	size_t cell = (size_t)r * tr->nx + c;
+	for (uint32_t i = tr->cell_start[cell]; i < tr->cell_start[cell + 1]; i++) {
+		uint32_t t = tr->cell_tri[i];
+		int k = weights(tr, t, x, y, w);
+		if (k >= 0 && w[k] >= -INSIDE_EPS) {
+			return t;
+		}
+	}
+	return TELEMAC_PARTICLE_OUT;
+}
+
+uint32_t telemac_tracker_locate(const telemac_tracker_t *tr, double x, double y, uint32_t hint, double w[3]) {
+/*!
+ * @brief Find the triangle containing a point
+ *
+ * Walks from @p hint towards the point, crossing the edge opposite the node
+ * with the most negative weight at each triangle. If the walk reaches the
+ * edge of the mesh or takes more than WALK_MAX triangles, the grid is used
+ * instead.
+ *
+ * @param tr	Tracker from telemac_tracker_init()
+ * @param x	X coordinate
+ * @param y	Y coordinate
+ * @param hint	Triangle to start from (such as the point's last triangle), or TELEMAC_PARTICLE_OUT
+ * @param[out] w	Interpolation weights of the triangle's nodes
+ * @returns	Triangle, or TELEMAC_PARTICLE_OUT if the point is outside the mesh
+ */
+	uint32_t t = hint;
+	for (int n = 0; t < tr->ntri && n < WALK_MAX; n++) {
+		int k = weights(tr, t, x, y, w);
+		if (k < 0) {
+			break;
+		}
+		if (w[k] >= -INSIDE_EPS) {
+			return t;
+		}
+		t = tr->nbr[k][t];
+	}
+	return grid_locate(tr, x, y, w);
+}
+
+int telemac_particles_alloc(telemac_particles_t *p, size_t n) {
+/*!
+ * @brief Allocate positions for a set of particles
+ *
+ * Particles start outside the mesh; set their positions then call
+ * telemac_particles_place().
+ *
+ * @param p	Particles. Free with telemac_particles_free().
+ * @param n	Number of particles
+ * @retval 0	Success
+ * @retval -1	Memory could not be allocated
+ */
+	memset(p, 0, sizeof(*p));
+	p->x = calloc(sizeof(double), n + 1);
+	p->y = calloc(sizeof(double), n + 1);
+	p->tri = calloc(sizeof(uint32_t), n + 1);
+	if (p->x == NULL || p->y == NULL || p->tri == NULL) {
+		perror("telemac_particles_alloc");
+		telemac_particles_free(p);
+		return -1;
+	}
+	TM_STATS_ALLOC((2 * sizeof(double) + sizeof(uint32_t)) * n);
+	p->n = n;
+	for (size_t i = 0; i < n; i++) {
+		p->tri[i] = TELEMAC_PARTICLE_OUT;
+	}
+	return 0;
+}
+
+void telemac_particles_free(telemac_particles_t *p) {
+/*!
+ * @brief Free a set of particles
+ * @param p	Particles from telemac_particles_alloc()
+ */
+	free(p->x);
+	free(p->y);
+	free(p->tri);
+	memset(p, 0, sizeof(*p));
+}
+
+static int place_task(void *ctx, size_t start, size_t end, int thread) {
+//! Locate particles start to end - 1 from the grid (see telemac_parallel_for())
+	(void)thread;
+	const advance_t *a = ctx;
+	telemac_particles_t *p = a->p;
+	double w[3];
+	for (size_t i = start; i < end; i++) {
+		p->tri[i] = telemac_tracker_locate(a->tr, p->x[i], p->y[i], TELEMAC_PARTICLE_OUT, w);
+	}
+	return 0;
+}
+
+size_t telemac_particles_place(const telemac_tracker_t *tr, telemac_particles_t *p, int nthreads) {
+/*!
+ * @brief Find the triangle holding each particle, from its position
+ *
+ * @param tr	Tracker from telemac_tracker_init()
+ * @param p	Particles, with positions set
+ * @param nthreads	Number of threads (values below 1 use all CPUs)
+ * @returns	Number of particles inside the mesh
+ */
+	advance_t a = {tr, NULL, p, 0, 0, 0};
+	telemac_parallel_for(nthreads, p->n, TELEMAC_PARTICLE_BATCH * ADVANCE_CHUNK, place_task, &a);
+	size_t inside = 0;
+	for (size_t i = 0; i < p->n; i++) {
+		inside += (p->tri[i] != TELEMAC_PARTICLE_OUT);
+	}
+	return inside;
+}
+
+static void batch_velocity(const advance_t *a, batch_t *b, int stage, double time) {
+/*!
+ * @brief Velocity at the batch positions, for one Runge-Kutta stage
+ *
+ * Particles found outside the mesh have their ok flag cleared and zero
+ * velocity, so the interpolation and updates need no branches.
+ */
+	const telemac_tracker_t *tr = a->tr;
+	const telemac_flow_t *fl = a->flow;
+	double s = (fl->t[1] > fl->t[0] ? (time - fl->t[0]) / (fl->t[1] - fl->t[0]) : 0);
+	double s0 = 1 - s;
+
+	for (size_t i = 0; i < b->n; i++) {
+		double w[3] = {0, 0, 0};
+		uint32_t t = (b->ok[i] != 0 ? telemac_tracker_locate(tr, b->x[i], b->y[i], b->tri[i], w) : TELEMAC_PARTICLE_OUT);
+		if (t == TELEMAC_PARTICLE_OUT) {
+			b->ok[i] = 0;
+			w[0] = w[1] = w[2] = 0;
+			t = 0;
+		} else {
+			b->tri[i] = t;
+		}
+		for (int k = 0; k < 3; k++) {
+			b->node[k][i] = tr->tri[k][t];
+			b->w[k][i] = w[k];
+		}
+	}
+
+	const float *u0 = fl->u[0], *u1 = fl->u[1], *v0 = fl->v[0], *v1 = fl->v[1];
+	double *restrict ku = b->ku[stage];
+	double *restrict kv = b->kv[stage];
+	for (size_t i = 0; i < b->n; i++) {
+		uint32_t n0 = b->node[0][i], n1 = b->node[1][i], n2 = b->node[2][i];
+		double w0 = b->w[0][i], w1 = b->w[1][i], w2 = b->w[2][i];
+		ku[i] = s0 * (w0 * u0[n0] + w1 * u0[n1] + w2 * u0[n2]) + s * (w0 * u1[n0] + w1 * u1[n1] + w2 * u1[n2]);
+		kv[i] = s0 * (w0 * v0[n0] + w1 * v0[n1] + w2 * v0[n2]) + s * (w0 * v1[n0] + w1 * v1[n1] + w2 * v1[n2]);
+	}
+}
+
+static int advance_task(void *ctx, size_t start, size_t end, int thread) {
+//! Advance particles start to end - 1 through every step, a batch at a time (see telemac_parallel_for())
+	(void)thread;
+	const advance_t *a = ctx;
+	telemac_particles_t *p = a->p;
+	batch_t b;
+	// Stage positions are offset from the step start by these fractions of the step
+	static const double frac[4] = {0, 0.5, 0.5, 1};
+
+	for (size_t first = start; first < end; first += TELEMAC_PARTICLE_BATCH) {
+		b.n = (end - first < TELEMAC_PARTICLE_BATCH ? end - first : TELEMAC_PARTICLE_BATCH);
+		double *restrict px = &p->x[first];
+		double *restrict py = &p->y[first];
+		uint32_t *ptri = &p->tri[first];
+		for (int s = 0; s < a->nsteps; s++) {
+			double t = a->time + s * a->dt;
+			for (size_t i = 0; i < b.n; i++) {
+				b.ok[i] = (ptri[i] != TELEMAC_PARTICLE_OUT);
+				b.tri[i] = ptri[i];
+				b.x[i] = px[i];
+				b.y[i] = py[i];
+			}
+			for (int stage = 0; stage < 4; stage++) {
+				if (stage > 0) {
+					double h = frac[stage] * a->dt;
+					const double *restrict ku = b.ku[stage - 1];
+					const double *restrict kv = b.kv[stage - 1];
+					for (size_t i = 0; i < b.n; i++) {
+						b.x[i] = px[i] + h * ku[i];
+						b.y[i] = py[i] + h * kv[i];
+					}
+				}
+				batch_velocity(a, &b, stage, t + frac[stage] * a->dt);
+			}
+
+			// Particles that left the mesh during the step stay where they were
+			const double h6 = a->dt / 6;
+			for (size_t i = 0; i < b.n; i++) {
+				double dx = h6 * (b.ku[0][i] + 2 * b.ku[1][i] + 2 * b.ku[2][i] + b.ku[3][i]);
+				double dy = h6 * (b.kv[0][i] + 2 * b.kv[1][i] + 2 * b.kv[2][i] + b.kv[3][i]);
+				b.x[i] = px[i] + b.ok[i] * dx;
+				b.y[i] = py[i] + b.ok[i] * dy;
+			}
+			for (size_t i = 0; i < b.n; i++) {
+				if (b.ok[i] == 0) {
+					ptri[i] = TELEMAC_PARTICLE_OUT;
+					continue;
+				}
+				double w[3];
+				uint32_t tri = telemac_tracker_locate(a->tr, b.x[i], b.y[i], b.tri[i], w);
+				if (tri == TELEMAC_PARTICLE_OUT) {
+					ptri[i] = TELEMAC_PARTICLE_OUT;
+					continue;
+				}
+				px[i] = b.x[i];
+				py[i] = b.y[i];
+				ptri[i] = tri;
+			}
+		}
+	}
+	return 0;
+}
+
+int telemac_particles_advance(const telemac_tracker_t *tr, const telemac_flow_t *flow, telemac_particles_t *p,
+		double time, double dt, int nsteps, int nthreads) {
+/*!
+ * @brief Advance particles by a number of fourth order Runge-Kutta steps
+ *
+ * The velocity is interpolated in time between the two fields of @p flow,
+ * so every step should lie within its interval. Particles outside the mesh
+ * are not moved. Each particle is independent, so the results do not depend
+ * on the number of threads.
+ *
+ * @param tr	Tracker from telemac_tracker_init()
+ * @param flow	Velocity field
+ * @param p	Particles, placed with telemac_particles_place()
+ * @param time	Time at the start of the first step
+ * @param dt	Length of each step
+ * @param nsteps	Number of steps
+ * @param nthreads	Number of threads (values below 1 use all CPUs)
+ * @retval 0	Success
+ * @retval -1	Failure
+ */
+	advance_t a = {tr, flow, p, time, dt, nsteps};
+	TM_STATS_BEGIN(TM_PHASE_FORMAT);
+	int rv = telemac_parallel_for(nthreads, p->n, TELEMAC_PARTICLE_BATCH * ADVANCE_CHUNK, advance_task, &a);
+	TM_STATS_END(TM_PHASE_FORMAT);
+	return (rv == 0 ? 0 : -1);
+}
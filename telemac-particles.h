@@ -0,0 +1,105 @@
+/******************************************************************************
+telemac-particles - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Lagrangian particle tracking through a velocity field
+ */
+
+#ifndef TELEMAC_PARTICLES_H
+#define TELEMAC_PARTICLES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "telemac-loader.h"
+#include "telemac-layers.h"
+
+/*!
+ * @defgroup particles Particle tracking
+ * @brief Particle paths and streamlines in the horizontal velocity field
+ *
+ * Particles move in the horizontal plane of the mesh, over the triangles
+ * from telemac_plane_triangles(). Velocity is interpolated linearly within
+ * each triangle and linearly in time between two timesteps, and positions
+ * are advanced with the classical fourth order Runge-Kutta method.
+ *
+ * A particle is found by walking from the triangle that held it last to
+ * the neighbouring triangle across the edge it lies beyond, so each step
+ * normally visits only one or two triangles. A uniform grid of the
+ * triangles overlapping each cell is used to place new particles and when a
+ * walk reaches the edge of the mesh (the mesh may be concave or have
+ * islands). A particle that leaves the mesh stops at its last position
+ * inside and is marked with TELEMAC_PARTICLE_OUT.
+ *
+ * Particles are held as separate arrays of each quantity and advanced in
+ * batches of TELEMAC_PARTICLE_BATCH: each Runge-Kutta stage locates the
+ * whole batch, then interpolates and updates it in loops without branches
+ * that the compiler can vectorise. Batches are shared between threads.
+ * @{
+ */
+
+//! Triangle of a particle that has left the mesh (or was never inside it)
+#define TELEMAC_PARTICLE_OUT UINT32_MAX
+
+//! Particles advanced together in each Runge-Kutta stage
+#define TELEMAC_PARTICLE_BATCH 64
+
+//! Triangles of the mesh, their neighbours and a spatial index
+typedef struct {
+	const float *X; //!< X coordinate of each node
+	const float *Y; //!< Y coordinate of each node
+	uint32_t ntri; //!< Number of triangles
+	uint32_t *tri[3]; //!< Nodes of each triangle (numbered from 0, bottom plane)
+	uint32_t *nbr[3]; //!< Triangle across the edge opposite each node, or TELEMAC_PARTICLE_OUT
+	double *coef[4]; //!< Weights of nodes 0 and 1 per unit X and Y from node 2 (NaN for degenerate triangles)
+	double x0; //!< X coordinate of the grid origin
+	double y0; //!< Y coordinate of the grid origin
+	double cell; //!< Grid cell size
+	uint32_t nx; //!< Grid columns
+	uint32_t ny; //!< Grid rows
+	uint32_t *cell_start; //!< Start of each cell's entries in cell_tri (nx * ny + 1 values)
+	uint32_t *cell_tri; //!< Triangles overlapping each cell
+} telemac_tracker_t;
+
+//! Positions of a set of particles
+typedef struct {
+	size_t n; //!< Number of particles
+	double *x; //!< X coordinate of each particle
+	double *y; //!< Y coordinate of each particle
+	uint32_t *tri; //!< Triangle holding each particle, or TELEMAC_PARTICLE_OUT
+} telemac_particles_t;
+
+//! Velocity field over an interval, varying linearly in time
+typedef struct {
+	const float *u[2]; //!< U velocity at each node at the start and end of the interval
+	const float *v[2]; //!< V velocity at each node at the start and end of the interval
+	double t[2]; //!< Times of the start and end of the interval (equal for a steady field)
+} telemac_flow_t;
+
+int telemac_tracker_init(telemac_tracker_t *tr, const telemac_data_t *results, const telemac_layers_t *layers);
+void telemac_tracker_free(telemac_tracker_t *tr);
+uint32_t telemac_tracker_locate(const telemac_tracker_t *tr, double x, double y, uint32_t hint, double w[3]);
+int telemac_particles_alloc(telemac_particles_t *p, size_t n);
+void telemac_particles_free(telemac_particles_t *p);
+size_t telemac_particles_place(const telemac_tracker_t *tr, telemac_particles_t *p, int nthreads);
+int telemac_particles_advance(const telemac_tracker_t *tr, const telemac_flow_t *flow, telemac_particles_t *p,
+		double time, double dt, int nsteps, int nthreads);
+
+/*! @} */
+#endif // TELEMAC_PARTICLES_H
@@ -0,0 +1,435 @@
+/******************************************************************************
+telemac-percentiles - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <math.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-stream.h"
+#include "telemac-writer.h"
+#include "telemac-expr.h"
+#include "telemac-hist.h"
+
+/*!
+ * @file
+ * @brief Percentiles and time above thresholds at every node over a whole run
+ *
+ * Makes a single pass over the timesteps, adding the selected variables at
+ * each node to a histogram (see telemac-hist.h), so memory use depends on
+ * the number of nodes and bins but not on the number of timesteps. Unless
+ * the limits of the bins are given, a first pass finds the range of each
+ * variable.
+ *
+ * The results are written as a single timestep of a SELAFIN file on the same
+ * mesh, with one variable for each percentile and threshold of each input
+ * variable, which can be converted with telemac-vtu.
+ *
+ * Returns zero on success and EXIT_FAILURE if an error occurs.
+ */
+
+//! Default number of bins for each node
+#define DEFAULT_BINS 256
+
+static int name_length(const char *name) {
+/*!
+ * @brief Length of a variable name without units or padding
+ */
+	int len = 16;
+	while (len > 0 && name[len - 1] == ' ') {
+		len--;
+	}
+	return len;
+}
+
+static char *output_name(const char *name, const char *suffix, const char *unit) {
+/*!
+ * @brief Name and unit of an output variable, shortening the input name to fit the suffix
+ * @returns Newly allocated 32 character name, or NULL on failure
+ */
+	char *out = NULL;
+	int keep = 16 - (int)strlen(suffix);
+	int len = name_length(name);
+	if (asprintf(&out, "%-16.16s%-16.16s", "", unit) < 0) {
+		return NULL;
+	}
+	char head[17];
+	snprintf(head, sizeof(head), "%.*s%s", (len < keep ? len : (keep > 0 ? keep : 0)), name, suffix);
+	memcpy(out, head, strlen(head));
+	return out;
+}
+
+static float *parse_list(char *arg, float *list, int *n) {
+//! Append comma separated values to a list, returning NULL on failure
+	for (char *tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		float *next = realloc(list, sizeof(float) * (*n + 1));
+		if (next == NULL) {
+			free(list);
+			return NULL;
+		}
+		list = next;
+		list[(*n)++] = strtof(tok, NULL);
+	}
+	return list;
+}
+
+int main(int argc, char **argv) {
+	char *outname = NULL;
+	int *vars = NULL;
+	int nvars = 0;
+	char **defs = NULL;
+	int ndefs = 0;
+	float *pct = NULL;
+	int npct = 0;
+	float *thr = NULL;
+	int nthr = 0;
+	int nbins = DEFAULT_BINS;
+	float limits[2] = {NAN, NAN};
+	int nthreads = 0;
+	bool verbose = false;
+
+	const char *usage = "Usage: %s [-V n] [-e NAME=expr] [-p p[,p...]] [-T t[,t...]] [-b bins] [-R lo,hi] [-j n] [-o output] [-c] [--stats[=json]] <filename> [filename...]\n"
+		"\t-V\tVariable to analyse (default: all). May be repeated\n"
+		"\t-e\tAnalyse a derived variable, e.g. -e 'SPEED=sqrt(U^2+V^2)'. May be repeated\n"
+		"\t-p\tPercentiles to write, separated by commas (default: 50,90,95,99)\n"
+		"\t-T\tThresholds for the time at or above, separated by commas\n"
+		"\t-b\tHistogram bins for each node (default: 256)\n"
+		"\t-R\tLimits of the histogram bins (default: range of each variable, found in a first pass)\n"
+		"\t-j\tNumber of threads to use (default: number of CPUs)\n"
+		"\t-o\tOutput file (default: input name with .percentiles.slf)\n"
+		"\t-c\tVerbose output\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "V:e:p:T:b:R:j:o:c")) != -1) {
+		switch (go) {
+			case 'V':
+				vars = realloc(vars, sizeof(int) * (nvars + 1));
+				if (vars == NULL) {
+					perror("Parsing options");
+					return EXIT_FAILURE;
+				}
+				vars[nvars++] = atoi(optarg);
+				break;
+			case 'e':
+				defs = realloc(defs, sizeof(char *) * (ndefs + 1));
+				if (defs == NULL) {
+					perror("Parsing options");
+					return EXIT_FAILURE;
+				}
+				defs[ndefs++] = optarg;
+				break;
+			case 'p':
+				pct = parse_list(optarg, pct, &npct);
+				if (pct == NULL) {
+					perror("Parsing options");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'T':
+				thr = parse_list(optarg, thr, &nthr);
+				if (thr == NULL) {
+					perror("Parsing options");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'b':
+				nbins = atoi(optarg);
+				if (nbins < 1) {
+					fprintf(stderr, "Number of bins must be greater than 0\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'R':
+				if (sscanf(optarg, "%f,%f", &limits[0], &limits[1]) != 2 || !(limits[1] > limits[0])) {
+					fprintf(stderr, "Bin limits must be given as lo,hi with hi above lo\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'o':
+				outname = optarg;
+				break;
+			case 'c':
+				verbose = true;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 1) {
+		fprintf(stderr, "Must provide a file (or restart chain of files) to process\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (npct == 0) {
+		static const float defpct[] = {50, 90, 95, 99};
+		npct = 4;
+		pct = malloc(sizeof(defpct));
+		if (pct == NULL) {
+			perror("Parsing options");
+			return EXIT_FAILURE;
+		}
+		memcpy(pct, defpct, sizeof(defpct));
+	}
+	for (int k = 0; k < npct; k++) {
+		if (pct[k] < 0 || pct[k] > 100) {
+			fprintf(stderr, "Percentile %g out of range (0 - 100)\n", pct[k]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	resfile_t rfs = {NULL, 0, 0, 0};
+	int rval = open_telemac_chain(&rfs, &argv[optind], argc - optind, false);
+	if (rfs.file == NULL || rval < 0) {
+		fprintf(stderr, "Unable to open %s (%d)\n", argv[optind], rval);
+		return EXIT_FAILURE;
+	}
+	telemac_data_t *mesh = &rfs.tmdat;
+	int nvar = mesh->nbv_1 + mesh->nbv_2;
+	if (mesh->nt < 1) {
+		fprintf(stderr, "No timesteps in %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	if (nvars == 0 && ndefs == 0) {
+		nvars = mesh->nbv_1;
+		vars = calloc(sizeof(int), nvars + 1);
+		if (vars == NULL) {
+			perror("Allocating variable list");
+			return EXIT_FAILURE;
+		}
+		for (int j = 0; j < nvars; j++) {
+			vars[j] = j;
+		}
+	}
+	bool *need = calloc(sizeof(bool), nvar + 1);
+	telemac_expr_t **exprs = calloc(sizeof(telemac_expr_t *), ndefs + 1);
+	float **derived = calloc(sizeof(float *), ndefs + 1);
+	if (need == NULL || exprs == NULL || derived == NULL) {
+		perror("Allocating variables");
+		return EXIT_FAILURE;
+	}
+	for (int j = 0; j < nvars; j++) {
+		if (vars[j] < 0 || vars[j] >= nvar) {
+			fprintf(stderr, "Variable %d out of range (%d variables)\n", vars[j], nvar);
+			return EXIT_FAILURE;
+		}
+		need[vars[j]] = true;
+	}
+	for (int e = 0; e < ndefs; e++) {
+		char err[512];
+		exprs[e] = telemac_expr_compile(defs[e], mesh, err, sizeof(err));
+		if (exprs[e] == NULL) {
+			fprintf(stderr, "Invalid derived variable: %s\n", err);
+			return EXIT_FAILURE;
+		}
+		telemac_expr_uses(exprs[e], need);
+		derived[e] = calloc(sizeof(float), mesh->npoin + 1);
+		if (derived[e] == NULL) {
+			perror("Allocating derived variables");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Inputs are the stored variables, then the derived variables
+	int nin = nvars + ndefs;
+	float **range = calloc(sizeof(float *), 2);
+	const float **values = calloc(sizeof(float *), nin);
+	telemac_hist_t *hist = calloc(sizeof(telemac_hist_t), nin);
+	if (range == NULL || values == NULL || hist == NULL) {
+		perror("Allocating histograms");
+		return EXIT_FAILURE;
+	}
+	for (int k = 0; k < 2; k++) {
+		range[k] = calloc(sizeof(float), nin);
+		if (range[k] == NULL) {
+			perror("Allocating histograms");
+			return EXIT_FAILURE;
+		}
+		for (int j = 0; j < nin; j++) {
+			range[k][j] = limits[k];
+		}
+	}
+
+	// Two passes if the range of the variables is needed, otherwise one
+	for (int pass = (isnan(limits[0]) ? 0 : 1); pass < 2; pass++) {
+		if (pass == 1) {
+			for (int j = 0; j < nin; j++) {
+				if (isnan(range[0][j]) || !(range[1][j] > range[0][j])) {
+					// Constant or entirely NaN: any bin will do
+					range[0][j] = (isnan(range[0][j]) ? 0 : range[0][j]);
+					range[1][j] = range[0][j] + 1;
+				}
+				if (verbose) {
+					fprintf(stdout, "Input %d: bins from %g to %g\n", j, range[0][j], range[1][j]);
+				}
+				if (telemac_hist_init(&hist[j], mesh->npoin, nbins, range[0][j], range[1][j], mesh->nt, thr, nthr) != 0) {
+					return EXIT_FAILURE;
+				}
+			}
+		}
+		telemac_stream_t *str = telemac_stream_open(&rfs, NULL, 0, need);
+		if (str == NULL) {
+			return EXIT_FAILURE;
+		}
+		for (int t = 0; t < (int)mesh->nt; t++) {
+			float time = 0;
+			float **data = telemac_stream_next(str, NULL, &time);
+			if (data == NULL) {
+				fprintf(stderr, "Unable to read timestep %d\n", t);
+				return EXIT_FAILURE;
+			}
+			if (telemac_expr_eval_all(exprs, ndefs, mesh, data, derived, nthreads) != 0) {
+				fprintf(stderr, "Unable to calculate derived variables for timestep %d\n", t);
+				return EXIT_FAILURE;
+			}
+			for (int j = 0; j < nin; j++) {
+				values[j] = (j < nvars ? data[vars[j]] : derived[j - nvars]);
+				if (pass == 1) {
+					if (telemac_hist_add(&hist[j], values[j], time, nthreads) != 0) {
+						return EXIT_FAILURE;
+					}
+					continue;
+				}
+				TM_STATS_BEGIN(TM_PHASE_FORMAT);
+				float mn = range[0][j], mx = range[1][j];
+				for (uint32_t i = 0; i < mesh->npoin; i++) {
+					float v = values[j][i];
+					mn = (v < mn || isnan(mn) ? v : mn);
+					mx = (v > mx || isnan(mx) ? v : mx);
+				}
+				range[0][j] = mn;
+				range[1][j] = mx;
+				TM_STATS_END(TM_PHASE_FORMAT);
+			}
+		}
+		telemac_stream_close(str);
+	}
+
+	// One output variable for each percentile and each threshold of each input
+	int nout = nin * (npct + nthr);
+	char **names = calloc(sizeof(char *), nout);
+	float **out = calloc(sizeof(float *), nout);
+	if (names == NULL || out == NULL) {
+		perror("Allocating output");
+		return EXIT_FAILURE;
+	}
+	for (int j = 0, o = 0; j < nin; j++) {
+		// Quadratic variables have no name in the file
+		bool named = (j < nvars && vars[j] < (int)mesh->nbv_1);
+		const char *name = (j < nvars ? (named ? mesh->var_names[vars[j]] : "(quadratic)") : exprs[j - nvars]->name);
+		const char *unit = (named ? &mesh->var_names[vars[j]][16] : "");
+		for (int k = 0; k < npct + nthr; k++, o++) {
+			char suffix[17];
+			if (k < npct) {
+				snprintf(suffix, sizeof(suffix), " P%g", pct[k]);
+			} else {
+				snprintf(suffix, sizeof(suffix), ">%g", thr[k - npct]);
+			}
+			names[o] = output_name(name, suffix, (k < npct ? unit : "S"));
+			out[o] = calloc(sizeof(float), mesh->npoin + 1);
+			if (names[o] == NULL || out[o] == NULL) {
+				perror("Allocating output");
+				return EXIT_FAILURE;
+			}
+			if (k < npct) {
+				if (telemac_hist_percentile(&hist[j], pct[k], out[o], nthreads) != 0) {
+					return EXIT_FAILURE;
+				}
+			} else {
+				const double *above = &hist[j].above[(size_t)(k - npct) * mesh->npoin];
+				for (uint32_t i = 0; i < mesh->npoin; i++) {
+					out[o][i] = above[i];
+				}
+			}
+		}
+	}
+
+	// Write a single timestep, at the time of the last timestep read
+	if (outname == NULL) {
+		char *base = strdup(argv[optind]);
+		asprintf(&outname, "%s.percentiles.slf", basename(base));
+		free(base);
+	}
+	telemac_data_t outmesh = *mesh;
+	outmesh.nbv_1 = nout;
+	outmesh.nbv_2 = 0;
+	outmesh.var_names = names;
+	FILE *outfile = fopen(outname, "wb");
+	if (outfile == NULL) {
+		perror("Unable to open output file");
+		return EXIT_FAILURE;
+	}
+	TM_STATS_BEGIN(TM_PHASE_WRITE);
+	rval = write_telemac_header(outfile, &outmesh);
+	if (rval == 0) {
+		rval = write_telemac_timestep(outfile, &outmesh, hist[0].time, out);
+	}
+	TM_STATS_END(TM_PHASE_WRITE);
+	if (rval != 0 || fclose(outfile) != 0) {
+		perror("Writing output");
+		return EXIT_FAILURE;
+	}
+	telemac_stats_add_file(outname);
+	size_t width = (hist[0].count16 != NULL ? sizeof(uint16_t) : sizeof(uint32_t));
+	fprintf(stdout, "%d percentiles and %d thresholds of %d variables over %u timesteps (%.1f MiB of histograms). Wrote %s\n",
+			npct, nthr, nin, mesh->nt, (double)width * nbins * mesh->npoin * nin / (1 << 20), outname);
+
+	for (int o = 0; o < nout; o++) {
+		free(names[o]);
+		free(out[o]);
+	}
+	for (int j = 0; j < nin; j++) {
+		telemac_hist_free(&hist[j]);
+	}
+	for (int e = 0; e < ndefs; e++) {
+		telemac_expr_free(exprs[e]);
+		free(derived[e]);
+	}
+	free(names);
+	free(out);
+	free(hist);
+	free(values);
+	free(range[0]);
+	free(range[1]);
+	free(range);
+	free(exprs);
+	free(derived);
+	free(need);
+	free(vars);
+	free(defs);
+	free(pct);
+	free(thr);
+	close_telemac(&rfs);
+	return EXIT_SUCCESS;
+}
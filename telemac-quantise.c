@@ -0,0 +1,229 @@
+/******************************************************************************
+telemac-quantise - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "telemac-quantise.h"
+
+/*!
+ * @file
+ * @brief Reduced precision values for binary exports
+ *
+ * Half precision conversions work on the bits of each value with integer
+ * arithmetic, after F. Giesen's branch-free float/half conversions: every
+ * case (normal, subnormal, overflow and NaN) is calculated and the result
+ * selected, so the loops have no branches.
+ */
+
+//! Bits of a float
+typedef union {
+	float f; //!< Value
+	uint32_t u; //!< Bits of the value
+} bits_t;
+
+//! Names of the value types, as given on the command line
+static const char *names[] = {"double", "float", "half", "u16", "u8"};
+
+//! Size of each value type in bytes
+static const size_t sizes[] = {sizeof(double), sizeof(float), sizeof(uint16_t), sizeof(uint16_t), sizeof(uint8_t)};
+
+int telemac_values_parse(const char *name) {
+/*!
+ * @brief Find a value type by name
+ * @param name	One of "double", "float", "half", "u16" or "u8"
+ * @returns	Value type, or -1 if the name is not recognised
+ */
+	for (int k = 0; k < (int)(sizeof(names) / sizeof(names[0])); k++) {
+		if (strcmp(name, names[k]) == 0) {
+			return k;
+		}
+	}
+	return -1;
+}
+
+const char *telemac_values_name(telemac_values_t type) {
+/*!
+ * @brief Name of a value type, as accepted by telemac_values_parse()
+ */
+	return names[type];
+}
+
+size_t telemac_values_size(telemac_values_t type) {
+/*!
+ * @brief Size of one value in bytes
+ */
+	return sizes[type];
+}
+
+static uint32_t top_code(telemac_values_t type) {
+/*!
+ * @brief Code used for NaN by scaled types, one more than the largest code for a value
+ */
+	return (type == TELEMAC_VALUES_U8 ? UINT8_MAX : UINT16_MAX);
+}
+
+telemac_scale_t telemac_values_range(telemac_values_t type, const float *values, size_t n) {
+/*!
+ * @brief Choose the offset and scale of scaled integers for an array
+ *
+ * The offset is the smallest finite value, and the largest finite value
+ * has the largest code. Arrays with a single value (or none) have a scale
+ * of 1.
+ * @param type	Value type. Types other than TELEMAC_VALUES_U16 and TELEMAC_VALUES_U8 always have an offset of 0 and a scale of 1.
+ * @param values	Values to write
+ * @param n	Number of values
+ * @returns	Offset and scale to pass to telemac_values_pack()
+ */
+	telemac_scale_t sc = {0, 1};
+	if (type != TELEMAC_VALUES_U16 && type != TELEMAC_VALUES_U8) {
+		return sc;
+	}
+	float lo = FLT_MAX;
+	float hi = -FLT_MAX;
+	for (size_t i = 0; i < n; i++) {
+		// NaN and infinite values are replaced by the limit found so far
+		float f = (fabsf(values[i]) <= FLT_MAX ? values[i] : lo);
+		lo = (f < lo ? f : lo);
+		f = (fabsf(values[i]) <= FLT_MAX ? values[i] : hi);
+		hi = (f > hi ? f : hi);
+	}
+	if (lo > hi) {
+		return sc;
+	}
+	sc.offset = lo;
+	if (hi > lo) {
+		sc.scale = ((double)hi - lo) / (top_code(type) - 1);
+	}
+	return sc;
+}
+
+void telemac_float_to_half(const float *values, size_t n, uint16_t *out) {
+/*!
+ * @brief Convert floats to half precision, rounding to nearest even
+ * @param values	Values to convert
+ * @param n	Number of values
+ * @param out	Half precision values
+ */
+	for (size_t i = 0; i < n; i++) {
+		bits_t b = {.f = values[i]};
+		uint32_t sign = b.u & 0x80000000u;
+		uint32_t f = b.u ^ sign;
+
+		// Too large for half precision: infinity, or a quiet NaN
+		uint32_t big = (f > 0x7f800000u ? 0x7e00u : 0x7c00u);
+
+		// Subnormal: adding 0.5 lines the mantissa up with that of the half
+		bits_t s = {.u = f};
+		s.f += 0.5f;
+		uint32_t sub = s.u - 0x3f000000u;
+
+		// Normal: rebias the exponent and round the mantissa to nearest even
+		uint32_t odd = (f >> 13) & 1;
+		uint32_t norm = (f + 0xc8000fffu + odd) >> 13;
+
+		uint32_t h = (f < 0x38800000u ? sub : norm);
+		h = (f >= 0x47800000u ? big : h);
+		out[i] = (uint16_t)(h | (sign >> 16));
+	}
+}
+
+void telemac_half_to_float(const uint16_t *values, size_t n, float *out) {
+/*!
+ * @brief Convert half precision values to floats (exactly)
+ * @param values	Half precision values
+ * @param n	Number of values
+ * @param out	Converted values
+ */
+	for (size_t i = 0; i < n; i++) {
+		uint32_t h = values[i];
+		uint32_t f = (h & 0x7fffu) << 13;
+		uint32_t e = f & 0x0f800000u;
+		f += 0x38000000u;
+
+		// Infinity or NaN: the exponent is all ones
+		uint32_t infnan = f + 0x38000000u;
+
+		// Zero or subnormal: renormalised by subtracting 2^-14
+		bits_t s = {.u = f + 0x00800000u};
+		s.f -= 6.103515625e-05f;
+
+		f = (e == 0 ? s.u : f);
+		f = (e == 0x0f800000u ? infnan : f);
+		bits_t b = {.u = f | (h & 0x8000u) << 16};
+		out[i] = b.f;
+	}
+}
+
+void telemac_values_pack(telemac_values_t type, const float *values, size_t n, telemac_scale_t sc, void *out) {
+/*!
+ * @brief Convert an array of values for writing
+ * @param type	Value type
+ * @param values	Values to convert
+ * @param n	Number of values
+ * @param sc	Offset and scale for scaled types, from telemac_values_range()
+ * @param out	Converted values, of n * telemac_values_size(type) bytes (native byte order)
+ */
+	const float *restrict v = values;
+	if (type == TELEMAC_VALUES_DOUBLE) {
+		double *restrict o = out;
+		for (size_t i = 0; i < n; i++) {
+			o[i] = v[i];
+		}
+		return;
+	}
+	if (type == TELEMAC_VALUES_FLOAT) {
+		memcpy(out, values, n * sizeof(float));
+		return;
+	}
+	if (type == TELEMAC_VALUES_HALF) {
+		telemac_float_to_half(values, n, out);
+		return;
+	}
+
+	const int32_t nan = top_code(type);
+	if (type == TELEMAC_VALUES_U16) {
+		// In double precision, as float rounding would be a noticeable fraction of a code
+		const double off = sc.offset;
+		const double inv = 1 / sc.scale;
+		const double top = nan - 1;
+		uint16_t *restrict o = out;
+		for (size_t i = 0; i < n; i++) {
+			// NaN fails the first comparison, and its code is replaced below
+			double q = (v[i] - off) * inv + 0.5;
+			q = (q > 0 ? q : 0);
+			q = (q < top ? q : top);
+			int32_t c = (int32_t)q;
+			o[i] = (uint16_t)(v[i] == v[i] ? c : nan);
+		}
+	} else {
+		const float off = sc.offset;
+		const float inv = 1 / sc.scale;
+		const float top = nan - 1;
+		uint8_t *restrict o = out;
+		for (size_t i = 0; i < n; i++) {
+			float q = (v[i] - off) * inv + 0.5f;
+			q = (q > 0 ? q : 0);
+			q = (q < top ? q : top);
+			int32_t c = (int32_t)q;
+			o[i] = (uint8_t)(v[i] == v[i] ? c : nan);
+		}
+	}
+}
@@ -0,0 +1,74 @@
+/******************************************************************************
+telemac-quantise - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Reduced precision values for binary exports
+ */
+
+#ifndef TELEMAC_QUANTISE_H
+#define TELEMAC_QUANTISE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*!
+ * @defgroup quantise Reduced precision values
+ * @brief Conversion of variables to smaller types for visualisation
+ *
+ * Values may be written as IEEE half precision floats, or as 8 or 16-bit
+ * unsigned integers scaled to the range of each array. A scaled value is
+ * recovered as offset + code * scale, where the offset is the smallest
+ * finite value in the array and the scale spreads the codes over its
+ * range. The largest code of each type is reserved for NaN, and infinite
+ * values are limited to the range. The error of a scaled value is at most
+ * half of the scale. Half precision keeps 11 significant bits, rounding to
+ * nearest even; magnitudes above 65504 become infinite.
+ *
+ * The conversions are written without branches, so that the compiler can
+ * vectorise them.
+ * @{
+ */
+
+//! Types of value written by binary exports
+typedef enum {
+	TELEMAC_VALUES_DOUBLE, //!< 64-bit floating point
+	TELEMAC_VALUES_FLOAT, //!< 32-bit floating point
+	TELEMAC_VALUES_HALF, //!< 16-bit floating point (IEEE 754 binary16)
+	TELEMAC_VALUES_U16, //!< 16-bit unsigned integers, scaled
+	TELEMAC_VALUES_U8, //!< 8-bit unsigned integers, scaled
+} telemac_values_t;
+
+//! Offset and scale of an array of scaled integers
+typedef struct {
+	double offset; //!< Value of code 0
+	double scale; //!< Difference in value between successive codes
+} telemac_scale_t;
+
+int telemac_values_parse(const char *name);
+const char *telemac_values_name(telemac_values_t type);
+size_t telemac_values_size(telemac_values_t type);
+telemac_scale_t telemac_values_range(telemac_values_t type, const float *values, size_t n);
+void telemac_values_pack(telemac_values_t type, const float *values, size_t n, telemac_scale_t sc, void *out);
+
+void telemac_float_to_half(const float *values, size_t n, uint16_t *out);
+void telemac_half_to_float(const uint16_t *values, size_t n, float *out);
+
+/*! @} */
+#endif // TELEMAC_QUANTISE_H
@@ -0,0 +1,156 @@
+/******************************************************************************
+telemac-query - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "telemac-served.h"
+#include "telemac-socket.h"
+
+/*!
+ * @file
+ * @brief Command line client for telemac-served
+ *
+ * Sends a single request, built from the command line arguments, and copies
+ * the reply to standard output. For requests naming a results file, the last
+ * argument is taken as the file name and made absolute before sending.
+ *
+ * Returns zero if the server answered OK, and EXIT_FAILURE otherwise.
+ */
+
+int main(int argc, char **argv) {
+	char *sockpath = getenv(TELEMAC_SOCKET_ENV);
+	char defpath[108];
+	bool quiet = false;
+
+	const char *usage = "Usage: %s [-s socket] [-q] REQUEST [arguments...] [filename]\n"
+		"\t-s\tSocket path (default: $" TELEMAC_SOCKET_ENV ", or " TELEMAC_SOCKET_DEFAULT ")\n"
+		"\t-q\tDo not print the status line\n"
+		"Requests:\n"
+		"\tINFO file\n"
+		"\tTIMES file\n"
+		"\tSERIES node var file\n"
+		"\tPOINT x y var step file\t(step -1 for every timestep)\n"
+		"\tSTATS var step file\n"
+		"\tSTATUS\n"
+		"\tQUIT\n";
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "+s:q")) != -1) {
+		switch (go) {
+			case 's':
+				sockpath = optarg;
+				break;
+			case 'q':
+				quiet = true;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind < 1) {
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (sockpath == NULL) {
+		if (telemac_socket_path(defpath, sizeof(defpath), false) != 0) {
+			fprintf(stderr, "No safe default socket path: use -s\n");
+			return EXIT_FAILURE;
+		}
+		sockpath = defpath;
+	}
+
+	// Build the request, making the file name (if any) absolute
+	bool hasfile = (strcmp(argv[optind], "STATUS") != 0 && strcmp(argv[optind], "QUIT") != 0 && argc - optind > 1);
+	char *request = strdup("");
+	for (int i = optind; i < argc && request != NULL; i++) {
+		char *arg = argv[i];
+		char *path = NULL;
+		if (hasfile && i == argc - 1) {
+			path = realpath(arg, NULL);
+			if (path == NULL) {
+				perror(arg);
+				return EXIT_FAILURE;
+			}
+			arg = path;
+		}
+		char *next = NULL;
+		if (asprintf(&next, "%s%s%s", request, (i > optind ? " " : ""), arg) < 0) {
+			next = NULL;
+		}
+		free(request);
+		free(path);
+		request = next;
+	}
+	if (request == NULL || strlen(request) >= TELEMAC_REQUEST_MAX) {
+		fprintf(stderr, "Request too long\n");
+		return EXIT_FAILURE;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(sockpath) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", sockpath);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, sockpath);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		perror(sockpath);
+		return EXIT_FAILURE;
+	}
+
+	FILE *conn = fdopen(fd, "r+");
+	if (conn == NULL) {
+		perror("Opening connection");
+		return EXIT_FAILURE;
+	}
+	fprintf(conn, "%s\n", request);
+	fflush(conn);
+	shutdown(fd, SHUT_WR);
+	free(request);
+
+	char line[TELEMAC_REQUEST_MAX];
+	bool ok = false;
+	if (fgets(line, sizeof(line), conn) != NULL) {
+		ok = (strcmp(line, "OK\n") == 0);
+		if (!ok) {
+			fputs(line, stderr);
+		} else if (!quiet) {
+			fputs(line, stdout);
+		}
+	} else {
+		fprintf(stderr, "No reply from server\n");
+	}
+	size_t n = 0;
+	while ((n = fread(line, 1, sizeof(line), conn)) > 0) {
+		fwrite(line, 1, n, stdout);
+	}
+	fclose(conn);
+	return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,349 @@
+/******************************************************************************
+telemac-raster - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "telemac-raster.h"
+#include "telemac-layers.h"
+#include "telemac-thread.h"
+#include "telemac-stats.h"
+
+/*!
+ * @file
+ * @brief Interpolation of mesh results on to regular grids
+ *
+ * The map is built by scanline rasterisation: for each row of cell centres
+ * crossing a triangle, the span of columns inside the triangle is found from
+ * the intersections of the row with the triangle's edges.
+ *
+ * To build the map in parallel, rows are divided into bands and each
+ * triangle is listed in every band it crosses. Each band is then filled by
+ * one worker, taking its triangles in order, so a cell centre lying on an
+ * edge shared by two triangles is always given to the same one.
+ */
+
+//! Rows of cells in each band
+#define RASTER_BAND 32
+//! Cells handled by each call to the gather task
+#define RASTER_CHUNK 65536
+//! No triangle covers this cell
+#define RASTER_NONE UINT32_MAX
+
+//! Working state for building a map
+typedef struct {
+	telemac_raster_t *map; //!< Map being built (grid size only)
+	const float *X; //!< Node X coordinates
+	const float *Y; //!< Node Y coordinates
+	uint32_t *tri[3]; //!< Nodes of each triangle
+	size_t *band_start; //!< Start of each band's entries in band_tri
+	uint32_t *band_tri; //!< Triangles crossing each band, in order
+	uint32_t *cell_tri; //!< Triangle covering each cell, or RASTER_NONE
+	float *cell_w[2]; //!< First two interpolation weights for each cell
+} raster_build_t;
+
+static void row_range(const raster_build_t *b, uint32_t t, int64_t *rlo, int64_t *rhi) {
+//! Rows whose cell centres may lie within triangle t (may be outside the grid)
+	const telemac_raster_t *m = b->map;
+	float ymin = b->Y[b->tri[0][t]];
+	float ymax = ymin;
+	for (int k = 1; k < 3; k++) {
+		float y = b->Y[b->tri[k][t]];
+		ymin = (y < ymin ? y : ymin);
+		ymax = (y > ymax ? y : ymax);
+	}
+	// Centre of row r is at yll + (nrows - r - 0.5) * cellsize
+	*rlo = (int64_t)ceil(m->nrows - 0.5 - (ymax - m->yll) / m->cellsize);
+	*rhi = (int64_t)floor(m->nrows - 0.5 - (ymin - m->yll) / m->cellsize);
+}
+
+static void band_range(const raster_build_t *b, uint32_t t, int64_t *blo, int64_t *bhi) {
+//! Bands of the grid crossed by triangle t (none if blo > bhi)
+	int64_t rlo, rhi;
+	row_range(b, t, &rlo, &rhi);
+	rlo = (rlo > 0 ? rlo : 0);
+	rhi = (rhi < b->map->nrows ? rhi : (int64_t)b->map->nrows - 1);
+	*blo = rlo / RASTER_BAND;
+	*bhi = (rlo <= rhi ? rhi / RASTER_BAND : *blo - 1);
+}
+
+static int band_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: rasterise the triangles crossing a range of bands
+	raster_build_t *b = (raster_build_t *)ctx;
+	const telemac_raster_t *m = b->map;
+	for (size_t band = start; band < end; band++) {
+		int64_t r0 = band * RASTER_BAND;
+		int64_t r1 = r0 + RASTER_BAND - 1;
+		r1 = (r1 < m->nrows ? r1 : m->nrows - 1);
+		for (size_t i = b->band_start[band]; i < b->band_start[band + 1]; i++) {
+			uint32_t t = b->band_tri[i];
+			double x[3], y[3];
+			for (int k = 0; k < 3; k++) {
+				x[k] = b->X[b->tri[k][t]];
+				y[k] = b->Y[b->tri[k][t]];
+			}
+			double det = (y[1] - y[2]) * (x[0] - x[2]) + (x[2] - x[1]) * (y[0] - y[2]);
+			if (det == 0) {
+				continue;
+			}
+			int64_t rlo, rhi;
+			row_range(b, t, &rlo, &rhi);
+			rlo = (rlo > r0 ? rlo : r0);
+			rhi = (rhi < r1 ? rhi : r1);
+			for (int64_t r = rlo; r <= rhi; r++) {
+				double py = m->yll + (m->nrows - r - 0.5) * m->cellsize;
+				// Span of the row inside the triangle
+				double xl = INFINITY;
+				double xr = -INFINITY;
+				for (int k = 0; k < 3; k++) {
+					int k2 = (k + 1) % 3;
+					if ((py < y[k] && py < y[k2]) || (py > y[k] && py > y[k2])) {
+						continue;
+					}
+					if (y[k] == y[k2]) {
+						// Edge lies along the row
+						xl = fmin(xl, fmin(x[k], x[k2]));
+						xr = fmax(xr, fmax(x[k], x[k2]));
+					} else {
+						double xi = x[k] + (py - y[k]) * (x[k2] - x[k]) / (y[k2] - y[k]);
+						xl = fmin(xl, xi);
+						xr = fmax(xr, xi);
+					}
+				}
+				if (xl > xr) {
+					continue;
+				}
+				int64_t clo = (int64_t)ceil((xl - m->xll) / m->cellsize - 0.5);
+				int64_t chi = (int64_t)floor((xr - m->xll) / m->cellsize - 0.5);
+				clo = (clo > 0 ? clo : 0);
+				chi = (chi < m->ncols ? chi : (int64_t)m->ncols - 1);
+				for (int64_t c = clo; c <= chi; c++) {
+					double px = m->xll + (c + 0.5) * m->cellsize;
+					double w0 = ((y[1] - y[2]) * (px - x[2]) + (x[2] - x[1]) * (py - y[2])) / det;
+					double w1 = ((y[2] - y[0]) * (px - x[2]) + (x[0] - x[2]) * (py - y[2])) / det;
+					size_t cell = (size_t)r * m->ncols + c;
+					b->cell_tri[cell] = t;
+					b->cell_w[0][cell] = fmin(fmax(w0, 0), 1);
+					b->cell_w[1][cell] = fmin(fmax(w1, 0), 1);
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+telemac_raster_t *telemac_raster_map(const telemac_data_t *results, double cellsize, const double *extent, int nthreads) {
+/*!
+ * @brief Calculate the mapping from grid cells to mesh nodes
+ *
+ * @param results	Results file header and mesh
+ * @param cellsize	Width and height of each cell
+ * @param extent	Grid extent as {xmin, ymin, xmax, ymax}, or NULL to cover the mesh
+ * @param nthreads	Number of threads (see telemac_parallel_for())
+ * @retval telemac_raster_t*	Map, to be released with telemac_raster_free()
+ * @retval NULL	Invalid arguments or allocation failure
+ */
+	telemac_layers_t layers;
+	if (results->state != 2 || !(cellsize > 0) || telemac_get_layers(results, &layers) != 0) {
+		fprintf(stderr, "telemac_raster_map: mesh not loaded or invalid cell size\n");
+		return NULL;
+	}
+	double ext[4] = {results->XYrange[0], results->XYrange[2], results->XYrange[1], results->XYrange[3]};
+	if (extent != NULL) {
+		memcpy(ext, extent, sizeof(ext));
+	}
+	double nc = ceil((ext[2] - ext[0]) / cellsize);
+	double nr = ceil((ext[3] - ext[1]) / cellsize);
+	nc = (nc < 1 ? 1 : nc);
+	nr = (nr < 1 ? 1 : nr);
+	if (!(ext[2] >= ext[0] && ext[3] >= ext[1]) || nc * nr > UINT32_MAX - 1) {
+		fprintf(stderr, "telemac_raster_map: invalid extent, or too many cells (%.0f x %.0f)\n", nc, nr);
+		return NULL;
+	}
+
+	telemac_raster_t *map = calloc(sizeof(telemac_raster_t), 1);
+	if (map == NULL) {
+		perror("telemac_raster_map");
+		return NULL;
+	}
+	map->ncols = nc;
+	map->nrows = nr;
+	map->xll = ext[0];
+	map->yll = ext[1];
+	map->cellsize = cellsize;
+
+	size_t ncell = (size_t)map->ncols * map->nrows;
+	size_t maxtri = (size_t)layers.nelem2 * (results->ndp == 4 ? 2 : 1) + 1;
+	uint32_t nband = (map->nrows + RASTER_BAND - 1) / RASTER_BAND;
+	raster_build_t b = {map, results->X, results->Y, {NULL, NULL, NULL}, NULL, NULL, NULL, {NULL, NULL}};
+	for (int k = 0; k < 3; k++) {
+		b.tri[k] = calloc(sizeof(uint32_t), maxtri);
+	}
+	b.band_start = calloc(sizeof(size_t), nband + 1);
+	b.cell_tri = malloc(sizeof(uint32_t) * ncell);
+	b.cell_w[0] = malloc(sizeof(float) * ncell);
+	b.cell_w[1] = malloc(sizeof(float) * ncell);
+	int rv = 0;
+	if (b.tri[0] == NULL || b.tri[1] == NULL || b.tri[2] == NULL || b.band_start == NULL
+			|| b.cell_tri == NULL || b.cell_w[0] == NULL || b.cell_w[1] == NULL) {
+		rv = -1;
+	}
+
+	TM_STATS_BEGIN(TM_PHASE_MESH);
+	uint32_t ntri = 0;
+	if (rv == 0) {
+		ntri = telemac_plane_triangles(results, &layers, b.tri);
+		memset(b.cell_tri, 0xff, sizeof(uint32_t) * ncell);
+
+		// List the triangles crossing each band: count, prefix sum, fill
+		for (uint32_t t = 0; t < ntri; t++) {
+			int64_t blo, bhi;
+			band_range(&b, t, &blo, &bhi);
+			for (int64_t band = blo; band <= bhi; band++) {
+				b.band_start[band + 1]++;
+			}
+		}
+		for (uint32_t i = 0; i < nband; i++) {
+			b.band_start[i + 1] += b.band_start[i];
+		}
+		b.band_tri = calloc(sizeof(uint32_t), b.band_start[nband] + 1);
+		size_t *next = calloc(sizeof(size_t), nband + 1);
+		if (b.band_tri == NULL || next == NULL) {
+			rv = -1;
+		} else {
+			memcpy(next, b.band_start, sizeof(size_t) * nband);
+			for (uint32_t t = 0; t < ntri; t++) {
+				int64_t blo, bhi;
+				band_range(&b, t, &blo, &bhi);
+				for (int64_t band = blo; band <= bhi; band++) {
+					b.band_tri[next[band]++] = t;
+				}
+			}
+		}
+		free(next);
+	}
+	if (rv == 0) {
+		rv = telemac_parallel_for(nthreads, nband, 1, band_task, &b);
+	}
+
+	// Keep only the cells inside the mesh, in grid order
+	if (rv == 0) {
+		for (size_t c = 0; c < ncell; c++) {
+			map->npix += (b.cell_tri[c] != RASTER_NONE);
+		}
+		size_t n = (map->npix ? map->npix : 1);
+		map->pix = calloc(sizeof(uint32_t), n);
+		for (int k = 0; k < 3; k++) {
+			map->node[k] = calloc(sizeof(uint32_t), n);
+			map->w[k] = calloc(sizeof(float), n);
+			rv |= (map->node[k] == NULL || map->w[k] == NULL ? -1 : 0);
+		}
+		rv |= (map->pix == NULL ? -1 : 0);
+	}
+	if (rv == 0) {
+		uint32_t p = 0;
+		for (size_t c = 0; c < ncell; c++) {
+			uint32_t t = b.cell_tri[c];
+			if (t == RASTER_NONE) {
+				continue;
+			}
+			map->pix[p] = c;
+			for (int k = 0; k < 3; k++) {
+				map->node[k][p] = b.tri[k][t];
+			}
+			map->w[0][p] = b.cell_w[0][c];
+			map->w[1][p] = b.cell_w[1][c];
+			map->w[2][p] = 1.0f - b.cell_w[0][c] - b.cell_w[1][c];
+			p++;
+		}
+		TM_STATS_ALLOC(map->npix * (sizeof(uint32_t) * 4 + sizeof(float) * 3));
+	}
+	TM_STATS_END(TM_PHASE_MESH);
+
+	for (int k = 0; k < 3; k++) {
+		free(b.tri[k]);
+	}
+	free(b.band_start);
+	free(b.band_tri);
+	free(b.cell_tri);
+	free(b.cell_w[0]);
+	free(b.cell_w[1]);
+	if (rv != 0) {
+		perror("telemac_raster_map");
+		telemac_raster_free(map);
+		return NULL;
+	}
+	return map;
+}
+
+//! Arguments for the gather task
+typedef struct {
+	const telemac_raster_t *map; //!< Cell map
+	const float *values; //!< Nodal values
+	float *grid; //!< Output grid
+} raster_fill_t;
+
+static int fill_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: interpolate a range of cells
+	raster_fill_t *f = (raster_fill_t *)ctx;
+	const telemac_raster_t *m = f->map;
+	const uint32_t *restrict n0 = m->node[0], *restrict n1 = m->node[1], *restrict n2 = m->node[2];
+	const float *restrict w0 = m->w[0], *restrict w1 = m->w[1], *restrict w2 = m->w[2];
+	const uint32_t *restrict pix = m->pix;
+	const float *restrict v = f->values;
+	float *restrict grid = f->grid;
+	for (size_t p = start; p < end; p++) {
+		grid[pix[p]] = w0[p] * v[n0[p]] + w1[p] * v[n1[p]] + w2[p] * v[n2[p]];
+	}
+	return 0;
+}
+
+int telemac_raster_fill(const telemac_raster_t *map, const float *values, float *grid, float nodata, int nthreads) {
+/*!
+ * @brief Interpolate nodal values on to a grid
+ *
+ * @param map	Cell map (see telemac_raster_map())
+ * @param values	Nodal values (of a single plane, for 3D meshes)
+ * @param grid	Output: ncols * nrows values, from the top row down
+ * @param nodata	Value for cells outside the mesh
+ * @param nthreads	Number of threads (see telemac_parallel_for())
+ * @returns	0 on success, -1 on failure
+ */
+	size_t ncell = (size_t)map->ncols * map->nrows;
+	for (size_t c = 0; c < ncell; c++) {
+		grid[c] = nodata;
+	}
+	raster_fill_t f = {map, values, grid};
+	return telemac_parallel_for(nthreads, map->npix, RASTER_CHUNK, fill_task, &f);
+}
+
+void telemac_raster_free(telemac_raster_t *map) {
+//! Release a cell map
+	if (map == NULL) {
+		return;
+	}
+	free(map->pix);
+	for (int k = 0; k < 3; k++) {
+		free(map->node[k]);
+		free(map->w[k]);
+	}
+	free(map);
+}
@@ -0,0 +1,65 @@
+/******************************************************************************
+telemac-raster - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Interpolation of mesh results on to regular grids
+ */
+
+#ifndef TELEMAC_RASTER_H
+#define TELEMAC_RASTER_H
+
+#include <stdint.h>
+#include "telemac-loader.h"
+
+/*!
+ * @defgroup raster Rasterisation
+ * @brief Regular grids of values interpolated from the mesh
+ *
+ * A map from grid cells to mesh nodes is calculated once: the centre of each
+ * cell is located in a triangle of the mesh, and the linear interpolation
+ * weights of the triangle's nodes at that point are stored. Filling a grid
+ * for a variable is then a weighted gather of three nodal values per cell.
+ *
+ * Rows are numbered from the top (largest Y) of the grid, as used by most
+ * raster formats. Quadrilaterals are split into two triangles. For 3D meshes
+ * the triangles of the bottom plane are used, so the map refers to nodes of
+ * a single plane (see telemac_read_plane()).
+ * @{
+ */
+
+//! Mapping from grid cells to interpolation weights
+typedef struct {
+	uint32_t ncols; //!< Number of columns
+	uint32_t nrows; //!< Number of rows
+	double xll; //!< X coordinate of the lower left corner of the grid
+	double yll; //!< Y coordinate of the lower left corner of the grid
+	double cellsize; //!< Width and height of each cell
+	uint32_t npix; //!< Number of cells inside the mesh
+	uint32_t *pix; //!< Index (row * ncols + column) of each cell inside the mesh
+	uint32_t *node[3]; //!< Nodes of the triangle containing each cell centre
+	float *w[3]; //!< Interpolation weight of each node
+} telemac_raster_t;
+
+telemac_raster_t *telemac_raster_map(const telemac_data_t *results, double cellsize, const double *extent, int nthreads);
+int telemac_raster_fill(const telemac_raster_t *map, const float *values, float *grid, float nodata, int nthreads);
+void telemac_raster_free(telemac_raster_t *map);
+
+/*! @} */
+#endif // TELEMAC_RASTER_H
@@ -0,0 +1,399 @@
+/******************************************************************************
+telemac-rasterise - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-layers.h"
+#include "telemac-raster.h"
+#include "telemac-thread.h"
+#include "telemac-format.h"
+
+/*!
+ * @file
+ * @brief Interpolate results on to regular grids for use in GIS software
+ *
+ * Writes one grid for each selected variable at each selected timestep, as
+ * an ESRI ASCII grid (.asc) or as raw single precision values with an ESRI
+ * header (.flt and .hdr). The mapping from grid cells to the mesh is
+ * calculated once, so each grid costs only a weighted gather of nodal values.
+ *
+ * Each variable at each timestep is a separate unit of work, shared between
+ * threads. Every thread reads, interpolates and writes its grids with its own
+ * buffers, formatting text grids a buffer at a time.
+ *
+ * Returns zero on success and EXIT_FAILURE if an error occurs.
+ */
+
+//! Size of the text output buffer for each thread
+#define RASTERISE_BUFSIZE (1 << 20)
+
+//! Largest memory to use for the grids of all threads together
+#define RASTERISE_MEMORY ((size_t)1 << 30)
+
+//! Shared state for writing the grids
+typedef struct {
+	const resfile_t *rfs; //!< Results file
+	const telemac_layers_t *layers; //!< 3D layout
+	const telemac_raster_t *map; //!< Cell map
+	const char *basefilename; //!< Output directory and file name prefix
+	const int *vars; //!< Variables to rasterise
+	int nvars; //!< Number of entries in vars
+	int first; //!< First timestep
+	int every; //!< Interval between timesteps
+	int plane; //!< Plane of 3D results
+	float nodata; //!< Value for cells outside the mesh
+	bool binary; //!< Write binary rather than text grids
+	bool verbose; //!< Report each timestep
+	int inner; //!< Threads for interpolating each grid
+	float **values; //!< Nodal values, for each thread
+	float **grid; //!< Grid, for each thread
+	char **buf; //!< Text output buffer, for each thread
+} rasterise_t;
+
+static int write_header(FILE *file, const telemac_raster_t *map, float nodata, bool binary) {
+//! Write the ESRI grid header, shared by the ASCII and binary formats
+	fprintf(file, "ncols %u\nnrows %u\nxllcorner %.10g\nyllcorner %.10g\ncellsize %.10g\nNODATA_value %.10g\n",
+			map->ncols, map->nrows, map->xll, map->yll, map->cellsize, nodata);
+	if (binary) {
+		uint16_t one = 1;
+		fprintf(file, "byteorder %s\n", (*(uint8_t *)&one ? "LSBFIRST" : "MSBFIRST"));
+	}
+	return ferror(file);
+}
+
+static int flush_buffer(const char *buf, size_t len, FILE *file) {
+//! Write out the contents of an output buffer, returning 0 on success or -1 on failure
+	TM_STATS_BEGIN(TM_PHASE_WRITE);
+	size_t written = fwrite(buf, 1, len, file);
+	TM_STATS_END(TM_PHASE_WRITE);
+	TM_STATS_ADD(TM_COUNT_WRITE_CALLS, 1);
+	return (written == len ? 0 : -1);
+}
+
+static int write_grid(const char *base, const telemac_raster_t *map, const float *grid, float nodata, bool binary, char *buf) {
+/*!
+ * @brief Write a grid to base.asc, or to base.flt and base.hdr
+ *
+ * Text grids are formatted as printf("%.7g") through @p buf, of RASTERISE_BUFSIZE bytes.
+ * @returns 0 on success, -1 on failure
+ */
+	char *name = NULL;
+	asprintf(&name, "%s.%s", base, (binary ? "hdr" : "asc"));
+	FILE *file = fopen(name, "w");
+	if (file == NULL) {
+		perror(name);
+		free(name);
+		return -1;
+	}
+	int rv = write_header(file, map, nodata, binary);
+	if (!binary && rv == 0) {
+		size_t len = 0;
+		TM_STATS_BEGIN(TM_PHASE_FORMAT);
+		for (uint32_t r = 0; r < map->nrows && rv == 0; r++) {
+			const float *row = &grid[(size_t)r * map->ncols];
+			for (uint32_t c = 0; c < map->ncols; c++) {
+				if (len > RASTERISE_BUFSIZE - 2 * TELEMAC_FORMAT_MAX) {
+					TM_STATS_END(TM_PHASE_FORMAT);
+					rv = flush_buffer(buf, len, file);
+					len = 0;
+					TM_STATS_BEGIN(TM_PHASE_FORMAT);
+					if (rv != 0) {
+						break;
+					}
+				}
+				if (c > 0) {
+					buf[len++] = ' ';
+				}
+				len += telemac_format_general(&buf[len], row[c], 7);
+			}
+			buf[len++] = '\n';
+		}
+		TM_STATS_END(TM_PHASE_FORMAT);
+		if (rv == 0) {
+			rv = flush_buffer(buf, len, file);
+		}
+	}
+	rv |= fclose(file);
+	telemac_stats_add_file(name);
+	free(name);
+
+	if (binary && rv == 0) {
+		asprintf(&name, "%s.flt", base);
+		file = fopen(name, "wb");
+		if (file == NULL) {
+			perror(name);
+			free(name);
+			return -1;
+		}
+		size_t n = (size_t)map->ncols * map->nrows;
+		TM_STATS_BEGIN(TM_PHASE_WRITE);
+		rv = (fwrite(grid, sizeof(float), n, file) != n);
+		rv |= fclose(file);
+		TM_STATS_END(TM_PHASE_WRITE);
+		telemac_stats_add_file(name);
+		free(name);
+	}
+	return (rv ? -1 : 0);
+}
+
+static int rasterise_task(void *ctx, size_t start, size_t end, int thread) {
+/*!
+ * @brief Write the grids for work units @p start to @p end - 1 (see telemac_parallel_for())
+ *
+ * Unit u is variable vars[u % nvars] at the (u / nvars)th selected timestep.
+ */
+	const rasterise_t *rs = ctx;
+	float *values = rs->values[thread];
+	float *grid = rs->grid[thread];
+	for (size_t u = start; u < end; u++) {
+		int t = rs->first + (int)(u / rs->nvars) * rs->every;
+		int var = rs->vars[u % rs->nvars];
+		if (rs->verbose && u % rs->nvars == 0) {
+			fprintf(stdout, "Rasterising timestep %d\n", t);
+		}
+		int rv = (rs->layers->nplan > 1 ? telemac_read_plane(rs->rfs, rs->layers, t, var, rs->plane, values)
+				: read_telemac_var(rs->rfs, t, var, values));
+		if (rv != 0) {
+			fprintf(stderr, "Unable to read variable %d at timestep %d\n", var, t);
+			return -1;
+		}
+		TM_STATS_BEGIN(TM_PHASE_FORMAT);
+		rv = telemac_raster_fill(rs->map, values, grid, rs->nodata, rs->inner);
+		TM_STATS_END(TM_PHASE_FORMAT);
+		if (rv != 0) {
+			fprintf(stderr, "Unable to interpolate variable %d at timestep %d\n", var, t);
+			return -1;
+		}
+
+		char *name = NULL;
+		if (asprintf(&name, "%s.var%d.t%d", rs->basefilename, var, t) < 0) {
+			perror("Naming output file");
+			return -1;
+		}
+		if (write_grid(name, rs->map, grid, rs->nodata, rs->binary, rs->buf[thread]) != 0) {
+			fprintf(stderr, "Unable to write grid %s\n", name);
+			free(name);
+			return -1;
+		}
+		free(name);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	char *outputdir = ".";
+	bool verbose = false;
+	bool binary = false;
+	double cellsize = 0;
+	double extent[4];
+	bool have_extent = false;
+	int step = -1;
+	int every = 1;
+	int plane = -1;
+	int nthreads = 0;
+	float nodata = -9999;
+	int *vars = NULL;
+	int nvars = 0;
+
+	const char *usage = "Usage: %s -c cellsize [-e xmin,ymin,xmax,ymax] [-V n] [-t step] [-f n] [-p plane] [-b] [-N nodata] [-j n] [-o dir] [-v] [--stats[=json]] <filename> [filename...]\n"
+		"\t-c\tCell size, in mesh units\n"
+		"\t-e\tGrid extent (default: extent of mesh)\n"
+		"\t-V\tVariable to rasterise (default: all). May be repeated\n"
+		"\t-t\tRasterise a single timestep (default: all)\n"
+		"\t-f\tRasterise every n^th timestep\n"
+		"\t-p\tPlane of 3D results (0 = bottom, default -1 = surface)\n"
+		"\t-b\tWrite binary grids (.flt and .hdr) instead of ESRI ASCII grids (.asc)\n"
+		"\t-N\tValue for cells outside the mesh (default: -9999)\n"
+		"\t-j\tNumber of threads to use (default: number of CPUs)\n"
+		"\t-o\tOutput directory\n"
+		"\t-v\tVerbose output\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "c:e:V:t:f:p:bN:j:o:v")) != -1) {
+		switch (go) {
+			case 'c':
+				cellsize = strtod(optarg, NULL);
+				break;
+			case 'e':
+				if (sscanf(optarg, "%lf,%lf,%lf,%lf", &extent[0], &extent[1], &extent[2], &extent[3]) != 4) {
+					fprintf(stderr, "Extent must be given as xmin,ymin,xmax,ymax\n");
+					return EXIT_FAILURE;
+				}
+				have_extent = true;
+				break;
+			case 'V':
+				vars = realloc(vars, sizeof(int) * (nvars + 1));
+				if (vars == NULL) {
+					perror("Parsing options");
+					return EXIT_FAILURE;
+				}
+				vars[nvars++] = atoi(optarg);
+				break;
+			case 't':
+				step = atoi(optarg);
+				break;
+			case 'f':
+				every = atoi(optarg);
+				break;
+			case 'p':
+				plane = atoi(optarg);
+				break;
+			case 'b':
+				binary = true;
+				break;
+			case 'N':
+				nodata = strtof(optarg, NULL);
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'o':
+				outputdir = optarg;
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (!(cellsize > 0) || every < 1 || argc - optind < 1) {
+		fprintf(stderr, "Must give a positive cell size and a file (or restart chain of files) to process\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	resfile_t rfs = {NULL, 0, 0, 0};
+	int rval = open_telemac_chain(&rfs, &argv[optind], argc - optind, false);
+	if (rfs.file == NULL || rval < 0) {
+		fprintf(stderr, "Unable to open %s (%d)\n", argv[optind], rval);
+		return EXIT_FAILURE;
+	}
+	telemac_data_t *mesh = &rfs.tmdat;
+	int nvar = mesh->nbv_1 + mesh->nbv_2;
+
+	if (nvars == 0) {
+		vars = calloc(sizeof(int), nvar);
+		if (vars == NULL) {
+			perror("Allocating variable list");
+			return EXIT_FAILURE;
+		}
+		for (nvars = 0; nvars < nvar; nvars++) {
+			vars[nvars] = nvars;
+		}
+	}
+	for (int j = 0; j < nvars; j++) {
+		if (vars[j] < 0 || vars[j] >= nvar) {
+			fprintf(stderr, "Variable %d out of range (%d variables)\n", vars[j], nvar);
+			return EXIT_FAILURE;
+		}
+	}
+	if (step >= (int)mesh->nt) {
+		fprintf(stderr, "Timestep %d out of range (0 - %d)\n", step, mesh->nt - 1);
+		return EXIT_FAILURE;
+	}
+
+	telemac_layers_t layers;
+	if (telemac_get_layers(mesh, &layers) != 0) {
+		return EXIT_FAILURE;
+	}
+	plane = (plane < 0 ? plane + (int)layers.nplan : plane);
+	if (plane < 0 || plane >= (int)layers.nplan) {
+		fprintf(stderr, "Plane out of range (%u planes)\n", layers.nplan);
+		return EXIT_FAILURE;
+	}
+
+	telemac_raster_t *map = telemac_raster_map(mesh, cellsize, (have_extent ? extent : NULL), nthreads);
+	if (map == NULL) {
+		return EXIT_FAILURE;
+	}
+	fprintf(stdout, "Grid of %u x %u cells (%u inside the mesh) from (%f, %f)\n", map->ncols, map->nrows, map->npix, map->xll, map->yll);
+
+	char *base = strdup(argv[optind]);
+	char *basefilename = NULL;
+	asprintf(&basefilename, "%s/%s", outputdir, basename(base));
+	free(base);
+
+	// Threads share the grids, each needing its own buffers; the rest interpolate each grid
+	int first = (step < 0 ? 0 : step);
+	int nsteps = (step < 0 ? ((int)mesh->nt + every - 1) / every : 1);
+	size_t nunits = (size_t)nsteps * nvars;
+	size_t gridbytes = sizeof(float) * map->ncols * map->nrows;
+	nthreads = (nthreads < 1 ? telemac_default_threads() : nthreads);
+	int outer = nthreads;
+	if ((size_t)outer > nunits) {
+		outer = (nunits > 0 ? nunits : 1);
+	}
+	if ((size_t)outer > RASTERISE_MEMORY / gridbytes) {
+		outer = (RASTERISE_MEMORY / gridbytes > 0 ? RASTERISE_MEMORY / gridbytes : 1);
+	}
+	rasterise_t rs = {&rfs, &layers, map, basefilename, vars, nvars, first, every, plane, nodata, binary, verbose,
+		(nthreads / outer > 1 ? nthreads / outer : 1), NULL, NULL, NULL};
+	rs.values = calloc(sizeof(float *), outer);
+	rs.grid = calloc(sizeof(float *), outer);
+	rs.buf = calloc(sizeof(char *), outer);
+	if (rs.values == NULL || rs.grid == NULL || rs.buf == NULL) {
+		perror("Allocating grids");
+		return EXIT_FAILURE;
+	}
+	for (int k = 0; k < outer; k++) {
+		rs.values[k] = calloc(sizeof(float), layers.npoin2 + 1);
+		rs.grid[k] = malloc(gridbytes);
+		rs.buf[k] = (binary ? NULL : malloc(RASTERISE_BUFSIZE));
+		if (rs.values[k] == NULL || rs.grid[k] == NULL || (!binary && rs.buf[k] == NULL)) {
+			perror("Allocating grids");
+			return EXIT_FAILURE;
+		}
+	}
+	TM_STATS_ALLOC(outer * (sizeof(float) * (layers.npoin2 + 1) + gridbytes + (binary ? 0 : RASTERISE_BUFSIZE)));
+
+	if (telemac_parallel_for(outer, nunits, 1, rasterise_task, &rs) != 0) {
+		return EXIT_FAILURE;
+	}
+	int written = nunits;
+	fprintf(stdout, "Wrote %d grids\n", written);
+
+	free(basefilename);
+	for (int k = 0; k < outer; k++) {
+		free(rs.values[k]);
+		free(rs.grid[k]);
+		free(rs.buf[k]);
+	}
+	free(rs.values);
+	free(rs.grid);
+	free(rs.buf);
+	free(vars);
+	telemac_raster_free(map);
+	close_telemac(&rfs);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,281 @@
+/******************************************************************************
+telemac-regions - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <float.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-stream.h"
+#include "telemac-geom.h"
+#include "telemac-mesh.h"
+
+/*!
+ * @file
+ * @brief Report connected regions where a variable exceeds a threshold
+ *
+ * For each timestep, elements where a variable is above a threshold (for
+ * example, wet elements where the water depth is above 0.01m) are grouped
+ * into connected regions, and the number of elements, area and extent of
+ * each region are reported.
+ *
+ * Returns zero on success and EXIT_FAILURE if an error occurs.
+ */
+
+//! Size and extent of one region
+typedef struct {
+	uint32_t nelem; //!< Number of elements
+	double area; //!< Total element area
+	float xmin; //!< Smallest node X coordinate
+	float ymin; //!< Smallest node Y coordinate
+	float xmax; //!< Largest node X coordinate
+	float ymax; //!< Largest node Y coordinate
+} region_t;
+
+static int find_depth(const telemac_data_t *results) {
+//! Find the water depth variable by name, returning -1 if not present
+	for (int j = 0; j < results->nbv_1; j++) {
+		if (strncmp(results->var_names[j], "WATER DEPTH", 11) == 0 || strncmp(results->var_names[j], "HAUTEUR D'EAU", 13) == 0) {
+			return j;
+		}
+	}
+	return -1;
+}
+
+int main(int argc, char **argv) {
+	bool csv = false;
+	bool summary = false;
+	bool any = false;
+	int var = -1;
+	int step = -1;
+	int nthreads = 0;
+	float threshold = 0.01;
+	double minarea = 0;
+
+	const char *usage = "Usage: %s [-V n] [-T threshold] [-a] [-m area] [-t step] [-s] [-c] [-j n] [--stats[=json]] <filename> [filename...]\n"
+		"\t-V\tVariable to test (default: water depth)\n"
+		"\t-T\tThreshold the variable must exceed (default: 0.01)\n"
+		"\t-a\tInclude elements where any node exceeds the threshold (default: all nodes)\n"
+		"\t-m\tOmit regions smaller than this area\n"
+		"\t-t\tReport a single timestep (default: all)\n"
+		"\t-s\tSummary only: number and total area of regions at each timestep\n"
+		"\t-c\tCSV output\n"
+		"\t-j\tNumber of threads to use (default: number of CPUs)\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "V:T:am:t:scj:")) != -1) {
+		switch (go) {
+			case 'V':
+				var = atoi(optarg);
+				break;
+			case 'T':
+				threshold = strtof(optarg, NULL);
+				break;
+			case 'a':
+				any = true;
+				break;
+			case 'm':
+				minarea = strtod(optarg, NULL);
+				break;
+			case 't':
+				step = atoi(optarg);
+				break;
+			case 's':
+				summary = true;
+				break;
+			case 'c':
+				csv = true;
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 1) {
+		fprintf(stderr, "Must provide a file (or restart chain of files) to process\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	resfile_t rfs = {NULL, 0, 0, 0};
+	int rval = open_telemac_chain(&rfs, &argv[optind], argc - optind, false);
+	if (rfs.file == NULL || rval < 0) {
+		fprintf(stderr, "Unable to open %s (%d)\n", argv[optind], rval);
+		return EXIT_FAILURE;
+	}
+	telemac_data_t *mesh = &rfs.tmdat;
+	int nvar = mesh->nbv_1 + mesh->nbv_2;
+
+	if (var < 0) {
+		var = find_depth(mesh);
+		if (var < 0) {
+			fprintf(stderr, "No water depth variable found: use -V to choose a variable\n");
+			return EXIT_FAILURE;
+		}
+	}
+	if (var >= nvar) {
+		fprintf(stderr, "Variable %d out of range (%d variables)\n", var, nvar);
+		return EXIT_FAILURE;
+	}
+	if (step >= (int)mesh->nt) {
+		fprintf(stderr, "Timestep %d out of range (0 - %d)\n", step, mesh->nt - 1);
+		return EXIT_FAILURE;
+	}
+
+	const telemac_geom_t *geom = telemac_get_geom(&rfs);
+	const telemac_adjacency_t *adj = telemac_get_adjacency(&rfs, nthreads);
+	if (geom == NULL || adj == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	// Plan area of each element: prisms use their bottom face
+	float *elemarea = calloc(sizeof(float), (mesh->nelem ? mesh->nelem : 1));
+	uint8_t *active = calloc(sizeof(uint8_t), (mesh->nelem ? mesh->nelem : 1));
+	uint32_t *label = calloc(sizeof(uint32_t), (mesh->nelem ? mesh->nelem : 1));
+	region_t *reg = calloc(sizeof(region_t), (mesh->nelem ? mesh->nelem : 1));
+	int *steps = calloc(sizeof(int), (mesh->nt ? mesh->nt : 1));
+	bool *need = calloc(sizeof(bool), nvar);
+	if (elemarea == NULL || active == NULL || label == NULL || reg == NULL || steps == NULL || need == NULL) {
+		perror("Allocating region arrays");
+		return EXIT_FAILURE;
+	}
+	for (uint32_t e = 0; e < mesh->nelem; e++) {
+		if (geom->per_elem == 1) {
+			elemarea[e] = geom->area[e];
+		} else if (mesh->ndp == 4) {
+			elemarea[e] = geom->area[2 * e] + geom->area[2 * e + 1];
+		} else {
+			elemarea[e] = geom->area[2 * e];
+		}
+	}
+
+	int nsteps = 0;
+	for (int t = (step < 0 ? 0 : step); t < (step < 0 ? mesh->nt : step + 1); t++) {
+		steps[nsteps++] = t;
+	}
+	need[var] = true;
+	telemac_stream_t *str = telemac_stream_open(&rfs, steps, nsteps, need);
+	if (str == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	if (csv) {
+		fprintf(stdout, (summary ? "step,time,regions,area\n" : "step,time,region,elements,area,xmin,ymin,xmax,ymax\n"));
+	} else {
+		fprintf(stdout, "Regions where %s > %g (%s nodes)\n",
+				(var < (int)mesh->nbv_1 ? mesh->var_names[var] : "(quadratic)"), threshold, (any ? "any" : "all"));
+	}
+
+	for (int k = 0; k < nsteps; k++) {
+		int t = 0;
+		float time = 0;
+		float **data = telemac_stream_next(str, &t, &time);
+		if (data == NULL) {
+			fprintf(stderr, "Unable to read timestep %d\n", steps[k]);
+			return EXIT_FAILURE;
+		}
+
+		TM_STATS_BEGIN(TM_PHASE_FORMAT);
+		const float *f = data[var];
+		for (uint32_t e = 0; e < mesh->nelem; e++) {
+			const uint32_t *ik = &mesh->ikle[e * mesh->ndp];
+			uint32_t above = 0;
+			for (uint32_t j = 0; j < mesh->ndp; j++) {
+				above += (f[ik[j] - 1] > threshold);
+			}
+			active[e] = (any ? above > 0 : above == mesh->ndp);
+		}
+		int64_t nreg = telemac_label_regions(adj, active, label, nthreads);
+		if (nreg < 0) {
+			return EXIT_FAILURE;
+		}
+		for (int64_t r = 0; r < nreg; r++) {
+			reg[r] = (region_t){0, 0, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+		}
+		for (uint32_t e = 0; e < mesh->nelem; e++) {
+			if (label[e] == TELEMAC_NO_REGION) {
+				continue;
+			}
+			region_t *r = &reg[label[e]];
+			r->nelem++;
+			r->area += elemarea[e];
+			for (uint32_t j = 0; j < mesh->ndp; j++) {
+				uint32_t n = mesh->ikle[e * mesh->ndp + j] - 1;
+				r->xmin = (mesh->X[n] < r->xmin ? mesh->X[n] : r->xmin);
+				r->ymin = (mesh->Y[n] < r->ymin ? mesh->Y[n] : r->ymin);
+				r->xmax = (mesh->X[n] > r->xmax ? mesh->X[n] : r->xmax);
+				r->ymax = (mesh->Y[n] > r->ymax ? mesh->Y[n] : r->ymax);
+			}
+		}
+		TM_STATS_END(TM_PHASE_FORMAT);
+
+		int shown = 0;
+		double total = 0;
+		for (int64_t r = 0; r < nreg; r++) {
+			if (reg[r].area >= minarea) {
+				shown++;
+				total += reg[r].area;
+			}
+		}
+		if (summary) {
+			fprintf(stdout, (csv ? "%d,%f,%d,%f\n" : "Step %d (t = %+f): %d regions, area %f\n"), t, time, shown, total);
+			continue;
+		}
+		if (!csv) {
+			fprintf(stdout, "\nStep %d (t = %+f): %d regions, area %f\n", t, time, shown, total);
+			if (shown > 0) {
+				fprintf(stdout, "%8s %10s %16s %14s %14s %14s %14s\n", "Region", "Elements", "Area", "Xmin", "Ymin", "Xmax", "Ymax");
+			}
+		}
+		for (int64_t r = 0; r < nreg; r++) {
+			region_t *g = &reg[r];
+			if (g->area < minarea) {
+				continue;
+			}
+			if (csv) {
+				fprintf(stdout, "%d,%f,%d,%u,%f,%f,%f,%f,%f\n", t, time, (int)r, g->nelem, g->area, g->xmin, g->ymin, g->xmax, g->ymax);
+			} else {
+				fprintf(stdout, "%8d %10u %16.4f %+14.4f %+14.4f %+14.4f %+14.4f\n", (int)r, g->nelem, g->area, g->xmin, g->ymin, g->xmax, g->ymax);
+			}
+		}
+	}
+	telemac_stream_close(str);
+
+	free(elemarea);
+	free(active);
+	free(label);
+	free(reg);
+	free(steps);
+	free(need);
+	close_telemac(&rfs);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,337 @@
+/******************************************************************************
+telemac-resample - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <math.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-writer.h"
+#include "telemac-frames.h"
+
+/*!
+ * @file
+ * @brief Resample results to a uniform or given set of times
+ *
+ * Values at each output time are interpolated linearly between the
+ * timesteps either side (see telemac-frames.h). Output times are processed
+ * in increasing order, so each timestep of the input is read at most once.
+ * Results are written as a SELAFIN file on the same mesh, or as binary flat
+ * files in the layout used by telemac-parse.
+ *
+ * Returns zero on success and EXIT_FAILURE if an error occurs.
+ */
+
+static int time_cmp(const void *a, const void *b) {
+//! qsort() comparison for output times
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static int write_flat(const char *base, int var, int k, const float *values, uint32_t npoin) {
+/*!
+ * @brief Write values as doubles to base.var<var>.t<k>.dat, as telemac-parse -b does
+ * @returns 0 on success, -1 on failure
+ */
+	char *name = NULL;
+	if (asprintf(&name, "%s.var%d.t%d.dat", base, var, k) < 0) {
+		return -1;
+	}
+	double *dd = calloc(sizeof(double), npoin + 1);
+	FILE *file = (dd != NULL ? fopen(name, "wb") : NULL);
+	if (file == NULL) {
+		perror(name);
+		free(dd);
+		free(name);
+		return -1;
+	}
+	TM_STATS_BEGIN(TM_PHASE_FORMAT);
+	for (uint32_t p = 0; p < npoin; p++) {
+		dd[p] = values[p];
+	}
+	TM_STATS_END(TM_PHASE_FORMAT);
+	TM_STATS_BEGIN(TM_PHASE_WRITE);
+	size_t written = fwrite(dd, sizeof(double), npoin, file);
+	int rv = fclose(file);
+	TM_STATS_END(TM_PHASE_WRITE);
+	TM_STATS_ADD(TM_COUNT_WRITE_CALLS, 1);
+	free(dd);
+	if (written != npoin || rv != 0) {
+		perror(name);
+		free(name);
+		return -1;
+	}
+	telemac_stats_add_file(name);
+	free(name);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	char *outname = NULL;
+	char *flatdir = NULL;
+	bool verbose = false;
+	double dt = 0;
+	double start = NAN;
+	double end = NAN;
+	double *times = NULL;
+	int ntimes = 0;
+	int *vars = NULL;
+	int nvars = 0;
+	int nthreads = 0;
+
+	const char *usage = "Usage: %s [-d dt [-s start] [-e end] | -T t1,t2,...] [-V n] [-b dir | -o output] [-j n] [-v] [--stats[=json]] <filename> [filename...]\n"
+		"\t-d\tResample at a uniform interval\n"
+		"\t-s\tFirst output time (default: first timestep)\n"
+		"\t-e\tLast output time (default: last timestep)\n"
+		"\t-T\tResample at the given times. May be repeated\n"
+		"\t-V\tVariable to resample (default: all). May be repeated\n"
+		"\t-o\tOutput SELAFIN file (default: input name with .resampled.slf)\n"
+		"\t-b\tWrite binary flat files (as telemac-parse -b) to a directory instead\n"
+		"\t-j\tNumber of threads (default: number of CPUs)\n"
+		"\t-v\tVerbose output\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "d:s:e:T:V:o:b:j:v")) != -1) {
+		switch (go) {
+			case 'd':
+				dt = strtod(optarg, NULL);
+				break;
+			case 's':
+				start = strtod(optarg, NULL);
+				break;
+			case 'e':
+				end = strtod(optarg, NULL);
+				break;
+			case 'T':
+				for (char *tok = strtok(optarg, ","); tok != NULL; tok = strtok(NULL, ",")) {
+					times = realloc(times, sizeof(double) * (ntimes + 1));
+					if (times == NULL) {
+						perror("Parsing options");
+						return EXIT_FAILURE;
+					}
+					times[ntimes++] = strtod(tok, NULL);
+				}
+				break;
+			case 'V':
+				vars = realloc(vars, sizeof(int) * (nvars + 1));
+				if (vars == NULL) {
+					perror("Parsing options");
+					return EXIT_FAILURE;
+				}
+				vars[nvars++] = atoi(optarg);
+				break;
+			case 'o':
+				outname = optarg;
+				break;
+			case 'b':
+				flatdir = optarg;
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if ((dt > 0) == (ntimes > 0) || dt < 0 || argc - optind < 1) {
+		fprintf(stderr, "Must give either a positive interval or a list of times, and a file (or restart chain of files)\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	resfile_t rfs = {NULL, 0, 0, 0};
+	int rval = open_telemac_chain(&rfs, &argv[optind], argc - optind, false);
+	if (rfs.file == NULL || rval < 0) {
+		fprintf(stderr, "Unable to open %s (%d)\n", argv[optind], rval);
+		return EXIT_FAILURE;
+	}
+	telemac_data_t *mesh = &rfs.tmdat;
+
+	if (nvars == 0) {
+		nvars = mesh->nbv_1;
+		vars = calloc(sizeof(int), nvars + 1);
+		if (vars == NULL) {
+			perror("Allocating variable list");
+			return EXIT_FAILURE;
+		}
+		for (int j = 0; j < nvars; j++) {
+			vars[j] = j;
+		}
+	}
+	for (int j = 0; j < nvars; j++) {
+		if (vars[j] < 0 || vars[j] >= (int)mesh->nbv_1) {
+			fprintf(stderr, "Variable %d out of range (%u variables)\n", vars[j], mesh->nbv_1);
+			return EXIT_FAILURE;
+		}
+	}
+
+	telemac_frames_t fr;
+	if (telemac_frames_open(&fr, &rfs, vars, nvars) != 0) {
+		fprintf(stderr, "Unable to read timesteps of %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	// Output times, in increasing order so each timestep is read at most once
+	if (dt > 0) {
+		start = (isnan(start) ? fr.times[0] : start);
+		end = (isnan(end) ? fr.times[mesh->nt - 1] : end);
+		if (end < start) {
+			fprintf(stderr, "Last output time is before the first\n");
+			return EXIT_FAILURE;
+		}
+		ntimes = (int)floor((end - start) / dt + 1e-6) + 1;
+		times = calloc(sizeof(double), ntimes);
+		if (times == NULL) {
+			perror("Allocating output times");
+			return EXIT_FAILURE;
+		}
+		for (int k = 0; k < ntimes; k++) {
+			times[k] = start + k * dt;
+		}
+	} else {
+		qsort(times, ntimes, sizeof(double), time_cmp);
+	}
+	if (times[0] < fr.times[0] || times[ntimes - 1] > fr.times[mesh->nt - 1]) {
+		fprintf(stderr, "Warning: output times outside %g - %g take the values of the first or last timestep\n",
+				fr.times[0], fr.times[mesh->nt - 1]);
+	}
+
+	float **out = calloc(sizeof(float *), nvars);
+	char **names = calloc(sizeof(char *), nvars);
+	if (out == NULL || names == NULL) {
+		perror("Allocating output");
+		return EXIT_FAILURE;
+	}
+	for (int j = 0; j < nvars; j++) {
+		out[j] = calloc(sizeof(float), mesh->npoin + 1);
+		names[j] = mesh->var_names[vars[j]];
+		if (out[j] == NULL) {
+			perror("Allocating output");
+			return EXIT_FAILURE;
+		}
+	}
+
+	char *base = strdup(argv[optind]);
+	char *flatbase = NULL;
+	FILE *outfile = NULL;
+	telemac_data_t outmesh = *mesh;
+	outmesh.nbv_1 = nvars;
+	outmesh.nbv_2 = 0;
+	outmesh.var_names = names;
+	if (flatdir != NULL) {
+		asprintf(&flatbase, "%s/%s", flatdir, basename(base));
+	} else {
+		if (outname == NULL) {
+			asprintf(&outname, "%s.resampled.slf", basename(base));
+		}
+		outfile = fopen(outname, "wb");
+		if (outfile == NULL) {
+			perror("Unable to open output file");
+			return EXIT_FAILURE;
+		}
+		TM_STATS_BEGIN(TM_PHASE_WRITE);
+		rval = write_telemac_header(outfile, &outmesh);
+		TM_STATS_END(TM_PHASE_WRITE);
+		if (rval != 0) {
+			perror("Writing output");
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (int k = 0; k < ntimes; k++) {
+		if (verbose) {
+			fprintf(stdout, "Output %d: time %f\n", k, times[k]);
+		}
+		if (telemac_frames_at(&fr, times[k], out, nthreads) != 0) {
+			fprintf(stderr, "Unable to interpolate to time %f\n", times[k]);
+			return EXIT_FAILURE;
+		}
+		if (flatbase != NULL) {
+			for (int j = 0; j < nvars; j++) {
+				if (write_flat(flatbase, vars[j], k, out[j], mesh->npoin) != 0) {
+					return EXIT_FAILURE;
+				}
+			}
+		} else {
+			TM_STATS_BEGIN(TM_PHASE_WRITE);
+			rval = write_telemac_timestep(outfile, &outmesh, times[k], out);
+			TM_STATS_END(TM_PHASE_WRITE);
+			if (rval != 0) {
+				perror("Writing output");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (flatbase != NULL) {
+		char *tsname = NULL;
+		asprintf(&tsname, "%s.times.txt", flatbase);
+		FILE *tsfile = fopen(tsname, "w");
+		if (tsfile == NULL) {
+			perror(tsname);
+			return EXIT_FAILURE;
+		}
+		fprintf(tsfile, "%d\n", ntimes);
+		for (int k = 0; k < ntimes; k++) {
+			fprintf(tsfile, "%d\t%+.10f\n", k, (float)times[k]);
+		}
+		if (fclose(tsfile) != 0) {
+			perror(tsname);
+			return EXIT_FAILURE;
+		}
+		telemac_stats_add_file(tsname);
+		free(tsname);
+	} else {
+		if (fclose(outfile) != 0) {
+			perror("Writing output");
+			return EXIT_FAILURE;
+		}
+		telemac_stats_add_file(outname);
+	}
+	fprintf(stdout, "Resampled %u timesteps (%u read) to %d times\n", mesh->nt, fr.nread, ntimes);
+
+	for (int j = 0; j < nvars; j++) {
+		free(out[j]);
+	}
+	free(out);
+	free(names);
+	free(times);
+	free(vars);
+	free(base);
+	free(flatbase);
+	telemac_frames_close(&fr);
+	close_telemac(&rfs);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,232 @@
+/******************************************************************************
+telemac-scan - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "telemac-scan.h"
+#include "telemac-thread.h"
+#include "telemac-stats.h"
+
+/*!
+ * @file
+ * @brief Integrity checks of SELAFIN results files
+ *
+ * Work is divided into ranges of whole records (one variable at one
+ * timestep, with the timestamp record counted with the first variable).
+ * Each range is mapped, checked and unmapped in turn, so the address space
+ * used is bounded however large the file.
+ */
+
+//! Approximate number of bytes checked by each task
+#define SCAN_CHUNK_BYTES ((off_t)64 << 20)
+
+//! Arguments for scanning ranges of records
+typedef struct {
+	const resfile_t *rfile; //!< File being scanned
+	telemac_scan_t *scan; //!< Results
+	int nunit; //!< Records (units) per timestep
+	off_t reclen; //!< Length of each variable record, with markers
+	long pagesize; //!< System page size
+} scan_ctx_t;
+
+static off_t unit_start(const scan_ctx_t *sc, size_t u) {
+//! File offset of unit u (the timestamp record, for the first unit of a timestep)
+	size_t t = u / sc->nunit;
+	size_t v = u % sc->nunit;
+	off_t step = sc->rfile->datastart + (off_t)t * sc->rfile->datasize;
+	return (v == 0 ? step : step + 12 + (off_t)v * sc->reclen);
+}
+
+static off_t unit_end(const scan_ctx_t *sc, size_t u) {
+//! File offset after the end of unit u
+	size_t t = u / sc->nunit;
+	size_t v = u % sc->nunit;
+	off_t step = sc->rfile->datastart + (off_t)t * sc->rfile->datasize;
+	return step + 12 + (sc->scan->nvar > 0 ? (off_t)(v + 1) * sc->reclen : 0);
+}
+
+static bool marker_ok(const char *rec, uint32_t len) {
+//! Check the leading and trailing markers of a record of len bytes
+	uint32_t start = 0;
+	uint32_t end = 0;
+	memcpy(&start, rec, 4);
+	memcpy(&end, rec + 4 + (size_t)len, 4);
+	return (int_swap(start) == len && int_swap(end) == len);
+}
+
+static int scan_task(void *ctx, size_t start, size_t end, int thread) {
+//! Map and check units start to end - 1 (see telemac_parallel_for())
+	(void)thread;
+	const scan_ctx_t *sc = ctx;
+	telemac_scan_t *scan = sc->scan;
+	uint32_t npoin = sc->rfile->tmdat.npoin;
+	off_t first = unit_start(sc, start);
+	off_t base = first - first % sc->pagesize;
+	size_t len = unit_end(sc, end - 1) - base;
+
+	TM_STATS_BEGIN(TM_PHASE_READ);
+	char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(sc->rfile->file), base);
+	if (map == MAP_FAILED) {
+		TM_STATS_END(TM_PHASE_READ);
+		perror("telemac_scan: mmap");
+		return -1;
+	}
+	madvise(map, len, MADV_SEQUENTIAL);
+
+	// NaN and infinity have every exponent bit set, whatever the byte order
+	const uint32_t expmask = int_swap(0x7f800000);
+	for (size_t u = start; u < end; u++) {
+		const char *rec = map + (unit_start(sc, u) - base);
+		size_t v = u % sc->nunit;
+		bool ok = true;
+		if (v == 0) {
+			ok = marker_ok(rec, sizeof(float));
+			rec += 12;
+		}
+		if (scan->nvar > 0) {
+			ok = ok && marker_ok(rec, sizeof(float) * npoin);
+			const uint32_t *values = (const uint32_t *)(rec + 4);
+			uint32_t count = 0;
+			for (uint32_t i = 0; i < npoin; i++) {
+				count += ((values[i] & expmask) == expmask);
+			}
+			scan->nonfinite[u] = count;
+		}
+		scan->bad[u] = !ok;
+	}
+	munmap(map, len);
+	TM_STATS_END(TM_PHASE_READ);
+	TM_STATS_ADD(TM_COUNT_READ_CALLS, 1);
+	TM_STATS_ADD(TM_COUNT_BYTES_READ, len);
+	return 0;
+}
+
+int telemac_scan(const resfile_t *rfile, int nthreads, telemac_scan_t *scan) {
+/*!
+ * @brief Check the record markers and values of every timestep of a file
+ *
+ * May be used after either open_telemac() or open_telemac_header().
+ *
+ * @param rfile	Opened results file (not a restart chain or archive)
+ * @param nthreads	Number of threads (values below 1 use all CPUs)
+ * @param scan	Set to the results. Free with telemac_scan_free().
+ * @retval 0	Success
+ * @retval -1	Not a single SELAFIN file, or bad state
+ * @retval -2	Memory could not be allocated, or the file could not be mapped
+ */
+	const telemac_data_t *results = &rfile->tmdat;
+	memset(scan, 0, sizeof(*scan));
+	if (results->state < 1 || rfile->datasize == 0 || rfile->nseg > 0 || rfile->archive != NULL) {
+		fprintf(stderr, "telemac_scan: only single SELAFIN files can be scanned\n");
+		return -1;
+	}
+
+	struct stat buf;
+	if (fstat(fileno(rfile->file), &buf) != 0) {
+		perror("telemac_scan: fstat");
+		return -2;
+	}
+	scan->nt = results->nt;
+	scan->nvar = results->nbv_1 + results->nbv_2;
+	off_t end = rfile->datastart + (off_t)results->nt * rfile->datasize;
+	scan->trailing = (buf.st_size > end ? buf.st_size - end : 0);
+
+	scan_ctx_t sc = {rfile, scan, (scan->nvar > 0 ? scan->nvar : 1),
+		sizeof(float) * (off_t)results->npoin + 8, sysconf(_SC_PAGESIZE)};
+	size_t nunits = (size_t)scan->nt * sc.nunit;
+	scan->bad = calloc(1, nunits + 1);
+	scan->nonfinite = calloc(sizeof(uint32_t), nunits + 1);
+	if (scan->bad == NULL || scan->nonfinite == NULL) {
+		perror("telemac_scan");
+		telemac_scan_free(scan);
+		return -2;
+	}
+	TM_STATS_ALLOC((1 + sizeof(uint32_t)) * nunits);
+
+	size_t chunk = SCAN_CHUNK_BYTES / sc.reclen;
+	chunk = (chunk < 1 ? 1 : chunk);
+	if (nunits > 0 && telemac_parallel_for(nthreads, nunits, chunk, scan_task, &sc) != 0) {
+		telemac_scan_free(scan);
+		return -2;
+	}
+
+	scan->nvalid = scan->nt;
+	for (size_t u = 0; u < nunits; u++) {
+		if (scan->bad[u]) {
+			scan->nbad++;
+			if (scan->nvalid == scan->nt) {
+				scan->nvalid = u / sc.nunit;
+			}
+		}
+		scan->nnonfinite += (scan->nonfinite[u] > 0);
+	}
+	return 0;
+}
+
+void telemac_scan_free(telemac_scan_t *scan) {
+/*!
+ * @brief Free the results of telemac_scan()
+ * @param scan	Results to free
+ */
+	free(scan->bad);
+	free(scan->nonfinite);
+	scan->bad = NULL;
+	scan->nonfinite = NULL;
+}
+
+bool telemac_salvage_enabled(void) {
+/*!
+ * @brief Check whether the `TELEMAC_SALVAGE` environment variable is set
+ * @returns true if set to anything other than an empty string or `0`
+ */
+	const char *env = getenv(TELEMAC_SALVAGE_ENV);
+	return (env != NULL && env[0] != '\0' && strcmp(env, "0") != 0);
+}
+
+int telemac_salvage(resfile_t *rfile, int nthreads) {
+/*!
+ * @brief Limit a file to its valid prefix
+ *
+ * Scans the file with telemac_scan() and reduces the number of timesteps to
+ * those before the first damaged record. The file itself is not changed.
+ *
+ * @param rfile	Opened results file
+ * @param nthreads	Number of threads (values below 1 use all CPUs)
+ * @returns	Number of timesteps kept, or a negative value if the scan failed
+ */
+	telemac_scan_t scan;
+	if (telemac_scan(rfile, nthreads, &scan) != 0) {
+		return -1;
+	}
+	if (scan.nvalid < scan.nt) {
+		fprintf(stderr, "Warning: damaged record in timestep %u, using the first %u of %u timesteps\n",
+				scan.nvalid, scan.nvalid, scan.nt);
+	}
+	if (scan.trailing > 0) {
+		fprintf(stderr, "Warning: ignoring %jd bytes after the last complete timestep\n", (intmax_t)scan.trailing);
+	}
+	rfile->tmdat.nt = scan.nvalid;
+	telemac_scan_free(&scan);
+	return rfile->tmdat.nt;
+}
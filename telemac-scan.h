@@ -0,0 +1,69 @@
+/******************************************************************************
+telemac-scan - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Integrity checks of SELAFIN results files
+ */
+
+#ifndef TELEMAC_SCAN_H
+#define TELEMAC_SCAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "telemac-loader.h"
+
+/*!
+ * @defgroup scan Integrity scanning
+ * @brief Find damaged records and non-finite values in results files
+ *
+ * The timesteps of a file are divided into ranges of records which are
+ * mapped and checked in parallel. For each timestep and variable, the
+ * leading and trailing record markers are compared with the record length,
+ * and values which are NaN or infinite are counted.
+ *
+ * The valid prefix of a file is the timesteps before the first one with a
+ * bad record marker. Bytes after the last complete timestep (for example,
+ * from a run which stopped while writing) are not part of it.
+ * @{
+ */
+
+//! Environment variable which makes open_telemac() open only the valid prefix of a file
+#define TELEMAC_SALVAGE_ENV "TELEMAC_SALVAGE"
+
+//! Result of scanning a results file
+typedef struct {
+	uint32_t nt; //!< Number of complete timesteps in the file
+	uint32_t nvalid; //!< Number of timesteps in the valid prefix
+	int nvar; //!< Number of variables in each timestep
+	off_t trailing; //!< Bytes after the last complete timestep
+	uint8_t *bad; //!< For each timestep then variable, non-zero if a record marker is wrong
+	uint32_t *nonfinite; //!< For each timestep then variable, number of NaN or infinite values
+	uint64_t nbad; //!< Number of records with bad markers
+	uint64_t nnonfinite; //!< Number of records containing NaN or infinite values
+} telemac_scan_t;
+
+int telemac_scan(const resfile_t *rfile, int nthreads, telemac_scan_t *scan);
+void telemac_scan_free(telemac_scan_t *scan);
+bool telemac_salvage_enabled(void);
+int telemac_salvage(resfile_t *rfile, int nthreads);
+
+/*! @} */
+#endif // TELEMAC_SCAN_H
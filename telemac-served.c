@@ -0,0 +1,873 @@
+/******************************************************************************
+telemac-served - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <math.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-thread.h"
+#include "telemac-layers.h"
+#include "telemac-served.h"
+#include "telemac-socket.h"
+
+/*!
+ * @file
+ * @brief Answer queries on results files from a long running local server
+ *
+ * Results files are opened on first use and kept open, with their mesh,
+ * timestamps and (once a point query needs it) a spatial index of the mesh
+ * triangles held in memory. Whole variables read for a timestep are kept in
+ * a cache of limited size, discarding the least recently used first, so
+ * repeated queries on the same timestep need no further reads.
+ *
+ * Connections are accepted by one thread and answered by a pool of worker
+ * threads. A client that does not send its request, or read the reply,
+ * within SERVED_TIMEOUT seconds is disconnected, so that idle clients cannot
+ * hold every worker. Replies are built in memory and sent once complete, so
+ * a request that fails part way is answered only with an error. The
+ * protocol is described in telemac-served.h, and telemac-query provides a
+ * command line client.
+ *
+ * Returns zero on success and EXIT_FAILURE if an error occurs.
+ */
+
+//! Largest number of connections waiting for a worker
+#define SERVED_QUEUE 256
+
+//! Seconds allowed for a client to send its request, and for each write of the reply
+#define SERVED_TIMEOUT 5
+
+//! An open results file
+typedef struct served_file {
+	char *path; //!< File name, as requested
+	resfile_t rfs; //!< Opened file
+	telemac_layers_t layers; //!< 3D layout
+	float *times; //!< Time of each timestep
+	pthread_mutex_t lock; //!< Protects the spatial index while it is built
+	bool indexed; //!< Set once the spatial index has been built
+	uint32_t ntri; //!< Number of triangles
+	uint32_t *tri[3]; //!< Triangle nodes (of the bottom plane)
+	uint32_t nx; //!< Index columns
+	uint32_t ny; //!< Index rows
+	double x0; //!< X coordinate of the index origin
+	double y0; //!< Y coordinate of the index origin
+	double cell; //!< Width and height of each index cell
+	uint32_t *cell_start; //!< First entry of each cell in cell_tri (nx * ny + 1 entries)
+	uint32_t *cell_tri; //!< Triangles overlapping each cell
+	struct served_file *next; //!< Next open file
+} served_file_t;
+
+//! A variable at one timestep, held in the frame cache
+typedef struct served_frame {
+	served_file_t *file; //!< Results file
+	int step; //!< Timestep
+	int var; //!< Variable
+	float *values; //!< Values at every node
+	int refs; //!< Number of queries using the frame
+	struct served_frame *prev; //!< More recently used frame
+	struct served_frame *next; //!< Less recently used frame
+} served_frame_t;
+
+//! Server state
+typedef struct {
+	int listener; //!< Listening socket
+	pthread_mutex_t lock; //!< Protects everything below
+	pthread_cond_t cond; //!< Signalled when a connection is queued or the server stops
+	int queue[SERVED_QUEUE]; //!< Connections waiting for a worker
+	int qhead; //!< First waiting connection
+	int qcount; //!< Number of waiting connections
+	bool stop; //!< Set when the server is stopping
+	served_file_t *files; //!< Open files
+	int nfiles; //!< Number of open files
+	served_frame_t *head; //!< Most recently used frame
+	served_frame_t *tail; //!< Least recently used frame
+	int nframes; //!< Number of cached frames
+	size_t bytes; //!< Memory used by cached frames
+	size_t limit; //!< Largest memory to use for cached frames
+	uint64_t hits; //!< Frames found in the cache
+	uint64_t misses; //!< Frames read from file
+	uint64_t requests; //!< Requests answered
+} served_t;
+
+//! Set by signal handlers to stop the server
+static volatile sig_atomic_t stop_signal = 0;
+
+static void on_signal(int sig) {
+//! Signal handler: ask the server to stop
+	stop_signal = sig;
+}
+
+static void free_file(served_file_t *f) {
+//! Close a results file and release everything held for it
+	close_telemac(&f->rfs);
+	for (int k = 0; k < 3; k++) {
+		free(f->tri[k]);
+	}
+	free(f->cell_start);
+	free(f->cell_tri);
+	free(f->times);
+	free(f->path);
+	pthread_mutex_destroy(&f->lock);
+	free(f);
+}
+
+static served_file_t *open_file(const char *path, char *err, size_t errlen) {
+//! Open a results file and read its timestamps
+	served_file_t *f = calloc(sizeof(served_file_t), 1);
+	if (f == NULL || (f->path = strdup(path)) == NULL) {
+		snprintf(err, errlen, "out of memory");
+		free(f);
+		return NULL;
+	}
+	resfile_t empty = {NULL, 0, 0, 0};
+	f->rfs = empty;
+	char *names[1] = {f->path};
+	int rv = open_telemac_chain(&f->rfs, names, 1, false);
+	if (f->rfs.file == NULL || rv < 0 || telemac_get_layers(&f->rfs.tmdat, &f->layers) != 0) {
+		snprintf(err, errlen, "unable to open %s (%d)", path, rv);
+		if (f->rfs.file != NULL) {
+			close_telemac(&f->rfs);
+		}
+		free(f->path);
+		free(f);
+		return NULL;
+	}
+	pthread_mutex_init(&f->lock, NULL);
+	f->times = calloc(sizeof(float), f->rfs.tmdat.nt + 1);
+	for (int t = 0; f->times != NULL && t < (int)f->rfs.tmdat.nt; t++) {
+		if (get_telemac_timestamp(&f->rfs, t, &f->times[t]) != 0) {
+			free(f->times);
+			f->times = NULL;
+		}
+	}
+	if (f->times == NULL) {
+		snprintf(err, errlen, "unable to read timestamps of %s", path);
+		free_file(f);
+		return NULL;
+	}
+	return f;
+}
+
+static served_file_t *find_file(served_t *srv, const char *path) {
+//! Find an open file, or return NULL (lock held)
+	served_file_t *f = srv->files;
+	while (f != NULL && strcmp(f->path, path) != 0) {
+		f = f->next;
+	}
+	return f;
+}
+
+static served_file_t *get_file(served_t *srv, const char *path, char *err, size_t errlen) {
+//! Find an open file, or open it and read its timestamps
+	pthread_mutex_lock(&srv->lock);
+	served_file_t *found = find_file(srv, path);
+	pthread_mutex_unlock(&srv->lock);
+	if (found != NULL) {
+		return found;
+	}
+
+	// Open without the lock, so other queries continue meanwhile
+	served_file_t *f = open_file(path, err, errlen);
+	if (f == NULL) {
+		return NULL;
+	}
+
+	// Another query may have opened the same file meanwhile: use that one instead
+	pthread_mutex_lock(&srv->lock);
+	found = find_file(srv, path);
+	if (found == NULL) {
+		f->next = srv->files;
+		srv->files = f;
+		srv->nfiles++;
+	}
+	pthread_mutex_unlock(&srv->lock);
+	if (found != NULL) {
+		free_file(f);
+		return found;
+	}
+	return f;
+}
+
+static void unlink_frame(served_t *srv, served_frame_t *fr) {
+//! Remove a frame from the recently used list (lock held)
+	if (fr->prev != NULL) {
+		fr->prev->next = fr->next;
+	} else {
+		srv->head = fr->next;
+	}
+	if (fr->next != NULL) {
+		fr->next->prev = fr->prev;
+	} else {
+		srv->tail = fr->prev;
+	}
+	fr->prev = fr->next = NULL;
+}
+
+static void push_frame(served_t *srv, served_frame_t *fr) {
+//! Add a frame at the most recently used end of the list (lock held)
+	fr->prev = NULL;
+	fr->next = srv->head;
+	if (srv->head != NULL) {
+		srv->head->prev = fr;
+	} else {
+		srv->tail = fr;
+	}
+	srv->head = fr;
+}
+
+static served_frame_t *find_frame(served_t *srv, served_file_t *f, int step, int var) {
+//! Find a cached frame and take a reference to it, or return NULL (lock held)
+	for (served_frame_t *fr = srv->head; fr != NULL; fr = fr->next) {
+		if (fr->file == f && fr->step == step && fr->var == var) {
+			unlink_frame(srv, fr);
+			push_frame(srv, fr);
+			fr->refs++;
+			return fr;
+		}
+	}
+	return NULL;
+}
+
+static served_frame_t *get_frame(served_t *srv, served_file_t *f, int step, int var) {
+//! Find a cached frame or read it, returning it with a reference held (see release_frame())
+	pthread_mutex_lock(&srv->lock);
+	served_frame_t *found = find_frame(srv, f, step, var);
+	if (found != NULL) {
+		srv->hits++;
+		pthread_mutex_unlock(&srv->lock);
+		return found;
+	}
+	srv->misses++;
+	pthread_mutex_unlock(&srv->lock);
+
+	// Read without the lock, so other queries continue meanwhile
+	served_frame_t *fr = calloc(sizeof(served_frame_t), 1);
+	size_t size = sizeof(float) * (f->rfs.tmdat.npoin + 1);
+	if (fr == NULL || (fr->values = malloc(size)) == NULL || read_telemac_var(&f->rfs, step, var, fr->values) != 0) {
+		if (fr != NULL) {
+			free(fr->values);
+		}
+		free(fr);
+		return NULL;
+	}
+	fr->file = f;
+	fr->step = step;
+	fr->var = var;
+	fr->refs = 1;
+
+	// Another query may have read the same frame meanwhile: use that one instead
+	pthread_mutex_lock(&srv->lock);
+	found = find_frame(srv, f, step, var);
+	if (found != NULL) {
+		pthread_mutex_unlock(&srv->lock);
+		free(fr->values);
+		free(fr);
+		return found;
+	}
+	push_frame(srv, fr);
+	srv->nframes++;
+	srv->bytes += size;
+	served_frame_t *old = srv->tail;
+	while (srv->bytes > srv->limit && old != NULL) {
+		served_frame_t *prev = old->prev;
+		if (old->refs == 0) {
+			unlink_frame(srv, old);
+			srv->nframes--;
+			srv->bytes -= sizeof(float) * (old->file->rfs.tmdat.npoin + 1);
+			free(old->values);
+			free(old);
+		}
+		old = prev;
+	}
+	pthread_mutex_unlock(&srv->lock);
+	return fr;
+}
+
+static void release_frame(served_t *srv, served_frame_t *fr) {
+//! Release a reference to a frame returned by get_frame()
+	pthread_mutex_lock(&srv->lock);
+	fr->refs--;
+	pthread_mutex_unlock(&srv->lock);
+}
+
+static int build_index(served_file_t *f) {
+//! Build a uniform grid of the triangles overlapping each cell, if not already built
+	pthread_mutex_lock(&f->lock);
+	if (f->indexed) {
+		pthread_mutex_unlock(&f->lock);
+		return 0;
+	}
+	const telemac_data_t *mesh = &f->rfs.tmdat;
+	int rv = 0;
+	for (int k = 0; k < 3; k++) {
+		f->tri[k] = calloc(sizeof(uint32_t), 2 * (size_t)f->layers.nelem2 + 1);
+		rv |= (f->tri[k] == NULL);
+	}
+	if (rv == 0) {
+		f->ntri = telemac_plane_triangles(mesh, &f->layers, f->tri);
+		double w = mesh->XYrange[1] - mesh->XYrange[0];
+		double h = mesh->XYrange[3] - mesh->XYrange[2];
+		f->cell = sqrt((w * h > 0 ? w * h : 1) / (f->ntri + 1)) * 2;
+		// Keep each side within the number of triangles, so that degenerate extents cannot give a huge grid
+		double side = fmax(w, h) / (f->ntri + 1);
+		f->cell = (f->cell >= side ? f->cell : side);
+		f->x0 = mesh->XYrange[0];
+		f->y0 = mesh->XYrange[2];
+		double cols = w / f->cell, rows = h / f->cell;
+		f->nx = (cols >= 0 && cols <= f->ntri ? (uint32_t)cols : f->ntri) + 1;
+		f->ny = (rows >= 0 && rows <= f->ntri ? (uint32_t)rows : f->ntri) + 1;
+		f->cell_start = calloc(sizeof(uint32_t), (size_t)f->nx * f->ny + 1);
+		rv = (f->cell_start == NULL);
+	}
+
+	// Count, prefix sum, then fill the triangles overlapping each cell
+	for (int pass = 0; pass < 2 && rv == 0; pass++) {
+		for (uint32_t t = 0; t < f->ntri; t++) {
+			double xmin = INFINITY, xmax = -INFINITY, ymin = INFINITY, ymax = -INFINITY;
+			for (int k = 0; k < 3; k++) {
+				xmin = fmin(xmin, mesh->X[f->tri[k][t]]);
+				xmax = fmax(xmax, mesh->X[f->tri[k][t]]);
+				ymin = fmin(ymin, mesh->Y[f->tri[k][t]]);
+				ymax = fmax(ymax, mesh->Y[f->tri[k][t]]);
+			}
+			uint32_t c0 = (uint32_t)((xmin - f->x0) / f->cell), c1 = (uint32_t)((xmax - f->x0) / f->cell);
+			uint32_t r0 = (uint32_t)((ymin - f->y0) / f->cell), r1 = (uint32_t)((ymax - f->y0) / f->cell);
+			for (uint32_t r = r0; r <= r1 && r < f->ny; r++) {
+				for (uint32_t c = c0; c <= c1 && c < f->nx; c++) {
+					size_t cell = (size_t)r * f->nx + c;
+					if (pass == 0) {
+						f->cell_start[cell + 1]++;
+					} else {
+						f->cell_tri[f->cell_start[cell]++] = t;
+					}
+				}
+			}
+		}
+		size_t ncell = (size_t)f->nx * f->ny;
+		if (pass == 0) {
+			for (size_t c = 0; c < ncell; c++) {
+				f->cell_start[c + 1] += f->cell_start[c];
+			}
+			f->cell_tri = calloc(sizeof(uint32_t), f->cell_start[ncell] + 1);
+			rv = (f->cell_tri == NULL);
+		} else {
+			// Filling advanced each start to the next cell's start
+			memmove(&f->cell_start[1], &f->cell_start[0], sizeof(uint32_t) * ncell);
+			f->cell_start[0] = 0;
+		}
+	}
+	f->indexed = (rv == 0);
+	pthread_mutex_unlock(&f->lock);
+	return (rv ? -1 : 0);
+}
+
+static int locate(const served_file_t *f, double x, double y, uint32_t node[3], double w[3]) {
+//! Find the triangle containing a point and the interpolation weights of its nodes
+	const telemac_data_t *mesh = &f->rfs.tmdat;
+	if (x < f->x0 || y < f->y0) {
+		return -1;
+	}
+	uint32_t c = (uint32_t)((x - f->x0) / f->cell);
+	uint32_t r = (uint32_t)((y - f->y0) / f->cell);
+	if (c >= f->nx || r >= f->ny) {
+		return -1;
+	}
+	size_t cell = (size_t)r * f->nx + c;
+	for (uint32_t i = f->cell_start[cell]; i < f->cell_start[cell + 1]; i++) {
+		uint32_t t = f->cell_tri[i];
+		uint32_t a = f->tri[0][t], b = f->tri[1][t], d = f->tri[2][t];
+		double det = ((double)mesh->Y[b] - mesh->Y[d]) * (mesh->X[a] - mesh->X[d]) + ((double)mesh->X[d] - mesh->X[b]) * (mesh->Y[a] - mesh->Y[d]);
+		if (det == 0) {
+			continue;
+		}
+		double l0 = (((double)mesh->Y[b] - mesh->Y[d]) * (x - mesh->X[d]) + ((double)mesh->X[d] - mesh->X[b]) * (y - mesh->Y[d])) / det;
+		double l1 = (((double)mesh->Y[d] - mesh->Y[a]) * (x - mesh->X[d]) + ((double)mesh->X[a] - mesh->X[d]) * (y - mesh->Y[d])) / det;
+		double l2 = 1 - l0 - l1;
+		if (l0 >= -1e-9 && l1 >= -1e-9 && l2 >= -1e-9) {
+			node[0] = a;
+			node[1] = b;
+			node[2] = d;
+			w[0] = l0;
+			w[1] = l1;
+			w[2] = l2;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int check_args(const served_file_t *f, int var, int step, bool allsteps, char *err, size_t errlen) {
+//! Check variable and timestep numbers, setting an error message if out of range
+	const telemac_data_t *mesh = &f->rfs.tmdat;
+	if (var < 0 || var >= (int)(mesh->nbv_1 + mesh->nbv_2)) {
+		snprintf(err, errlen, "variable %d out of range (%u variables)", var, mesh->nbv_1 + mesh->nbv_2);
+		return -1;
+	}
+	if ((step < 0 && !(allsteps && step == -1)) || step >= (int)mesh->nt) {
+		snprintf(err, errlen, "timestep %d out of range (%u timesteps)", step, mesh->nt);
+		return -1;
+	}
+	return 0;
+}
+
+static int handle(served_t *srv, char *line, FILE *out, char *err, size_t errlen) {
+/*!
+ * @brief Answer a single request
+ *
+ * The result lines (after the status line) are written to @p out.
+ * @returns 0 on success, or -1 with an error message in @p err, in which
+ * case anything written to @p out is discarded
+ */
+	char cmd[16] = "";
+	int n = 0;
+	if (sscanf(line, "%15s %n", cmd, &n) < 1) {
+		snprintf(err, errlen, "empty request");
+		return -1;
+	}
+	char *args = line + n;
+
+	if (strcmp(cmd, "STATUS") == 0) {
+		pthread_mutex_lock(&srv->lock);
+		fprintf(out, "files,frames,bytes,limit,hits,misses,requests\n%d,%d,%zu,%zu,%lu,%lu,%lu\n", srv->nfiles, srv->nframes,
+				srv->bytes, srv->limit, (unsigned long)srv->hits, (unsigned long)srv->misses, (unsigned long)srv->requests);
+		for (served_file_t *f = srv->files; f != NULL; f = f->next) {
+			fprintf(out, "file,%s\n", f->path);
+		}
+		pthread_mutex_unlock(&srv->lock);
+		return 0;
+	}
+	if (strcmp(cmd, "QUIT") == 0) {
+		pthread_mutex_lock(&srv->lock);
+		srv->stop = true;
+		pthread_cond_broadcast(&srv->cond);
+		pthread_mutex_unlock(&srv->lock);
+		shutdown(srv->listener, SHUT_RDWR);
+		return 0;
+	}
+
+	// Remaining requests: numeric arguments, then the file name
+	double num[4] = {0, 0, 0, 0};
+	int nnum = (strcmp(cmd, "POINT") == 0 ? 4 : strcmp(cmd, "SERIES") == 0 || strcmp(cmd, "STATS") == 0 ? 2 :
+			strcmp(cmd, "INFO") == 0 || strcmp(cmd, "TIMES") == 0 ? 0 : -1);
+	if (nnum < 0) {
+		snprintf(err, errlen, "unknown request %s", cmd);
+		return -1;
+	}
+	for (int k = 0; k < nnum; k++) {
+		char *end = NULL;
+		num[k] = strtod(args, &end);
+		if (end == args) {
+			snprintf(err, errlen, "%s needs %d numeric arguments", cmd, nnum);
+			return -1;
+		}
+		args = end + strspn(end, " ");
+	}
+	if (*args == '\0') {
+		snprintf(err, errlen, "no file given");
+		return -1;
+	}
+	served_file_t *f = get_file(srv, args, err, errlen);
+	if (f == NULL) {
+		return -1;
+	}
+	const telemac_data_t *mesh = &f->rfs.tmdat;
+
+	if (strcmp(cmd, "INFO") == 0) {
+		fprintf(out, "nodes,elements,ndp,planes,timesteps,first,last,xmin,xmax,ymin,ymax\n%u,%u,%u,%u,%u,%f,%f,%f,%f,%f,%f\nvariable,name\n",
+				mesh->npoin, mesh->nelem, mesh->ndp, f->layers.nplan, mesh->nt, (mesh->nt ? f->times[0] : 0),
+				(mesh->nt ? f->times[mesh->nt - 1] : 0), mesh->XYrange[0], mesh->XYrange[1], mesh->XYrange[2], mesh->XYrange[3]);
+		for (int j = 0; j < (int)(mesh->nbv_1 + mesh->nbv_2); j++) {
+			fprintf(out, "%d,%.32s\n", j, (j < (int)mesh->nbv_1 ? mesh->var_names[j] : "QUADRATIC"));
+		}
+	} else if (strcmp(cmd, "TIMES") == 0) {
+		fprintf(out, "step,time\n");
+		for (int t = 0; t < (int)mesh->nt; t++) {
+			fprintf(out, "%d,%f\n", t, f->times[t]);
+		}
+	} else if (strcmp(cmd, "SERIES") == 0) {
+		int node = (int)num[0], var = (int)num[1];
+		if (node < 0 || node >= (int)mesh->npoin) {
+			snprintf(err, errlen, "node %d out of range (%u nodes)", node, mesh->npoin);
+			return -1;
+		}
+		if (check_args(f, var, 0, false, err, errlen) != 0) {
+			return -1;
+		}
+		fprintf(out, "step,time,value\n");
+		for (int t = 0; t < (int)mesh->nt; t++) {
+			float v = 0;
+			if (read_telemac_var_range(&f->rfs, t, var, node, 1, &v) != 0) {
+				snprintf(err, errlen, "unable to read timestep %d", t);
+				return -1;
+			}
+			fprintf(out, "%d,%f,%.8g\n", t, f->times[t], v);
+		}
+	} else if (strcmp(cmd, "POINT") == 0) {
+		int var = (int)num[2], step = (int)num[3];
+		uint32_t node[3];
+		double w[3];
+		if (check_args(f, var, step, true, err, errlen) != 0) {
+			return -1;
+		}
+		if (build_index(f) != 0) {
+			snprintf(err, errlen, "unable to build spatial index");
+			return -1;
+		}
+		if (locate(f, num[0], num[1], node, w) != 0) {
+			snprintf(err, errlen, "point (%f, %f) is outside the mesh", num[0], num[1]);
+			return -1;
+		}
+		// 3D results are interpolated on the surface plane
+		uint32_t offset = (f->layers.nplan - 1) * f->layers.npoin2;
+		fprintf(out, "step,time,value\n");
+		for (int t = (step < 0 ? 0 : step); t < (step < 0 ? (int)mesh->nt : step + 1); t++) {
+			float v[3];
+			for (int k = 0; k < 3; k++) {
+				if (read_telemac_var_range(&f->rfs, t, var, node[k] + offset, 1, &v[k]) != 0) {
+					snprintf(err, errlen, "unable to read timestep %d", t);
+					return -1;
+				}
+			}
+			fprintf(out, "%d,%f,%.8g\n", t, f->times[t], w[0] * v[0] + w[1] * v[1] + w[2] * v[2]);
+		}
+	} else if (strcmp(cmd, "STATS") == 0) {
+		int var = (int)num[0], step = (int)num[1];
+		if (check_args(f, var, step, false, err, errlen) != 0) {
+			return -1;
+		}
+		served_frame_t *fr = get_frame(srv, f, step, var);
+		if (fr == NULL) {
+			snprintf(err, errlen, "unable to read variable %d at timestep %d", var, step);
+			return -1;
+		}
+		double vmin = INFINITY, vmax = -INFINITY, sum = 0;
+		for (uint32_t i = 0; i < mesh->npoin; i++) {
+			vmin = fmin(vmin, fr->values[i]);
+			vmax = fmax(vmax, fr->values[i]);
+			sum += fr->values[i];
+		}
+		release_frame(srv, fr);
+		fprintf(out, "step,time,min,max,mean\n%d,%f,%.8g,%.8g,%.8g\n", step, f->times[step], vmin, vmax, sum / (mesh->npoin ? mesh->npoin : 1));
+	}
+	return 0;
+}
+
+static int read_request(int fd, char *line, size_t size) {
+/*!
+ * @brief Read a request line from a connection, allowing SERVED_TIMEOUT seconds in all
+ *
+ * The line is returned without its newline.
+ * @returns 0 on success, -1 if the line is too long or incomplete, -2 if the client took too long
+ */
+	struct timespec now, deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += SERVED_TIMEOUT;
+	size_t len = 0;
+	while (len < size - 1) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+		struct pollfd pfd = {fd, POLLIN, 0};
+		int pr = (ms > 0 ? poll(&pfd, 1, (int)ms) : 0);
+		if (pr < 0 && errno == EINTR) {
+			continue;
+		}
+		if (pr == 0) {
+			return -2;
+		}
+		ssize_t n = (pr > 0 ? recv(fd, &line[len], size - 1 - len, 0) : -1);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		char *nl = memchr(&line[len], '\n', n);
+		len += n;
+		if (nl != NULL) {
+			*nl = '\0';
+			line[strcspn(line, "\r")] = '\0';
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+//! Write all of a buffer to a connection, returning 0 on success or -1 on failure (including a timeout)
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int serve_task(void *ctx, size_t start, size_t end, int thread) {
+//! telemac_parallel_for() callback: a worker answering connections until the server stops
+	served_t *srv = (served_t *)ctx;
+	char *line = malloc(TELEMAC_REQUEST_MAX + 1);
+	if (line == NULL) {
+		return -1;
+	}
+	for (;;) {
+		pthread_mutex_lock(&srv->lock);
+		while (srv->qcount == 0 && !srv->stop) {
+			pthread_cond_wait(&srv->cond, &srv->lock);
+		}
+		if (srv->qcount == 0) {
+			pthread_mutex_unlock(&srv->lock);
+			break;
+		}
+		int fd = srv->queue[srv->qhead];
+		srv->qhead = (srv->qhead + 1) % SERVED_QUEUE;
+		srv->qcount--;
+		srv->requests++;
+		pthread_mutex_unlock(&srv->lock);
+
+		// Writes to a client that stops reading fail after the timeout, rather than holding the worker
+		struct timeval tv = {SERVED_TIMEOUT, 0};
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		char *reply = NULL;
+		size_t rlen = 0;
+		FILE *out = open_memstream(&reply, &rlen);
+		if (out == NULL) {
+			perror("Preparing reply");
+			close(fd);
+			continue;
+		}
+		char err[256] = "";
+		int rv = read_request(fd, line, TELEMAC_REQUEST_MAX + 1);
+		if (rv == -2) {
+			snprintf(err, sizeof(err), "request not received within %d seconds", SERVED_TIMEOUT);
+		} else if (rv != 0) {
+			snprintf(err, sizeof(err), "request too long or incomplete");
+		} else {
+			rv = handle(srv, line, out, err, sizeof(err));
+		}
+		fclose(out);
+
+		// Only a complete reply is sent after OK
+		char status[sizeof(err) + 8] = "OK\n";
+		if (rv != 0) {
+			snprintf(status, sizeof(status), "ERR %s\n", err);
+		}
+		if (write_all(fd, status, strlen(status)) != 0 || (rv == 0 && write_all(fd, reply, rlen) != 0)) {
+			perror("Sending reply");
+		}
+		free(reply);
+		close(fd);
+	}
+	free(line);
+	return 0;
+}
+
+static void *accept_thread(void *arg) {
+//! Accept connections and queue them for the workers, until the server stops
+	served_t *srv = (served_t *)arg;
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_UNBLOCK, &sigs, NULL);
+	for (;;) {
+		int fd = accept(srv->listener, NULL, NULL);
+		bool failed = (fd < 0 && errno != EINTR && errno != ECONNABORTED);
+		pthread_mutex_lock(&srv->lock);
+		bool stop = srv->stop || stop_signal || failed;
+		if (fd >= 0 && !stop && srv->qcount < SERVED_QUEUE) {
+			srv->queue[(srv->qhead + srv->qcount++) % SERVED_QUEUE] = fd;
+			pthread_cond_signal(&srv->cond);
+			fd = -1;
+		}
+		if (stop) {
+			srv->stop = true;
+			pthread_cond_broadcast(&srv->cond);
+			pthread_mutex_unlock(&srv->lock);
+			if (fd >= 0) {
+				close(fd);
+			}
+			break;
+		}
+		pthread_mutex_unlock(&srv->lock);
+		if (fd >= 0) {
+			// Queue full: turn the connection away
+			const char *busy = "ERR server busy\n";
+			if (write(fd, busy, strlen(busy)) < 0) {
+				perror("Refusing connection");
+			}
+			close(fd);
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	char *sockpath = getenv(TELEMAC_SOCKET_ENV);
+	char defpath[108];
+	bool background = false;
+	int nthreads = 0;
+	double cachemb = 256;
+
+	const char *usage = "Usage: %s [-s socket] [-c MiB] [-j n] [-d] [--stats[=json]] [filename...]\n"
+		"\t-s\tSocket path (default: $" TELEMAC_SOCKET_ENV ", or " TELEMAC_SOCKET_DEFAULT ")\n"
+		"\t-c\tMemory for cached variables, in MiB (default: 256)\n"
+		"\t-j\tNumber of worker threads (default: number of CPUs)\n"
+		"\t-d\tRun in the background\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n"
+		"Files given on the command line are opened at startup.\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "s:c:j:d")) != -1) {
+		switch (go) {
+			case 's':
+				sockpath = optarg;
+				break;
+			case 'c':
+				cachemb = strtod(optarg, NULL);
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'd':
+				background = true;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (sockpath == NULL) {
+		if (telemac_socket_path(defpath, sizeof(defpath), true) != 0) {
+			fprintf(stderr, "No safe default socket path: use -s\n");
+			return EXIT_FAILURE;
+		}
+		sockpath = defpath;
+	}
+	nthreads = (nthreads < 1 ? telemac_default_threads() : nthreads);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(sockpath) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", sockpath);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, sockpath);
+
+	served_t srv;
+	memset(&srv, 0, sizeof(served_t));
+	pthread_mutex_init(&srv.lock, NULL);
+	pthread_cond_init(&srv.cond, NULL);
+	srv.limit = (size_t)(cachemb * 1024 * 1024);
+
+	for (int i = optind; i < argc; i++) {
+		char err[256];
+		char *path = realpath(argv[i], NULL);
+		if (path == NULL || get_file(&srv, path, err, sizeof(err)) == NULL) {
+			fprintf(stderr, "Unable to open %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+		free(path);
+	}
+
+	srv.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (srv.listener < 0) {
+		perror("Creating socket");
+		return EXIT_FAILURE;
+	}
+	// Only the user may connect: create the socket closed to others, then make sure of it
+	unlink(sockpath);
+	mode_t mask = umask(0177);
+	int bound = bind(srv.listener, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (bound != 0 || chmod(sockpath, 0600) != 0 || listen(srv.listener, SERVED_QUEUE) != 0) {
+		perror(sockpath);
+		return EXIT_FAILURE;
+	}
+	fprintf(stdout, "Listening on %s with %d workers (%d files open)\n", sockpath, nthreads, srv.nfiles);
+	fflush(stdout);
+	if (background && daemon(1, 0) != 0) {
+		perror("Running in background");
+		return EXIT_FAILURE;
+	}
+
+	// Signals are handled only by the accepting thread, interrupting accept() rather than restarting it
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	pthread_t acceptor;
+	if (pthread_create(&acceptor, NULL, accept_thread, &srv) != 0) {
+		perror("Starting server");
+		return EXIT_FAILURE;
+	}
+	int rv = telemac_parallel_for(nthreads, nthreads, 1, serve_task, &srv);
+	pthread_join(acceptor, NULL);
+	close(srv.listener);
+	unlink(sockpath);
+	for (int k = 0; k < srv.qcount; k++) {
+		close(srv.queue[(srv.qhead + k) % SERVED_QUEUE]);
+	}
+
+	while (srv.head != NULL) {
+		served_frame_t *fr = srv.head;
+		srv.head = fr->next;
+		free(fr->values);
+		free(fr);
+	}
+	while (srv.files != NULL) {
+		served_file_t *f = srv.files;
+		srv.files = f->next;
+		free_file(f);
+	}
+	fprintf(stdout, "Answered %lu requests\n", (unsigned long)srv.requests);
+	return (rv == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
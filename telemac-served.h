@@ -0,0 +1,57 @@
+/******************************************************************************
+telemac-served - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Protocol shared by the query server and client
+ *
+ * Each connection to the server's Unix domain socket carries a single
+ * request: one line of words separated by spaces, ending with a newline.
+ * Where a request refers to a results file, the file name is the last word
+ * and extends to the end of the line, so it may contain spaces. File names
+ * must be absolute, as the server does not share the client's working
+ * directory.
+ *
+ * The server replies with a status line, either "OK" or "ERR" followed by a
+ * message, then (for OK) any result lines as CSV with a header, and closes
+ * the connection. OK is only sent once the whole result is ready, so it is
+ * never followed by an error. The request must arrive within SERVED_TIMEOUT
+ * seconds of connecting (see telemac-served.c).
+ *
+ * | Request                        | Result                                        |
+ * |--------------------------------|-----------------------------------------------|
+ * | INFO file                      | Mesh size, variables and time range           |
+ * | TIMES file                     | Time of each timestep                         |
+ * | SERIES node var file           | Value of a variable at a node at every timestep |
+ * | POINT x y var step file        | Value interpolated at a point (step -1: every timestep) |
+ * | STATS var step file            | Minimum, maximum and mean of a variable       |
+ * | STATUS                         | Open files and frame cache use                |
+ * | QUIT                           | Stop the server                               |
+ */
+
+#ifndef TELEMAC_SERVED_H
+#define TELEMAC_SERVED_H
+
+//! Environment variable giving the socket path
+#define TELEMAC_SOCKET_ENV "TELEMAC_SOCKET"
+
+//! Longest request line accepted by the server
+#define TELEMAC_REQUEST_MAX 4096
+
+#endif // TELEMAC_SERVED_H
@@ -0,0 +1,638 @@
+/******************************************************************************
+telemac-simplify - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "telemac-simplify.h"
+#include "telemac-layers.h"
+#include "telemac-stats.h"
+
+//! No corner or node
+#define SIMPLIFY_NONE UINT32_MAX
+
+//! Lowest shape quality (1 for an equilateral triangle) accepted for a triangle changed by a collapse
+#define SIMPLIFY_MIN_QUALITY 0.1
+
+//! Candidate collapse in the priority queue
+typedef struct {
+	double cost; //!< Quadric error of the collapse
+	double len2; //!< Squared length of the edge, to order collapses of equal cost
+	uint32_t from; //!< Node removed
+	uint32_t to; //!< Node kept
+	uint32_t stamp; //!< Stamp of the removed node when calculated. The entry is stale if it has changed.
+} collapse_t;
+
+//! Working state for telemac_simplify()
+/*!
+ * The corners of the triangles (corner c is node c % 3 of triangle c / 3)
+ * are kept in a doubly linked list for each node, so the triangles around a
+ * node can be found and updated as edges are collapsed.
+ */
+typedef struct {
+	uint32_t npoin; //!< Number of nodes
+	uint32_t ntri; //!< Number of triangles
+	double *x; //!< Node X coordinates, relative to the first node
+	double *y; //!< Node Y coordinates, relative to the first node
+	double *z; //!< Node heights
+	uint32_t *tv; //!< Nodes of each triangle (three per triangle)
+	uint8_t *alive; //!< Non-zero for triangles not yet removed
+	uint32_t *head; //!< First corner of each node
+	uint32_t *next; //!< Next corner of the same node
+	uint32_t *prev; //!< Previous corner of the same node
+	double *q; //!< Error quadric of each node (10 values, the upper triangle of a symmetric 4x4 matrix)
+	uint8_t *fixed; //!< Non-zero for nodes that may not be removed
+	uint8_t *removed; //!< Non-zero for nodes merged into another
+	uint32_t *parent; //!< Node each removed node was merged into
+	uint32_t *stamp; //!< Changed whenever the best collapse of a node is recalculated
+	uint32_t *mark[2]; //!< Marks for finding shared neighbours
+	uint32_t qid; //!< Current mark value
+	uint32_t *ring; //!< Neighbours of a node
+	size_t nring; //!< Number of entries in ring
+	size_t ringsize; //!< Allocated entries in ring
+	collapse_t *cand; //!< Candidate collapses of one node
+	size_t candsize; //!< Allocated entries in cand
+	collapse_t *heap; //!< Candidate collapses, as a binary heap ordered by cost
+	size_t nheap; //!< Number of entries in heap
+	size_t heapsize; //!< Allocated entries in heap
+} simp_t;
+
+static bool collapse_less(const collapse_t *a, const collapse_t *b) {
+//! Heap order: lower cost first, then shorter edge
+	return (a->cost < b->cost || (a->cost == b->cost && a->len2 < b->len2));
+}
+
+static int heap_push(simp_t *s, collapse_t c) {
+/*!
+ * @brief Add a candidate collapse to the heap
+ * @returns 0 on success, -1 if memory could not be allocated
+ */
+	if (s->nheap == s->heapsize) {
+		size_t size = (s->heapsize ? 2 * s->heapsize : 1024);
+		collapse_t *heap = realloc(s->heap, sizeof(collapse_t) * size);
+		if (heap == NULL) {
+			return -1;
+		}
+		s->heap = heap;
+		s->heapsize = size;
+	}
+	size_t i = s->nheap++;
+	while (i > 0 && collapse_less(&c, &s->heap[(i - 1) / 2])) {
+		s->heap[i] = s->heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	s->heap[i] = c;
+	return 0;
+}
+
+static collapse_t heap_pop(simp_t *s) {
+//! Remove and return the cheapest candidate collapse. The heap must not be empty.
+	collapse_t top = s->heap[0];
+	collapse_t last = s->heap[--s->nheap];
+	size_t i = 0;
+	for (;;) {
+		size_t c = 2 * i + 1;
+		if (c >= s->nheap) {
+			break;
+		}
+		if (c + 1 < s->nheap && collapse_less(&s->heap[c + 1], &s->heap[c])) {
+			c++;
+		}
+		if (!collapse_less(&s->heap[c], &last)) {
+			break;
+		}
+		s->heap[i] = s->heap[c];
+		i = c;
+	}
+	if (s->nheap > 0) {
+		s->heap[i] = last;
+	}
+	return top;
+}
+
+static void next_mark(simp_t *s) {
+//! Start a new set of marks, clearing the old marks when the counter wraps
+	if (++s->qid == 0) {
+		memset(s->mark[0], 0, sizeof(uint32_t) * s->npoin);
+		memset(s->mark[1], 0, sizeof(uint32_t) * s->npoin);
+		s->qid = 1;
+	}
+}
+
+static void corner_link(simp_t *s, uint32_t c, uint32_t n) {
+//! Add corner @p c to the list of node @p n
+	s->prev[c] = SIMPLIFY_NONE;
+	s->next[c] = s->head[n];
+	if (s->head[n] != SIMPLIFY_NONE) {
+		s->prev[s->head[n]] = c;
+	}
+	s->head[n] = c;
+}
+
+static void corner_unlink(simp_t *s, uint32_t c) {
+//! Remove corner @p c from the list of its node
+	if (s->prev[c] != SIMPLIFY_NONE) {
+		s->next[s->prev[c]] = s->next[c];
+	} else {
+		s->head[s->tv[c]] = s->next[c];
+	}
+	if (s->next[c] != SIMPLIFY_NONE) {
+		s->prev[s->next[c]] = s->prev[c];
+	}
+}
+
+static int collect_ring(simp_t *s, uint32_t n) {
+/*!
+ * @brief List the neighbours of node @p n in s->ring
+ * @returns 0 on success, -1 if memory could not be allocated
+ */
+	s->nring = 0;
+	next_mark(s);
+	for (uint32_t c = s->head[n]; c != SIMPLIFY_NONE; c = s->next[c]) {
+		uint32_t t = c / 3;
+		for (int k = 1; k < 3; k++) {
+			uint32_t w = s->tv[3 * t + (c % 3 + k) % 3];
+			if (s->mark[0][w] == s->qid) {
+				continue;
+			}
+			s->mark[0][w] = s->qid;
+			if (s->nring == s->ringsize) {
+				size_t size = (s->ringsize ? 2 * s->ringsize : 64);
+				uint32_t *ring = realloc(s->ring, sizeof(uint32_t) * size);
+				if (ring == NULL) {
+					return -1;
+				}
+				s->ring = ring;
+				s->ringsize = size;
+			}
+			s->ring[s->nring++] = w;
+		}
+	}
+	return 0;
+}
+
+static double signed_area(const simp_t *s, uint32_t a, uint32_t b, uint32_t c) {
+//! Twice the signed area of triangle a-b-c in the horizontal plane
+	return (s->x[b] - s->x[a]) * (s->y[c] - s->y[a]) - (s->x[c] - s->x[a]) * (s->y[b] - s->y[a]);
+}
+
+static double quality(const simp_t *s, uint32_t a, uint32_t b, uint32_t c) {
+//! Shape quality of a triangle in the horizontal plane: 1 if equilateral, 0 if degenerate
+	double l = 0;
+	const uint32_t v[3] = {a, b, c};
+	for (int k = 0; k < 3; k++) {
+		double dx = s->x[v[(k + 1) % 3]] - s->x[v[k]];
+		double dy = s->y[v[(k + 1) % 3]] - s->y[v[k]];
+		l += dx * dx + dy * dy;
+	}
+	return (l > 0 ? 2 * sqrt(3.0) * fabs(signed_area(s, a, b, c)) / l : 0);
+}
+
+static bool collapse_valid(simp_t *s, uint32_t from, uint32_t to) {
+/*!
+ * @brief Check whether node @p from can be merged into its neighbour @p to
+ *
+ * The nodes must share exactly the two triangles either side of the edge
+ * joining them (so the mesh stays manifold), and every other triangle
+ * around @p from must keep its orientation and a reasonable shape.
+ */
+	if (s->removed[from] || s->removed[to] || s->fixed[from]) {
+		return false;
+	}
+	// Neighbours of both nodes, and triangles containing both
+	next_mark(s);
+	uint32_t shared = 0;
+	for (uint32_t c = s->head[from]; c != SIMPLIFY_NONE; c = s->next[c]) {
+		uint32_t t = c / 3;
+		for (int k = 1; k < 3; k++) {
+			uint32_t w = s->tv[3 * t + (c % 3 + k) % 3];
+			s->mark[0][w] = s->qid;
+			if (w == to) {
+				shared++;
+			}
+		}
+	}
+	if (shared != 2) {
+		return false;
+	}
+	uint32_t common = 0;
+	for (uint32_t c = s->head[to]; c != SIMPLIFY_NONE; c = s->next[c]) {
+		uint32_t t = c / 3;
+		for (int k = 1; k < 3; k++) {
+			uint32_t w = s->tv[3 * t + (c % 3 + k) % 3];
+			if (s->mark[0][w] == s->qid && s->mark[1][w] != s->qid) {
+				s->mark[1][w] = s->qid;
+				common++;
+			}
+		}
+	}
+	if (common != 2) {
+		return false;
+	}
+
+	for (uint32_t c = s->head[from]; c != SIMPLIFY_NONE; c = s->next[c]) {
+		uint32_t t = c / 3;
+		uint32_t v[3] = {s->tv[3 * t], s->tv[3 * t + 1], s->tv[3 * t + 2]};
+		if (v[0] == to || v[1] == to || v[2] == to) {
+			continue;
+		}
+		double before = signed_area(s, v[0], v[1], v[2]);
+		double qbefore = quality(s, v[0], v[1], v[2]);
+		v[c % 3] = to;
+		double after = signed_area(s, v[0], v[1], v[2]);
+		if (after == 0 || (after > 0) != (before > 0)) {
+			return false;
+		}
+		double qafter = quality(s, v[0], v[1], v[2]);
+		if (qafter < SIMPLIFY_MIN_QUALITY && qafter < qbefore) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static double collapse_cost(const simp_t *s, uint32_t from, uint32_t to) {
+//! Quadric error of moving node @p from on to node @p to
+	const double *a = &s->q[10 * (size_t)from];
+	const double *b = &s->q[10 * (size_t)to];
+	double q[10];
+	for (int k = 0; k < 10; k++) {
+		q[k] = a[k] + b[k];
+	}
+	double x = s->x[to];
+	double y = s->y[to];
+	double z = s->z[to];
+	return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+		+ q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+		+ q[7] * z * z + 2 * q[8] * z + q[9];
+}
+
+static int update_node(simp_t *s, uint32_t n) {
+/*!
+ * @brief Find the cheapest valid collapse of node @p n and add it to the heap
+ *
+ * Any earlier entry for the node becomes stale.
+ * @returns 0 on success, -1 if memory could not be allocated
+ */
+	s->stamp[n]++;
+	if (s->removed[n] || s->fixed[n]) {
+		return 0;
+	}
+	if (collect_ring(s, n) != 0) {
+		return -1;
+	}
+	// Cost each neighbour, then check them in order of cost until one is valid
+	if (s->nring > s->candsize) {
+		collapse_t *cand = realloc(s->cand, sizeof(collapse_t) * s->nring);
+		if (cand == NULL) {
+			return -1;
+		}
+		s->cand = cand;
+		s->candsize = s->nring;
+	}
+	size_t ncand = s->nring;
+	for (size_t i = 0; i < ncand; i++) {
+		uint32_t to = s->ring[i];
+		double dx = s->x[to] - s->x[n];
+		double dy = s->y[to] - s->y[n];
+		double dz = s->z[to] - s->z[n];
+		collapse_t c = {collapse_cost(s, n, to), dx * dx + dy * dy + dz * dz, n, to, s->stamp[n]};
+		s->cand[i] = c;
+	}
+	while (ncand > 0) {
+		size_t best = 0;
+		for (size_t i = 1; i < ncand; i++) {
+			if (collapse_less(&s->cand[i], &s->cand[best])) {
+				best = i;
+			}
+		}
+		if (collapse_valid(s, n, s->cand[best].to)) {
+			return heap_push(s, s->cand[best]);
+		}
+		s->cand[best] = s->cand[--ncand];
+	}
+	return 0;
+}
+
+static uint32_t collapse(simp_t *s, uint32_t from, uint32_t to) {
+/*!
+ * @brief Merge node @p from into node @p to
+ * @returns Number of triangles removed
+ */
+	for (int k = 0; k < 10; k++) {
+		s->q[10 * (size_t)to + k] += s->q[10 * (size_t)from + k];
+	}
+	uint32_t killed = 0;
+	uint32_t c = s->head[from];
+	while (c != SIMPLIFY_NONE) {
+		uint32_t nc = s->next[c];
+		uint32_t t = c / 3;
+		if (s->tv[3 * t] == to || s->tv[3 * t + 1] == to || s->tv[3 * t + 2] == to) {
+			for (int k = 0; k < 3; k++) {
+				corner_unlink(s, 3 * t + k);
+			}
+			s->alive[t] = 0;
+			killed++;
+		} else {
+			corner_unlink(s, c);
+			s->tv[c] = to;
+			corner_link(s, c, to);
+		}
+		c = nc;
+	}
+	s->removed[from] = 1;
+	s->parent[from] = to;
+	return killed;
+}
+
+static int mark_fixed(simp_t *s, const telemac_data_t *results) {
+/*!
+ * @brief Fix the nodes on the edge of the mesh, and those with a non-zero IPOBO
+ *
+ * A node is on the edge if any edge leading from it belongs to other than
+ * two triangles. Nodes not used by any triangle are also fixed.
+ * @returns 0 on success
+ */
+	uint32_t *count = s->mark[1];
+	for (uint32_t n = 0; n < s->npoin; n++) {
+		if (results->ipobo != NULL && results->ipobo[n] != 0) {
+			s->fixed[n] = 1;
+		}
+		if (s->head[n] == SIMPLIFY_NONE) {
+			s->fixed[n] = 1;
+			continue;
+		}
+		next_mark(s);
+		for (uint32_t c = s->head[n]; c != SIMPLIFY_NONE; c = s->next[c]) {
+			uint32_t t = c / 3;
+			for (int k = 1; k < 3; k++) {
+				uint32_t w = s->tv[3 * t + (c % 3 + k) % 3];
+				if (s->mark[0][w] != s->qid) {
+					s->mark[0][w] = s->qid;
+					count[w] = 0;
+				}
+				count[w]++;
+			}
+		}
+		for (uint32_t c = s->head[n]; c != SIMPLIFY_NONE && !s->fixed[n]; c = s->next[c]) {
+			uint32_t t = c / 3;
+			for (int k = 1; k < 3; k++) {
+				if (count[s->tv[3 * t + (c % 3 + k) % 3]] != 2) {
+					s->fixed[n] = 1;
+				}
+			}
+		}
+	}
+	memset(count, 0, sizeof(uint32_t) * s->npoin);
+	return 0;
+}
+
+static void add_quadrics(simp_t *s) {
+//! Add the area weighted plane quadric of each triangle to its nodes
+	for (uint32_t t = 0; t < s->ntri; t++) {
+		const uint32_t *v = &s->tv[3 * t];
+		double e1[3] = {s->x[v[1]] - s->x[v[0]], s->y[v[1]] - s->y[v[0]], s->z[v[1]] - s->z[v[0]]};
+		double e2[3] = {s->x[v[2]] - s->x[v[0]], s->y[v[2]] - s->y[v[0]], s->z[v[2]] - s->z[v[0]]};
+		double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+		double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (len == 0) {
+			continue;
+		}
+		double area = len / 2;
+		double p[4] = {n[0] / len, n[1] / len, n[2] / len, 0};
+		p[3] = -(p[0] * s->x[v[0]] + p[1] * s->y[v[0]] + p[2] * s->z[v[0]]);
+		double q[10] = {p[0] * p[0], p[0] * p[1], p[0] * p[2], p[0] * p[3], p[1] * p[1],
+			p[1] * p[2], p[1] * p[3], p[2] * p[2], p[2] * p[3], p[3] * p[3]};
+		for (int k = 0; k < 3; k++) {
+			for (int j = 0; j < 10; j++) {
+				s->q[10 * (size_t)v[k] + j] += area * q[j];
+			}
+		}
+	}
+}
+
+static void simp_free(simp_t *s) {
+//! Free the working state
+	free(s->x);
+	free(s->y);
+	free(s->z);
+	free(s->tv);
+	free(s->alive);
+	free(s->head);
+	free(s->next);
+	free(s->prev);
+	free(s->q);
+	free(s->fixed);
+	free(s->removed);
+	free(s->parent);
+	free(s->stamp);
+	free(s->mark[0]);
+	free(s->mark[1]);
+	free(s->ring);
+	free(s->cand);
+	free(s->heap);
+}
+
+int telemac_simplify(const telemac_data_t *results, const float *height, uint32_t target, telemac_simplified_t *out) {
+/*!
+ * @brief Simplify the triangles of the mesh to about @p target triangles
+ *
+ * Edges are collapsed in order of increasing error until the mesh has no
+ * more than @p target triangles, or no further collapse is allowed. The
+ * simplified nodes are numbered in the order of the original nodes.
+ *
+ * @param results	Results file header and mesh
+ * @param height	Height of each node of the bottom plane, or NULL for a flat mesh
+ * @param target	Number of triangles wanted
+ * @param out	Simplified mesh. Free with telemac_simplified_free().
+ * @retval 0	Success
+ * @retval -1	Unsupported mesh
+ * @retval -2	Memory could not be allocated
+ */
+	memset(out, 0, sizeof(*out));
+	telemac_layers_t layers;
+	if (telemac_get_layers(results, &layers) != 0) {
+		return -1;
+	}
+
+	TM_STATS_BEGIN(TM_PHASE_MESH);
+	simp_t s;
+	memset(&s, 0, sizeof(s));
+	s.npoin = layers.npoin2;
+	uint32_t maxtri = (results->ndp == 4 ? 2 : 1) * layers.nelem2;
+	uint32_t *tri[3] = {calloc(sizeof(uint32_t), maxtri), calloc(sizeof(uint32_t), maxtri), calloc(sizeof(uint32_t), maxtri)};
+	s.x = calloc(sizeof(double), s.npoin);
+	s.y = calloc(sizeof(double), s.npoin);
+	s.z = calloc(sizeof(double), s.npoin);
+	s.tv = calloc(sizeof(uint32_t), 3 * (size_t)maxtri);
+	s.alive = calloc(1, maxtri);
+	s.head = malloc(sizeof(uint32_t) * s.npoin);
+	s.next = calloc(sizeof(uint32_t), 3 * (size_t)maxtri);
+	s.prev = calloc(sizeof(uint32_t), 3 * (size_t)maxtri);
+	s.q = calloc(sizeof(double), 10 * (size_t)s.npoin);
+	s.fixed = calloc(1, s.npoin);
+	s.removed = calloc(1, s.npoin);
+	s.parent = calloc(sizeof(uint32_t), s.npoin);
+	s.stamp = calloc(sizeof(uint32_t), s.npoin);
+	s.mark[0] = calloc(sizeof(uint32_t), s.npoin);
+	s.mark[1] = calloc(sizeof(uint32_t), s.npoin);
+	TM_STATS_ALLOC(maxtri * (3 * sizeof(uint32_t) * 4 + 1) + s.npoin * (sizeof(double) * 13 + sizeof(uint32_t) * 5 + 2));
+	if (tri[0] == NULL || tri[1] == NULL || tri[2] == NULL || s.x == NULL || s.y == NULL || s.z == NULL
+			|| s.tv == NULL || s.alive == NULL || s.head == NULL || s.next == NULL || s.prev == NULL
+			|| s.q == NULL || s.fixed == NULL || s.removed == NULL || s.parent == NULL || s.stamp == NULL
+			|| s.mark[0] == NULL || s.mark[1] == NULL) {
+		perror("telemac_simplify");
+		for (int k = 0; k < 3; k++) {
+			free(tri[k]);
+		}
+		simp_free(&s);
+		TM_STATS_END(TM_PHASE_MESH);
+		return -2;
+	}
+
+	s.ntri = telemac_plane_triangles(results, &layers, tri);
+	for (uint32_t n = 0; n < s.npoin; n++) {
+		s.x[n] = (double)results->X[n] - results->X[0];
+		s.y[n] = (double)results->Y[n] - results->Y[0];
+		s.z[n] = (height != NULL ? height[n] : 0);
+		s.head[n] = SIMPLIFY_NONE;
+	}
+	for (uint32_t t = 0; t < s.ntri; t++) {
+		s.alive[t] = 1;
+		for (int k = 0; k < 3; k++) {
+			s.tv[3 * t + k] = tri[k][t];
+			corner_link(&s, 3 * t + k, tri[k][t]);
+		}
+	}
+	for (int k = 0; k < 3; k++) {
+		free(tri[k]);
+	}
+	mark_fixed(&s, results);
+	add_quadrics(&s);
+
+	// Collapse the cheapest edge until the target is reached. Collapses found
+	// invalid are recalculated when reached, and the heap is rebuilt if it
+	// runs out, in case earlier collapses have allowed others.
+	uint32_t nalive = s.ntri;
+	int rv = 0;
+	bool progress = true;
+	while (nalive > target && progress && rv == 0) {
+		progress = false;
+		s.nheap = 0;
+		for (uint32_t n = 0; n < s.npoin && rv == 0; n++) {
+			rv = update_node(&s, n);
+		}
+		while (nalive > target && s.nheap > 0 && rv == 0) {
+			collapse_t c = heap_pop(&s);
+			if (c.stamp != s.stamp[c.from] || s.removed[c.from]) {
+				continue;
+			}
+			if (!collapse_valid(&s, c.from, c.to)) {
+				rv = update_node(&s, c.from);
+				continue;
+			}
+			nalive -= collapse(&s, c.from, c.to);
+			progress = true;
+			rv = collect_ring(&s, c.to);
+			// update_node() reuses the ring, so take a copy
+			size_t nring = s.nring;
+			uint32_t *ring = (rv == 0 ? malloc(sizeof(uint32_t) * (nring + 1)) : NULL);
+			if (ring == NULL) {
+				rv = -1;
+				break;
+			}
+			memcpy(ring, s.ring, sizeof(uint32_t) * nring);
+			rv = update_node(&s, c.to);
+			for (size_t i = 0; i < nring && rv == 0; i++) {
+				rv = update_node(&s, ring[i]);
+			}
+			free(ring);
+		}
+	}
+	if (rv != 0) {
+		perror("telemac_simplify");
+		simp_free(&s);
+		TM_STATS_END(TM_PHASE_MESH);
+		return -2;
+	}
+
+	// Number the remaining nodes and triangles
+	uint32_t *index = s.stamp;
+	out->npoin = 0;
+	for (uint32_t n = 0; n < s.npoin; n++) {
+		index[n] = (s.removed[n] ? SIMPLIFY_NONE : out->npoin++);
+	}
+	out->ntri = nalive;
+	out->node = calloc(sizeof(uint32_t), out->npoin);
+	out->owner = calloc(sizeof(uint32_t), s.npoin);
+	for (int k = 0; k < 3; k++) {
+		out->tri[k] = calloc(sizeof(uint32_t), (nalive ? nalive : 1));
+	}
+	if (out->node == NULL || out->owner == NULL || out->tri[0] == NULL || out->tri[1] == NULL || out->tri[2] == NULL) {
+		perror("telemac_simplify");
+		telemac_simplified_free(out);
+		simp_free(&s);
+		TM_STATS_END(TM_PHASE_MESH);
+		return -2;
+	}
+	for (uint32_t n = 0; n < s.npoin; n++) {
+		uint32_t root = n;
+		while (s.removed[root]) {
+			root = s.parent[root];
+		}
+		// Shorten the chain for the nodes that follow it
+		for (uint32_t m = n; s.removed[m]; ) {
+			uint32_t p = s.parent[m];
+			s.parent[m] = root;
+			m = p;
+		}
+		out->owner[n] = index[root];
+		if (!s.removed[n]) {
+			out->node[index[n]] = n;
+		}
+	}
+	uint32_t j = 0;
+	for (uint32_t t = 0; t < s.ntri; t++) {
+		if (s.alive[t]) {
+			for (int k = 0; k < 3; k++) {
+				out->tri[k][j] = index[s.tv[3 * t + k]];
+			}
+			j++;
+		}
+	}
+	simp_free(&s);
+	TM_STATS_END(TM_PHASE_MESH);
+	return 0;
+}
+
+void telemac_simplified_free(telemac_simplified_t *simple) {
+/*!
+ * @brief Free a simplified mesh from telemac_simplify()
+ * @param simple	Simplified mesh to free
+ */
+	free(simple->node);
+	free(simple->owner);
+	for (int k = 0; k < 3; k++) {
+		free(simple->tri[k]);
+	}
+	memset(simple, 0, sizeof(*simple));
+}
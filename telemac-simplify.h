@@ -0,0 +1,67 @@
+/******************************************************************************
+telemac-simplify - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Simplification of the mesh for previews
+ */
+
+#ifndef TELEMAC_SIMPLIFY_H
+#define TELEMAC_SIMPLIFY_H
+
+#include <stdint.h>
+#include "telemac-loader.h"
+
+/*!
+ * @defgroup simplify Mesh simplification
+ * @brief Coarse versions of a 2D mesh, made by edge collapse
+ *
+ * The triangles of the mesh are simplified by repeatedly collapsing the
+ * edge whose removal changes the surface least, measured by the quadric
+ * error metric of Garland and Heckbert. The surface is formed from the node
+ * coordinates and an optional height (such as the bed level); without a
+ * height the mesh is flat and the shortest edges are collapsed first.
+ *
+ * Each collapse moves one node on to a neighbouring node, so the nodes of the
+ * simplified mesh are a subset of the original nodes and values are carried
+ * over by a gather through telemac_simplified_t::node. Nodes on the edge of
+ * the mesh, and any with a non-zero IPOBO, are never removed, so the
+ * boundaries are unchanged. Collapses that would fold a triangle over or
+ * leave a much thinner triangle are not made.
+ *
+ * Quadrilaterals are split into two triangles. For 3D meshes the triangles
+ * of the bottom plane are simplified, to be used with the values of a single
+ * plane (see telemac_read_plane()).
+ * @{
+ */
+
+//! Simplified mesh and its relation to the original
+typedef struct {
+	uint32_t npoin; //!< Number of nodes
+	uint32_t ntri; //!< Number of triangles
+	uint32_t *node; //!< Original node (from 0) for each node, used to gather values
+	uint32_t *owner; //!< Node (from 0) that each original node was merged into
+	uint32_t *tri[3]; //!< Nodes of each triangle (numbered from 0)
+} telemac_simplified_t;
+
+int telemac_simplify(const telemac_data_t *results, const float *height, uint32_t target, telemac_simplified_t *out);
+void telemac_simplified_free(telemac_simplified_t *simple);
+
+/*! @} */
+#endif // TELEMAC_SIMPLIFY_H
@@ -0,0 +1,310 @@
+/******************************************************************************
+telemac-slice - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "telemac-loader.h"
+#include "telemac-writer.h"
+#include "telemac-stats.h"
+#include "telemac-layers.h"
+
+/*!
+ * @file
+ * @brief Extract planes, vertical profiles and depth averages from 3D results
+ *
+ * Writes a single horizontal plane, or the depth average, of every variable
+ * in a TELEMAC-3D results file to a 2D SELAFIN file, or writes the vertical
+ * profile of every variable at one node as CSV. Only the planes (or values)
+ * needed are read from the results file.
+ *
+ * Returns zero on success and EXIT_FAILURE if an error occurs.
+ */
+
+//! Output modes
+typedef enum {
+	SLICE_NONE, //!< No mode selected
+	SLICE_PLANE, //!< Single plane
+	SLICE_AVERAGE, //!< Depth average
+	SLICE_PROFILE //!< Vertical profile at a node
+} slice_mode_t;
+
+static const char *trim_name(const char *name, char *buf, size_t len) {
+//! Copy the name part of a variable name (without units or trailing spaces)
+	snprintf(buf, len, "%.16s", name);
+	for (size_t i = strlen(buf); i > 0 && buf[i - 1] == ' '; i--) {
+		buf[i - 1] = '\0';
+	}
+	return buf;
+}
+
+int main(int argc, char **argv) {
+	slice_mode_t mode = SLICE_NONE;
+	int plane = 0;
+	int node = 0;
+	int zvar = -1;
+	int step = -1;
+	bool verbose = false;
+	char *outname = NULL;
+
+	const char *usage = "Usage: %s (-p plane | -a | -n node) [-z n] [-t step] [-o output] [-v] [--stats[=json]] <filename> [filename...]\n"
+		"\t-p\tWrite one horizontal plane to a 2D SELAFIN file (0 = bottom, -1 = surface)\n"
+		"\t-a\tWrite the depth average to a 2D SELAFIN file\n"
+		"\t-n\tWrite the vertical profile at a node of the 2D mesh as CSV\n"
+		"\t-z\tElevation variable (default: ELEVATION Z)\n"
+		"\t-t\tProcess a single timestep (default: all)\n"
+		"\t-o\tOutput file (default: based on input name, or standard output for profiles)\n"
+		"\t-v\tVerbose output\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "p:an:z:t:o:v")) != -1) {
+		switch (go) {
+			case 'p':
+				mode = SLICE_PLANE;
+				plane = atoi(optarg);
+				break;
+			case 'a':
+				mode = SLICE_AVERAGE;
+				break;
+			case 'n':
+				mode = SLICE_PROFILE;
+				node = atoi(optarg);
+				break;
+			case 'z':
+				zvar = atoi(optarg);
+				break;
+			case 't':
+				step = atoi(optarg);
+				break;
+			case 'o':
+				outname = optarg;
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (mode == SLICE_NONE || argc - optind < 1) {
+		fprintf(stderr, "Must choose a plane, depth average or profile, and provide a file (or restart chain of files)\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	resfile_t rfs = {NULL, 0, 0, 0};
+	int rval = open_telemac_chain(&rfs, &argv[optind], argc - optind, false);
+	if (rfs.file == NULL || rval < 0) {
+		fprintf(stderr, "Unable to open %s (%d)\n", argv[optind], rval);
+		return EXIT_FAILURE;
+	}
+	telemac_data_t *mesh = &rfs.tmdat;
+	int nvar = mesh->nbv_1 + mesh->nbv_2;
+
+	telemac_layers_t layers;
+	if (telemac_get_layers(mesh, &layers) != 0) {
+		return EXIT_FAILURE;
+	}
+	if (layers.nplan < 2) {
+		fprintf(stderr, "%s is not a 3D results file\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	if (plane < 0) {
+		plane += layers.nplan;
+	}
+	if (plane < 0 || plane >= (int)layers.nplan) {
+		fprintf(stderr, "Plane out of range (%u planes)\n", layers.nplan);
+		return EXIT_FAILURE;
+	}
+	if (node < 0 || node >= (int)layers.npoin2) {
+		fprintf(stderr, "Node %d out of range (%u nodes in each plane)\n", node, layers.npoin2);
+		return EXIT_FAILURE;
+	}
+	if (zvar < 0) {
+		zvar = telemac_find_elevation(mesh);
+	}
+	if (zvar >= nvar || step >= (int)mesh->nt) {
+		fprintf(stderr, "Elevation variable or timestep out of range\n");
+		return EXIT_FAILURE;
+	}
+	int first = (step < 0 ? 0 : step);
+	int last = (step < 0 ? (int)mesh->nt - 1 : step);
+	for (int t = first; t <= last; t++) {
+		if (get_telemac_timestamp(&rfs, t, &mesh->timestamp[t]) != 0) {
+			fprintf(stderr, "Unable to read time of timestep %d\n", t);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (verbose) {
+		fprintf(stdout, "%u planes of %u nodes and %u triangles\n", layers.nplan, layers.npoin2, layers.nelem2);
+	}
+
+	if (mode == SLICE_PROFILE) {
+		FILE *out = stdout;
+		if (outname != NULL) {
+			out = fopen(outname, "w");
+			if (out == NULL) {
+				perror("Unable to open output file");
+				return EXIT_FAILURE;
+			}
+		}
+		float *prof = calloc(sizeof(float), (size_t)layers.nplan * nvar);
+		if (prof == NULL) {
+			perror("Allocating profile");
+			return EXIT_FAILURE;
+		}
+		char name[17];
+		fprintf(out, "step,time,plane");
+		for (int j = 0; j < nvar; j++) {
+			fprintf(out, ",%s", (j < (int)mesh->nbv_1 ? trim_name(mesh->var_names[j], name, sizeof(name)) : "QUADRATIC"));
+		}
+		fprintf(out, "\n");
+		for (int t = first; t <= last; t++) {
+			for (int j = 0; j < nvar; j++) {
+				if (telemac_read_profile(&rfs, &layers, t, j, node, &prof[(size_t)j * layers.nplan]) != 0) {
+					fprintf(stderr, "Unable to read timestep %d\n", t);
+					return EXIT_FAILURE;
+				}
+			}
+			TM_STATS_BEGIN(TM_PHASE_FORMAT);
+			for (uint32_t k = 0; k < layers.nplan; k++) {
+				fprintf(out, "%d,%f,%u", t, mesh->timestamp[t], k);
+				for (int j = 0; j < nvar; j++) {
+					fprintf(out, ",%.8g", prof[(size_t)j * layers.nplan + k]);
+				}
+				fprintf(out, "\n");
+			}
+			TM_STATS_END(TM_PHASE_FORMAT);
+		}
+		free(prof);
+		if (out != stdout) {
+			fclose(out);
+			telemac_stats_add_file(outname);
+		}
+		close_telemac(&rfs);
+		return EXIT_SUCCESS;
+	}
+
+	// Plane or depth average: write a 2D results file
+	telemac_data_t mesh2d;
+	if (telemac_layers_mesh(mesh, &layers, &mesh2d) != 0) {
+		return EXIT_FAILURE;
+	}
+	char **names = calloc(sizeof(char *), nvar);
+	float **data = calloc(sizeof(float *), nvar);
+	float **avg = calloc(sizeof(float *), nvar);
+	int *vars = calloc(sizeof(int), nvar);
+	if (names == NULL || data == NULL || avg == NULL || vars == NULL) {
+		perror("Allocating output");
+		return EXIT_FAILURE;
+	}
+	int navg = 0;
+	for (int j = 0; j < nvar; j++) {
+		names[j] = (j < (int)mesh->nbv_1 ? mesh->var_names[j] : NULL);
+		data[j] = calloc(sizeof(float), layers.npoin2 + 1);
+		if (data[j] == NULL) {
+			perror("Allocating output");
+			return EXIT_FAILURE;
+		}
+		if (j != zvar) {
+			vars[navg] = j;
+			avg[navg++] = data[j];
+		}
+	}
+	if (mode == SLICE_AVERAGE) {
+		// The elevation is replaced by the thickness of each column
+		names[zvar] = "WATER DEPTH     M               ";
+		mesh2d.var_names = names;
+	}
+
+	if (outname == NULL) {
+		char *base = strdup(argv[optind]);
+		if (mode == SLICE_PLANE) {
+			asprintf(&outname, "%s.plane%d.slf", basename(base), plane);
+		} else {
+			asprintf(&outname, "%s.avg.slf", basename(base));
+		}
+		free(base);
+	}
+	FILE *outfile = fopen(outname, "wb");
+	if (outfile == NULL) {
+		perror("Unable to open output file");
+		return EXIT_FAILURE;
+	}
+	if (write_telemac_header(outfile, &mesh2d) != 0) {
+		perror("Writing output header");
+		return EXIT_FAILURE;
+	}
+
+	for (int t = first; t <= last; t++) {
+		if (verbose) {
+			fprintf(stdout, "Step %d (t = %+f)\n", t, mesh->timestamp[t]);
+		}
+		int rv = 0;
+		if (mode == SLICE_PLANE) {
+			for (int j = 0; rv == 0 && j < nvar; j++) {
+				rv = telemac_read_plane(&rfs, &layers, t, j, plane, data[j]);
+			}
+		} else {
+			TM_STATS_BEGIN(TM_PHASE_FORMAT);
+			rv = telemac_depth_average(&rfs, &layers, t, zvar, vars, navg, avg, data[zvar]);
+			TM_STATS_END(TM_PHASE_FORMAT);
+		}
+		if (rv != 0) {
+			fprintf(stderr, "Unable to read timestep %d\n", t);
+			return EXIT_FAILURE;
+		}
+		TM_STATS_BEGIN(TM_PHASE_WRITE);
+		rv = write_telemac_timestep(outfile, &mesh2d, mesh->timestamp[t], data);
+		TM_STATS_END(TM_PHASE_WRITE);
+		if (rv != 0) {
+			perror("Writing output");
+			return EXIT_FAILURE;
+		}
+	}
+	if (fclose(outfile) != 0) {
+		perror("Closing output");
+		return EXIT_FAILURE;
+	}
+	telemac_stats_add_file(outname);
+	fprintf(stdout, "Wrote %d timesteps to %s\n", last - first + 1, outname);
+
+	for (int j = 0; j < nvar; j++) {
+		free(data[j]);
+	}
+	free(data);
+	free(avg);
+	free(vars);
+	free(names);
+	telemac_layers_free_mesh(&mesh2d);
+	close_telemac(&rfs);
+	return EXIT_SUCCESS;
+}
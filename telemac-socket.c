@@ -0,0 +1,65 @@
+/******************************************************************************
+telemac-socket - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "telemac-socket.h"
+
+int telemac_socket_path(char *path, size_t len, bool create) {
+/*!
+ * @brief Find the default socket path
+ *
+ * Without $XDG_RUNTIME_DIR, the per-user directory is checked before use:
+ * it must be a directory (not a link), owned by the user, with no access
+ * for group or others.
+ *
+ * @param path	Set to the socket path
+ * @param len	Size of path
+ * @param create	Create the per-user directory if it does not exist (server)
+ * @retval 0	Success
+ * @retval -1	Path too long
+ * @retval -2	The per-user directory is missing or not safe to use
+ */
+	const char *runtime = getenv("XDG_RUNTIME_DIR");
+	if (runtime != NULL && runtime[0] != '\0') {
+		return (snprintf(path, len, "%s/%s", runtime, TELEMAC_SOCKET_NAME) < (int)len ? 0 : -1);
+	}
+
+	uid_t uid = getuid();
+	char dir[64];
+	snprintf(dir, sizeof(dir), TELEMAC_SOCKET_DIR_FORMAT, (unsigned)uid);
+	if (create && mkdir(dir, 0700) != 0 && errno != EEXIST) {
+		perror(dir);
+		return -2;
+	}
+	struct stat st;
+	if (lstat(dir, &st) != 0) {
+		perror(dir);
+		return -2;
+	}
+	if (!S_ISDIR(st.st_mode) || st.st_uid != uid || (st.st_mode & 077) != 0) {
+		fprintf(stderr, "%s: not a private directory owned by this user\n", dir);
+		return -2;
+	}
+	return (snprintf(path, len, "%s/socket", dir) < (int)len ? 0 : -1);
+}
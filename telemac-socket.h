@@ -0,0 +1,47 @@
+/******************************************************************************
+telemac-socket - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Default socket path for telemac-served and telemac-query
+ *
+ * The socket is placed in $XDG_RUNTIME_DIR when it is set. Otherwise it is
+ * placed in a directory under /tmp named after the user ID, which must be
+ * owned by the user and closed to everyone else, so that another user can
+ * neither take the name first nor stand in for the server.
+ */
+
+#ifndef TELEMAC_SOCKET_H
+#define TELEMAC_SOCKET_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+//! Name of the socket within $XDG_RUNTIME_DIR
+#define TELEMAC_SOCKET_NAME "telemac-served"
+
+//! Per-user directory holding the socket when $XDG_RUNTIME_DIR is not set, formatted with the user ID
+#define TELEMAC_SOCKET_DIR_FORMAT "/tmp/telemac-served.%u"
+
+//! Default socket path, as described in usage messages
+#define TELEMAC_SOCKET_DEFAULT "$XDG_RUNTIME_DIR/" TELEMAC_SOCKET_NAME ", or /tmp/telemac-served.UID/socket"
+
+int telemac_socket_path(char *path, size_t len, bool create);
+
+#endif // TELEMAC_SOCKET_H
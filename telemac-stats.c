@@ -0,0 +1,312 @@
+/******************************************************************************
+telemac-stats - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "telemac-stats.h"
+#include "telemac-format.h"
+
+/*!
+ * @file
+ * @brief Phase timing and I/O accounting for the loader and tools
+ */
+
+//! Non-zero when instrumentation is enabled. Tested by the TM_STATS_* macros.
+int telemac_stats_enabled = 0;
+
+static int stats_json = 0; //!< Non-zero to report in JSON rather than as a table
+static const char *stats_prog = NULL; //!< Program name used in the report
+
+static uint64_t phase_calls[TM_PHASE_COUNT]; //!< Number of completed timings per phase
+static uint64_t phase_wall[TM_PHASE_COUNT]; //!< Accumulated wall time per phase (ns)
+static uint64_t phase_cpu[TM_PHASE_COUNT]; //!< Accumulated thread CPU time per phase (ns)
+static uint64_t counters[TM_COUNT_COUNT]; //!< Accumulated counter values
+
+//! Deepest nesting of phases timed on one thread
+#define STATS_MAX_DEPTH 16
+
+//! A phase in progress on one thread
+typedef struct {
+	telemac_phase_t phase; //!< Phase being timed
+	uint64_t wall_start; //!< Wall clock when the phase was started or resumed
+	uint64_t cpu_start; //!< Thread CPU clock when the phase was started or resumed
+	uint64_t wall; //!< Wall time accumulated before the phase was last paused
+	uint64_t cpu; //!< CPU time accumulated before the phase was last paused
+} phase_frame_t;
+
+static __thread phase_frame_t phase_stack[STATS_MAX_DEPTH]; //!< Phases in progress on this thread, innermost last
+static __thread int phase_depth; //!< Number of phases in progress on this thread
+
+static uint64_t run_start = 0; //!< Wall clock at telemac_stats_init()
+
+//! Kernel I/O accounting read from /proc/self/io
+typedef struct {
+	uint64_t rchar; //!< Bytes passed to read-like calls
+	uint64_t wchar; //!< Bytes passed to write-like calls
+	uint64_t syscr; //!< Number of read-like system calls
+	uint64_t syscw; //!< Number of write-like system calls
+} proc_io_t;
+
+static proc_io_t io_start; //!< /proc/self/io at telemac_stats_init()
+
+static const char *phase_names[TM_PHASE_COUNT] = {
+	"header", "mesh", "read", "swap", "format", "write"
+};
+
+static const char *counter_names[TM_COUNT_COUNT] = {
+	"bytes_read", "bytes_written", "read_calls", "seek_calls", "write_calls", "allocs", "alloc_bytes"
+};
+
+static uint64_t clock_ns(clockid_t clk) {
+//! Read the given clock in nanoseconds
+	struct timespec ts;
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int read_proc_io(proc_io_t *io) {
+/*!
+ * @brief Read system call accounting for this process
+ *
+ * @param io	Structure to populate
+ * @returns	0 on success, -1 if /proc/self/io is unavailable
+ */
+	memset(io, 0, sizeof(proc_io_t));
+	FILE *pf = fopen("/proc/self/io", "r");
+	if (pf == NULL) {
+		return -1;
+	}
+	char key[32];
+	unsigned long long val = 0;
+	while (fscanf(pf, "%31[^:]: %llu\n", key, &val) == 2) {
+		if (strcmp(key, "rchar") == 0) {
+			io->rchar = val;
+		} else if (strcmp(key, "wchar") == 0) {
+			io->wchar = val;
+		} else if (strcmp(key, "syscr") == 0) {
+			io->syscr = val;
+		} else if (strcmp(key, "syscw") == 0) {
+			io->syscw = val;
+		}
+	}
+	fclose(pf);
+	return 0;
+}
+
+void telemac_stats_init(int *argc, char **argv) {
+/*!
+ * @brief Enable instrumentation if requested and register the exit report
+ *
+ * Removes any `--stats` or `--stats=json` arguments from argv so that
+ * the remaining options can be processed by getopt() as usual, then checks
+ * the `TELEMAC_STATS` environment variable.
+ *
+ * @param argc	Pointer to argument count, updated if arguments are removed
+ * @param argv	Argument vector
+ */
+	int enable = 0;
+	int n = 1;
+	for (int i = 1; i < *argc; i++) {
+		if (strcmp(argv[i], "--stats") == 0) {
+			enable = 1;
+		} else if (strcmp(argv[i], "--stats=json") == 0) {
+			enable = 1;
+			stats_json = 1;
+		} else if (strcmp(argv[i], "--stats=table") == 0) {
+			enable = 1;
+		} else {
+			argv[n++] = argv[i];
+		}
+	}
+	argv[n] = NULL;
+	*argc = n;
+
+	const char *env = getenv("TELEMAC_STATS");
+	if (env != NULL && env[0] != '\0' && strcmp(env, "0") != 0) {
+		enable = 1;
+		if (strcmp(env, "json") == 0) {
+			stats_json = 1;
+		}
+	}
+
+	if (!enable) {
+		return;
+	}
+
+	stats_prog = basename(argv[0]);
+	run_start = clock_ns(CLOCK_MONOTONIC);
+	read_proc_io(&io_start);
+	telemac_stats_enabled = 1;
+	atexit(telemac_stats_report);
+}
+
+void telemac_stats_begin(telemac_phase_t phase) {
+/*!
+ * @brief Mark the start of a phase on the calling thread
+ *
+ * Phases may be nested (e.g. reading within a formatting loop). The enclosing
+ * phase is paused until the nested phase ends, so each interval of time is
+ * counted in one phase only.
+ *
+ * @param phase	Phase being started
+ */
+	uint64_t wall = clock_ns(CLOCK_MONOTONIC);
+	uint64_t cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	if (phase_depth > 0 && phase_depth <= STATS_MAX_DEPTH) {
+		phase_frame_t *outer = &phase_stack[phase_depth - 1];
+		outer->wall += wall - outer->wall_start;
+		outer->cpu += cpu - outer->cpu_start;
+	}
+	if (phase_depth < STATS_MAX_DEPTH) {
+		phase_stack[phase_depth] = (phase_frame_t){phase, wall, cpu, 0, 0};
+	}
+	phase_depth++;
+}
+
+void telemac_stats_end(telemac_phase_t phase) {
+/*!
+ * @brief Mark the end of a phase on the calling thread and accumulate its time
+ *
+ * The time excludes any nested phases. The enclosing phase, if any, resumes.
+ *
+ * @param phase	Phase being ended. Must be the innermost phase started with telemac_stats_begin().
+ */
+	uint64_t wall = clock_ns(CLOCK_MONOTONIC);
+	uint64_t cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	if (phase_depth == 0) {
+		return;
+	}
+	phase_depth--;
+	if (phase_depth < STATS_MAX_DEPTH) {
+		phase_frame_t *f = &phase_stack[phase_depth];
+		__atomic_fetch_add(&phase_wall[f->phase], f->wall + (wall - f->wall_start), __ATOMIC_RELAXED);
+		__atomic_fetch_add(&phase_cpu[f->phase], f->cpu + (cpu - f->cpu_start), __ATOMIC_RELAXED);
+		__atomic_fetch_add(&phase_calls[f->phase], 1, __ATOMIC_RELAXED);
+	}
+	if (phase_depth > 0 && phase_depth <= STATS_MAX_DEPTH) {
+		phase_stack[phase_depth - 1].wall_start = wall;
+		phase_stack[phase_depth - 1].cpu_start = cpu;
+	}
+}
+
+void telemac_stats_add(telemac_counter_t counter, uint64_t n) {
+/*!
+ * @brief Add to one of the instrumentation counters
+ * @param counter	Counter to update
+ * @param n		Amount to add
+ */
+	__atomic_fetch_add(&counters[counter], n, __ATOMIC_RELAXED);
+}
+
+void telemac_stats_add_file(const char *filename) {
+/*!
+ * @brief Count the size of a completed output file as bytes written
+ *
+ * Used where output is produced by a library (e.g. libxml2) that does not
+ * report the number of bytes it writes.
+ * @param filename	Path to a closed output file
+ */
+	if (!telemac_stats_enabled) {
+		return;
+	}
+	struct stat buf;
+	if (stat(filename, &buf) == 0) {
+		telemac_stats_add(TM_COUNT_BYTES_WRITTEN, buf.st_size);
+	}
+}
+
+static double mb_per_s(uint64_t bytes, uint64_t ns) {
+//! Throughput in MiB/s, or zero if no time was recorded
+	if (ns == 0) {
+		return 0;
+	}
+	return ((double)bytes / 1048576.0) / ((double)ns / 1e9);
+}
+
+void telemac_stats_report(void) {
+/*!
+ * @brief Write the instrumentation summary to stderr
+ *
+ * Registered with atexit() by telemac_stats_init(), but may also be called
+ * directly.
+ */
+	if (!telemac_stats_enabled) {
+		return;
+	}
+	telemac_stats_enabled = 0; // Report once only
+
+	uint64_t wall = clock_ns(CLOCK_MONOTONIC) - run_start;
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	double utime = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+	double stime = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+	proc_io_t io_end;
+	int have_io = (read_proc_io(&io_end) == 0);
+	uint64_t syscr = have_io ? io_end.syscr - io_start.syscr : 0;
+	uint64_t syscw = have_io ? io_end.syscw - io_start.syscw : 0;
+	uint64_t rchar = have_io ? io_end.rchar - io_start.rchar : 0;
+	uint64_t wchar = have_io ? io_end.wchar - io_start.wchar : 0;
+
+	if (stats_json) {
+		fputs("{\"program\": ", stderr);
+		telemac_format_json_string(stderr, stats_prog);
+		fprintf(stderr, ", \"wall_s\": %.6f, \"user_s\": %.6f, \"sys_s\": %.6f, \"max_rss_kb\": %ld,\n",
+				wall / 1e9, utime, stime, ru.ru_maxrss);
+		fprintf(stderr, " \"phases\": {");
+		for (int p = 0; p < TM_PHASE_COUNT; p++) {
+			fprintf(stderr, "%s\n  \"%s\": {\"calls\": %llu, \"wall_s\": %.6f, \"cpu_s\": %.6f}", (p ? "," : ""), phase_names[p],
+					(unsigned long long)phase_calls[p], phase_wall[p] / 1e9, phase_cpu[p] / 1e9);
+		}
+		fprintf(stderr, "},\n \"counters\": {");
+		for (int c = 0; c < TM_COUNT_COUNT; c++) {
+			fprintf(stderr, "%s\"%s\": %llu", (c ? ", " : ""), counter_names[c], (unsigned long long)counters[c]);
+		}
+		fprintf(stderr, "},\n \"syscalls\": {\"read\": %llu, \"write\": %llu, \"rchar\": %llu, \"wchar\": %llu}}\n",
+				(unsigned long long)syscr, (unsigned long long)syscw, (unsigned long long)rchar, (unsigned long long)wchar);
+		return;
+	}
+
+	fprintf(stderr, "\n%s statistics:\n", stats_prog);
+	fprintf(stderr, "\tWall time: %.3fs\tUser: %.3fs\tSystem: %.3fs\tMax RSS: %ld kB\n\n", wall / 1e9, utime, stime, ru.ru_maxrss);
+	fprintf(stderr, "\t%-8s %12s %12s %12s %7s\n", "Phase", "Calls", "Wall (s)", "CPU (s)", "Wall %");
+	for (int p = 0; p < TM_PHASE_COUNT; p++) {
+		fprintf(stderr, "\t%-8s %12llu %12.6f %12.6f %6.1f%%\n", phase_names[p], (unsigned long long)phase_calls[p],
+				phase_wall[p] / 1e9, phase_cpu[p] / 1e9, (wall ? 100.0 * phase_wall[p] / wall : 0));
+	}
+	fprintf(stderr, "\n\tBytes read:    %14llu (%.1f MiB/s during read)\n", (unsigned long long)counters[TM_COUNT_BYTES_READ],
+			mb_per_s(counters[TM_COUNT_BYTES_READ], phase_wall[TM_PHASE_READ] + phase_wall[TM_PHASE_HEADER] + phase_wall[TM_PHASE_MESH]));
+	fprintf(stderr, "\tBytes written: %14llu (%.1f MiB/s overall)\n", (unsigned long long)counters[TM_COUNT_BYTES_WRITTEN],
+			mb_per_s(counters[TM_COUNT_BYTES_WRITTEN], wall));
+	fprintf(stderr, "\tLoader calls:  %14llu reads, %llu seeks, %llu writes\n", (unsigned long long)counters[TM_COUNT_READ_CALLS],
+			(unsigned long long)counters[TM_COUNT_SEEK_CALLS], (unsigned long long)counters[TM_COUNT_WRITE_CALLS]);
+	if (have_io) {
+		fprintf(stderr, "\tSystem calls:  %14llu reads (%llu bytes), %llu writes (%llu bytes)\n", (unsigned long long)syscr,
+				(unsigned long long)rchar, (unsigned long long)syscw, (unsigned long long)wchar);
+	}
+	fprintf(stderr, "\tAllocations:   %14llu (%llu bytes)\n", (unsigned long long)counters[TM_COUNT_ALLOCS],
+			(unsigned long long)counters[TM_COUNT_ALLOC_BYTES]);
+}
@@ -0,0 +1,88 @@
+/******************************************************************************
+telemac-stats - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Phase timing and I/O accounting for the loader and tools
+ */
+
+#ifndef TELEMAC_STATS_H
+#define TELEMAC_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*!
+ * @defgroup stats Run-time instrumentation
+ * @brief Optional per-phase timing, byte and call counters
+ *
+ * Instrumentation is switched on by passing `--stats` (or `--stats=json`) to
+ * any of the tools, or by setting the `TELEMAC_STATS` environment variable to
+ * `1`, `table` or `json`. A summary is written to stderr when the program exits.
+ *
+ * Phases may be nested on a thread. Time spent in a nested phase is counted
+ * only in that phase, not in the enclosing one.
+ *
+ * When disabled, each hook reduces to a test of telemac_stats_enabled.
+ * @{
+ */
+
+//! Phases timed by the instrumentation layer
+typedef enum {
+	TM_PHASE_HEADER = 0, //!< Header parsing in get_telemac_header()
+	TM_PHASE_MESH, //!< Mesh parsing in get_telemac_mesh()
+	TM_PHASE_READ, //!< Seeking and reading timestep records
+	TM_PHASE_SWAP, //!< Byte swapping of timestep data
+	TM_PHASE_FORMAT, //!< Converting or formatting values for output
+	TM_PHASE_WRITE, //!< Writing and flushing output files
+	TM_PHASE_COUNT //!< Number of phases (not a phase)
+} telemac_phase_t;
+
+//! Counters accumulated alongside the phase timings
+typedef enum {
+	TM_COUNT_BYTES_READ = 0, //!< Bytes read from results files
+	TM_COUNT_BYTES_WRITTEN, //!< Bytes written to output files
+	TM_COUNT_READ_CALLS, //!< Read calls issued by the loader
+	TM_COUNT_SEEK_CALLS, //!< Seek calls issued by the loader
+	TM_COUNT_WRITE_CALLS, //!< Write calls issued by the tools
+	TM_COUNT_ALLOCS, //!< Memory allocations made by the loader and tools
+	TM_COUNT_ALLOC_BYTES, //!< Bytes requested by those allocations
+	TM_COUNT_COUNT //!< Number of counters (not a counter)
+} telemac_counter_t;
+
+extern int telemac_stats_enabled;
+
+//! Start timing a phase, if instrumentation is enabled
+#define TM_STATS_BEGIN(p) do { if (telemac_stats_enabled) { telemac_stats_begin(p); } } while (0)
+//! Stop timing a phase, if instrumentation is enabled
+#define TM_STATS_END(p) do { if (telemac_stats_enabled) { telemac_stats_end(p); } } while (0)
+//! Add @p n to counter @p c, if instrumentation is enabled
+#define TM_STATS_ADD(c, n) do { if (telemac_stats_enabled) { telemac_stats_add((c), (uint64_t)(n)); } } while (0)
+//! Record an allocation of @p n bytes, if instrumentation is enabled
+#define TM_STATS_ALLOC(n) do { if (telemac_stats_enabled) { telemac_stats_add(TM_COUNT_ALLOCS, 1); telemac_stats_add(TM_COUNT_ALLOC_BYTES, (uint64_t)(n)); } } while (0)
+
+void telemac_stats_init(int *argc, char **argv);
+void telemac_stats_begin(telemac_phase_t phase);
+void telemac_stats_end(telemac_phase_t phase);
+void telemac_stats_add(telemac_counter_t counter, uint64_t n);
+void telemac_stats_add_file(const char *filename);
+void telemac_stats_report(void);
+
+/*! @} */
+#endif // TELEMAC_STATS_H
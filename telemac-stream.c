@@ -0,0 +1,592 @@
+/******************************************************************************
+telemac-stream - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "telemac-stream.h"
+#include "telemac-stats.h"
+
+/*!
+ * @file
+ * @brief Background reading of timesteps with double buffering
+ *
+ * Used by tools that make a single pass over the timesteps of one or more
+ * files, so that reading the next timestep overlaps with processing the
+ * current one. Reading two files through separate streams also reads the
+ * files concurrently.
+ *
+ * Setting the `TELEMAC_IO` environment variable to `uring` or `direct`
+ * reads streams with io_uring instead, keeping many record reads in flight
+ * so that fast devices are not limited to one request at a time. `direct`
+ * also opens the files with O_DIRECT, so that large scans do not fill the
+ * page cache, and reads whole aligned timesteps. Where io_uring or O_DIRECT
+ * is unavailable, streams fall back to the background thread or to the page
+ * cache with a warning.
+ */
+
+//! Largest single read queued with io_uring (a multiple of STREAM_ALIGN)
+#define STREAM_CHUNK (1 << 20)
+
+//! Alignment of offsets, lengths and buffers for O_DIRECT reads
+#define STREAM_ALIGN 4096
+
+//! Number of reads in flight at once with io_uring
+#define STREAM_URING_ENTRIES 64
+
+//! Memory used for io_uring record buffers, which sets the number of frames in flight
+#define STREAM_URING_MEMORY ((size_t)256 << 20)
+
+static void *stream_reader(void *arg) {
+//! Reader thread: fill frames in order, waiting while all buffers are in use
+	telemac_stream_t *s = (telemac_stream_t *)arg;
+	for (int i = 0; i < s->nsteps; i++) {
+		pthread_mutex_lock(&s->lock);
+		while (!s->stop && i - s->consumed >= s->depth) {
+			pthread_cond_wait(&s->cond, &s->lock);
+		}
+		bool stop = s->stop;
+		pthread_mutex_unlock(&s->lock);
+		if (stop) {
+			break;
+		}
+
+		int slot = i % s->depth;
+		s->status[slot] = read_telemac_data(s->rfile, s->steps[i], s->frames[slot], &s->times[slot]);
+
+		pthread_mutex_lock(&s->lock);
+		s->filled = i + 1;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+	}
+	return NULL;
+}
+
+telemac_io_t telemac_io_mode(void) {
+/*!
+ * @brief Read method requested by the `TELEMAC_IO` environment variable
+ * @retval TELEMAC_IO_URING	`uring`
+ * @retval TELEMAC_IO_DIRECT	`direct`
+ * @retval TELEMAC_IO_PREAD	Anything else, or not set
+ */
+	const char *env = getenv(TELEMAC_IO_ENV);
+	if (env != NULL && strcmp(env, "uring") == 0) {
+		return TELEMAC_IO_URING;
+	}
+	if (env != NULL && strcmp(env, "direct") == 0) {
+		return TELEMAC_IO_DIRECT;
+	}
+	return TELEMAC_IO_PREAD;
+}
+
+static int stream_fd(telemac_stream_t *s, FILE *file) {
+/*!
+ * @brief File descriptor to read a loader file handle with
+ *
+ * For TELEMAC_IO_DIRECT, the file is reopened with O_DIRECT the first time
+ * it is seen. If that fails, the loader's descriptor is used.
+ * @returns File descriptor
+ */
+	int fd = fileno(file);
+	if (s->io != TELEMAC_IO_DIRECT) {
+		return fd;
+	}
+	for (int i = 0; i < s->nfdmap; i++) {
+		if (s->fdmap[2 * i] == fd) {
+			return s->fdmap[2 * i + 1];
+		}
+	}
+	int *fdmap = realloc(s->fdmap, sizeof(int) * 2 * (s->nfdmap + 1));
+	if (fdmap == NULL) {
+		return fd;
+	}
+	s->fdmap = fdmap;
+	char path[32];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	int dfd = open(path, O_RDONLY | O_DIRECT);
+	s->fdmap[2 * s->nfdmap] = fd;
+	s->fdmap[2 * s->nfdmap + 1] = (dfd >= 0 ? dfd : fd);
+	s->nfdmap++;
+	return s->fdmap[2 * s->nfdmap - 1];
+}
+
+static size_t stream_bufpos(const telemac_stream_t *s, off_t rel) {
+//! Position in the record buffer of byte rel of a timestep
+	for (int e = 0; e < s->nextent; e++) {
+		if (rel >= s->extent[2 * e] && rel < s->extent[2 * e] + s->extent[2 * e + 1]) {
+			return s->bufpos[e] + (rel - s->extent[2 * e]);
+		}
+	}
+	return 0;
+}
+
+static int stream_collect(telemac_stream_t *s) {
+/*!
+ * @brief Collect one completed read, waiting if necessary
+ *
+ * The tag of each read is its index in s->reads. A read that returns fewer
+ * bytes than its frame needs is queued again for the rest (from the last
+ * aligned offset with O_DIRECT), and only fails if no progress was made.
+ * @returns 0 on success, -1 if waiting failed
+ */
+	uint64_t tag = 0;
+	int res = 0;
+	if (telemac_uring_wait(&s->ring, &tag, &res) != 0) {
+		return -1;
+	}
+	telemac_stream_read_t *r = &s->reads[tag];
+	int slot = r->slot;
+	if (res > 0) {
+		TM_STATS_ADD(TM_COUNT_BYTES_READ, res);
+	}
+	const char *err = NULL;
+	if (res < 0) {
+		err = strerror(-res);
+	} else if ((size_t)res < r->need) {
+		size_t done = res;
+		if (s->io == TELEMAC_IO_DIRECT) {
+			done &= ~(size_t)(STREAM_ALIGN - 1);
+		}
+		int rv = -1;
+		if (done > 0) {
+			r->dest += done;
+			r->len -= done;
+			r->offset += done;
+			r->need -= done;
+			rv = telemac_uring_read(&s->ring, r->fd, r->dest, r->len, r->offset, slot, tag);
+		}
+		if (rv == 0) {
+			TM_STATS_ADD(TM_COUNT_READ_CALLS, 1);
+			return 0;
+		}
+		err = (rv < -1 ? strerror(-rv) : "short read");
+	}
+	s->pending[slot]--;
+	s->idle[s->nidle++] = tag;
+	if (err != NULL && s->status[slot] == 0) {
+		fprintf(stderr, "telemac_stream: %s\n", err);
+		s->status[slot] = -2;
+	}
+	return 0;
+}
+
+static void stream_queue(telemac_stream_t *s, int i) {
+//! Queue the reads for frame i of a stream read with io_uring
+	int slot = i % s->depth;
+	s->status[slot] = 0;
+	s->pending[slot] = 0;
+	FILE *file = NULL;
+	off_t offset = 0;
+	if (telemac_locate(s->rfile, s->steps[i], &file, &offset) != 0) {
+		s->status[slot] = -1;
+		return;
+	}
+	int fd = stream_fd(s, file);
+
+	s->shift[slot] = 0;
+	for (int e = 0; e < s->nextent; e++) {
+		off_t start = offset + s->extent[2 * e];
+		size_t len = s->extent[2 * e + 1];
+		size_t need = len;
+		char *dest = s->buf[slot] + s->bufpos[e];
+		if (s->io == TELEMAC_IO_DIRECT) {
+			// One span, widened to aligned offsets
+			off_t base = start & ~(off_t)(STREAM_ALIGN - 1);
+			s->shift[slot] = start - base;
+			need = s->shift[slot] + len;
+			len = (need + STREAM_ALIGN - 1) & ~(size_t)(STREAM_ALIGN - 1);
+			start = base;
+			dest = s->buf[slot];
+		}
+		for (size_t c = 0; c < len; c += STREAM_CHUNK) {
+			size_t clen = (len - c > STREAM_CHUNK ? STREAM_CHUNK : len - c);
+			size_t cneed = (need > c ? need - c : 0);
+			int rv = 0;
+			while (s->nidle == 0 && rv == 0) {
+				rv = (stream_collect(s) != 0 ? -EIO : 0);
+			}
+			if (rv == 0) {
+				int tag = s->idle[--s->nidle];
+				s->reads[tag] = (telemac_stream_read_t){fd, slot, dest + c, clen, start + c, (cneed > clen ? clen : cneed)};
+				while ((rv = telemac_uring_read(&s->ring, fd, dest + c, clen, start + c, slot, tag)) == -EAGAIN) {
+					if (stream_collect(s) != 0) {
+						rv = -EIO;
+						break;
+					}
+				}
+				if (rv != 0) {
+					s->idle[s->nidle++] = tag;
+				}
+			}
+			if (rv != 0) {
+				fprintf(stderr, "telemac_stream: unable to queue read (%s)\n", strerror(-rv));
+				s->status[slot] = -2;
+				return;
+			}
+			s->pending[slot]++;
+			TM_STATS_ADD(TM_COUNT_READ_CALLS, 1);
+		}
+	}
+}
+
+static char *stream_record(char *rec, uint32_t len) {
+//! Check the markers around a record of len bytes, returning its contents or NULL
+	uint32_t start = 0;
+	uint32_t end = 0;
+	memcpy(&start, rec, 4);
+	memcpy(&end, rec + 4 + len, 4);
+	start = int_swap(start);
+	end = int_swap(end);
+	if (start != end || start != len) {
+		fprintf(stderr, "Error: record markers do not match expected length (start: %u, end: %u, expected: %u)\n",
+				start, end, len);
+		return NULL;
+	}
+	return rec + 4;
+}
+
+static void stream_finish(telemac_stream_t *s, int slot) {
+//! Check markers and swap the byte order of a completed frame, pointing the frame at its values
+	const telemac_data_t *results = &s->rfile->tmdat;
+	int nvar = results->nbv_1 + results->nbv_2;
+	size_t reclen = sizeof(float) * results->npoin;
+	char *buf = s->buf[slot] + s->shift[slot];
+	const char *ts = stream_record(buf + stream_bufpos(s, 0), sizeof(float));
+	if (ts == NULL) {
+		s->status[slot] = -3;
+		return;
+	}
+	float t = 0;
+	memcpy(&t, ts, sizeof(float));
+	s->times[slot] = float_swap(t);
+
+	TM_STATS_BEGIN(TM_PHASE_SWAP);
+	for (int j = 0; j < nvar; j++) {
+		if (!s->want[j]) {
+			continue;
+		}
+		char *rec = stream_record(buf + stream_bufpos(s, 12 + (off_t)j * (reclen + 8)), reclen);
+		if (rec == NULL) {
+			s->status[slot] = -3;
+			break;
+		}
+		s->frames[slot][j] = (float *)rec;
+		float_swap_array(s->frames[slot][j], results->npoin);
+	}
+	TM_STATS_END(TM_PHASE_SWAP);
+}
+
+static int stream_uring_open(telemac_stream_t *s, const bool *vars) {
+/*!
+ * @brief Set up a stream to be read with io_uring and queue its first frames
+ *
+ * For TELEMAC_IO_URING, each selected variable record (and the timestamp
+ * record) is read, with adjacent records merged into one span. For
+ * TELEMAC_IO_DIRECT, the span from the start of the timestep to the end of
+ * the last selected record is read, widened to aligned offsets.
+ *
+ * @retval 0	Success
+ * @retval -1	io_uring is not available, and the stream should use a thread
+ * @retval -2	Memory could not be allocated
+ */
+	const telemac_data_t *results = &s->rfile->tmdat;
+	int nvar = results->nbv_1 + results->nbv_2;
+	off_t reclen = sizeof(float) * (off_t)results->npoin + 8;
+
+	if (telemac_uring_init(&s->ring, STREAM_URING_ENTRIES) != 0) {
+		fprintf(stderr, "io_uring unavailable (%s), reading with pread\n", strerror(errno));
+		return -1;
+	}
+	if (s->io == TELEMAC_IO_DIRECT && stream_fd(s, s->rfile->file) == fileno(s->rfile->file)) {
+		fprintf(stderr, "O_DIRECT unavailable, reading through the page cache\n");
+		s->io = TELEMAC_IO_URING;
+	}
+
+	s->want = calloc(sizeof(bool), nvar + 1);
+	s->extent = calloc(sizeof(off_t), 2 * (nvar + 1));
+	s->bufpos = calloc(sizeof(size_t), nvar + 1);
+	s->reads = calloc(sizeof(telemac_stream_read_t), STREAM_URING_ENTRIES);
+	s->idle = calloc(sizeof(int), STREAM_URING_ENTRIES);
+	if (s->want == NULL || s->extent == NULL || s->bufpos == NULL || s->reads == NULL || s->idle == NULL) {
+		perror("telemac_stream_open");
+		return -2;
+	}
+	for (s->nidle = 0; s->nidle < STREAM_URING_ENTRIES; s->nidle++) {
+		s->idle[s->nidle] = STREAM_URING_ENTRIES - 1 - s->nidle;
+	}
+	s->extent[0] = 0;
+	s->extent[1] = 12;
+	s->nextent = 1;
+	for (int j = 0; j < nvar; j++) {
+		s->want[j] = (vars == NULL || vars[j]);
+		if (!s->want[j]) {
+			continue;
+		}
+		off_t start = 12 + j * reclen;
+		off_t *last = &s->extent[2 * (s->nextent - 1)];
+		if (s->io == TELEMAC_IO_DIRECT || last[0] + last[1] == start) {
+			last[1] = start + reclen - last[0];
+		} else {
+			s->extent[2 * s->nextent] = start;
+			s->extent[2 * s->nextent + 1] = reclen;
+			s->nextent++;
+		}
+	}
+	s->bufsize = 0;
+	for (int e = 0; e < s->nextent; e++) {
+		s->bufpos[e] = s->bufsize;
+		s->bufsize += s->extent[2 * e + 1];
+	}
+	if (s->io == TELEMAC_IO_DIRECT) {
+		s->bufsize += 2 * STREAM_ALIGN;
+	}
+
+	s->depth = STREAM_URING_MEMORY / s->bufsize;
+	s->depth = (s->depth < 2 ? 2 : (s->depth > TELEMAC_STREAM_MAX_DEPTH ? TELEMAC_STREAM_MAX_DEPTH : s->depth));
+	struct iovec iov[TELEMAC_STREAM_MAX_DEPTH];
+	for (int f = 0; f < s->depth; f++) {
+		void *buf = NULL;
+		s->frames[f] = calloc(sizeof(float *), nvar + 1);
+		if (s->frames[f] == NULL || posix_memalign(&buf, STREAM_ALIGN, s->bufsize) != 0) {
+			perror("telemac_stream_open");
+			return -2;
+		}
+		s->buf[f] = buf;
+		iov[f].iov_base = buf;
+		iov[f].iov_len = s->bufsize;
+	}
+	TM_STATS_ALLOC(s->depth * s->bufsize);
+	telemac_uring_register(&s->ring, iov, s->depth);
+
+	for (s->filled = 0; s->filled < s->depth && s->filled < s->nsteps; s->filled++) {
+		stream_queue(s, s->filled);
+	}
+	return 0;
+}
+
+static float **stream_uring_next(telemac_stream_t *s, int *step, float *timestamp) {
+//! telemac_stream_next() for a stream read with io_uring
+	if (s->held) {
+		s->consumed++;
+		s->held = false;
+		if (s->filled < s->nsteps) {
+			stream_queue(s, s->filled++);
+		}
+	}
+	int i = s->consumed;
+	if (i >= s->nsteps) {
+		return NULL;
+	}
+
+	int slot = i % s->depth;
+	TM_STATS_BEGIN(TM_PHASE_READ);
+	while (s->pending[slot] > 0) {
+		if (stream_collect(s) != 0) {
+			s->status[slot] = -2;
+			break;
+		}
+	}
+	TM_STATS_END(TM_PHASE_READ);
+	s->held = true;
+	if (s->status[slot] == 0) {
+		stream_finish(s, slot);
+	}
+	if (s->status[slot] != 0) {
+		fprintf(stderr, "Error %d reading timestep %d\n", s->status[slot], s->steps[i]);
+		return NULL;
+	}
+	if (step != NULL) {
+		*step = s->steps[i];
+	}
+	if (timestamp != NULL) {
+		*timestamp = s->times[slot];
+	}
+	return s->frames[slot];
+}
+
+telemac_stream_t *telemac_stream_open(const resfile_t *rfile, const int *steps, int nsteps, const bool *vars) {
+/*!
+ * @brief Start reading a sequence of timesteps in the background
+ *
+ * The read method is chosen with telemac_io_mode(). Compressed archives are
+ * always read by a background thread.
+ *
+ * @param rfile		Opened results file (or restart chain)
+ * @param steps		Timesteps to read, in order. NULL to read all timesteps.
+ * @param nsteps	Number of timesteps in steps (ignored if steps is NULL)
+ * @param vars		Flags selecting the variables to read, or NULL for all.
+ *			Unselected variables are NULL in the returned frames.
+ * @retval telemac_stream_t*	Stream, to be released with telemac_stream_close()
+ * @retval NULL			Allocation or thread creation failed
+ */
+	telemac_stream_t *s = calloc(sizeof(telemac_stream_t), 1);
+	if (s == NULL) {
+		perror("telemac_stream_open");
+		return NULL;
+	}
+	s->rfile = rfile;
+	s->ring.fd = -1;
+	s->depth = TELEMAC_STREAM_DEPTH;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	s->nsteps = (steps == NULL ? (int)rfile->tmdat.nt : nsteps);
+	s->steps = calloc(sizeof(int), (s->nsteps ? s->nsteps : 1));
+	if (s->steps == NULL) {
+		perror("telemac_stream_open");
+		telemac_stream_close(s);
+		return NULL;
+	}
+	for (int i = 0; i < s->nsteps; i++) {
+		s->steps[i] = (steps == NULL ? i : steps[i]);
+	}
+
+	s->io = (rfile->archive == NULL ? telemac_io_mode() : TELEMAC_IO_PREAD);
+	if (s->io != TELEMAC_IO_PREAD) {
+		int rv = stream_uring_open(s, vars);
+		if (rv == 0) {
+			return s;
+		}
+		if (rv != -1) {
+			telemac_stream_close(s);
+			return NULL;
+		}
+		s->io = TELEMAC_IO_PREAD;
+	}
+
+	int nvar = rfile->tmdat.nbv_1 + rfile->tmdat.nbv_2;
+	for (int f = 0; f < s->depth; f++) {
+		s->frames[f] = alloc_telemac_data(rfile);
+		if (s->frames[f] == NULL) {
+			telemac_stream_close(s);
+			return NULL;
+		}
+		for (int j = 0; vars != NULL && j < nvar; j++) {
+			if (!vars[j]) {
+				free(s->frames[f][j]);
+				s->frames[f][j] = NULL;
+			}
+		}
+	}
+
+	if (pthread_create(&s->thread, NULL, stream_reader, s) != 0) {
+		perror("telemac_stream_open: pthread_create");
+		telemac_stream_close(s);
+		return NULL;
+	}
+	s->running = true;
+	return s;
+}
+
+float **telemac_stream_next(telemac_stream_t *s, int *step, float *timestamp) {
+/*!
+ * @brief Get the next frame from a stream
+ *
+ * Releases the frame returned by the previous call, so that it can be reused
+ * by the reader, then waits for the next frame to be available. With
+ * io_uring, the released frame is queued to be refilled and the next frame's
+ * byte order is swapped here.
+ *
+ * @param s		Stream
+ * @param step		If not NULL, set to the timestep number of the frame
+ * @param timestamp	If not NULL, set to the timestamp of the frame
+ * @retval float**	Frame data, valid until the next call
+ * @retval NULL		No more frames, or a read error occurred
+ */
+	if (s->io != TELEMAC_IO_PREAD) {
+		return stream_uring_next(s, step, timestamp);
+	}
+	pthread_mutex_lock(&s->lock);
+	if (s->held) {
+		s->consumed++;
+		s->held = false;
+		pthread_cond_broadcast(&s->cond);
+	}
+	int i = s->consumed;
+	while (s->filled <= i && i < s->nsteps) {
+		pthread_cond_wait(&s->cond, &s->lock);
+	}
+	pthread_mutex_unlock(&s->lock);
+	if (i >= s->nsteps) {
+		return NULL;
+	}
+
+	int slot = i % s->depth;
+	s->held = true;
+	if (s->status[slot] != 0) {
+		fprintf(stderr, "Error %d reading timestep %d\n", s->status[slot], s->steps[i]);
+		return NULL;
+	}
+	if (step != NULL) {
+		*step = s->steps[i];
+	}
+	if (timestamp != NULL) {
+		*timestamp = s->times[slot];
+	}
+	return s->frames[slot];
+}
+
+void telemac_stream_close(telemac_stream_t *s) {
+/*!
+ * @brief Stop a stream and release its buffers
+ * @param s	Stream to close
+ */
+	if (s == NULL) {
+		return;
+	}
+	if (s->running) {
+		pthread_mutex_lock(&s->lock);
+		s->stop = true;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+		pthread_join(s->thread, NULL);
+	}
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+	if (s->ring.fd >= 0) {
+		telemac_uring_exit(&s->ring);
+	}
+	for (int i = 0; i < s->nfdmap; i++) {
+		if (s->fdmap[2 * i + 1] != s->fdmap[2 * i]) {
+			close(s->fdmap[2 * i + 1]);
+		}
+	}
+	for (int f = 0; f < TELEMAC_STREAM_MAX_DEPTH; f++) {
+		free(s->buf[f]);
+		if (s->frames[f] != NULL && s->io != TELEMAC_IO_PREAD) {
+			free(s->frames[f]);
+		} else if (s->frames[f] != NULL) {
+			for (uint32_t j = 0; j < s->rfile->tmdat.nbv_1 + s->rfile->tmdat.nbv_2; j++) {
+				free(s->frames[f][j]);
+			}
+			free(s->frames[f]);
+		}
+	}
+	free(s->fdmap);
+	free(s->want);
+	free(s->extent);
+	free(s->bufpos);
+	free(s->reads);
+	free(s->idle);
+	free(s->steps);
+	free(s);
+}
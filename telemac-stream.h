@@ -0,0 +1,110 @@
+/******************************************************************************
+telemac-stream - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Background reading of timesteps with double buffering
+ */
+
+#ifndef TELEMAC_STREAM_H
+#define TELEMAC_STREAM_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "telemac-loader.h"
+#include "telemac-uring.h"
+
+//! Number of frames buffered by a stream read by a background thread
+#define TELEMAC_STREAM_DEPTH 2
+
+//! Largest number of frames buffered by a stream read with io_uring
+#define TELEMAC_STREAM_MAX_DEPTH 8
+
+//! Environment variable selecting how streams are read
+#define TELEMAC_IO_ENV "TELEMAC_IO"
+
+//! How a stream reads its timesteps
+typedef enum {
+	TELEMAC_IO_PREAD = 0, //!< Background thread using read_telemac_data()
+	TELEMAC_IO_URING, //!< Many records in flight at once with io_uring
+	TELEMAC_IO_DIRECT //!< As TELEMAC_IO_URING, bypassing the page cache with O_DIRECT
+} telemac_io_t;
+
+//! A read queued with io_uring, tracked until all of its bytes have arrived
+typedef struct {
+	int fd; //!< File descriptor read from
+	int slot; //!< Frame slot the read belongs to
+	char *dest; //!< Destination of the bytes not yet read
+	size_t len; //!< Number of bytes still requested
+	off_t offset; //!< File offset of the bytes not yet read
+	size_t need; //!< Number of bytes still required for the frame to be complete
+} telemac_stream_read_t;
+
+/*!
+ * @brief A sequence of timesteps read ahead by a background thread
+ *
+ * While the consumer processes one frame, the next is read into a second
+ * buffer. Frames are allocated once when the stream is opened and re-used.
+ *
+ * With io_uring (see telemac_io_mode()), there is no reader thread. Instead,
+ * the records of up to TELEMAC_STREAM_MAX_DEPTH frames are queued at once,
+ * split into reads of up to 1 MiB, and a frame's byte swapping is done by
+ * the consumer when it is collected. The frames then point into one buffer
+ * per frame, registered with the kernel.
+ */
+typedef struct {
+	const resfile_t *rfile; //!< Results file being read
+	int *steps; //!< Timesteps to read, in order
+	int nsteps; //!< Number of entries in steps
+	int depth; //!< Number of frames buffered
+	float **frames[TELEMAC_STREAM_MAX_DEPTH]; //!< Frame buffers (see alloc_telemac_data())
+	float times[TELEMAC_STREAM_MAX_DEPTH]; //!< Timestamp of each buffered frame
+	int status[TELEMAC_STREAM_MAX_DEPTH]; //!< read_telemac_data() result for each buffered frame
+	int filled; //!< Number of frames read (or queued, with io_uring) so far
+	int consumed; //!< Number of frames released by the consumer
+	bool stop; //!< Set to ask the reader thread to finish early
+	bool held; //!< Set while the consumer holds a frame
+	bool running; //!< Set once the reader thread has been started
+	pthread_t thread; //!< Reader thread
+	pthread_mutex_t lock; //!< Protects filled, consumed and stop
+	pthread_cond_t cond; //!< Signalled when filled, consumed or stop change
+	telemac_io_t io; //!< Read method in use
+	telemac_uring_t ring; //!< Ring, for TELEMAC_IO_URING and TELEMAC_IO_DIRECT
+	char *buf[TELEMAC_STREAM_MAX_DEPTH]; //!< Record buffer for each frame (io_uring)
+	size_t bufsize; //!< Size of each record buffer
+	size_t shift[TELEMAC_STREAM_MAX_DEPTH]; //!< Offset of the timestep within each record buffer
+	int pending[TELEMAC_STREAM_MAX_DEPTH]; //!< Reads not yet completed for each frame
+	bool *want; //!< Flags for the variables read (io_uring)
+	off_t *extent; //!< Offset and length of each span read from a timestep, in pairs
+	size_t *bufpos; //!< Position of each span in the record buffer
+	int nextent; //!< Number of spans read from each timestep
+	int *fdmap; //!< Pairs of file descriptors: loader, and the one used for reading
+	int nfdmap; //!< Number of pairs in fdmap
+	telemac_stream_read_t *reads; //!< Reads in flight, indexed by their io_uring tag
+	int *idle; //!< Indices of unused entries in reads
+	int nidle; //!< Number of entries in idle
+} telemac_stream_t;
+
+telemac_io_t telemac_io_mode(void);
+
+telemac_stream_t *telemac_stream_open(const resfile_t *rfile, const int *steps, int nsteps, const bool *vars);
+float **telemac_stream_next(telemac_stream_t *stream, int *step, float *timestamp);
+void telemac_stream_close(telemac_stream_t *stream);
+
+#endif // TELEMAC_STREAM_H
@@ -0,0 +1,140 @@
+/******************************************************************************
+telemac-thread - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "telemac-thread.h"
+
+/*!
+ * @file
+ * @brief Minimal parallel loop helper for the tools
+ */
+
+//! Shared state for one telemac_parallel_for() call
+typedef struct {
+	size_t n; //!< Total number of items
+	size_t chunk; //!< Items handed out per request
+	size_t next; //!< Next unclaimed item (updated atomically)
+	int failed; //!< Set non-zero once any worker reports an error
+	telemac_task_fn fn; //!< Work function
+	void *ctx; //!< Work function context
+} pfor_t;
+
+//! Per-worker arguments
+typedef struct {
+	pfor_t *pf; //!< Shared state
+	int thread; //!< Worker index
+} pfor_worker_t;
+
+int telemac_default_threads(void) {
+/*!
+ * @brief Number of worker threads to use if not specified by the user
+ * @returns Number of online processors, or 1 if unknown
+ */
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0 ? (int)n : 1);
+}
+
+static void *pfor_worker(void *arg) {
+//! Claim and process chunks until no work remains
+	pfor_worker_t *w = (pfor_worker_t *)arg;
+	pfor_t *pf = w->pf;
+	while (!__atomic_load_n(&pf->failed, __ATOMIC_RELAXED)) {
+		size_t start = __atomic_fetch_add(&pf->next, pf->chunk, __ATOMIC_RELAXED);
+		if (start >= pf->n) {
+			break;
+		}
+		size_t end = (start + pf->chunk < pf->n ? start + pf->chunk : pf->n);
+		if (pf->fn(pf->ctx, start, end, w->thread) != 0) {
+			__atomic_store_n(&pf->failed, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+int telemac_parallel_for(int nthreads, size_t n, size_t chunk, telemac_task_fn fn, void *ctx) {
+/*!
+ * @brief Process n items across a number of threads
+ *
+ * Items are handed out in chunks on demand, so uneven work is balanced
+ * between threads. With one thread (or a single chunk of work) @p fn is called
+ * directly from the calling thread.
+ *
+ * @param nthreads	Number of threads to use. Values below 1 use telemac_default_threads()
+ * @param n		Number of work items
+ * @param chunk		Number of items per call to @p fn. 0 splits the items evenly between threads
+ * @param fn		Work function
+ * @param ctx		Context passed to @p fn
+ * @retval 0		All items processed successfully
+ * @retval -1		A work function failed or threads could not be created
+ */
+	if (n == 0) {
+		return 0;
+	}
+	if (nthreads < 1) {
+		nthreads = telemac_default_threads();
+	}
+	if (chunk == 0) {
+		chunk = (n + nthreads - 1) / nthreads;
+	}
+	if (nthreads == 1 || chunk >= n) {
+		for (size_t s = 0; s < n; s += chunk) {
+			if (fn(ctx, s, (s + chunk < n ? s + chunk : n), 0) != 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	pfor_t pf = {n, chunk, 0, 0, fn, ctx};
+	pthread_t *threads = calloc(sizeof(pthread_t), nthreads);
+	pfor_worker_t *workers = calloc(sizeof(pfor_worker_t), nthreads);
+	if (threads == NULL || workers == NULL) {
+		perror("telemac_parallel_for: allocating threads");
+		free(threads);
+		free(workers);
+		return -1;
+	}
+
+	int started = 0;
+	for (int i = 1; i < nthreads; i++) {
+		workers[i].pf = &pf;
+		workers[i].thread = i;
+		if (pthread_create(&threads[i], NULL, pfor_worker, &workers[i]) != 0) {
+			perror("telemac_parallel_for: pthread_create");
+			break;
+		}
+		started = i;
+	}
+
+	// The calling thread does its share as worker 0
+	workers[0].pf = &pf;
+	workers[0].thread = 0;
+	pfor_worker(&workers[0]);
+
+	for (int i = 1; i <= started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	free(workers);
+	return (pf.failed ? -1 : 0);
+}
@@ -0,0 +1,45 @@
+/******************************************************************************
+telemac-thread - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Minimal parallel loop helper for the tools
+ */
+
+#ifndef TELEMAC_THREAD_H
+#define TELEMAC_THREAD_H
+
+#include <stddef.h>
+
+/*!
+ * @brief Work function for telemac_parallel_for()
+ *
+ * Called with a half-open range [start, end) of work items.
+ * @param ctx		Caller supplied context pointer
+ * @param start		First item in range
+ * @param end		One past the last item in range
+ * @param thread	Index of the calling worker, from 0 to nthreads-1
+ * @returns		0 on success, non-zero to stop further work being handed out
+ */
+typedef int (*telemac_task_fn)(void *ctx, size_t start, size_t end, int thread);
+
+int telemac_default_threads(void);
+int telemac_parallel_for(int nthreads, size_t n, size_t chunk, telemac_task_fn fn, void *ctx);
+
+#endif // TELEMAC_THREAD_H
@@ -0,0 +1,474 @@
+/******************************************************************************
+telemac-track - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <math.h>
+
+#include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-layers.h"
+#include "telemac-frames.h"
+#include "telemac-particles.h"
+#include "telemac-format.h"
+
+/*!
+ * @file
+ * @brief Track particles through the velocity field of a results file
+ *
+ * Particles are released at the start time, either at positions read from a
+ * file or at random over the mesh, and carried by the horizontal velocity
+ * (see telemac-particles.h). The velocity varies linearly in time between
+ * timesteps; steps are shortened where needed so that none spans a timestep
+ * of the file or an output time. Each timestep of the file is read at most
+ * once (see telemac-frames.h).
+ *
+ * With -L, streamlines are traced instead: the velocity is held at its
+ * value at the start time, and particles are followed for the given
+ * travel time.
+ *
+ * Positions are written as CSV, one line per particle at each output time.
+ *
+ * Returns zero on success and EXIT_FAILURE if an error occurs.
+ */
+
+//! Size of the buffer used to format particle positions
+#define TRACK_BUFSIZE (1 << 20)
+//! Longest line written for one particle (two %.4f doubles may take 315 characters each)
+#define TRACK_LINE_MAX 1024
+
+static int find_var(const telemac_data_t *results, const char *en, const char *fr) {
+//! Find a variable by its English or French name, returning -1 if not present
+	for (int j = 0; j < (int)results->nbv_1; j++) {
+		if (strncmp(results->var_names[j], en, strlen(en)) == 0 || strncmp(results->var_names[j], fr, strlen(fr)) == 0) {
+			return j;
+		}
+	}
+	return -1;
+}
+
+static size_t read_seeds(const char *name, telemac_particles_t *p) {
+/*!
+ * @brief Read particle positions, one "x y" or "x,y" pair per line
+ *
+ * Blank lines and lines starting with '#' are skipped.
+ * @returns Number of particles, or 0 on failure
+ */
+	FILE *file = fopen(name, "r");
+	if (file == NULL) {
+		perror(name);
+		return 0;
+	}
+	size_t n = 0;
+	size_t cap = 0;
+	double *x = NULL;
+	double *y = NULL;
+	char *line = NULL;
+	size_t llen = 0;
+	while (getline(&line, &llen, file) > 0) {
+		double a = 0, b = 0;
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+			continue;
+		}
+		if (sscanf(line, "%lf%*[ \t,]%lf", &a, &b) != 2) {
+			fprintf(stderr, "%s: unable to read position \"%s\"\n", name, strtok(line, "\r\n"));
+			n = 0;
+			break;
+		}
+		if (n == cap) {
+			cap = (cap ? 2 * cap : 1024);
+			double *nx = realloc(x, sizeof(double) * cap);
+			double *ny = (nx != NULL ? realloc(y, sizeof(double) * cap) : NULL);
+			x = (nx != NULL ? nx : x);
+			y = (ny != NULL ? ny : y);
+			if (nx == NULL || ny == NULL) {
+				perror("Reading positions");
+				n = 0;
+				break;
+			}
+		}
+		x[n] = a;
+		y[n] = b;
+		n++;
+	}
+	free(line);
+	fclose(file);
+	if (n > 0 && telemac_particles_alloc(p, n) == 0) {
+		memcpy(p->x, x, sizeof(double) * n);
+		memcpy(p->y, y, sizeof(double) * n);
+	} else {
+		n = 0;
+	}
+	free(x);
+	free(y);
+	return n;
+}
+
+static uint64_t next_random(uint64_t *state) {
+//! SplitMix64 generator, so that random seeding is repeatable
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static int random_seeds(const telemac_tracker_t *tr, size_t n, telemac_particles_t *p) {
+/*!
+ * @brief Place particles uniformly at random over the area of the mesh
+ * @returns 0 on success, -1 on failure
+ */
+	if (tr->ntri == 0) {
+		fprintf(stderr, "The mesh has no elements to place particles in\n");
+		return -1;
+	}
+	double *cum = calloc(sizeof(double), tr->ntri + 1);
+	if (cum == NULL || telemac_particles_alloc(p, n) != 0) {
+		perror("Placing particles");
+		free(cum);
+		return -1;
+	}
+	double total = 0;
+	for (uint32_t t = 0; t < tr->ntri; t++) {
+		uint32_t a = tr->tri[0][t], b = tr->tri[1][t], c = tr->tri[2][t];
+		total += fabs(((double)tr->X[b] - tr->X[a]) * ((double)tr->Y[c] - tr->Y[a])
+				- ((double)tr->X[c] - tr->X[a]) * ((double)tr->Y[b] - tr->Y[a])) / 2;
+		cum[t] = total;
+	}
+	uint64_t state = 1;
+	for (size_t i = 0; i < n; i++) {
+		double r = (next_random(&state) >> 11) * 0x1.0p-53 * total;
+		uint32_t lo = 0, hi = tr->ntri - 1;
+		while (lo < hi) {
+			uint32_t mid = lo + (hi - lo) / 2;
+			if (cum[mid] < r) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		// Uniform point in the triangle, folding the unit square onto it
+		double s = (next_random(&state) >> 11) * 0x1.0p-53;
+		double q = (next_random(&state) >> 11) * 0x1.0p-53;
+		if (s + q > 1) {
+			s = 1 - s;
+			q = 1 - q;
+		}
+		uint32_t a = tr->tri[0][lo], b = tr->tri[1][lo], c = tr->tri[2][lo];
+		p->x[i] = tr->X[a] + s * ((double)tr->X[b] - tr->X[a]) + q * ((double)tr->X[c] - tr->X[a]);
+		p->y[i] = tr->Y[a] + s * ((double)tr->Y[b] - tr->Y[a]) + q * ((double)tr->Y[c] - tr->Y[a]);
+	}
+	free(cum);
+	return 0;
+}
+
+static int flush_buffer(const char *buf, size_t len, FILE *file) {
+//! Write out the contents of an output buffer, returning 0 on success or -1 on failure
+	TM_STATS_BEGIN(TM_PHASE_WRITE);
+	size_t written = fwrite(buf, 1, len, file);
+	TM_STATS_END(TM_PHASE_WRITE);
+	TM_STATS_ADD(TM_COUNT_WRITE_CALLS, 1);
+	return (written == len ? 0 : -1);
+}
+
+static int write_positions(FILE *out, const telemac_particles_t *p, double time, char *buf) {
+/*!
+ * @brief Write the position of every particle at one time
+ *
+ * Lines are formatted as printf("%zu,%.3f,%.4f,%.4f,%d\n") through a buffer of
+ * TRACK_BUFSIZE bytes.
+ * @returns 0 on success, -1 on failure
+ */
+	char tm[TELEMAC_FORMAT_MAX];
+	int tmlen = snprintf(tm, sizeof(tm), ",%.3f,", time);
+	if (tmlen < 0 || tmlen >= (int)sizeof(tm)) {
+		return -1;
+	}
+	size_t len = 0;
+	TM_STATS_BEGIN(TM_PHASE_FORMAT);
+	for (size_t i = 0; i < p->n; i++) {
+		if (len > TRACK_BUFSIZE - TRACK_LINE_MAX) {
+			TM_STATS_END(TM_PHASE_FORMAT);
+			if (flush_buffer(buf, len, out) != 0) {
+				return -1;
+			}
+			len = 0;
+			TM_STATS_BEGIN(TM_PHASE_FORMAT);
+		}
+		len += telemac_format_uint(&buf[len], i);
+		memcpy(&buf[len], tm, tmlen);
+		len += tmlen;
+		len += snprintf(&buf[len], TRACK_BUFSIZE - len, "%.4f,%.4f,%d\n", p->x[i], p->y[i], (p->tri[i] != TELEMAC_PARTICLE_OUT));
+	}
+	TM_STATS_END(TM_PHASE_FORMAT);
+	return flush_buffer(buf, len, out);
+}
+
+int main(int argc, char **argv) {
+	char *outname = NULL;
+	char *seedname = NULL;
+	size_t nrandom = 0;
+	int uvar = -1;
+	int vvar = -1;
+	int plane = -1;
+	double start = NAN;
+	double end = NAN;
+	double dt = 0;
+	double interval = 0;
+	double length = 0;
+	int nthreads = 0;
+	bool verbose = false;
+
+	const char *usage = "Usage: %s (-P file | -n count) [-u n] [-v n] [-p plane] [-s start] [-e end | -L length] [-d dt] [-w interval] [-j n] [-o output] [-c] [--stats[=json]] <filename> [filename...]\n"
+		"\t-P\tRelease particles at the positions in a file (x y or x,y on each line)\n"
+		"\t-n\tRelease count particles at random over the mesh\n"
+		"\t-u\tVelocity U variable (default: VELOCITY U or VITESSE U)\n"
+		"\t-v\tVelocity V variable (default: VELOCITY V or VITESSE V)\n"
+		"\t-p\tPlane of 3D results (0 = bottom, default -1 = surface)\n"
+		"\t-s\tRelease time (default: first timestep)\n"
+		"\t-e\tEnd time (default: last timestep)\n"
+		"\t-L\tTrace streamlines of the velocity at the release time, for this travel time\n"
+		"\t-d\tLongest time step (default: a tenth of the mean interval between timesteps)\n"
+		"\t-w\tWrite positions at this interval (default: release and end only)\n"
+		"\t-j\tNumber of threads (default: number of CPUs)\n"
+		"\t-o\tOutput CSV file (default: input name with .tracks.csv)\n"
+		"\t-c\tVerbose output\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
+
+	telemac_stats_init(&argc, argv);
+
+	opterr = 0;
+	int go = 0;
+	while ((go = getopt(argc, argv, "P:n:u:v:p:s:e:L:d:w:j:o:c")) != -1) {
+		switch (go) {
+			case 'P':
+				seedname = optarg;
+				break;
+			case 'n':
+				nrandom = strtoull(optarg, NULL, 10);
+				break;
+			case 'u':
+				uvar = atoi(optarg);
+				break;
+			case 'v':
+				vvar = atoi(optarg);
+				break;
+			case 'p':
+				plane = atoi(optarg);
+				break;
+			case 's':
+				start = strtod(optarg, NULL);
+				break;
+			case 'e':
+				end = strtod(optarg, NULL);
+				break;
+			case 'L':
+				length = strtod(optarg, NULL);
+				if (length <= 0) {
+					fprintf(stderr, "Streamline travel time must be greater than 0\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'd':
+				dt = strtod(optarg, NULL);
+				if (dt <= 0) {
+					fprintf(stderr, "Time step must be greater than 0\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'w':
+				interval = strtod(optarg, NULL);
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'o':
+				outname = optarg;
+				break;
+			case 'c':
+				verbose = true;
+				break;
+			case '?':
+				fprintf(stderr, "Unrecognised option '-%c'\n", optopt);
+				fprintf(stderr, usage, argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind < 1 || (seedname == NULL) == (nrandom == 0)) {
+		fprintf(stderr, "Must provide a file (or restart chain of files) and either -P or -n\n");
+		fprintf(stderr, usage, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	resfile_t rfs = {NULL, 0, 0, 0};
+	int rval = open_telemac_chain(&rfs, &argv[optind], argc - optind, false);
+	if (rfs.file == NULL || rval < 0) {
+		fprintf(stderr, "Unable to open %s (%d)\n", argv[optind], rval);
+		return EXIT_FAILURE;
+	}
+	telemac_data_t *mesh = &rfs.tmdat;
+	int nvar = mesh->nbv_1 + mesh->nbv_2;
+
+	uvar = (uvar < 0 ? find_var(mesh, "VELOCITY U", "VITESSE U") : uvar);
+	vvar = (vvar < 0 ? find_var(mesh, "VELOCITY V", "VITESSE V") : vvar);
+	if (uvar < 0 || vvar < 0 || uvar >= nvar || vvar >= nvar) {
+		fprintf(stderr, "Velocity variables not found or out of range (%d variables)\n", nvar);
+		return EXIT_FAILURE;
+	}
+	telemac_layers_t layers;
+	if (telemac_get_layers(mesh, &layers) != 0) {
+		return EXIT_FAILURE;
+	}
+	plane = (plane < 0 ? plane + (int)layers.nplan : plane);
+	if (plane < 0 || plane >= (int)layers.nplan) {
+		fprintf(stderr, "Plane out of range (%u planes)\n", layers.nplan);
+		return EXIT_FAILURE;
+	}
+	size_t offset = (size_t)plane * layers.npoin2;
+
+	int vars[2] = {uvar, vvar};
+	telemac_frames_t fr;
+	if (telemac_frames_open(&fr, &rfs, vars, 2) != 0) {
+		fprintf(stderr, "Unable to read timesteps of %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+	double first = fr.times[0];
+	double last = fr.times[mesh->nt - 1];
+	start = (isnan(start) ? first : start);
+	end = (length > 0 ? start + length : (isnan(end) ? last : end));
+	if (end < start) {
+		fprintf(stderr, "End time is before the release time\n");
+		return EXIT_FAILURE;
+	}
+	if (length == 0 && (start < first || end > last)) {
+		fprintf(stderr, "Warning: times outside %g - %g use the velocity of the first or last timestep\n", first, last);
+	}
+	if (dt == 0) {
+		dt = (mesh->nt > 1 && last > first ? (last - first) / (mesh->nt - 1) / 10 : (end - start) / 100);
+	}
+
+	telemac_tracker_t tr;
+	if (telemac_tracker_init(&tr, mesh, &layers) != 0) {
+		return EXIT_FAILURE;
+	}
+	telemac_particles_t p;
+	if (seedname != NULL ? read_seeds(seedname, &p) == 0 : random_seeds(&tr, nrandom, &p) != 0) {
+		return EXIT_FAILURE;
+	}
+	size_t inside = telemac_particles_place(&tr, &p, nthreads);
+	if (inside < p.n) {
+		fprintf(stderr, "Warning: %zu of %zu particles released outside the mesh\n", p.n - inside, p.n);
+	}
+
+	// Streamlines use the velocity at the release time throughout
+	float *steady[2] = {NULL, NULL};
+	if (length > 0) {
+		steady[0] = calloc(sizeof(float), mesh->npoin + 1);
+		steady[1] = calloc(sizeof(float), mesh->npoin + 1);
+		if (steady[0] == NULL || steady[1] == NULL) {
+			perror("Allocating velocity");
+			return EXIT_FAILURE;
+		}
+		if (telemac_frames_at(&fr, start, steady, nthreads) != 0) {
+			fprintf(stderr, "Unable to read velocity at time %f\n", start);
+			return EXIT_FAILURE;
+		}
+	}
+
+	char *base = strdup(argv[optind]);
+	if (outname == NULL) {
+		asprintf(&outname, "%s.tracks.csv", basename(base));
+	}
+	FILE *out = fopen(outname, "w");
+	if (out == NULL) {
+		perror("Unable to open output file");
+		return EXIT_FAILURE;
+	}
+	char *buf = malloc(TRACK_BUFSIZE);
+	if (buf == NULL) {
+		perror("Allocating output buffer");
+		return EXIT_FAILURE;
+	}
+	fprintf(out, "particle,time,x,y,inside\n");
+
+	double t = start;
+	double next = (interval > 0 && start + interval < end ? start + interval : end);
+	uint64_t nsteps = 0;
+	int rv = write_positions(out, &p, t, buf);
+	while (t < end && rv == 0) {
+		telemac_flow_t flow = {{steady[0], steady[0]}, {steady[1], steady[1]}, {start, start}};
+		double stop = next;
+		if (length == 0) {
+			float **a = NULL;
+			float **b = NULL;
+			if (telemac_frames_bracket(&fr, t, &a, &b, &flow.t[0], &flow.t[1]) != 0) {
+				fprintf(stderr, "Unable to read velocity at time %f\n", t);
+				return EXIT_FAILURE;
+			}
+			flow.u[0] = a[0] + offset;
+			flow.u[1] = b[0] + offset;
+			flow.v[0] = a[1] + offset;
+			flow.v[1] = b[1] + offset;
+			if (flow.t[1] > t && flow.t[1] < stop) {
+				stop = flow.t[1];
+			}
+		} else {
+			flow.u[0] = flow.u[1] = steady[0] + offset;
+			flow.v[0] = flow.v[1] = steady[1] + offset;
+		}
+		int n = (int)ceil((stop - t) / dt - 1e-9);
+		n = (n < 1 ? 1 : n);
+		if (verbose) {
+			fprintf(stdout, "Time %f to %f: %d steps\n", t, stop, n);
+		}
+		rv = telemac_particles_advance(&tr, &flow, &p, t, (stop - t) / n, n, nthreads);
+		nsteps += n;
+		t = stop;
+		if (rv == 0 && t >= next) {
+			rv = write_positions(out, &p, t, buf);
+			next = (next + interval < end && interval > 0 ? next + interval : end);
+		}
+	}
+	free(buf);
+	if (fclose(out) != 0 || rv != 0) {
+		perror("Writing output");
+		return EXIT_FAILURE;
+	}
+	telemac_stats_add_file(outname);
+
+	inside = 0;
+	for (size_t i = 0; i < p.n; i++) {
+		inside += (p.tri[i] != TELEMAC_PARTICLE_OUT);
+	}
+	fprintf(stdout, "Tracked %zu particles for %" PRIu64 " steps (%u timesteps read): %zu inside the mesh at the end\n",
+			p.n, nsteps, fr.nread, inside);
+
+	telemac_particles_free(&p);
+	telemac_tracker_free(&tr);
+	telemac_frames_close(&fr);
+	free(steady[0]);
+	free(steady[1]);
+	free(base);
+	return EXIT_SUCCESS;
+}
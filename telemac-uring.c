@@ -0,0 +1,304 @@
+/******************************************************************************
+telemac-uring - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "telemac-uring.h"
+
+/*!
+ * @file
+ * @brief Minimal io_uring submission and completion queue, without liburing
+ *
+ * Only what is needed for reads is implemented: setting up and mapping the
+ * ring, registering buffers, queueing IORING_OP_READ_FIXED (or
+ * IORING_OP_READ without registered buffers) and collecting completions.
+ * The queue heads and tails shared with the kernel are accessed with
+ * acquire and release ordering.
+ */
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#define TELEMAC_HAVE_URING
+#endif
+#endif
+
+#ifdef TELEMAC_HAVE_URING
+#include <linux/io_uring.h>
+
+int telemac_uring_init(telemac_uring_t *ring, unsigned entries) {
+/*!
+ * @brief Set up a ring for reads
+ *
+ * @param ring	Ring to set up. Release with telemac_uring_exit().
+ * @param entries	Number of reads that may be in flight at once
+ * @retval 0	Success
+ * @retval -1	io_uring is not available (errno is set)
+ */
+	struct io_uring_params p;
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0) {
+		ring->fd = -1;
+		return -1;
+	}
+	ring->entries = p.sq_entries;
+
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->sq_size = (ring->cq_size > ring->sq_size ? ring->cq_size : ring->sq_size);
+		ring->cq_size = 0;
+	}
+	ring->sq_map = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED) {
+		ring->sq_map = NULL;
+		telemac_uring_exit(ring);
+		return -1;
+	}
+	char *cq = ring->sq_map;
+	if (ring->cq_size > 0) {
+		ring->cq_map = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_map == MAP_FAILED) {
+			ring->cq_map = NULL;
+			telemac_uring_exit(ring);
+			return -1;
+		}
+		cq = ring->cq_map;
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		telemac_uring_exit(ring);
+		return -1;
+	}
+
+	char *sq = ring->sq_map;
+	ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes = cq + p.cq_off.cqes;
+	return 0;
+}
+
+int telemac_uring_register(telemac_uring_t *ring, const struct iovec *bufs, unsigned nbufs) {
+/*!
+ * @brief Register buffers, so the kernel does not need to map them for each read
+ *
+ * If registration fails (for example, because of the locked memory limit),
+ * reads are still accepted but use unregistered buffers.
+ *
+ * @param ring	Ring from telemac_uring_init()
+ * @param bufs	Buffers. Reads into buffer i must pass i as bufindex.
+ * @param nbufs	Number of buffers
+ * @retval 0	Buffers registered
+ * @retval -1	Registration failed (errno is set)
+ */
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, bufs, nbufs) != 0) {
+		return -1;
+	}
+	ring->fixed = true;
+	return 0;
+}
+
+static int uring_enter(telemac_uring_t *ring, unsigned wait) {
+//! Submit queued reads and optionally wait for a completion
+	unsigned flags = (wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+	int rv = 0;
+	do {
+		rv = syscall(__NR_io_uring_enter, ring->fd, ring->queued, wait, flags, NULL, 0);
+	} while (rv < 0 && errno == EINTR);
+	if (rv < 0) {
+		return -errno;
+	}
+	ring->queued -= (rv < (int)ring->queued ? (unsigned)rv : ring->queued);
+	return 0;
+}
+
+int telemac_uring_read(telemac_uring_t *ring, int fd, void *buf, size_t len, off_t offset, int bufindex, uint64_t tag) {
+/*!
+ * @brief Queue a positioned read
+ *
+ * Reads are submitted to the kernel in batches, when the queue is full or
+ * when telemac_uring_wait() is called.
+ *
+ * @param ring	Ring from telemac_uring_init()
+ * @param fd	File descriptor to read from
+ * @param buf	Destination, within buffer bufindex if buffers are registered
+ * @param len	Number of bytes to read
+ * @param offset	File offset to read from
+ * @param bufindex	Registered buffer holding buf (ignored if none are registered)
+ * @param tag	Value returned by telemac_uring_wait() for this read
+ * @retval 0	Read queued
+ * @retval -EAGAIN	Ring full: collect a completion first
+ * @retval <0	Submission failed (negative errno)
+ */
+	if (ring->inflight >= ring->entries) {
+		return -EAGAIN;
+	}
+	unsigned tail = *ring->sq_tail;
+	if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->entries) {
+		int rv = uring_enter(ring, 0);
+		if (rv != 0) {
+			return rv;
+		}
+		return -EAGAIN;
+	}
+
+	unsigned idx = tail & ring->sq_mask;
+	struct io_uring_sqe *sqe = &((struct io_uring_sqe *)ring->sqes)[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ);
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->buf_index = (ring->fixed ? bufindex : 0);
+	sqe->user_data = tag;
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued++;
+	ring->inflight++;
+	return 0;
+}
+
+int telemac_uring_wait(telemac_uring_t *ring, uint64_t *tag, int *res) {
+/*!
+ * @brief Submit any queued reads and collect one completion, waiting if needed
+ *
+ * @param ring	Ring from telemac_uring_init()
+ * @param tag	Set to the tag of the completed read
+ * @param res	Set to the number of bytes read, or a negative errno
+ * @retval 0	Completion collected
+ * @retval -1	Nothing in flight
+ * @retval <-1	Waiting failed (negative errno)
+ */
+	if (ring->inflight == 0) {
+		return -1;
+	}
+	if (ring->queued > 0) {
+		int rv = uring_enter(ring, 0);
+		if (rv != 0) {
+			return rv;
+		}
+	}
+	while (true) {
+		unsigned head = *ring->cq_head;
+		if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			const struct io_uring_cqe *cqe = &((struct io_uring_cqe *)ring->cqes)[head & ring->cq_mask];
+			*tag = cqe->user_data;
+			*res = cqe->res;
+			__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+			ring->inflight--;
+			return 0;
+		}
+		int rv = uring_enter(ring, 1);
+		if (rv != 0) {
+			return rv;
+		}
+	}
+}
+
+void telemac_uring_exit(telemac_uring_t *ring) {
+/*!
+ * @brief Release a ring
+ *
+ * Reads still in flight are collected first, so their buffers may be freed
+ * once this returns.
+ * @param ring	Ring from telemac_uring_init()
+ */
+	uint64_t tag = 0;
+	int res = 0;
+	while (ring->fd >= 0 && ring->sqes != NULL && telemac_uring_wait(ring, &tag, &res) == 0) {
+	}
+	if (ring->sqes != NULL) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->cq_map != NULL) {
+		munmap(ring->cq_map, ring->cq_size);
+	}
+	if (ring->sq_map != NULL) {
+		munmap(ring->sq_map, ring->sq_size);
+	}
+	if (ring->fd >= 0) {
+		close(ring->fd);
+	}
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+#else
+
+// Stubs for systems without io_uring: callers fall back to pread()
+
+int telemac_uring_init(telemac_uring_t *ring, unsigned entries) {
+//! io_uring is not available on this system
+	(void)entries;
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+	errno = ENOSYS;
+	return -1;
+}
+
+int telemac_uring_register(telemac_uring_t *ring, const struct iovec *bufs, unsigned nbufs) {
+//! io_uring is not available on this system
+	(void)ring;
+	(void)bufs;
+	(void)nbufs;
+	errno = ENOSYS;
+	return -1;
+}
+
+int telemac_uring_read(telemac_uring_t *ring, int fd, void *buf, size_t len, off_t offset, int bufindex, uint64_t tag) {
+//! io_uring is not available on this system
+	(void)ring;
+	(void)fd;
+	(void)buf;
+	(void)len;
+	(void)offset;
+	(void)bufindex;
+	(void)tag;
+	return -ENOSYS;
+}
+
+int telemac_uring_wait(telemac_uring_t *ring, uint64_t *tag, int *res) {
+//! io_uring is not available on this system
+	(void)ring;
+	(void)tag;
+	(void)res;
+	return -1;
+}
+
+void telemac_uring_exit(telemac_uring_t *ring) {
+//! io_uring is not available on this system
+	ring->fd = -1;
+}
+
+#endif
@@ -0,0 +1,79 @@
+/******************************************************************************
+telemac-uring - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief Minimal io_uring submission and completion queue, without liburing
+ */
+
+#ifndef TELEMAC_URING_H
+#define TELEMAC_URING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*!
+ * @defgroup uring Asynchronous reads
+ * @brief Queue many positioned reads and collect their completions
+ *
+ * The ring is set up with the raw system calls, so no extra library is
+ * needed. On systems without io_uring (older kernels, or where it has been
+ * disabled) telemac_uring_init() fails and the caller should fall back to
+ * pread().
+ *
+ * Each read carries a 64-bit tag which is returned with its completion.
+ * No more reads are accepted than fit in the ring, so the completion queue
+ * cannot overflow: when telemac_uring_read() returns -EAGAIN, collect a
+ * completion with telemac_uring_wait() and try again.
+ * @{
+ */
+
+//! Submission and completion queues shared with the kernel
+typedef struct {
+	int fd; //!< Ring file descriptor, or -1
+	unsigned entries; //!< Submission queue size
+	unsigned queued; //!< Reads queued but not yet submitted
+	unsigned inflight; //!< Reads queued or submitted but not yet collected
+	bool fixed; //!< Set if buffers have been registered
+	unsigned *sq_head; //!< Submission queue head (kernel)
+	unsigned *sq_tail; //!< Submission queue tail (ours)
+	unsigned sq_mask; //!< Submission queue index mask
+	unsigned *sq_array; //!< Submission queue index array
+	void *sqes; //!< Submission queue entries
+	unsigned *cq_head; //!< Completion queue head (ours)
+	unsigned *cq_tail; //!< Completion queue tail (kernel)
+	unsigned cq_mask; //!< Completion queue index mask
+	void *cqes; //!< Completion queue entries
+	void *sq_map; //!< Mapping of the submission ring
+	size_t sq_size; //!< Size of sq_map
+	void *cq_map; //!< Mapping of the completion ring, if separate
+	size_t cq_size; //!< Size of cq_map
+	size_t sqes_size; //!< Size of sqes
+} telemac_uring_t;
+
+int telemac_uring_init(telemac_uring_t *ring, unsigned entries);
+int telemac_uring_register(telemac_uring_t *ring, const struct iovec *bufs, unsigned nbufs);
+int telemac_uring_read(telemac_uring_t *ring, int fd, void *buf, size_t len, off_t offset, int bufindex, uint64_t tag);
+int telemac_uring_wait(telemac_uring_t *ring, uint64_t *tag, int *res);
+void telemac_uring_exit(telemac_uring_t *ring);
+
+/*! @} */
+#endif // TELEMAC_URING_H
@@ -20,12 +20,20 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdbool.h>
 #include <libgen.h>
 #include <unistd.h>
 #include <libxml/xmlwriter.h>
 #include <libxml/tree.h>
 
 #include "telemac-loader.h"
+#include "telemac-stats.h"
+#include "telemac-expr.h"
+#include "telemac-geom.h"
+#include "telemac-mesh.h"
+#include "telemac-layers.h"
+#include "telemac-thread.h"
+#include "telemac-manifest.h"
 
 /*!
  * @file
@@ -34,10 +42,41 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
  * Reads a SELAFIN file and exports details to VTU and PVD files suitable
  * for use with Paraview - an open-source visualisation tool.
  *
+ * Derived variables (see telemac-expr.h) may be added to the exported
+ * variables, and are calculated from the stored variables as each timestep
+ * is read. Gradients, vorticity and divergence may also be exported, using
+ * the element geometry from telemac-geom.h.
+ *
+ * The mesh may be split into parts (see telemac_partition()), in which case
+ * each timestep is written as one VTU file per part and a PVTU file listing
+ * them.
+ *
+ * With -i, a manifest (see telemac-manifest.h) records the timesteps already
+ * exported, and only new or changed timesteps are written. The PVD file is
+ * always rewritten, atomically, to list every timestep.
+ *
+ * Data arrays are written as text by default. With -b they are written as
+ * base64 encoded binary, in the byte order of the host, with a 32-bit size
+ * before each array.
+ *
  * Returns zero on success and non-zero if an error occurs
  */
 
 int writeTimestep(void *wtsargs);
+static uint64_t timestep_output_size(const void *wtsargs);
+
+//! Spatial derivatives requested for export
+typedef struct {
+	const telemac_geom_t *geom; //!< Element geometry, or NULL if no derivatives are requested
+	int *grad; //!< Variables to export the gradient of
+	int ngrad; //!< Number of entries in grad
+	bool vort; //!< Export vorticity and divergence of the velocity
+	float *tri[2]; //!< Buffers for values on each triangle
+	float **gnode; //!< Nodal gradient X and Y components, two arrays for each entry in grad
+	float *vnode; //!< Nodal vorticity
+	float *dnode; //!< Nodal divergence
+	float *velem; //!< Vorticity for each element
+} deriv_t;
 
 //! Arguments for writeTimestep
 typedef struct {
@@ -49,8 +88,59 @@ typedef struct {
 	int v; //!< Variable to use for V velocity component
 	int w; //!< Variable to use for W velocity component
 	int verbose; //!< Non-zero for verbose output
+	float **data; //!< Buffers for stored variables. NULL entries are not read.
+	bool stored; //!< Export stored variables as well as derived variables
+	telemac_expr_t **exprs; //!< Derived variables
+	int nexpr; //!< Number of derived variables
+	float **derived; //!< Buffers for derived variables
+	int nthreads; //!< Number of threads for evaluating derived variables
+	deriv_t *deriv; //!< Spatial derivatives to export
+	const telemac_partition_t *part; //!< Parts to write as separate files, or NULL for a single VTU file
+	bool binary; //!< Write data arrays as base64 encoded binary rather than text
 } wTSargs;
 
+//! Nodes and elements written to one VTU file
+typedef struct {
+	uint32_t npoin; //!< Number of nodes
+	const uint32_t *node; //!< Mesh node (from 0) for each node, or NULL for all nodes in order
+	uint32_t nelem; //!< Number of elements
+	const uint32_t *elem; //!< Mesh element (from 0) for each element, or NULL for all elements in order
+	const uint32_t *ikle; //!< Connectivity using local node numbers from 0, or NULL to use the mesh connectivity
+} piece_t;
+
+//! Buffers for writing the binary data arrays of one piece
+typedef struct {
+	float *values; //!< Values of one array, gathered from the mesh
+	char *raw; //!< Encoded array, after four bytes for its size
+	char *text; //!< Encoded array in base64
+} binbuf_t;
+
+//! Mesh node for local node @p i of piece @p pc
+#define NODE(pc, i) ((pc)->node ? (pc)->node[(i)] : (i))
+
+static int calculate_derivatives(deriv_t *dv, float **data, int u, int v, int nthreads) {
+/*!
+ * @brief Calculate the requested gradients, vorticity and divergence for one timestep
+ * @returns 0 on success, -1 on failure
+ */
+	for (int g = 0; g < dv->ngrad; g++) {
+		if (telemac_geom_gradient(dv->geom, data[dv->grad[g]], dv->tri[0], dv->tri[1], nthreads) != 0
+				|| telemac_geom_to_nodes(dv->geom, dv->tri[0], dv->gnode[2 * g], nthreads) != 0
+				|| telemac_geom_to_nodes(dv->geom, dv->tri[1], dv->gnode[2 * g + 1], nthreads) != 0) {
+			return -1;
+		}
+	}
+	if (dv->vort) {
+		if (telemac_geom_vorticity(dv->geom, data[u], data[v], dv->tri[0], dv->tri[1], nthreads) != 0
+				|| telemac_geom_to_nodes(dv->geom, dv->tri[0], dv->vnode, nthreads) != 0
+				|| telemac_geom_to_nodes(dv->geom, dv->tri[1], dv->dnode, nthreads) != 0) {
+			return -1;
+		}
+		telemac_geom_elements(dv->geom, dv->tri[0], dv->velem);
+	}
+	return 0;
+}
+
 
 int main(int argc, char **argv) {
 
@@ -64,8 +154,16 @@ int main(int argc, char **argv) {
 	int w = 3;
 	int printfreq = 1;
 	int ts = -1;
+	bool stored = true;
+	int nthreads = 0;
+	char **defs = NULL;
+	int ndefs = 0;
+	int nparts = 0;
+	bool incremental = false;
+	bool binary = false;
+	deriv_t deriv = {NULL, NULL, 0, false, {NULL, NULL}, NULL, NULL, NULL, NULL};
 
-	char *usage =  "Usage: %s [-z Z] [-u U] [-v V] [-w W] [-t T|-f n] [-c] [-o output_path] <results file>\n"
+	char *usage =  "Usage: %s [-z Z] [-u U] [-v V] [-w W] [-t T|-f n] [-c] [-e NAME=expr] [-g n] [-r] [-x] [-p n] [-j n] [-i] [-b] [-o output_path] [--stats[=json]] <results file> [results file...]\n"
 		"\t-c\tVerbose output\n"
 		"\t-F\tForce continuation on certain errors\n"
 		"\t-f\tExport every n^th timestep\n"
@@ -74,12 +172,23 @@ int main(int argc, char **argv) {
 		"\t-u\t|\n"
 		"\t-v\t} Specify index for Z (height) and velocity components (u,v,w)\n"
 		"\t-w\t|\n"
-		"\t-o\tSpecify output folder for result files\n";
+		"\t-e\tAdd a derived variable, e.g. -e 'SPEED=sqrt(U^2+V^2)'. May be repeated\n"
+		"\t-g\tExport the gradient of variable n. May be repeated\n"
+		"\t-r\tExport vorticity and divergence of the velocity (u,v)\n"
+		"\t-x\tExport derived variables only, omitting stored scalar variables\n"
+		"\t-p\tSplit the mesh into n parts, written as a PVTU file for each timestep\n"
+		"\t-j\tNumber of threads for derived variables and parts (default: number of CPUs)\n"
+		"\t-i\tIncremental: only write timesteps not already exported, or changed since\n"
+		"\t-b\tWrite data arrays as binary (base64) rather than text\n"
+		"\t-o\tSpecify output folder for result files\n"
+		"\t--stats\tPrint timing and I/O statistics on exit\n";
 	opterr = 0;
 
+	telemac_stats_init(&argc, argv);
+
 	int go = 0;
 	int oplength = -1;
-	while ((go = getopt (argc, argv, "u:v:w:z:f:o:t:cF")) != -1) {
+	while ((go = getopt (argc, argv, "u:v:w:z:f:o:t:e:g:j:p:bcFirx")) != -1) {
 		switch(go) {
 			case 'z':
 				z = atoi(optarg);
@@ -96,9 +205,47 @@ int main(int argc, char **argv) {
 			case 'c':
 				verbose = 1;
 				break;
+			case 'e':
+				defs = realloc(defs, sizeof(char *) * (ndefs + 1));
+				if (defs == NULL) {
+					perror("Parsing options");
+					return EXIT_FAILURE;
+				}
+				defs[ndefs++] = optarg;
+				break;
+			case 'x':
+				stored = false;
+				break;
+			case 'g':
+				deriv.grad = realloc(deriv.grad, sizeof(int) * (deriv.ngrad + 1));
+				if (deriv.grad == NULL) {
+					perror("Parsing options");
+					return EXIT_FAILURE;
+				}
+				deriv.grad[deriv.ngrad++] = atoi(optarg);
+				break;
+			case 'r':
+				deriv.vort = true;
+				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'p':
+				nparts = atoi(optarg);
+				if (nparts <= 0) {
+					fprintf(stderr, "Number of parts must be greater than 0\n");
+					return EXIT_FAILURE;
+				}
+				break;
 			case 'F':
 				force = 1;
 				break;
+			case 'b':
+				binary = true;
+				break;
+			case 'i':
+				incremental = true;
+				break;
 			case 't':
 				ts = atoi(optarg);
 				break;
@@ -130,8 +277,8 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	if (argc - optind != 1) {
-		fprintf(stderr, "%s: A single SLF file must be provided\n", argv[0]);
+	if (argc - optind < 1) {
+		fprintf(stderr, "%s: A single SLF file (or restart chain of files) must be provided\n", argv[0]);
 		fprintf(stderr, usage, argv[0]);
 		return EXIT_FAILURE;
 	} else {
@@ -144,18 +291,15 @@ int main(int argc, char **argv) {
 		return EXIT_FAILURE;
 	}
 
-	FILE *resfile = NULL;
-	resfile = fopen(filename, "rb");
-	if (resfile == NULL) {
+	resfile_t rfs = {NULL, 0, 0, 0};
+
+	int otres;
+	otres = open_telemac_chain(&rfs, &argv[optind], argc - optind, verbose);
+	if (rfs.file == NULL) {
 		perror("Unable to open input file");
 		return EXIT_FAILURE;
 	}
 
-	resfile_t rfs = {resfile, 0, 0, 0};
-
-	int otres;
-	otres = open_telemac(&rfs, verbose);
-
 	if (otres != 0) {
 		fprintf(stderr, "Error: open_telemac call returned %d\n", otres);
 		if (force) {
@@ -165,13 +309,151 @@ int main(int argc, char **argv) {
 		}
 	}
 	telemac_data_t *mesh = &rfs.tmdat;
+	int nvar = mesh->nbv_1 + mesh->nbv_2;
+
+	telemac_expr_t **exprs = calloc(sizeof(telemac_expr_t *), (ndefs ? ndefs : 1));
+	float **derived = calloc(sizeof(float *), (ndefs ? ndefs : 1));
+	bool *need = calloc(sizeof(bool), nvar);
+	if (exprs == NULL || derived == NULL || need == NULL) {
+		perror("Allocating derived variables");
+		return EXIT_FAILURE;
+	}
+	for (int e = 0; e < ndefs; e++) {
+		char err[512];
+		exprs[e] = telemac_expr_compile(defs[e], mesh, err, sizeof(err));
+		if (exprs[e] == NULL) {
+			fprintf(stderr, "Invalid derived variable: %s\n", err);
+			return EXIT_FAILURE;
+		}
+		telemac_expr_uses(exprs[e], need);
+		derived[e] = calloc(sizeof(float), mesh->npoin);
+		if (derived[e] == NULL) {
+			perror("Allocating derived variables");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Read only the variables needed for the requested output
+	if (z < 0 || u < 0 || v < 0 || w < 0 || z >= nvar || u >= nvar || v >= nvar || (mesh->ndp == 6 && w >= nvar)) {
+		fprintf(stderr, "Coordinate or velocity variable out of range (%d variables)\n", nvar);
+		return EXIT_FAILURE;
+	}
+	need[z] = need[u] = need[v] = true;
+	if (mesh->ndp == 6) {
+		need[w] = true;
+	}
+
+	if (deriv.ngrad > 0 || deriv.vort) {
+		deriv.geom = telemac_get_geom(&rfs);
+		if (deriv.geom == NULL) {
+			return EXIT_FAILURE;
+		}
+		deriv.tri[0] = calloc(sizeof(float), deriv.geom->ntri);
+		deriv.tri[1] = calloc(sizeof(float), deriv.geom->ntri);
+		deriv.gnode = calloc(sizeof(float *), 2 * deriv.ngrad + 1);
+		deriv.vnode = calloc(sizeof(float), mesh->npoin);
+		deriv.dnode = calloc(sizeof(float), mesh->npoin);
+		deriv.velem = calloc(sizeof(float), mesh->nelem);
+		if (deriv.tri[0] == NULL || deriv.tri[1] == NULL || deriv.gnode == NULL || deriv.vnode == NULL
+				|| deriv.dnode == NULL || deriv.velem == NULL) {
+			perror("Allocating derivatives");
+			return EXIT_FAILURE;
+		}
+		for (int g = 0; g < deriv.ngrad; g++) {
+			if (deriv.grad[g] < 0 || deriv.grad[g] >= nvar) {
+				fprintf(stderr, "Gradient variable %d out of range (%d variables)\n", deriv.grad[g], nvar);
+				return EXIT_FAILURE;
+			}
+			need[deriv.grad[g]] = true;
+			deriv.gnode[2 * g] = calloc(sizeof(float), mesh->npoin);
+			deriv.gnode[2 * g + 1] = calloc(sizeof(float), mesh->npoin);
+			if (deriv.gnode[2 * g] == NULL || deriv.gnode[2 * g + 1] == NULL) {
+				perror("Allocating derivatives");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	float **data = alloc_telemac_data(&rfs);
+	if (data == NULL) {
+		return EXIT_FAILURE;
+	}
+	for (int j = 0; j < nvar && !stored; j++) {
+		if (!need[j]) {
+			free(data[j]);
+			data[j] = NULL;
+		}
+	}
+
+	// 3D meshes are partitioned by columns of prisms, so there can be no more parts than 2D elements
+	telemac_partition_t part;
+	telemac_layers_t layers;
+	if (nparts > 0 && telemac_get_layers(mesh, &layers) != 0) {
+		return EXIT_FAILURE;
+	}
+	if (nparts > 0 && (uint32_t)nparts > layers.nelem2) {
+		nparts = layers.nelem2;
+	}
+	if (nparts > 0) {
+		TM_STATS_BEGIN(TM_PHASE_MESH);
+		int pres = telemac_partition(mesh, nparts, &part);
+		TM_STATS_END(TM_PHASE_MESH);
+		if (pres != 0) {
+			fprintf(stderr, "Unable to partition mesh\n");
+			return EXIT_FAILURE;
+		}
+		// Parts are written from several threads
+		xmlInitParser();
+	}
+	const char *ext = (nparts > 0 ? "pvtu" : "vtu");
 
 	int tStart = ts >= 0 ? ts : 0;
 	int tLimit = ts >= 0 ? ts + 1 : mesh->nt;
 
+	// The manifest is only valid for output written with the same settings
+	telemac_manifest_t manifest;
+	int skipped = 0;
+	if (incremental) {
+		char *settings = NULL;
+		char *next = NULL;
+		if (asprintf(&settings, "vtu z=%d u=%d v=%d w=%d stored=%d parts=%d vort=%d", z, u, v, w, stored, nparts, deriv.vort) < 0) {
+			settings = NULL;
+		}
+		if (binary && settings != NULL) {
+			if (asprintf(&next, "%s binary=float", settings) < 0) {
+				next = NULL;
+			}
+			free(settings);
+			settings = next;
+		}
+		for (int g = 0; g < deriv.ngrad && settings != NULL; g++) {
+			if (asprintf(&next, "%s grad=%d", settings, deriv.grad[g]) < 0) {
+				next = NULL;
+			}
+			free(settings);
+			settings = next;
+		}
+		for (int e = 0; e < ndefs && settings != NULL; e++) {
+			if (asprintf(&next, "%s def=%s", settings, defs[e]) < 0) {
+				next = NULL;
+			}
+			free(settings);
+			settings = next;
+		}
+		char *manifestName = NULL;
+		if (settings == NULL || asprintf(&manifestName, "%s%s.vtu.manifest", outputpath, basename(filename)) < 0) {
+			perror("Preparing manifest");
+			return EXIT_FAILURE;
+		}
+		if (telemac_manifest_open(&manifest, manifestName, &rfs, settings) != 0) {
+			return EXIT_FAILURE;
+		}
+		free(manifestName);
+		free(settings);
+	}
+
 	for (int t = tStart; t < tLimit; t+=printfreq) {
 		char *vtuFileName = NULL;
-		asprintf(&vtuFileName, "%s%s.t%d.vtu", outputpath, basename(filename), t);
+		asprintf(&vtuFileName, "%s%s.t%d.%s", outputpath, basename(filename), t, ext);
 		wTSargs pt;
 		pt.file = strdup(vtuFileName);
 		pt.t = t;
@@ -181,10 +463,53 @@ int main(int argc, char **argv) {
 		pt.v = v;
 		pt.w = w;
 		pt.verbose = verbose;
+		pt.data = data;
+		pt.stored = stored;
+		pt.exprs = exprs;
+		pt.nexpr = ndefs;
+		pt.derived = derived;
+		pt.nthreads = nthreads;
+		pt.deriv = &deriv;
+		pt.part = (nparts > 0 ? &part : NULL);
+		pt.binary = binary;
+		uint64_t hash = 0;
+		if (incremental) {
+			hash = telemac_step_hash(&rfs, t);
+			if (telemac_manifest_current(&manifest, t, hash, timestep_output_size(&pt))) {
+				if (verbose) {
+					fprintf(stdout, "Timestep %d already exported\n", t);
+				}
+				// Timestamps are otherwise read with the data
+				mesh->timestamp[t] = manifest.step[t].time;
+				skipped++;
+				free(pt.file);
+				free(vtuFileName);
+				continue;
+			}
+		}
 		if (writeTimestep((void *) &pt)) {
 			fprintf(stderr, "Unable to write results to %s\n", vtuFileName);
+			if (incremental) {
+				telemac_manifest_save(&manifest, true);
+			}
 			return EXIT_FAILURE;
 		}
+		if (incremental) {
+			telemac_manifest_set(&manifest, t, mesh->timestamp[t], hash, timestep_output_size(&pt));
+			telemac_manifest_save(&manifest, false);
+		}
+		free(pt.file);
+		free(vtuFileName);
+	}
+	if (nparts > 0) {
+		telemac_partition_free(&part);
+	}
+	if (incremental) {
+		if (telemac_manifest_save(&manifest, true) != 0) {
+			return EXIT_FAILURE;
+		}
+		telemac_manifest_close(&manifest);
+		fprintf(stdout, "%d timesteps already exported, %d written\n", skipped, (tLimit - tStart + printfreq - 1) / printfreq - skipped);
 	}
 	//Done writing individual files, now write PVD file
 
@@ -193,10 +518,17 @@ int main(int argc, char **argv) {
 		return EXIT_SUCCESS;
 	}
 
+	// Written to a temporary file and renamed, so the PVD file is never incomplete
 	xmlTextWriterPtr pvdFile = NULL;
 	char *pvdFileName = NULL;
+	char *pvdTempName = NULL;
 	asprintf(&pvdFileName, "%s%s.pvd", outputpath, basename(filename));
-	pvdFile = xmlNewTextWriterFilename(pvdFileName, 0);
+	asprintf(&pvdTempName, "%s.tmp", pvdFileName);
+	pvdFile = xmlNewTextWriterFilename(pvdTempName, 0);
+	if (pvdFile == NULL) {
+		fprintf(stderr, "Unable to open PVD file %s\n", pvdTempName);
+		return EXIT_FAILURE;
+	}
 	xmlTextWriterSetIndent(pvdFile, 1);
 
 	xmlTextWriterStartDocument(pvdFile, NULL, "UTF-8", NULL);
@@ -207,152 +539,625 @@ int main(int argc, char **argv) {
 		xmlTextWriterStartElement(pvdFile, BAD_CAST "DataSet");
 		xmlTextWriterWriteFormatAttribute(pvdFile, BAD_CAST "timestep", "%.10f", mesh->timestamp[t]);
 		xmlTextWriterWriteAttribute(pvdFile, BAD_CAST "part", BAD_CAST "0");
-		xmlTextWriterWriteFormatAttribute(pvdFile, BAD_CAST "file", "%s.t%d.vtu", basename(filename), t);
+		xmlTextWriterWriteFormatAttribute(pvdFile, BAD_CAST "file", "%s.t%d.%s", basename(filename), t, ext);
 		xmlTextWriterEndElement(pvdFile); //DataSet
 	}
 	xmlTextWriterEndElement(pvdFile); //Collection
 	xmlTextWriterEndElement(pvdFile); //VTKFile
 	if (xmlTextWriterEndDocument(pvdFile) < 0) {
 		fprintf(stderr, "Failed to save PVD file\n");
+		unlink(pvdTempName);
 		return EXIT_FAILURE;
 	}
 	xmlFreeTextWriter(pvdFile);
+	if (rename(pvdTempName, pvdFileName) != 0) {
+		perror("Failed to save PVD file");
+		unlink(pvdTempName);
+		return EXIT_FAILURE;
+	}
+	telemac_stats_add_file(pvdFileName);
 
 	fprintf(stdout, "VTU files successfully written in %s\n", outputpath);
 	return EXIT_SUCCESS;
 }
 
-int writeTimestep(void *wtsargs) {
+static int name_length(const char *name) {
 /*!
- * @brief Write a single VTU file, based on information provided in \c wtsargs
+ * @brief Length of a variable name without units or padding
+ */
+	int len = 16;
+	while (len > 0 && name[len - 1] == ' ') {
+		len--;
+	}
+	return len;
+}
+
+static char *piece_file_name(const wTSargs *args, uint32_t k) {
+/*!
+ * @brief Name of the VTU file for part @p k, from the PVTU file name
+ * @returns Newly allocated name, or NULL on failure
+ */
+	char *name = NULL;
+	size_t len = strlen(args->file) - strlen(".pvtu");
+	if (asprintf(&name, "%.*s.p%u.vtu", (int)len, args->file, k) < 0) {
+		return NULL;
+	}
+	return name;
+}
+
+static uint64_t timestep_output_size(const void *wtsargs) {
+/*!
+ * @brief Total size of the files written for one timestep
  *
  * @param wtsargs Mesh information and parameters - see @ref wTSargs for details
+ * @returns Size in bytes, or UINT64_MAX if any of the files does not exist
+ */
+	const wTSargs *args = wtsargs;
+	uint32_t nparts = (args->part != NULL ? args->part->nparts : 0);
+	char **files = calloc(sizeof(char *), nparts + 1);
+	if (files == NULL) {
+		return UINT64_MAX;
+	}
+	files[0] = args->file;
+	uint64_t size = 0;
+	for (uint32_t k = 0; k < nparts && size != UINT64_MAX; k++) {
+		files[k + 1] = piece_file_name(args, k);
+		if (files[k + 1] == NULL) {
+			size = UINT64_MAX;
+		}
+	}
+	if (size == 0) {
+		size = telemac_output_size(files, nparts + 1);
+	}
+	for (uint32_t k = 0; k < nparts; k++) {
+		free(files[k + 1]);
+	}
+	free(files);
+	return size;
+}
+
+static const char *byte_order(void) {
+/*!
+ * @brief VTK name of the byte order of this host, used for binary data arrays
+ */
+	const uint16_t probe = 1;
+	return (*(const uint8_t *)&probe == 1 ? "LittleEndian" : "BigEndian");
+}
+
+static void vtk_file_element(xmlTextWriterPtr xmlFile, const char *type, bool binary) {
+/*!
+ * @brief Start the VTKFile element of a VTU or PVTU file
+ *
+ * Readers assume big-endian data unless told otherwise, so files with binary
+ * data arrays give the byte order and the type of the size before each array.
+ */
+	xmlTextWriterStartElement(xmlFile, BAD_CAST "VTKFile");
+	xmlTextWriterWriteAttribute(xmlFile, BAD_CAST "type", BAD_CAST type);
+	if (binary) {
+		xmlTextWriterWriteAttribute(xmlFile, BAD_CAST "version", BAD_CAST "1.0");
+		xmlTextWriterWriteAttribute(xmlFile, BAD_CAST "byte_order", BAD_CAST byte_order());
+		xmlTextWriterWriteAttribute(xmlFile, BAD_CAST "header_type", BAD_CAST "UInt32");
+	}
+}
+
+static int binbuf_alloc(binbuf_t *bb, const telemac_data_t *mesh, const piece_t *pc) {
+/*!
+ * @brief Allocate buffers large enough for every binary data array of a piece
+ * @returns 0 on success, -1 on failure, -2 if an array is too large for its 32-bit size
+ */
+	size_t n = (pc->npoin > pc->nelem ? pc->npoin : pc->nelem);
+	size_t len = sizeof(uint32_t) + 4 * (3 * n > (size_t)pc->nelem * mesh->ndp ? 3 * n : (size_t)pc->nelem * mesh->ndp);
+	if (len - sizeof(uint32_t) > UINT32_MAX) {
+		return -2;
+	}
+	bb->values = malloc(3 * n * sizeof(float));
+	bb->raw = malloc(len);
+	bb->text = malloc(4 * ((len + 2) / 3));
+	TM_STATS_ALLOC(3 * n * sizeof(float) + len + 4 * ((len + 2) / 3));
+	return (bb->values != NULL && bb->raw != NULL && bb->text != NULL ? 0 : -1);
+}
+
+static void binbuf_free(binbuf_t *bb) {
+/*!
+ * @brief Free buffers allocated by binbuf_alloc()
+ */
+	free(bb->values);
+	free(bb->raw);
+	free(bb->text);
+}
+
+static void binary_data(xmlTextWriterPtr vtuFile, binbuf_t *bb, size_t len) {
+/*!
+ * @brief Write the contents of a binary data array
+ *
+ * The @p len bytes of the array follow the first four bytes of bb->raw,
+ * which are set to its size. The size and array are written together as
+ * base64 on a single line.
+ */
+	static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	uint32_t size = len;
+	memcpy(bb->raw, &size, sizeof(size));
+	len += sizeof(size);
+
+	const uint8_t *in = (const uint8_t *)bb->raw;
+	char *out = bb->text;
+	size_t k = 0;
+	for (size_t i = 0; i + 3 <= len; i += 3) {
+		uint32_t w = (uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2];
+		out[k++] = digits[w >> 18];
+		out[k++] = digits[(w >> 12) & 63];
+		out[k++] = digits[(w >> 6) & 63];
+		out[k++] = digits[w & 63];
+	}
+	size_t rest = len % 3;
+	if (rest > 0) {
+		uint32_t w = (uint32_t)in[len - rest] << 16 | (rest > 1 ? (uint32_t)in[len - 1] << 8 : 0);
+		out[k++] = digits[w >> 18];
+		out[k++] = digits[(w >> 12) & 63];
+		out[k++] = (rest > 1 ? digits[(w >> 6) & 63] : '=');
+		out[k++] = '=';
+	}
+	xmlTextWriterWriteRawLen(vtuFile, BAD_CAST out, k);
+}
+
+static void binary_values(xmlTextWriterPtr vtuFile, binbuf_t *bb, const char *name, int ncomp, size_t n) {
+/*!
+ * @brief Write @p n values from bb->values as a binary data array
+ */
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST name);
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
+	if (ncomp > 1) {
+		xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "NumberOfComponents", "%d", ncomp);
+	}
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "binary");
+	memcpy(&bb->raw[sizeof(uint32_t)], bb->values, n * sizeof(float));
+	binary_data(vtuFile, bb, n * sizeof(float));
+	xmlTextWriterEndElement(vtuFile); //DataArray
+}
+
+static void binary_ints(xmlTextWriterPtr vtuFile, binbuf_t *bb, const char *name, size_t n) {
+/*!
+ * @brief Write @p n 32-bit integers, already in bb->raw after its first four bytes, as a binary data array
+ */
+	xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST name);
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Int32");
+	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "binary");
+	binary_data(vtuFile, bb, n * sizeof(int32_t));
+	xmlTextWriterEndElement(vtuFile); //DataArray
+}
+
+static int write_piece(const wTSargs *args, const char *file, const piece_t *pc) {
+/*!
+ * @brief Write the nodes and elements of one piece of the mesh to a VTU file
+ *
+ * @param args	Mesh, variables and parameters (see @ref wTSargs)
+ * @param file	Output file name
+ * @param pc	Nodes and elements to write
  * @returns 0 on success
  */
-	wTSargs args = *(wTSargs *) wtsargs;
-	telemac_data_t mesh = args.rfs->tmdat;
-	int t = args.t;
-	int z = args.z;
-	int u = args.u;
-	int v = args.v;
-	int w = args.w;
+	const telemac_data_t *mesh = &args->rfs->tmdat;
+	float **data = args->data;
+	int z = args->z;
+	int u = args->u;
+	int v = args->v;
+	int w = args->w;
 
-	if (args.verbose) {
-		fprintf(stdout, "Writing VTU file for timestep %d of %d...\n", t, mesh.nt);
+	binbuf_t bb = {NULL, NULL, NULL};
+	int br = (args->binary ? binbuf_alloc(&bb, mesh, pc) : 0);
+	if (br != 0) {
+		binbuf_free(&bb);
+		if (br == -2) {
+			fprintf(stderr, "%s: arrays are too large for binary VTU. Split the mesh with -p\n", file);
+		} else {
+			fprintf(stderr, "Unable to allocate buffers for %s\n", file);
+		}
+		return -1;
 	}
+
+	TM_STATS_BEGIN(TM_PHASE_FORMAT);
 	xmlTextWriterPtr vtuFile = NULL;
-	vtuFile = xmlNewTextWriterFilename(args.file, 0);
+	vtuFile = xmlNewTextWriterFilename(file, 0);
 	xmlTextWriterSetIndent(vtuFile, 1);
 
 	xmlTextWriterStartDocument(vtuFile, NULL, "UTF-8", NULL);
-	xmlTextWriterStartElement(vtuFile, BAD_CAST "VTKFile");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "UnstructuredGrid");
+	vtk_file_element(vtuFile, "UnstructuredGrid", args->binary);
 
 	xmlTextWriterStartElement(vtuFile, BAD_CAST "UnstructuredGrid");
 
 	xmlTextWriterStartElement(vtuFile, BAD_CAST "Piece");
 
-	xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "NumberOfPoints", "%d", mesh.npoin);
-	xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "NumberOfCells", "%d", mesh.nelem);
+	xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "NumberOfPoints", "%u", pc->npoin);
+	xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "NumberOfCells", "%u", pc->nelem);
 
 	xmlTextWriterStartElement(vtuFile, BAD_CAST "Points");
+	if (args->binary) {
+		for (uint32_t i = 0; i < pc->npoin; i++) {
+			uint32_t p = NODE(pc, i);
+			bb.values[3 * i] = mesh->X[p];
+			bb.values[3 * i + 1] = mesh->Y[p];
+			bb.values[3 * i + 2] = data[z][p];
+		}
+		binary_values(vtuFile, &bb, "Coordinates", 3, 3 * (size_t)pc->npoin);
+	} else {
+		xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "Coordinates");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "NumberOfComponents", BAD_CAST "3");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
 
-	xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "Coordinates");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "NumberOfComponents", BAD_CAST "3");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
-
-	float **data = NULL;
-	data = get_telemac_data(args.rfs, t, 0);
-	if (data == NULL) {
-		perror("NULL returned from get_telemac_data");
-		return -1;
-	}
+		for (uint32_t i = 0; i < pc->npoin; i++) {
+			uint32_t p = NODE(pc, i);
+			xmlTextWriterWriteFormatString(vtuFile, "%+.10f %+.10f %+.10f\n", mesh->X[p], mesh->Y[p], data[z][p]);
+		}
 
-	for (int p = 0; p < mesh.npoin; p++) {
-		xmlTextWriterWriteFormatString(vtuFile, "%+.10f %+.10f %+.10f\n", mesh.X[p], mesh.Y[p], data[z][p]);
+		xmlTextWriterEndElement(vtuFile); //DataArray
 	}
-
-	xmlTextWriterEndElement(vtuFile); //DataArray
 	xmlTextWriterEndElement(vtuFile); //Points
 
 	xmlTextWriterStartElement(vtuFile, BAD_CAST "Cells");
-	xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "connectivity");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Int32");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+	if (args->binary) {
+		int32_t *cell = (int32_t *)&bb.raw[sizeof(uint32_t)];
+		size_t ncell = (size_t)pc->nelem * mesh->ndp;
+		for (size_t k = 0; k < ncell; k++) {
+			cell[k] = (pc->ikle ? pc->ikle[k] : mesh->ikle[k] - 1);
+		}
+		binary_ints(vtuFile, &bb, "connectivity", ncell);
+		int32_t type = (mesh->ndp == 6 ? 13 : (mesh->ndp == 4 ? 9 : 5));
+		for (uint32_t p = 0; p < pc->nelem; p++) {
+			cell[p] = type;
+		}
+		binary_ints(vtuFile, &bb, "types", pc->nelem);
+		for (uint32_t p = 0; p < pc->nelem; p++) {
+			cell[p] = (p + 1) * mesh->ndp;
+		}
+		binary_ints(vtuFile, &bb, "offsets", pc->nelem);
+	} else {
+		xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "connectivity");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Int32");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
 
-	for (int p = 0; p < mesh.nelem; p++) {
-		for (int j = 0; j < mesh.ndp; j++) {
-			xmlTextWriterWriteFormatString(vtuFile, "%d ", mesh.ikle[(p*mesh.ndp)+j]-1);
+		for (uint32_t p = 0; p < pc->nelem; p++) {
+			for (uint32_t j = 0; j < mesh->ndp; j++) {
+				size_t k = (size_t)p * mesh->ndp + j;
+				xmlTextWriterWriteFormatString(vtuFile, "%d ", (int)(pc->ikle ? pc->ikle[k] : mesh->ikle[k] - 1));
+			}
+			xmlTextWriterWriteFormatString(vtuFile, "\n");
 		}
-		xmlTextWriterWriteFormatString(vtuFile, "\n");
-	}
-	xmlTextWriterEndElement(vtuFile); //DataArray
+		xmlTextWriterEndElement(vtuFile); //DataArray
 
-	xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "types");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Int32");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
-	for (int p = 0; p < mesh.nelem; p++) {
-		if (mesh.ndp == 6) {
-			xmlTextWriterWriteString(vtuFile, BAD_CAST "13 ");
-		} else if (mesh.ndp == 3) {
-			xmlTextWriterWriteString(vtuFile, BAD_CAST "5 ");
-		} else if (mesh.ndp == 4) {
-			xmlTextWriterWriteString(vtuFile, BAD_CAST "9 ");
+		xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "types");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Int32");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+		for (uint32_t p = 0; p < pc->nelem; p++) {
+			if (mesh->ndp == 6) {
+				xmlTextWriterWriteString(vtuFile, BAD_CAST "13 ");
+			} else if (mesh->ndp == 3) {
+				xmlTextWriterWriteString(vtuFile, BAD_CAST "5 ");
+			} else if (mesh->ndp == 4) {
+				xmlTextWriterWriteString(vtuFile, BAD_CAST "9 ");
+			}
 		}
-	}
-	xmlTextWriterEndElement(vtuFile); //DataArray
+		xmlTextWriterEndElement(vtuFile); //DataArray
 
-	xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "offsets");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Int32");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
-	for (int p = 0; p < mesh.nelem; p++) {
-		xmlTextWriterWriteFormatString(vtuFile, "%d ", (p+1)*mesh.ndp);
+		xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "offsets");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Int32");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+		for (uint32_t p = 0; p < pc->nelem; p++) {
+			xmlTextWriterWriteFormatString(vtuFile, "%d ", (int)((p + 1) * mesh->ndp));
+		}
+		xmlTextWriterEndElement(vtuFile); //DataArray
 	}
-	xmlTextWriterEndElement(vtuFile); //DataArray
 	xmlTextWriterEndElement(vtuFile); //Cells
 
 	xmlTextWriterStartElement(vtuFile, BAD_CAST "PointData");
 
-	for (int d = 0; d < mesh.nbv_1; d++) {
+	for (int d = 0; d < (int)mesh->nbv_1 && args->stored; d++) {
+		if (args->binary) {
+			for (uint32_t i = 0; i < pc->npoin; i++) {
+				bb.values[i] = data[d][NODE(pc, i)];
+			}
+			binary_values(vtuFile, &bb, mesh->var_names[d], 1, pc->npoin);
+			continue;
+		}
 		xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
-		xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "Name", "%s", mesh.var_names[d]);
+		xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "Name", "%s", mesh->var_names[d]);
 		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
 		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
-		for (int p = 0; p < mesh.npoin; p++) {
-			xmlTextWriterWriteFormatString(vtuFile, "%+.10f ", data[d][p]);
+		for (uint32_t i = 0; i < pc->npoin; i++) {
+			xmlTextWriterWriteFormatString(vtuFile, "%+.10f ", data[d][NODE(pc, i)]);
 		}
 		xmlTextWriterEndElement(vtuFile);
 	}
 
-	xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "Vector Velocity");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
-	xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "NumberOfComponents", BAD_CAST "3");
-	for (int p = 0; p < mesh.npoin; p++) {
-		float wval = (mesh.ndp == 6 ? data[w][p] : 0); // Assume 2D if ndp != 6
-		xmlTextWriterWriteFormatString(vtuFile, "%+.10f %.10f %.10f", data[u][p], data[v][p], wval);
+	for (int e = 0; e < args->nexpr; e++) {
+		if (args->binary) {
+			for (uint32_t i = 0; i < pc->npoin; i++) {
+				bb.values[i] = args->derived[e][NODE(pc, i)];
+			}
+			binary_values(vtuFile, &bb, args->exprs[e]->name, 1, pc->npoin);
+			continue;
+		}
+		xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+		xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "Name", "%s", args->exprs[e]->name);
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+		for (uint32_t i = 0; i < pc->npoin; i++) {
+			xmlTextWriterWriteFormatString(vtuFile, "%+.10f ", args->derived[e][NODE(pc, i)]);
+		}
+		xmlTextWriterEndElement(vtuFile);
+	}
+
+	const deriv_t *dv = args->deriv;
+	for (int g = 0; g < dv->ngrad; g++) {
+		const char *name = (dv->grad[g] < (int)mesh->nbv_1 ? mesh->var_names[dv->grad[g]] : "(quadratic)");
+		int len = name_length(name);
+		if (args->binary) {
+			char gname[32];
+			snprintf(gname, sizeof(gname), "%.*s GRADIENT", len, name);
+			for (uint32_t i = 0; i < pc->npoin; i++) {
+				uint32_t p = NODE(pc, i);
+				bb.values[3 * i] = dv->gnode[2 * g][p];
+				bb.values[3 * i + 1] = dv->gnode[2 * g + 1][p];
+				bb.values[3 * i + 2] = 0;
+			}
+			binary_values(vtuFile, &bb, gname, 3, 3 * (size_t)pc->npoin);
+			continue;
+		}
+		xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+		xmlTextWriterWriteFormatAttribute(vtuFile, BAD_CAST "Name", "%.*s GRADIENT", len, name);
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "NumberOfComponents", BAD_CAST "3");
+		for (uint32_t i = 0; i < pc->npoin; i++) {
+			uint32_t p = NODE(pc, i);
+			xmlTextWriterWriteFormatString(vtuFile, "%+.10f %+.10f 0 ", dv->gnode[2 * g][p], dv->gnode[2 * g + 1][p]);
+		}
+		xmlTextWriterEndElement(vtuFile);
+	}
+	if (dv->vort) {
+		const char *names[2] = {"VORTICITY", "DIVERGENCE"};
+		const float *values[2] = {dv->vnode, dv->dnode};
+		for (int k = 0; k < 2; k++) {
+			if (args->binary) {
+				for (uint32_t i = 0; i < pc->npoin; i++) {
+					bb.values[i] = values[k][NODE(pc, i)];
+				}
+				binary_values(vtuFile, &bb, names[k], 1, pc->npoin);
+				continue;
+			}
+			xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+			xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST names[k]);
+			xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
+			xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+			for (uint32_t i = 0; i < pc->npoin; i++) {
+				xmlTextWriterWriteFormatString(vtuFile, "%+.10f ", values[k][NODE(pc, i)]);
+			}
+			xmlTextWriterEndElement(vtuFile);
+		}
+	}
+
+	if (args->binary) {
+		for (uint32_t i = 0; i < pc->npoin; i++) {
+			uint32_t p = NODE(pc, i);
+			bb.values[3 * i] = data[u][p];
+			bb.values[3 * i + 1] = data[v][p];
+			bb.values[3 * i + 2] = (mesh->ndp == 6 ? data[w][p] : 0);
+		}
+		binary_values(vtuFile, &bb, "Vector Velocity", 3, 3 * (size_t)pc->npoin);
+	} else {
+		xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "Vector Velocity");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+		xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "NumberOfComponents", BAD_CAST "3");
+		for (uint32_t i = 0; i < pc->npoin; i++) {
+			uint32_t p = NODE(pc, i);
+			float wval = (mesh->ndp == 6 ? data[w][p] : 0); // Assume 2D if ndp != 6
+			xmlTextWriterWriteFormatString(vtuFile, "%+.10f %.10f %.10f", data[u][p], data[v][p], wval);
+		}
+		xmlTextWriterEndElement(vtuFile); //DataArray (Vector)
 	}
-	xmlTextWriterEndElement(vtuFile); //DataArray (Vector)
 	xmlTextWriterEndElement(vtuFile); //PointData
+
+	if (dv->vort) {
+		xmlTextWriterStartElement(vtuFile, BAD_CAST "CellData");
+		if (args->binary) {
+			for (uint32_t p = 0; p < pc->nelem; p++) {
+				bb.values[p] = dv->velem[(pc->elem ? pc->elem[p] : p)];
+			}
+			binary_values(vtuFile, &bb, "VORTICITY", 1, pc->nelem);
+		} else {
+			xmlTextWriterStartElement(vtuFile, BAD_CAST "DataArray");
+			xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "Name", BAD_CAST "VORTICITY");
+			xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "type", BAD_CAST "Float32");
+			xmlTextWriterWriteAttribute(vtuFile, BAD_CAST "format", BAD_CAST "ascii");
+			for (uint32_t p = 0; p < pc->nelem; p++) {
+				xmlTextWriterWriteFormatString(vtuFile, "%+.10f ", dv->velem[(pc->elem ? pc->elem[p] : p)]);
+			}
+			xmlTextWriterEndElement(vtuFile); //DataArray
+		}
+		xmlTextWriterEndElement(vtuFile); //CellData
+	}
 	xmlTextWriterEndElement(vtuFile); //Piece
 	xmlTextWriterEndElement(vtuFile); //UnstructuredGrid
 	xmlTextWriterEndElement(vtuFile); //VTKFile
+	TM_STATS_END(TM_PHASE_FORMAT);
+	binbuf_free(&bb);
 
+	TM_STATS_BEGIN(TM_PHASE_WRITE);
 	if (xmlTextWriterEndDocument(vtuFile) < 0) {
-		fprintf(stderr, "Failed to save VTU file for timestep %d", t);
+		TM_STATS_END(TM_PHASE_WRITE);
+		fprintf(stderr, "Failed to save VTU file %s\n", file);
 		return EXIT_FAILURE;
 	}
 
-	for (int d = 0; d < mesh.nbv_1; d++) {
-		free(data[d]);
-	}
-	free(data);
 	xmlFreeTextWriter(vtuFile);
+	TM_STATS_END(TM_PHASE_WRITE);
+	telemac_stats_add_file(file);
 	return 0;
 }
+
+
+static int piece_task(void *ctx, size_t start, size_t end, int thread) {
+/*!
+ * @brief Write the VTU files for parts @p start to @p end - 1 (see telemac_parallel_for())
+ */
+	(void)thread;
+	const wTSargs *args = ctx;
+	const telemac_partition_t *part = args->part;
+	for (size_t k = start; k < end; k++) {
+		uint32_t e0 = part->elem_start[k];
+		uint32_t n0 = part->node_start[k];
+		piece_t pc = {part->node_start[k + 1] - n0, &part->node[n0],
+			part->elem_start[k + 1] - e0, &part->elem[e0], &part->ikle[(size_t)e0 * part->ndp]};
+		char *file = piece_file_name(args, k);
+		int res = (file == NULL ? -1 : write_piece(args, file, &pc));
+		free(file);
+		if (res != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void pvtu_array(xmlTextWriterPtr pvtuFile, const char *element, const char *name, int ncomp) {
+/*!
+ * @brief Describe one data array of the pieces in a PVTU file
+ */
+	xmlTextWriterStartElement(pvtuFile, BAD_CAST element);
+	xmlTextWriterWriteAttribute(pvtuFile, BAD_CAST "Name", BAD_CAST name);
+	xmlTextWriterWriteAttribute(pvtuFile, BAD_CAST "type", BAD_CAST "Float32");
+	if (ncomp > 1) {
+		xmlTextWriterWriteFormatAttribute(pvtuFile, BAD_CAST "NumberOfComponents", "%d", ncomp);
+	}
+	xmlTextWriterEndElement(pvtuFile);
+}
+
+static int write_pvtu(const wTSargs *args) {
+/*!
+ * @brief Write the PVTU file listing the parts of one timestep
+ *
+ * The arrays listed must match those written to each part by write_piece().
+ * @returns 0 on success
+ */
+	const telemac_data_t *mesh = &args->rfs->tmdat;
+	const deriv_t *dv = args->deriv;
+
+	TM_STATS_BEGIN(TM_PHASE_FORMAT);
+	xmlTextWriterPtr pvtuFile = xmlNewTextWriterFilename(args->file, 0);
+	if (pvtuFile == NULL) {
+		TM_STATS_END(TM_PHASE_FORMAT);
+		fprintf(stderr, "Unable to open PVTU file %s\n", args->file);
+		return -1;
+	}
+	xmlTextWriterSetIndent(pvtuFile, 1);
+
+	xmlTextWriterStartDocument(pvtuFile, NULL, "UTF-8", NULL);
+	vtk_file_element(pvtuFile, "PUnstructuredGrid", args->binary);
+	xmlTextWriterStartElement(pvtuFile, BAD_CAST "PUnstructuredGrid");
+	xmlTextWriterWriteAttribute(pvtuFile, BAD_CAST "GhostLevel", BAD_CAST "0");
+
+	xmlTextWriterStartElement(pvtuFile, BAD_CAST "PPoints");
+	pvtu_array(pvtuFile, "PDataArray", "Coordinates", 3);
+	xmlTextWriterEndElement(pvtuFile); //PPoints
+
+	xmlTextWriterStartElement(pvtuFile, BAD_CAST "PPointData");
+	for (int d = 0; d < (int)mesh->nbv_1 && args->stored; d++) {
+		pvtu_array(pvtuFile, "PDataArray", mesh->var_names[d], 1);
+	}
+	for (int e = 0; e < args->nexpr; e++) {
+		pvtu_array(pvtuFile, "PDataArray", args->exprs[e]->name, 1);
+	}
+	for (int g = 0; g < dv->ngrad; g++) {
+		const char *name = (dv->grad[g] < (int)mesh->nbv_1 ? mesh->var_names[dv->grad[g]] : "(quadratic)");
+		char gname[32];
+		snprintf(gname, sizeof(gname), "%.*s GRADIENT", name_length(name), name);
+		pvtu_array(pvtuFile, "PDataArray", gname, 3);
+	}
+	if (dv->vort) {
+		pvtu_array(pvtuFile, "PDataArray", "VORTICITY", 1);
+		pvtu_array(pvtuFile, "PDataArray", "DIVERGENCE", 1);
+	}
+	pvtu_array(pvtuFile, "PDataArray", "Vector Velocity", 3);
+	xmlTextWriterEndElement(pvtuFile); //PPointData
+
+	if (dv->vort) {
+		xmlTextWriterStartElement(pvtuFile, BAD_CAST "PCellData");
+		pvtu_array(pvtuFile, "PDataArray", "VORTICITY", 1);
+		xmlTextWriterEndElement(pvtuFile); //PCellData
+	}
+
+	for (uint32_t k = 0; k < args->part->nparts; k++) {
+		char *file = piece_file_name(args, k);
+		if (file == NULL) {
+			xmlFreeTextWriter(pvtuFile);
+			TM_STATS_END(TM_PHASE_FORMAT);
+			return -1;
+		}
+		xmlTextWriterStartElement(pvtuFile, BAD_CAST "Piece");
+		xmlTextWriterWriteAttribute(pvtuFile, BAD_CAST "Source", BAD_CAST basename(file));
+		xmlTextWriterEndElement(pvtuFile); //Piece
+		free(file);
+	}
+	xmlTextWriterEndElement(pvtuFile); //PUnstructuredGrid
+	xmlTextWriterEndElement(pvtuFile); //VTKFile
+	TM_STATS_END(TM_PHASE_FORMAT);
+
+	TM_STATS_BEGIN(TM_PHASE_WRITE);
+	if (xmlTextWriterEndDocument(pvtuFile) < 0) {
+		TM_STATS_END(TM_PHASE_WRITE);
+		fprintf(stderr, "Failed to save PVTU file %s\n", args->file);
+		return -1;
+	}
+	xmlFreeTextWriter(pvtuFile);
+	TM_STATS_END(TM_PHASE_WRITE);
+	telemac_stats_add_file(args->file);
+	return 0;
+}
+
+int writeTimestep(void *wtsargs) {
+/*!
+ * @brief Write a single VTU file, based on information provided in \c wtsargs
+ *
+ * @param wtsargs Mesh information and parameters - see @ref wTSargs for details
+ * @returns 0 on success
+ */
+	wTSargs args = *(wTSargs *) wtsargs;
+	telemac_data_t mesh = args.rfs->tmdat;
+	int t = args.t;
+	int u = args.u;
+	int v = args.v;
+
+	if (args.verbose) {
+		fprintf(stdout, "Writing VTU file for timestep %d of %d...\n", t, mesh.nt);
+	}
+	float **data = args.data;
+	if (read_telemac_data(args.rfs, t, data, &args.rfs->tmdat.timestamp[t]) != 0) {
+		fprintf(stderr, "Unable to read timestep %d\n", t);
+		return -1;
+	}
+	if (telemac_expr_eval_all(args.exprs, args.nexpr, &mesh, data, args.derived, args.nthreads) != 0) {
+		fprintf(stderr, "Unable to calculate derived variables for timestep %d\n", t);
+		return -1;
+	}
+	if (args.deriv->geom != NULL && calculate_derivatives(args.deriv, data, u, v, args.nthreads) != 0) {
+		fprintf(stderr, "Unable to calculate derivatives for timestep %d\n", t);
+		return -1;
+	}
+
+	if (args.part == NULL) {
+		piece_t whole = {mesh.npoin, NULL, mesh.nelem, NULL, NULL};
+		return write_piece(&args, args.file, &whole);
+	}
+
+	// Partitioned: one VTU file per part, then a PVTU file listing them
+	if (telemac_parallel_for(args.nthreads, args.part->nparts, 1, piece_task, &args) != 0) {
+		return -1;
+	}
+	return write_pvtu(&args);
+}
@@ -0,0 +1,196 @@
+/******************************************************************************
+telemac-writer - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "telemac-writer.h"
+#include "telemac-stats.h"
+
+/*!
+ * @file
+ * @brief TELEMAC SELAFIN file writer
+ *
+ * Writes single precision SERAFIN files in big-endian format, using the same
+ * record layout read by telemac-loader.c. Tools producing derived results
+ * populate a telemac_data_t with the title, variable names and mesh to be
+ * written, then call write_telemac_header() once and write_telemac_timestep()
+ * for each timestep.
+ */
+
+int fortran_write(const void *cstruct, size_t csize, size_t num, FILE *tofile) {
+/*!
+ * @brief Write data as a single FORTRAN record
+ *
+ * The counterpart of fortran_read(). Data is written without conversion,
+ * surrounded by big-endian record length markers.
+ * @param cstruct	Pointer to start of structure or array of structures
+ * @param csize		Size of cstruct
+ * @param num		Number of structures to write
+ * @param tofile	Output file
+ * @returns		Number of structures written, or -1 on error
+ */
+	uint32_t marker = int_swap(csize * num);
+	if (fwrite(&marker, sizeof(marker), 1, tofile) != 1) {
+		return -1;
+	}
+	size_t count = fwrite(cstruct, csize, num, tofile);
+	if (fwrite(&marker, sizeof(marker), 1, tofile) != 1 || count != num) {
+		return -1;
+	}
+	TM_STATS_ADD(TM_COUNT_WRITE_CALLS, 3);
+	TM_STATS_ADD(TM_COUNT_BYTES_WRITTEN, 2 * sizeof(marker) + csize * num);
+	return count;
+}
+
+int fortran_write_swapped(const void *values, size_t num, FILE *tofile) {
+/*!
+ * @brief Write an array of 32-bit values as a single big-endian FORTRAN record
+ *
+ * Values (uint32_t or float) are byte swapped through a small buffer, leaving
+ * the source array unchanged.
+ * @param values	Array of 32-bit values
+ * @param num		Number of values
+ * @param tofile	Output file
+ * @returns		Number of values written, or -1 on error
+ */
+	uint32_t buf[4096];
+	const uint32_t *in = (const uint32_t *)values;
+	uint32_t marker = int_swap(num * sizeof(uint32_t));
+
+	if (fwrite(&marker, sizeof(marker), 1, tofile) != 1) {
+		return -1;
+	}
+	for (size_t done = 0; done < num; ) {
+		size_t n = (num - done < 4096 ? num - done : 4096);
+		for (size_t i = 0; i < n; i++) {
+			buf[i] = __builtin_bswap32(in[done + i]);
+		}
+		if (fwrite(buf, sizeof(uint32_t), n, tofile) != n) {
+			return -1;
+		}
+		TM_STATS_ADD(TM_COUNT_WRITE_CALLS, 1);
+		done += n;
+	}
+	if (fwrite(&marker, sizeof(marker), 1, tofile) != 1) {
+		return -1;
+	}
+	TM_STATS_ADD(TM_COUNT_WRITE_CALLS, 2);
+	TM_STATS_ADD(TM_COUNT_BYTES_WRITTEN, 2 * sizeof(marker) + num * sizeof(uint32_t));
+	return num;
+}
+
+int write_telemac_header(FILE *file, const telemac_data_t *results) {
+/*!
+ * @brief Write SELAFIN header and mesh records
+ *
+ * Writes the title, variable names, IPARAM, date (if IPARAM(10) is 1), mesh
+ * dimensions, IKLE, IPOBO and coordinates from results.
+ *
+ * If results->ipobo is NULL, IPOBO is written as all zeros.
+ *
+ * @param file		Output file, positioned at the start
+ * @param results	Header and mesh information to write
+ * @retval 0		Success
+ * @retval -1		Write error
+ */
+	R1 r1;
+	memset(&r1, ' ', sizeof(r1));
+	memcpy(r1.title, results->title, strnlen(results->title, sizeof(r1.title)));
+	memcpy(r1.format, "SERAFIN ", 8);
+	if (fortran_write(&r1, sizeof(R1), 1, file) != 1) {
+		return -1;
+	}
+
+	R2 r2 = {int_swap(results->nbv_1), int_swap(results->nbv_2)};
+	if (fortran_write(&r2, sizeof(R2), 1, file) != 1) {
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < results->nbv_1; i++) {
+		char name[32];
+		memset(name, ' ', sizeof(name));
+		memcpy(name, results->var_names[i], strnlen(results->var_names[i], sizeof(name)));
+		if (fortran_write(name, sizeof(name), 1, file) != 1) {
+			return -1;
+		}
+	}
+
+	if (fortran_write_swapped(results->iparam, 10, file) != 10) {
+		return -1;
+	}
+
+	if (results->iparam[9] == 1) {
+		R5 r5 = results->date;
+		if (fortran_write_swapped(&r5, 6, file) != 6) {
+			return -1;
+		}
+	}
+
+	R6 r6 = {results->nelem, results->npoin, results->ndp, 1};
+	if (fortran_write_swapped(&r6, 4, file) != 4) {
+		return -1;
+	}
+
+	if (fortran_write_swapped(results->ikle, (size_t)results->nelem * results->ndp, file) < 0) {
+		return -1;
+	}
+
+	if (results->ipobo != NULL) {
+		if (fortran_write_swapped(results->ipobo, results->npoin, file) < 0) {
+			return -1;
+		}
+	} else {
+		uint32_t *zero = calloc(sizeof(uint32_t), results->npoin);
+		int rv = (zero == NULL ? -1 : fortran_write(zero, sizeof(uint32_t), results->npoin, file));
+		free(zero);
+		if (rv < 0) {
+			return -1;
+		}
+	}
+
+	if (fortran_write_swapped(results->X, results->npoin, file) < 0
+			|| fortran_write_swapped(results->Y, results->npoin, file) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+int write_telemac_timestep(FILE *file, const telemac_data_t *results, float timestamp, float **data) {
+/*!
+ * @brief Append a timestep to a SELAFIN file
+ *
+ * @param file		Output file, following write_telemac_header() or a previous timestep
+ * @param results	Header information (number of variables and points)
+ * @param timestamp	Time of this timestep
+ * @param data		One array of npoin values for each of the nbv_1 + nbv_2 variables
+ * @retval 0		Success
+ * @retval -1		Write error
+ */
+	if (fortran_write_swapped(&timestamp, 1, file) != 1) {
+		return -1;
+	}
+	for (uint32_t j = 0; j < results->nbv_1 + results->nbv_2; j++) {
+		if (fortran_write_swapped(data[j], results->npoin, file) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,37 @@
+/******************************************************************************
+telemac-writer - part of tawe-telemac-utils
+Copyright (C) 2016 Thomas Lake
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, US
+*******************************************************************************/
+
+/*!
+ * @file
+ * @brief TELEMAC SELAFIN file writer
+ */
+
+#ifndef TELEMAC_WRITER_H
+#define TELEMAC_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "telemac-loader.h"
+
+int fortran_write(const void *cstruct, size_t csize, size_t num, FILE *tofile);
+int fortran_write_swapped(const void *values, size_t num, FILE *tofile);
+int write_telemac_header(FILE *file, const telemac_data_t *results);
+int write_telemac_timestep(FILE *file, const telemac_data_t *results, float timestamp, float **data);
+
+#endif // TELEMAC_WRITER_H